@@ -0,0 +1,231 @@
+// byte search microbenchmark: MsMemFind, MsMemSearcher and FindHeaderEnd against the code
+// they replaced and libc, over the buffers the server searches. build with -DMS_BUILD_BENCH=ON
+#include "MsCommon.h"
+#include "MsSearch.h"
+#include <chrono>
+#include <functional>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+using Clock = std::chrono::steady_clock;
+using FindFn = function<const char *(const char *hay, size_t hlen)>;
+
+static volatile size_t g_sink;
+
+// called through volatile pointers so the compiler can not hoist the libc calls out of the
+// timing loops as pure functions of unchanged arguments
+typedef const char *(*StrstrFn)(const char *, const char *);
+typedef void *(*MemmemFn)(const void *, size_t, const void *, size_t);
+static StrstrFn volatile g_strstr = strstr;
+static MemmemFn volatile g_memmem = memmem;
+
+// the per byte loop MsJtSource used for its header, for any needle
+static const char *ByteLoop(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+	for (size_t i = 0; i + nlen <= hlen; ++i) {
+		size_t j = 0;
+		while (j < nlen && hay[i + j] == needle[j]) {
+			++j;
+		}
+		if (j == nlen) {
+			return hay + i;
+		}
+	}
+	return nullptr;
+}
+
+// find_mem of the old multipart parser, memcmp at every offset
+static const char *FindMem(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+	if (hlen < nlen) {
+		return nullptr;
+	}
+	for (size_t i = 0; i <= hlen - nlen; ++i) {
+		if (memcmp(hay + i, needle, nlen) == 0) {
+			return hay + i;
+		}
+	}
+	return nullptr;
+}
+
+// random bytes without 0, so strstr sees the whole buffer
+static string RandBytes(mt19937 &rng, size_t n) {
+	uniform_int_distribution<int> d(1, 255);
+	string s(n, '\0');
+	for (auto &c : s) {
+		c = (char)d(rng);
+	}
+	return s;
+}
+
+// run fn for about 200 ms, return ns per call
+static double Time(const function<size_t()> &fn) {
+	size_t iters = 1;
+	for (;;) {
+		auto t0 = Clock::now();
+		for (size_t i = 0; i < iters; ++i) {
+			g_sink += fn();
+		}
+		double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+		if (ns > 2e8 || iters >= (1u << 30)) {
+			return ns / iters;
+		}
+		iters *= 2;
+	}
+}
+
+// every match of the needle in hay, each search starting one past the last match
+static size_t CountAll(const FindFn &find, const string &hay) {
+	size_t n = 0;
+	const char *p = hay.data();
+	const char *end = hay.data() + hay.size();
+
+	while (p < end) {
+		const char *m = find(p, end - p);
+		if (!m) {
+			break;
+		}
+		++n;
+		p = m + 1;
+	}
+	return n;
+}
+
+static void Report(const char *name, const char *method, size_t bytes, double ns) {
+	printf("%-12s %-16s %12.1f ns %10.1f MB/s\n", name, method, ns, bytes / ns * 1e3);
+}
+
+static void BenchCase(const char *name, const string &hay, const string &needle) {
+	const char *n = needle.c_str();
+	size_t nl = needle.size();
+	MsMemSearcher searcher(needle);
+
+	vector<pair<const char *, FindFn>> methods = {
+	    {"byte loop", [&](const char *h, size_t l) { return ByteLoop(h, l, n, nl); }},
+	    {"find_mem", [&](const char *h, size_t l) { return FindMem(h, l, n, nl); }},
+	    {"strstr", [&](const char *h, size_t) { return g_strstr(h, n); }},
+	    {"memmem", [&](const char *h, size_t l) { return (const char *)g_memmem(h, l, n, nl); }},
+	    {"MsMemFind", [&](const char *h, size_t l) { return MsMemFind(h, l, n, nl); }},
+	    {"MsMemSearcher", [&](const char *h, size_t l) { return searcher.Find(h, l); }},
+	};
+
+	size_t expect = CountAll(methods[0].second, hay);
+	for (auto &m : methods) {
+		size_t got = CountAll(m.second, hay);
+		if (got != expect) {
+			printf("%s: %s found %zu, byte loop %zu\n", name, m.first, got, expect);
+			exit(1);
+		}
+		Report(name, m.first, hay.size(), Time([&]() { return CountAll(m.second, hay); }));
+	}
+}
+
+// a header arriving in recv sized pieces: strstr over the whole buffer on every recv as
+// IsHeaderComplete did, against FindHeaderEnd resuming where it stopped
+static void BenchHeaderRecv(const char *name, const string &msg, size_t chunk) {
+	int end = (int)msg.find("\r\n\r\n") + 4;
+	string buf;
+	buf.reserve(msg.size() + 1);
+
+	auto oldWay = [&]() -> size_t {
+		buf.clear();
+		for (size_t off = 0; off < msg.size(); off += chunk) {
+			buf.append(msg, off, chunk);
+			const char *e = g_strstr(buf.c_str(), "\r\n\r\n");
+			if (e) {
+				return e - buf.data() + 4;
+			}
+		}
+		return 0;
+	};
+
+	auto newWay = [&]() -> size_t {
+		int scanOff = 0;
+		buf.clear();
+		for (size_t off = 0; off < msg.size(); off += chunk) {
+			buf.append(msg, off, chunk);
+			int e = FindHeaderEnd(buf.data(), buf.size(), scanOff);
+			if (e > 0) {
+				return e;
+			}
+		}
+		return 0;
+	};
+
+	if ((int)oldWay() != end || (int)newWay() != end) {
+		printf("%s: header end mismatch\n", name);
+		exit(1);
+	}
+
+	string label = string(name) + "/" + to_string(chunk);
+	Report(label.c_str(), "strstr per recv", msg.size(), Time(oldWay));
+	Report(label.c_str(), "FindHeaderEnd", msg.size(), Time(newWay));
+}
+
+int main() {
+	mt19937 rng(1078);
+
+	string sip = "INVITE sip:34020000001320000001@3402000000 SIP/2.0\r\n"
+	             "Via: SIP/2.0/UDP 192.168.1.10:5060;rport;branch=z9hG4bK1234567890\r\n"
+	             "From: <sip:34020000002000000001@3402000000>;tag=1234567890\r\n"
+	             "To: <sip:34020000001320000001@3402000000>\r\n"
+	             "Call-ID: 3b2e1f0a9c8d7e6f5a4b3c2d1e0f@192.168.1.10\r\n"
+	             "CSeq: 20 INVITE\r\n"
+	             "Contact: <sip:34020000002000000001@192.168.1.10:5060>\r\n"
+	             "Content-Type: APPLICATION/SDP\r\n"
+	             "Max-Forwards: 70\r\n"
+	             "User-Agent: media_server\r\n"
+	             "Subject: 34020000001320000001:0,34020000002000000001:0\r\n"
+	             "Content-Length: 236\r\n\r\n"
+	             "v=0\r\no=34020000001320000001 0 0 IN IP4 192.168.1.10\r\ns=Play\r\n"
+	             "c=IN IP4 192.168.1.10\r\nt=0 0\r\nm=video 30000 RTP/AVP 96 98 97\r\n"
+	             "a=recvonly\r\na=rtpmap:96 PS/90000\r\ny=0100000001\r\n";
+
+	string rtsp = "RTSP/1.0 200 OK\r\n"
+	              "CSeq: 3\r\n"
+	              "Server: media_server\r\n"
+	              "Date: Mon, 19 Oct 2026 08:00:00 GMT\r\n"
+	              "Content-Base: rtsp://192.168.1.20:554/live/34020000001320000001/\r\n"
+	              "Content-Type: application/sdp\r\n"
+	              "Content-Length: 420\r\n\r\n" +
+	              string(420, 'a');
+
+	string http = "POST /api/v1/device/query HTTP/1.1\r\n"
+	              "Host: 192.168.1.20:8080\r\n"
+	              "Connection: keep-alive\r\n"
+	              "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like "
+	              "Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+	              "Accept: application/json, text/plain, */*\r\n"
+	              "Accept-Encoding: gzip, deflate\r\n"
+	              "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+	              "Content-Type: application/json\r\n"
+	              "Cookie: session=8f3b2c1d0e9f8a7b6c5d4e3f2a1b0c9d; theme=dark\r\n"
+	              "Origin: http://192.168.1.20:8080\r\n"
+	              "Referer: http://192.168.1.20:8080/index.html\r\n"
+	              "Content-Length: 64\r\n\r\n" +
+	              string(64, 'j');
+
+	string boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+	string multipart = "--" + boundary +
+	                   "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a.mp4\"\r\n"
+	                   "Content-Type: video/mp4\r\n\r\n" +
+	                   RandBytes(rng, 4 << 20) + "\r\n--" + boundary + "--\r\n";
+
+	// jt1078 rtp: 30 byte header starting with 01cd and 950 bytes of body
+	string jt;
+	for (int i = 0; i < 4096; ++i) {
+		jt += "01cd" + RandBytes(rng, 26) + RandBytes(rng, 950);
+	}
+
+	BenchCase("sip", sip, "\r\n\r\n");
+	BenchCase("rtsp", rtsp, "\r\n\r\n");
+	BenchCase("http", http, "\r\n\r\n");
+	BenchCase("multipart", multipart, "\r\n--" + boundary);
+	BenchCase("jt1078", jt, "01cd");
+
+	BenchHeaderRecv("sip", sip, 64);
+	BenchHeaderRecv("rtsp", rtsp, 64);
+	BenchHeaderRecv("http", http, 64);
+	BenchHeaderRecv("http", http, 512);
+
+	return 0;
+}
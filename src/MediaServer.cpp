@@ -8,9 +8,13 @@
 #include "MsJtServer.h"
 #include "MsLog.h"
 #include "MsMsgDef.h"
+#include "MsRecordMgr.h"
+#include "MsResManager.h"
 #include "MsRtmpServer.h"
+#include "MsRtspClient.h"
 #include "MsRtspSink.h"
 #include "MsTimer.h"
+#include "MsVodPacer.h"
 #include <signal.h>
 
 #if ENABLE_RTC
@@ -45,6 +49,18 @@ int main(int argc, char *argv[]) {
 	shared_ptr<MsReactor> commReactor = make_shared<MsReactor>(MS_COMMON_REACTOR, 1);
 	commReactor->Run();
 
+	int vodPacers = config->GetConfigInt("vodPacerThreads");
+	for (int i = 1; i <= vodPacers; ++i) {
+		shared_ptr<MsVodPacer> pacer = make_shared<MsVodPacer>(MS_VOD_PACER, i);
+		pacer->Run();
+	}
+
+	int rtspClients = config->GetConfigInt("rtspClientThreads");
+	for (int i = 1; i <= rtspClients; ++i) {
+		shared_ptr<MsRtspClient> client = make_shared<MsRtspClient>(MS_RTSP_CLIENT, i);
+		client->Run();
+	}
+
 	shared_ptr<MsHttpServer> httpServer = make_shared<MsHttpServer>(MS_HTTP_SERVER, 1);
 	httpServer->Run();
 
@@ -68,6 +84,9 @@ int main(int argc, char *argv[]) {
 	rtcServer->Run();
 #endif
 
+	MsRecordMgr::Instance()->Init();
+	MsResManager::GetInstance().StartWarm();
+
 	printf("media server v1.0.0 running\n");
 
 	MsApp::Instance()->Run();
@@ -1,20 +1,34 @@
 #include "MsDbMgr.h"
+#include "MsCommon.h"
+#include "MsLog.h"
 #include <stdio.h>
 #include <string>
 
+#define DB_FILE "conf/media_server.db"
+
 unique_ptr<MsDbMgr> MsDbMgr::m_instance;
 mutex MsDbMgr::m_mutex;
 
-MsDbMgr::MsDbMgr() : m_sql(nullptr) {}
+MsDbMgr::MsDbMgr() : m_sql(nullptr), m_readSql(nullptr), m_exit(false), m_busy(false) {}
 
 MsDbMgr::~MsDbMgr() {
+	this->Exit();
+
+	for (auto &ss : m_stmtCache) {
+		sqlite3_finalize(ss.second);
+	}
+
+	if (m_readSql) {
+		sqlite3_close(m_readSql);
+	}
+
 	if (m_sql) {
 		sqlite3_close(m_sql);
 	}
 }
 
 int MsDbMgr::Init() {
-	int rc = sqlite3_open("conf/media_server.db", &m_sql);
+	int rc = sqlite3_open(DB_FILE, &m_sql);
 	if (rc) {
 		printf("Can't open database: %s\n", sqlite3_errmsg(m_sql));
 		return -1;
@@ -23,6 +37,17 @@ int MsDbMgr::Init() {
 	char *zErrMsg = 0;
 	string sql;
 
+	// wal lets the read connection run beside the writer, with synchronous=normal a commit
+	// does not wait for fsync, only checkpoints do
+	sql = "pragma journal_mode=wal; pragma synchronous=normal; pragma busy_timeout=5000;";
+
+	rc = sqlite3_exec(m_sql, sql.c_str(), NULL, 0, &zErrMsg);
+	if (rc != SQLITE_OK) {
+		printf("database error: %s\n", zErrMsg);
+		sqlite3_free(zErrMsg);
+		return 1;
+	}
+
 	sql = "create table if not exists t_file (\
 		file_id    INTEGER PRIMARY KEY,\
 		name       TEXT NOT NULL,\
@@ -40,6 +65,44 @@ int MsDbMgr::Init() {
 		return 1;
 	}
 
+	// probe result of a vod file, so opening it again can skip find_stream_info
+	sql = "create table if not exists t_file_probe (\
+		path       TEXT PRIMARY KEY,\
+		size       INTEGER NOT NULL,\
+		mtime      INTEGER NOT NULL,\
+		info       BLOB NOT NULL\
+		)";
+
+	rc = sqlite3_exec(m_sql, sql.c_str(), NULL, 0, &zErrMsg);
+	if (rc != SQLITE_OK) {
+		printf("database error: %s\n", zErrMsg);
+		sqlite3_free(zErrMsg);
+		return 1;
+	}
+
+	// dvr segments written by MsRecordMgr, times are wall clock ms
+	sql = "create table if not exists t_record (\
+		id         INTEGER PRIMARY KEY,\
+		stream_id  TEXT NOT NULL,\
+		path       TEXT NOT NULL,\
+		start_ms   INTEGER NOT NULL,\
+		end_ms     INTEGER NOT NULL,\
+		size       INTEGER NOT NULL,\
+		keys       BLOB\
+		);\
+		create index if not exists idx_record_stream on t_record (stream_id, start_ms);\
+		create index if not exists idx_record_start on t_record (start_ms);\
+		create table if not exists t_record_task (\
+		stream_id  TEXT PRIMARY KEY\
+		)";
+
+	rc = sqlite3_exec(m_sql, sql.c_str(), NULL, 0, &zErrMsg);
+	if (rc != SQLITE_OK) {
+		printf("database error: %s\n", zErrMsg);
+		sqlite3_free(zErrMsg);
+		return 1;
+	}
+
 	sql = "create table if not exists device (\
 		id INTEGER PRIMARY KEY ,\
 		device_id TEXT NOT NULL UNIQUE,\
@@ -92,9 +155,20 @@ int MsDbMgr::Init() {
 		return 1;
 	}
 
+	rc = sqlite3_open_v2(DB_FILE, &m_readSql, SQLITE_OPEN_READONLY, NULL);
+	if (rc) {
+		printf("Can't open read database: %s\n", sqlite3_errmsg(m_readSql));
+		return -1;
+	}
+
+	sqlite3_busy_timeout(m_readSql, 5000);
+
+	m_worker = make_unique<thread>(&MsDbMgr::OnRun, this);
+
 	return 0;
 }
 
+// synchronous access to the write connection, only for callers that need the result at once
 sqlite3 *MsDbMgr::GetSql() {
 	m_sqlMutex.lock();
 	return m_sql;
@@ -102,6 +176,160 @@ sqlite3 *MsDbMgr::GetSql() {
 
 void MsDbMgr::RelSql() { m_sqlMutex.unlock(); }
 
+sqlite3 *MsDbMgr::GetReadSql() {
+	m_readMutex.lock();
+	return m_readSql;
+}
+
+void MsDbMgr::RelReadSql() { m_readMutex.unlock(); }
+
+void MsDbMgr::PostCmd(MsDbCmd &cmd) {
+	{
+		lock_guard<mutex> lk(m_queMutex);
+		m_cmdQue.emplace_back(std::move(cmd));
+	}
+
+	m_queCond.notify_one();
+}
+
+void MsDbMgr::PostCmd(vector<MsDbCmd> &cmds) {
+	{
+		lock_guard<mutex> lk(m_queMutex);
+		for (auto &cmd : cmds) {
+			m_cmdQue.emplace_back(std::move(cmd));
+		}
+	}
+
+	m_queCond.notify_one();
+}
+
+// wait until every queued write is committed, only for shutdown: it blocks for a whole batch
+void MsDbMgr::Flush() {
+	unique_lock<mutex> lk(m_queMutex);
+	m_idleCond.wait(lk, [this]() { return (m_cmdQue.empty() && !m_busy) || !m_worker; });
+}
+
+void MsDbMgr::Exit() {
+	// queued writes are committed before the worker goes
+	this->Flush();
+
+	{
+		lock_guard<mutex> lk(m_queMutex);
+		m_exit = true;
+	}
+
+	m_queCond.notify_one();
+
+	if (m_worker && m_worker->joinable()) {
+		m_worker->join();
+	}
+}
+
+sqlite3_stmt *MsDbMgr::GetStmt(const string &sql) {
+	auto it = m_stmtCache.find(sql);
+	if (it != m_stmtCache.end()) {
+		return it->second;
+	}
+
+	// dynamic update statements may keep adding shapes, bound the cache
+	if (m_stmtCache.size() >= 256) {
+		for (auto &ss : m_stmtCache) {
+			sqlite3_finalize(ss.second);
+		}
+		m_stmtCache.clear();
+	}
+
+	sqlite3_stmt *pStmt = NULL;
+	if (sqlite3_prepare_v2(m_sql, sql.c_str(), -1, &pStmt, NULL) != SQLITE_OK) {
+		MS_LOG_ERROR("prepare sql:%s err:%s", sql.c_str(), sqlite3_errmsg(m_sql));
+		return NULL;
+	}
+
+	m_stmtCache.emplace(sql, pStmt);
+
+	return pStmt;
+}
+
+int MsDbMgr::RunCmd(MsDbCmd &cmd, int64_t &rowid) {
+	sqlite3_stmt *pStmt = this->GetStmt(cmd.m_sql);
+	int rc = SQLITE_ERROR;
+
+	if (pStmt) {
+		int idx = 1;
+		for (auto &vv : cmd.m_vals) {
+			if (vv.m_isBlob) {
+				sqlite3_bind_blob(pStmt, idx++, vv.m_text.data(), vv.m_text.size(), SQLITE_STATIC);
+			} else if (vv.m_isText) {
+				sqlite3_bind_text(pStmt, idx++, vv.m_text.c_str(), -1, SQLITE_STATIC);
+			} else {
+				sqlite3_bind_int64(pStmt, idx++, vv.m_int);
+			}
+		}
+
+		rc = sqlite3_step(pStmt);
+		if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+			MS_LOG_ERROR("exec sql:%s err:%s", cmd.m_sql.c_str(), sqlite3_errmsg(m_sql));
+		}
+
+		sqlite3_reset(pStmt);
+		sqlite3_clear_bindings(pStmt);
+	}
+
+	rowid = sqlite3_last_insert_rowid(m_sql);
+	return rc;
+}
+
+// drain everything queued so far and commit it as one transaction
+void MsDbMgr::OnRun() {
+	vector<MsDbCmd> cmds;
+
+	while (true) {
+		{
+			unique_lock<mutex> lk(m_queMutex);
+			m_busy = false;
+			m_idleCond.notify_all();
+			m_queCond.wait(lk, [this]() { return m_exit || m_cmdQue.size(); });
+
+			if (m_cmdQue.empty()) {
+				break;
+			}
+
+			cmds.swap(m_cmdQue);
+			m_busy = true;
+		}
+
+		vector<pair<int, int64_t>> res(cmds.size());
+		int64_t t1 = GetCurMs();
+		int crc;
+
+		{
+			lock_guard<mutex> lk(m_sqlMutex);
+			sqlite3_exec(m_sql, "begin transaction", NULL, 0, NULL);
+
+			for (size_t i = 0; i < cmds.size(); ++i) {
+				res[i].first = this->RunCmd(cmds[i], res[i].second);
+			}
+
+			crc = sqlite3_exec(m_sql, "commit transaction", NULL, 0, NULL);
+			if (crc != SQLITE_OK) {
+				MS_LOG_ERROR("db commit err:%s", sqlite3_errmsg(m_sql));
+				sqlite3_exec(m_sql, "rollback transaction", NULL, 0, NULL);
+			}
+		}
+
+		MS_LOG_DEBUG("db commit %d cmds take:%lldms", (int)cmds.size(),
+		             (long long)(GetCurMs() - t1));
+
+		// callbacks may use the db again, none of its locks is held here
+		for (size_t i = 0; i < cmds.size(); ++i) {
+			if (cmds[i].m_cb) {
+				cmds[i].m_cb(crc == SQLITE_OK ? res[i].first : crc, res[i].second);
+			}
+		}
+		cmds.clear();
+	}
+}
+
 MsDbMgr *MsDbMgr::Instance() {
 	if (MsDbMgr::m_instance.get()) {
 		return MsDbMgr::m_instance.get();
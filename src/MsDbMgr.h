@@ -1,12 +1,56 @@
 #ifndef MS_DB_MGR_H
 #define MS_DB_MGR_H
 
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <sqlite3.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
+class MsDbVal {
+public:
+	MsDbVal(int64_t val) : m_isText(false), m_isBlob(false), m_int(val) {}
+	MsDbVal(const string &val, bool blob = false)
+	    : m_isText(!blob), m_isBlob(blob), m_int(0), m_text(val) {}
+
+	bool m_isText;
+	bool m_isBlob;
+	int64_t m_int;
+	string m_text;
+};
+
+// a write queued to the db thread. m_cb runs there once its transaction is committed, without
+// any db lock held, with the rc of the statement or of the failed commit
+class MsDbCmd {
+public:
+	MsDbCmd(const string &sql) : m_sql(sql) {}
+
+	MsDbCmd &Bind(int64_t val) {
+		m_vals.emplace_back(val);
+		return *this;
+	}
+
+	MsDbCmd &Bind(const string &val) {
+		m_vals.emplace_back(val);
+		return *this;
+	}
+
+	MsDbCmd &BindBlob(const string &val) {
+		m_vals.emplace_back(val, true);
+		return *this;
+	}
+
+	string m_sql;
+	vector<MsDbVal> m_vals;
+	function<void(int rc, int64_t rowid)> m_cb;
+};
+
 class MsDbMgr {
 public:
 	MsDbMgr();
@@ -15,12 +59,34 @@ public:
 	int Init();
 	sqlite3 *GetSql();
 	void RelSql();
+	sqlite3 *GetReadSql();
+	void RelReadSql();
+
+	void PostCmd(MsDbCmd &cmd);
+	void PostCmd(vector<MsDbCmd> &cmds);
+	void Flush();
+	void Exit();
 
 	static MsDbMgr *Instance();
 
 private:
+	void OnRun();
+	sqlite3_stmt *GetStmt(const string &sql);
+	int RunCmd(MsDbCmd &cmd, int64_t &rowid);
+
 	sqlite3 *m_sql;
+	sqlite3 *m_readSql;
 	mutex m_sqlMutex;
+	mutex m_readMutex;
+
+	bool m_exit;
+	bool m_busy;
+	mutex m_queMutex;
+	condition_variable m_queCond;
+	condition_variable m_idleCond;
+	vector<MsDbCmd> m_cmdQue;
+	unordered_map<string, sqlite3_stmt *> m_stmtCache;
+	unique_ptr<thread> m_worker;
 
 	static unique_ptr<MsDbMgr> m_instance;
 	static mutex m_mutex;
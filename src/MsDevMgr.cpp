@@ -2,6 +2,7 @@
 #include "MsConfig.h"
 #include "MsDbMgr.h"
 #include "MsLog.h"
+#include <algorithm>
 
 unique_ptr<MsDevMgr> MsDevMgr::m_instance;
 mutex MsDevMgr::m_mutex;
@@ -219,6 +220,297 @@ static void AssignDbDev(int i, shared_ptr<MsGbDevice> &dev, const string &val) {
 	}
 }
 
+#define DEV_INSERT_SQL                                                                             \
+	"insert into device (device_id, parent_id, domain_id, name, status, manufacturer, model, "    \
+	"owner, civil_code, address, ip_addr, user, pass, longitude, latitude, port, url, ptz_type, " \
+	"type, protocol, bind_ip, remark) values (?, ?, ?, ?, 'OFF', ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "  \
+	"?, ?, ?, ?, ?, ?, ?)"
+
+static void BindInsertDev(MsDbCmd &cmd, const shared_ptr<MsGbDevice> &dev) {
+	cmd.Bind(dev->m_deviceID)
+	    .Bind(dev->m_parentID)
+	    .Bind(dev->m_domainID)
+	    .Bind(dev->m_name)
+	    .Bind(dev->m_manufacturer)
+	    .Bind(dev->m_model)
+	    .Bind(dev->m_owner)
+	    .Bind(dev->m_civilCode)
+	    .Bind(dev->m_address)
+	    .Bind(dev->m_ipaddr)
+	    .Bind(dev->m_user)
+	    .Bind(dev->m_pass)
+	    .Bind(dev->m_longitude)
+	    .Bind(dev->m_latitude)
+	    .Bind(dev->m_port)
+	    .Bind(dev->m_url)
+	    .Bind(dev->m_ptzType)
+	    .Bind(dev->m_type)
+	    .Bind(dev->m_protocol)
+	    .Bind(dev->m_bindIP)
+	    .Bind(dev->m_remark);
+}
+
+static inline uint32_t Gram(const char *p) {
+	return ((uint32_t)(uint8_t)p[0] << 16) | ((uint32_t)(uint8_t)p[1] << 8) | (uint8_t)p[2];
+}
+
+void MsDevIndex::AddGram(unordered_map<uint32_t, Posting> &idx, const string &s, uint32_t slot) {
+	for (size_t i = 0; i + 3 <= s.size(); ++i) {
+		Posting &ps = idx[Gram(s.data() + i)];
+		if (ps.empty() || ps.back() != slot) {
+			ps.push_back(slot);
+		}
+	}
+}
+
+// shortest posting among the trigrams of s, nullptr if s is too short to use the index
+const MsDevIndex::Posting *MsDevIndex::GetGram(unordered_map<uint32_t, Posting> &idx,
+                                               const string &s) {
+	static const Posting empty;
+	const Posting *best = nullptr;
+
+	for (size_t i = 0; i + 3 <= s.size(); ++i) {
+		auto it = idx.find(Gram(s.data() + i));
+		if (it == idx.end()) {
+			return &empty;
+		}
+
+		if (!best || it->second.size() < best->size()) {
+			best = &it->second;
+		}
+	}
+
+	return best;
+}
+
+void MsDevIndex::AddInternal(const shared_ptr<MsGbDevice> &dev) {
+	uint32_t slot = m_entry.size();
+
+	m_entry.emplace_back();
+	IdxEntry &e = m_entry.back();
+	e.m_dev = dev;
+	e.m_type = dev->m_type;
+	e.m_ptzType = dev->m_ptzType;
+	e.m_protocol = dev->m_protocol;
+	e.m_deviceID = dev->m_deviceID;
+	e.m_domainID = dev->m_domainID;
+	e.m_name = dev->m_name;
+	e.m_bindIP = dev->m_bindIP;
+	e.m_url = dev->m_url;
+
+	m_slot[e.m_deviceID] = slot;
+	m_domain[e.m_domainID].push_back(slot);
+	m_bindIP[e.m_bindIP].push_back(slot);
+	m_type[e.m_type].push_back(slot);
+	m_ptzType[e.m_ptzType].push_back(slot);
+	m_protocol[e.m_protocol].push_back(slot);
+	AddGram(m_nameGram, e.m_name, slot);
+	AddGram(m_idGram, e.m_deviceID, slot);
+}
+
+void MsDevIndex::DelInternal(const string &devId) {
+	auto it = m_slot.find(devId);
+	if (it == m_slot.end()) {
+		return;
+	}
+
+	m_entry[it->second].m_dev.reset();
+	m_slot.erase(it);
+	++m_dead;
+}
+
+// rebuild with slots in device id order once dead slots dominate
+void MsDevIndex::Compact() {
+	if (m_dead < 1024 || m_dead < m_slot.size()) {
+		return;
+	}
+
+	map<string, shared_ptr<MsGbDevice>> live;
+	for (auto &e : m_entry) {
+		if (e.m_dev) {
+			live.emplace(e.m_deviceID, e.m_dev);
+		}
+	}
+
+	m_entry.clear();
+	m_slot.clear();
+	m_domain.clear();
+	m_bindIP.clear();
+	m_type.clear();
+	m_ptzType.clear();
+	m_protocol.clear();
+	m_nameGram.clear();
+	m_idGram.clear();
+	m_dead = 0;
+
+	for (auto &dd : live) {
+		this->AddInternal(dd.second);
+	}
+}
+
+void MsDevIndex::Add(const shared_ptr<MsGbDevice> &dev) {
+	unique_lock<shared_mutex> lk(m_mutex);
+
+	this->DelInternal(dev->m_deviceID);
+	this->AddInternal(dev);
+	this->Compact();
+}
+
+// caller holds the device's shard lock, re-index only if an indexed field changed,
+// otherwise the slot just takes the new copy of the device
+void MsDevIndex::Update(const shared_ptr<MsGbDevice> &dev) {
+	unique_lock<shared_mutex> lk(m_mutex);
+
+	auto it = m_slot.find(dev->m_deviceID);
+	if (it != m_slot.end()) {
+		IdxEntry &e = m_entry[it->second];
+		if (e.m_type == dev->m_type && e.m_ptzType == dev->m_ptzType &&
+		    e.m_protocol == dev->m_protocol && e.m_domainID == dev->m_domainID &&
+		    e.m_name == dev->m_name && e.m_bindIP == dev->m_bindIP && e.m_url == dev->m_url) {
+			e.m_dev = dev;
+			return;
+		}
+	}
+
+	this->DelInternal(dev->m_deviceID);
+	this->AddInternal(dev);
+	this->Compact();
+}
+
+void MsDevIndex::Del(const string &devId) {
+	unique_lock<shared_mutex> lk(m_mutex);
+
+	this->DelInternal(devId);
+	this->Compact();
+}
+
+bool MsDevIndex::Match(const IdxEntry &e, const FindDev &fdev) {
+	if (!e.m_dev) {
+		return false;
+	}
+
+	if (fdev.type && e.m_type != fdev.type) {
+		return false;
+	}
+
+	if (fdev.ptzType && e.m_ptzType != fdev.ptzType) {
+		return false;
+	}
+
+	if (fdev.protocol && e.m_protocol != fdev.protocol) {
+		return false;
+	}
+
+	if (fdev.domainId.size() && e.m_domainID != fdev.domainId) {
+		return false;
+	}
+
+	if (fdev.bindIP.size() && e.m_bindIP != fdev.bindIP) {
+		return false;
+	}
+
+	if (fdev.deviceId.size() && string::npos == e.m_deviceID.find(fdev.deviceId)) {
+		return false;
+	}
+
+	if (fdev.name.size() && string::npos == e.m_name.find(fdev.name)) {
+		return false;
+	}
+
+	if (fdev.url.size() && string::npos == e.m_url.find(fdev.url)) {
+		return false;
+	}
+
+	return true;
+}
+
+// walk the shortest candidate posting, return total matched and copy only [off, off + cnt)
+// in device id order. slots lose that order as devices are updated, the page is sorted here
+int MsDevIndex::Query(const FindDev &fdev, int off, int cnt,
+                      vector<shared_ptr<MsGbDevice>> &vecDev) {
+	static const Posting empty;
+	shared_lock<shared_mutex> lk(m_mutex);
+	const Posting *cand = nullptr;
+
+	auto pick = [&cand](const Posting *ps) {
+		if (ps && (!cand || ps->size() < cand->size())) {
+			cand = ps;
+		}
+	};
+
+	auto pickStr = [&pick](unordered_map<string, Posting> &idx, const string &key) {
+		auto it = idx.find(key);
+		pick(it == idx.end() ? &empty : &it->second);
+	};
+
+	auto pickInt = [&pick](unordered_map<int, Posting> &idx, int key) {
+		auto it = idx.find(key);
+		pick(it == idx.end() ? &empty : &it->second);
+	};
+
+	if (fdev.domainId.size()) {
+		pickStr(m_domain, fdev.domainId);
+	}
+
+	if (fdev.bindIP.size()) {
+		pickStr(m_bindIP, fdev.bindIP);
+	}
+
+	if (fdev.type) {
+		pickInt(m_type, fdev.type);
+	}
+
+	if (fdev.ptzType) {
+		pickInt(m_ptzType, fdev.ptzType);
+	}
+
+	if (fdev.protocol) {
+		pickInt(m_protocol, fdev.protocol);
+	}
+
+	pick(this->GetGram(m_idGram, fdev.deviceId));
+	pick(this->GetGram(m_nameGram, fdev.name));
+
+	vector<uint32_t> hit;
+	auto check = [&](uint32_t slot) {
+		if (this->Match(m_entry[slot], fdev)) {
+			hit.push_back(slot);
+		}
+	};
+
+	if (cand) {
+		for (uint32_t slot : *cand) {
+			check(slot);
+		}
+	} else {
+		for (uint32_t slot = 0; slot < m_entry.size(); ++slot) {
+			check(slot);
+		}
+	}
+
+	size_t begin = off > 0 ? off : 0;
+	size_t end = cnt > 0 ? min(hit.size(), begin + cnt) : hit.size();
+	if (begin < end) {
+		partial_sort(hit.begin(), hit.begin() + end, hit.end(), [this](uint32_t a, uint32_t b) {
+			return m_entry[a].m_deviceID < m_entry[b].m_deviceID;
+		});
+		for (size_t i = begin; i < end; ++i) {
+			vecDev.emplace_back(m_entry[hit[i]].m_dev);
+		}
+	}
+
+	return hit.size();
+}
+
+MsDevMgr::DevShard &MsDevMgr::GetShard(const string &devId) {
+	return m_shard[hash<string>()(devId) % DEV_SHARD_NUM];
+}
+
+// caller holds shard.m_mutex
+void MsDevMgr::Publish(DevShard &shard) {
+	atomic_store(&shard.m_snap, shared_ptr<const DevMap>(make_shared<DevMap>(shard.m_device)));
+}
+
 void MsDevMgr::LoadDevice() {
 	char sql[512];
 	int nSql = sprintf(sql, "select \
@@ -227,9 +519,9 @@ void MsDevMgr::LoadDevice() {
           ip_addr, user, pass, longitude, latitude, \
           port, url, ptz_type, type, protocol, \
           bind_ip, remark, codec, resolution, onvif_profile, \
-          onvif_ptz_url from device");
+          onvif_ptz_url from device order by device_id");
 
-	sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
+	sqlite3 *pSql = MsDbMgr::Instance()->GetReadSql();
 	sqlite3_stmt *pStmt = NULL;
 
 	int rc = sqlite3_prepare_v2(pSql, sql, nSql, &pStmt, NULL);
@@ -248,15 +540,24 @@ void MsDevMgr::LoadDevice() {
 			if (dev->m_protocol == GB_DEV) {
 				dev->m_status = "OFF";
 			}
-			m_device.emplace(dev->m_deviceID, dev);
+
+			DevShard &shard = this->GetShard(dev->m_deviceID);
+			lock_guard<mutex> lk(shard.m_mutex);
+			shard.m_device.emplace(dev->m_deviceID, dev);
+			m_index.Add(dev);
 		}
 
 		sqlite3_finalize(pStmt);
+
+		for (DevShard &shard : m_shard) {
+			lock_guard<mutex> lk(shard.m_mutex);
+			this->Publish(shard);
+		}
 	} else {
 		printf("prepare sql failed:%s\n", sqlite3_errmsg(pSql));
 	}
 
-	MsDbMgr::Instance()->RelSql();
+	MsDbMgr::Instance()->RelReadSql();
 
 	// load net map here, a little ugly
 	json &obj = MsConfig::Instance()->GetConfigObj();
@@ -268,72 +569,115 @@ void MsDevMgr::LoadDevice() {
 }
 
 void MsDevMgr::AddOrUpdateDevice(shared_ptr<MsGbDevice> dev) {
-	lock_guard<mutex> lk(MsDevMgr::m_mutex);
-	auto it = m_device.find(dev->m_deviceID);
+	vector<shared_ptr<MsGbDevice>> devs{dev};
+	int nAdd, nMod;
 
-	if (it == m_device.end()) {
-		m_device.emplace(dev->m_deviceID, dev);
-		this->AddImportedDevcie(dev);
-	} else {
-		shared_ptr<MsGbDevice> gb = it->second;
-		string sql = "update device set ";
+	this->AddOrUpdateDevice(devs, nAdd, nMod);
+}
 
-		if (gb->m_name != dev->m_name) {
-			gb->m_name = dev->m_name;
+// merge devs into memory one shard at a time, then write all changes in one transaction.
+// on return devs hold the objects owned by the manager
+void MsDevMgr::AddOrUpdateDevice(vector<shared_ptr<MsGbDevice>> &devs, int &nAdd, int &nMod) {
+	vector<shared_ptr<MsGbDevice>> addDev;
+	vector<shared_ptr<MsGbDevice>> modDev;
+
+	vector<size_t> bucket[DEV_SHARD_NUM];
+	for (size_t i = 0; i < devs.size(); ++i) {
+		bucket[hash<string>()(devs[i]->m_deviceID) % DEV_SHARD_NUM].push_back(i);
+	}
 
-			sql += "name='";
-			sql += dev->m_name;
-			sql += "' ,";
+	for (int sn = 0; sn < DEV_SHARD_NUM; ++sn) {
+		if (bucket[sn].empty()) {
+			continue;
 		}
 
-		if (gb->m_status != dev->m_status) {
-			gb->m_status = dev->m_status;
+		DevShard &shard = m_shard[sn];
+		lock_guard<mutex> lk(shard.m_mutex);
+		size_t oldSize = shard.m_device.size();
+		int nChanged = 0;
 
-			sql += "status='";
-			sql += dev->m_status;
-			sql += "' ,";
-		}
+		for (size_t i : bucket[sn]) {
+			shared_ptr<MsGbDevice> &dev = devs[i];
+			auto it = shard.m_device.find(dev->m_deviceID);
 
-		if (gb->m_type != dev->m_type) {
-			gb->m_type = dev->m_type;
+			if (it == shard.m_device.end()) {
+				if (dev->m_parentID.size() == 0) {
+					dev->m_parentID = dev->m_domainID;
+				}
 
-			sql += "type=";
-			sql += to_string(dev->m_type);
-			sql += " ,";
-		}
+				shard.m_device.emplace(dev->m_deviceID, dev);
+				m_index.Add(dev);
+				addDev.emplace_back(make_shared<MsGbDevice>(*dev));
+				continue;
+			}
 
-		if (gb->m_longitude != dev->m_longitude && dev->m_longitude.size()) {
-			gb->m_longitude = dev->m_longitude;
+			// published devices are never written, changes go to a copy that replaces it
+			shared_ptr<MsGbDevice> gb = make_shared<MsGbDevice>(*it->second);
+			bool changed = false;
 
-			sql += "longitude='";
-			sql += dev->m_longitude;
-			sql += "' ,";
-		}
+			if (gb->m_name != dev->m_name) {
+				gb->m_name = dev->m_name;
+				changed = true;
+			}
 
-		if (gb->m_latitude != dev->m_latitude && dev->m_latitude.size()) {
-			gb->m_latitude = dev->m_latitude;
+			if (gb->m_status != dev->m_status) {
+				gb->m_status = dev->m_status;
+				changed = true;
+			}
 
-			sql += "latitude='";
-			sql += dev->m_latitude;
-			sql += "' ,";
-		}
+			if (gb->m_type != dev->m_type) {
+				gb->m_type = dev->m_type;
+				changed = true;
+			}
 
-		if (sql.size() > strlen("update device set ")) {
-			sql.resize(sql.size() - 1);
-			sql += "where device_id='";
-			sql += dev->m_deviceID;
-			sql += "'";
-
-			sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
-			char *zErrMsg = NULL;
-			int rc = sqlite3_exec(pSql, sql.c_str(), NULL, 0, &zErrMsg);
-			if (rc != SQLITE_OK) {
-				MS_LOG_ERROR("update device err:%s", zErrMsg);
-				sqlite3_free(zErrMsg);
+			if (gb->m_longitude != dev->m_longitude && dev->m_longitude.size()) {
+				gb->m_longitude = dev->m_longitude;
+				changed = true;
 			}
 
-			MsDbMgr::Instance()->RelSql();
+			if (gb->m_latitude != dev->m_latitude && dev->m_latitude.size()) {
+				gb->m_latitude = dev->m_latitude;
+				changed = true;
+			}
+
+			if (changed) {
+				it->second = gb;
+				m_index.Update(gb);
+				modDev.emplace_back(gb);
+				++nChanged;
+			}
+
+			dev = it->second;
 		}
+
+		if (nChanged || shard.m_device.size() != oldSize) {
+			this->Publish(shard);
+		}
+	}
+
+	nAdd = addDev.size();
+	nMod = modDev.size();
+
+	vector<MsDbCmd> cmds;
+	for (auto &dev : addDev) {
+		cmds.emplace_back(DEV_INSERT_SQL);
+		BindInsertDev(cmds.back(), dev);
+	}
+
+	for (auto &dev : modDev) {
+		cmds.emplace_back("update device set name=?, status=?, type=?, longitude=?, latitude=? "
+		                  "where device_id=?");
+		cmds.back()
+		    .Bind(dev->m_name)
+		    .Bind(dev->m_status)
+		    .Bind(dev->m_type)
+		    .Bind(dev->m_longitude)
+		    .Bind(dev->m_latitude)
+		    .Bind(dev->m_deviceID);
+	}
+
+	if (cmds.size()) {
+		MsDbMgr::Instance()->PostCmd(cmds);
 	}
 }
 
@@ -412,8 +756,11 @@ values ('%s', '%s','%s', '%s', '%s', \
 
 	MsDbMgr::Instance()->RelSql();
 
-	lock_guard<mutex> lk(MsDevMgr::m_mutex);
-	m_device[dev->m_deviceID] = dev;
+	DevShard &shard = this->GetShard(dev->m_deviceID);
+	lock_guard<mutex> lk(shard.m_mutex);
+	shard.m_device[dev->m_deviceID] = dev;
+	m_index.Add(dev);
+	this->Publish(shard);
 
 	return 0;
 }
@@ -423,40 +770,9 @@ int MsDevMgr::AddImportedDevcie(shared_ptr<MsGbDevice> dev) {
 		dev->m_parentID = dev->m_domainID;
 	}
 
-	char sql[1024];
-	int nSql = 0;
-
-	nSql = sprintf(sql, "insert into device ( \
-        device_id, parent_id, domain_id,  name, status, \
-        manufacturer, model, owner, civil_code, address, \
-        ip_addr, user, pass, longitude, latitude, \
-        port, url, ptz_type, type, protocol, \
-		bind_ip, remark) \
-values ('%s', '%s','%s', '%s', 'OFF', \
-    '%s', '%s','%s', '%s', '%s', \
-    '%s', '%s','%s', '%s', '%s', \
-        %d, '%s', %d, %d, %d, \
-        '%s', '%s')",
-	               dev->m_deviceID.c_str(), dev->m_parentID.c_str(), dev->m_domainID.c_str(),
-	               dev->m_name.c_str(), dev->m_manufacturer.c_str(), dev->m_model.c_str(),
-	               dev->m_owner.c_str(), dev->m_civilCode.c_str(), dev->m_address.c_str(),
-	               dev->m_ipaddr.c_str(), dev->m_user.c_str(), dev->m_pass.c_str(),
-	               dev->m_longitude.c_str(), dev->m_latitude.c_str(), dev->m_port,
-	               dev->m_url.c_str(), dev->m_ptzType, dev->m_type, dev->m_protocol,
-	               dev->m_bindIP.c_str(), dev->m_remark.c_str());
-
-	sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
-	char *zErrMsg = NULL;
-
-	int rc = sqlite3_exec(pSql, sql, NULL, 0, &zErrMsg);
-	if (rc != SQLITE_OK) {
-		MS_LOG_ERROR("insert device:%s err:%s", dev->m_name.c_str(), zErrMsg);
-		sqlite3_free(zErrMsg);
-		MsDbMgr::Instance()->RelSql();
-		return -1;
-	}
-
-	MsDbMgr::Instance()->RelSql();
+	MsDbCmd cmd(DEV_INSERT_SQL);
+	BindInsertDev(cmd, dev);
+	MsDbMgr::Instance()->PostCmd(cmd);
 
 	return 0;
 }
@@ -466,90 +782,79 @@ void MsDevMgr::DelDeviceInMem(set<string> &delDev) {
 		return;
 	}
 
-	{
-		lock_guard<mutex> lk(MsDevMgr::m_mutex);
-		for (auto &dd : delDev) {
-			m_device.erase(dd);
-		}
+	vector<const string *> bucket[DEV_SHARD_NUM];
+	for (auto &dd : delDev) {
+		bucket[hash<string>()(dd) % DEV_SHARD_NUM].push_back(&dd);
 	}
-}
 
-void MsDevMgr::DeleteDevice(set<string> &delDev) {
-	char sql[256];
-	sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
+	for (int sn = 0; sn < DEV_SHARD_NUM; ++sn) {
+		if (bucket[sn].empty()) {
+			continue;
+		}
 
-	for (auto &dd : delDev) {
-		int nSql = sprintf(sql, "delete from device where device_id='%s'", dd.c_str());
-		char *zErrMsg = NULL;
+		DevShard &shard = m_shard[sn];
+		lock_guard<mutex> lk(shard.m_mutex);
 
-		int rc = sqlite3_exec(pSql, sql, NULL, 0, &zErrMsg);
-		if (rc != SQLITE_OK) {
-			MS_LOG_ERROR("delete device err:%s", zErrMsg);
-			sqlite3_free(zErrMsg);
+		for (const string *dd : bucket[sn]) {
+			shard.m_device.erase(*dd);
+			m_index.Del(*dd);
 		}
 
-		nSql = sprintf(sql, "delete from group_dev where device_id='%s'", dd.c_str());
+		this->Publish(shard);
+	}
+}
 
-		rc = sqlite3_exec(pSql, sql, NULL, 0, &zErrMsg);
-		if (rc != SQLITE_OK) {
-			MS_LOG_ERROR("delete group_dev err:%s", zErrMsg);
-			sqlite3_free(zErrMsg);
-		}
+void MsDevMgr::DeleteDevice(set<string> &delDev) {
+	vector<MsDbCmd> cmds;
+
+	for (auto &dd : delDev) {
+		cmds.emplace_back("delete from device where device_id=?");
+		cmds.back().Bind(dd);
+		cmds.emplace_back("delete from group_dev where device_id=?");
+		cmds.back().Bind(dd);
 	}
 
-	MsDbMgr::Instance()->RelSql();
+	MsDbMgr::Instance()->PostCmd(cmds);
 
 	this->DelDeviceInMem(delDev);
 }
 
 void MsDevMgr::AddGroupDev(const string &devId, vector<string> &addDev) {
-	char sql[512];
-	int nSql;
-	shared_ptr<MsGbDevice> dev;
+	vector<MsDbCmd> cmds;
 
 	for (auto &dd : addDev) {
-		sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
-		nSql = sprintf(sql,
-		               "insert into group_dev (group_id, device_id, name, "
-		               "type) values ('%s', '%s', '%s', %d)",
-		               devId.c_str(), dd.c_str(), dev->m_name.c_str(), dev->m_type);
-
-		char *zErrMsg = NULL;
-		int rc = sqlite3_exec(pSql, sql, NULL, 0, &zErrMsg);
-		if (rc != SQLITE_OK) {
-			MS_LOG_ERROR("insert group_dev err:%s", zErrMsg);
-			sqlite3_free(zErrMsg);
+		shared_ptr<MsGbDevice> dev = this->FindDevice(dd);
+		if (!dev) {
+			continue;
 		}
 
-		MsDbMgr::Instance()->RelSql();
+		cmds.emplace_back("insert into group_dev (group_id, device_id, name, type) values (?, ?, "
+		                  "?, ?)");
+		cmds.back().Bind(devId).Bind(dd).Bind(dev->m_name).Bind(dev->m_type);
 	}
+
+	MsDbMgr::Instance()->PostCmd(cmds);
 }
 
 void MsDevMgr::DelGroupDev(const string &devId, vector<string> &delDev) {
-	char sql[512];
-	int nSql;
+	vector<MsDbCmd> cmds;
 
 	for (auto &dd : delDev) {
-		sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
-		nSql = sprintf(sql, "delete from group_dev where group_id='%s' and device_id='%s'",
-		               devId.c_str(), dd.c_str());
-
-		char *zErrMsg = NULL;
-		int rc = sqlite3_exec(pSql, sql, NULL, 0, &zErrMsg);
-		if (rc != SQLITE_OK) {
-			MS_LOG_ERROR("delete group_dev err:%s", zErrMsg);
-			sqlite3_free(zErrMsg);
-		}
-
-		MsDbMgr::Instance()->RelSql();
+		cmds.emplace_back("delete from group_dev where group_id=? and device_id=?");
+		cmds.back().Bind(devId).Bind(dd);
 	}
+
+	MsDbMgr::Instance()->PostCmd(cmds);
 }
 
 shared_ptr<MsGbDevice> MsDevMgr::FindDevice(const string &devId) {
+	shared_ptr<const DevMap> snap = atomic_load(&this->GetShard(devId).m_snap);
+	if (!snap) {
+		return nullptr;
+	}
 
-	lock_guard<mutex> lk(m_mutex);
-	auto it = m_device.find(devId);
-	if (it != m_device.end()) {
+	auto it = snap->find(devId);
+	if (it != snap->end()) {
 		return it->second;
 	} else {
 		return nullptr;
@@ -576,29 +881,13 @@ void MsDevMgr::GetAllDevice(json &jRsp, int page, int size) {
 	jRsp["msg"] = "success";
 
 	vector<shared_ptr<MsGbDevice>> devices;
+	FindDev fdev;
+	fdev.type = 0;
 
-	{
-		lock_guard<mutex> lk(m_mutex);
-
-		if (page > 0 && size > 0) {
-			int off = (page - 1) * size;
-			int mm = page * size;
-			int nn = 0;
-
-			for (auto &dd : m_device) {
-				++nn;
-
-				if (nn > off && nn <= mm) {
-					devices.emplace_back(dd.second);
-				} else if (nn > mm) {
-					break;
-				}
-			}
-		} else {
-			for (auto &dd : m_device) {
-				devices.emplace_back(dd.second);
-			}
-		}
+	if (page > 0 && size > 0) {
+		m_index.Query(fdev, (page - 1) * size, size, devices);
+	} else {
+		m_index.Query(fdev, 0, 0, devices);
 	}
 
 	for (auto &dd : devices) {
@@ -609,138 +898,141 @@ void MsDevMgr::GetAllDevice(json &jRsp, int page, int size) {
 }
 
 void MsDevMgr::ModifyDevice(const string &devId, const ModDev &mm) {
-	lock_guard<mutex> lk(m_mutex);
-	auto it = m_device.find(devId);
-	if (it == m_device.end()) {
+	DevShard &shard = this->GetShard(devId);
+	lock_guard<mutex> lk(shard.m_mutex);
+	auto it = shard.m_device.find(devId);
+	if (it == shard.m_device.end()) {
 		return;
 	}
 
-	shared_ptr<MsGbDevice> dev = it->second;
+	shared_ptr<MsGbDevice> dev = make_shared<MsGbDevice>(*it->second);
 
 	// Build parameterized SQL to prevent SQL injection
 	vector<string> setClauses;
-	vector<pair<int, string>> textBindings; // index, value
-	vector<pair<int, int>> intBindings;     // index, value
-	int paramIndex = 1;
+	vector<MsDbVal> bindings;
 
 	if (mm.m_port > 0) {
 		dev->m_port = mm.m_port;
 		setClauses.push_back("port=?");
-		intBindings.push_back({paramIndex++, mm.m_port});
+		bindings.emplace_back(mm.m_port);
 	}
 
 	if (mm.m_ipaddr.size()) {
 		dev->m_ipaddr = mm.m_ipaddr;
 		setClauses.push_back("ip_addr=?");
-		textBindings.push_back({paramIndex++, mm.m_ipaddr});
+		bindings.emplace_back(mm.m_ipaddr);
 	}
 
 	if (mm.m_codec.size() && mm.m_codec != dev->m_codec) {
 		dev->m_codec = mm.m_codec;
 		setClauses.push_back("codec=?");
-		textBindings.push_back({paramIndex++, mm.m_codec});
+		bindings.emplace_back(mm.m_codec);
 	}
 
 	if (mm.m_resolution.size() && mm.m_resolution != dev->m_resolution) {
 		dev->m_resolution = mm.m_resolution;
 		setClauses.push_back("resolution=?");
-		textBindings.push_back({paramIndex++, mm.m_resolution});
+		bindings.emplace_back(mm.m_resolution);
 	}
 
 	if (mm.m_status.size() && mm.m_status != dev->m_status) {
 		dev->m_status = mm.m_status;
 		setClauses.push_back("status=?");
-		textBindings.push_back({paramIndex++, mm.m_status});
+		bindings.emplace_back(mm.m_status);
 	}
 
 	if (mm.m_name.size()) {
 		dev->m_name = mm.m_name;
 		setClauses.push_back("name=?");
-		textBindings.push_back({paramIndex++, mm.m_name});
+		bindings.emplace_back(mm.m_name);
 	}
 
 	if (mm.m_address.size()) {
 		dev->m_address = mm.m_address;
 		setClauses.push_back("address=?");
-		textBindings.push_back({paramIndex++, mm.m_address});
+		bindings.emplace_back(mm.m_address);
 	}
 
 	if (mm.m_user.size()) {
 		dev->m_user = mm.m_user;
 		setClauses.push_back("user=?");
-		textBindings.push_back({paramIndex++, mm.m_user});
+		bindings.emplace_back(mm.m_user);
 	}
 
 	if (mm.m_pass.size()) {
 		dev->m_pass = mm.m_pass;
 		setClauses.push_back("pass=?");
-		textBindings.push_back({paramIndex++, mm.m_pass});
+		bindings.emplace_back(mm.m_pass);
 	}
 
 	if (mm.m_civilCode.size()) {
 		dev->m_civilCode = mm.m_civilCode;
 		setClauses.push_back("civil_code=?");
-		textBindings.push_back({paramIndex++, mm.m_civilCode});
+		bindings.emplace_back(mm.m_civilCode);
 	}
 
 	if (mm.m_latitude.size()) {
 		dev->m_latitude = mm.m_latitude;
 		setClauses.push_back("latitude=?");
-		textBindings.push_back({paramIndex++, mm.m_latitude});
+		bindings.emplace_back(mm.m_latitude);
 	}
 
 	if (mm.m_longitude.size()) {
 		dev->m_longitude = mm.m_longitude;
 		setClauses.push_back("longitude=?");
-		textBindings.push_back({paramIndex++, mm.m_longitude});
+		bindings.emplace_back(mm.m_longitude);
 	}
 
 	if (mm.m_url.size()) {
 		dev->m_url = mm.m_url;
 		setClauses.push_back("url=?");
-		textBindings.push_back({paramIndex++, mm.m_url});
+		bindings.emplace_back(mm.m_url);
 	}
 
 	if (mm.m_remark.size()) {
 		dev->m_remark = mm.m_remark;
 		setClauses.push_back("remark=?");
-		textBindings.push_back({paramIndex++, mm.m_remark});
+		bindings.emplace_back(mm.m_remark);
 	}
 
 	if (mm.m_owner.size()) {
 		dev->m_owner = mm.m_owner;
 		setClauses.push_back("owner=?");
-		textBindings.push_back({paramIndex++, mm.m_owner});
+		bindings.emplace_back(mm.m_owner);
 	}
 
 	if (mm.b_bindIP) {
 		dev->m_bindIP = mm.m_bindIP;
 		setClauses.push_back("bind_ip=?");
-		textBindings.push_back({paramIndex++, mm.m_bindIP});
+		bindings.emplace_back(mm.m_bindIP);
 	}
 
 	if (mm.b_ptzType) {
 		dev->m_ptzType = mm.m_ptzType;
 		setClauses.push_back("ptz_type=?");
-		intBindings.push_back({paramIndex++, mm.m_ptzType});
+		bindings.emplace_back(mm.m_ptzType);
 	}
 
 	if (mm.m_onvifprofile.size()) {
 		dev->m_onvifprofile = mm.m_onvifprofile;
 		setClauses.push_back("onvif_profile=?");
-		textBindings.push_back({paramIndex++, mm.m_onvifprofile});
+		bindings.emplace_back(mm.m_onvifprofile);
 	}
 
 	if (mm.m_onvifptzurl.size()) {
 		dev->m_onvifptzurl = mm.m_onvifptzurl;
 		setClauses.push_back("onvif_ptz_url=?");
-		textBindings.push_back({paramIndex++, mm.m_onvifptzurl});
+		bindings.emplace_back(mm.m_onvifptzurl);
 	}
 
 	if (setClauses.empty()) {
 		return;
 	}
 
+	it->second = dev;
+	m_index.Update(dev);
+	this->Publish(shard);
+
 	// Build SQL with placeholders
 	string sql = "UPDATE device SET ";
 	for (size_t i = 0; i < setClauses.size(); ++i) {
@@ -750,38 +1042,47 @@ void MsDevMgr::ModifyDevice(const string &devId, const ModDev &mm) {
 		}
 	}
 	sql += " WHERE device_id=?";
-	int devIdParamIndex = paramIndex;
 
-	sqlite3 *pSql = MsDbMgr::Instance()->GetSql();
-	sqlite3_stmt *pStmt = NULL;
+	// queued to the db thread, never wait for the disk here
+	MsDbCmd cmd(sql);
+	cmd.m_vals = std::move(bindings);
+	cmd.Bind(devId);
+	MsDbMgr::Instance()->PostCmd(cmd);
+}
 
-	int rc = sqlite3_prepare_v2(pSql, sql.c_str(), -1, &pStmt, NULL);
-	if (rc != SQLITE_OK || !pStmt) {
-		MS_LOG_ERROR("prepare sql failed: %s", sqlite3_errmsg(pSql));
-		MsDbMgr::Instance()->RelSql();
-		return;
+// status of devices that is not kept in the db, e.g. gb devices going on and off line
+void MsDevMgr::SetDeviceStatus(const vector<string> &devIds, const string &status) {
+	vector<const string *> bucket[DEV_SHARD_NUM];
+	for (auto &dd : devIds) {
+		bucket[hash<string>()(dd) % DEV_SHARD_NUM].push_back(&dd);
 	}
 
-	// Bind all text parameters
-	for (const auto &binding : textBindings) {
-		sqlite3_bind_text(pStmt, binding.first, binding.second.c_str(), -1, SQLITE_TRANSIENT);
-	}
+	for (int sn = 0; sn < DEV_SHARD_NUM; ++sn) {
+		if (bucket[sn].empty()) {
+			continue;
+		}
 
-	// Bind all integer parameters
-	for (const auto &binding : intBindings) {
-		sqlite3_bind_int(pStmt, binding.first, binding.second);
-	}
+		DevShard &shard = m_shard[sn];
+		lock_guard<mutex> lk(shard.m_mutex);
+		int nChanged = 0;
 
-	// Bind the device_id parameter
-	sqlite3_bind_text(pStmt, devIdParamIndex, devId.c_str(), -1, SQLITE_TRANSIENT);
+		for (const string *dd : bucket[sn]) {
+			auto it = shard.m_device.find(*dd);
+			if (it == shard.m_device.end() || it->second->m_status == status) {
+				continue;
+			}
 
-	rc = sqlite3_step(pStmt);
-	if (rc != SQLITE_DONE) {
-		MS_LOG_ERROR("mod device err: %s", sqlite3_errmsg(pSql));
-	}
+			auto dev = make_shared<MsGbDevice>(*it->second);
+			dev->m_status = status;
+			it->second = dev;
+			m_index.Update(dev);
+			++nChanged;
+		}
 
-	sqlite3_finalize(pStmt);
-	MsDbMgr::Instance()->RelSql();
+		if (nChanged) {
+			this->Publish(shard);
+		}
+	}
 }
 
 void MsDevMgr::OnDetectResult(const string &devId, const string &c, const string &r) {
@@ -795,15 +1096,7 @@ void MsDevMgr::OnDetectResult(const string &devId, const string &c, const string
 }
 
 void MsDevMgr::GetOneDev(json &rsp, const string &devId) {
-	shared_ptr<MsGbDevice> dev;
-
-	{
-		lock_guard<mutex> lk(m_mutex);
-		auto it = m_device.find(devId);
-		if (it != m_device.end()) {
-			dev = it->second;
-		}
-	}
+	shared_ptr<MsGbDevice> dev = this->FindDevice(devId);
 
 	if (dev.get()) {
 		json j;
@@ -819,118 +1112,38 @@ void MsDevMgr::GetOneDev(json &rsp, const string &devId) {
 	}
 }
 
-void MsDevMgr::GetCondiDevInternal(const FindDev &fdev, vector<shared_ptr<MsGbDevice>> &vecDev) {
-	const string &domainId = fdev.domainId;
-	const string &url = fdev.url;
-	const string &bindIP = fdev.bindIP;
-	const string &name = fdev.name;
-	const string &devId = fdev.deviceId;
-	const int &type = fdev.type;
-
-	const int &ptzType = fdev.ptzType;
-	const int &protocol = fdev.protocol;
-
-	{
-		lock_guard<mutex> lk(m_mutex);
-
-		for (auto &&dd : m_device) {
-			shared_ptr<MsGbDevice> &dev = dd.second;
-
-			if (type) {
-				if (dev->m_type != type) {
-					continue;
-				}
-			}
-
-			if (domainId.size()) {
-				if (dev->m_domainID != domainId) {
-					continue;
-				}
-			}
-
-			if (devId.size()) {
-				if (string::npos == dev->m_deviceID.find(devId)) {
-					continue;
-				}
-			}
-
-			if (bindIP.size()) {
-				if (dev->m_bindIP != bindIP) {
-					continue;
-				}
-			}
-
-			if (name.size()) {
-				if (string::npos == dev->m_name.find(name)) {
-					continue;
-				}
-			}
-
-			if (url.size()) {
-				if (string::npos == dev->m_url.find(url)) {
-					continue;
-				}
-			}
-
-			if (ptzType) {
-				if (dev->m_ptzType != ptzType) {
-					continue;
-				}
-			}
-
-			if (protocol) {
-				if (dev->m_protocol != protocol) {
-					continue;
-				}
-			}
-
-			vecDev.push_back(dev);
-		}
-	}
-}
-
 void MsDevMgr::GetCondiDev(json &jRsp, const FindDev &fdev) {
 	vector<shared_ptr<MsGbDevice>> vecDev;
-	this->GetCondiDevInternal(fdev, vecDev);
 	const int &page = fdev.page;
 	const int &size = fdev.size;
+	int total = 0;
+
+	if (page > 0 && size > 0) {
+		total = m_index.Query(fdev, (page - 1) * size, size, vecDev);
+	} else {
+		total = m_index.Query(fdev, 0, 0, vecDev);
+	}
 
 	jRsp["code"] = 0;
 	jRsp["msg"] = "success";
-	jRsp["totalSize"] = vecDev.size();
+	jRsp["totalSize"] = total;
 
-	if (page > 0 && size > 0) {
-		int off = (page - 1) * size;
-		int mm = page * size;
-		int nn = 0;
-
-		for (auto &dd : vecDev) {
-			++nn;
-
-			if (nn > off && nn <= mm) {
-				json j;
-				AssignDev(dd, j);
-				jRsp["result"].emplace_back(j);
-			} else if (nn > mm) {
-				break;
-			}
-		}
-	} else {
-		for (auto &dd : vecDev) {
-			json j;
-			AssignDev(dd, j);
-			jRsp["result"].emplace_back(j);
-		}
+	for (auto &dd : vecDev) {
+		json j;
+		AssignDev(dd, j);
+		jRsp["result"].emplace_back(j);
 	}
 }
 
 void MsDevMgr::GetDomainDevice(const string &did, map<string, shared_ptr<MsGbDevice>> &devMap) {
-	lock_guard<mutex> lk(m_mutex);
-	for (auto &&dd : m_device) {
-		shared_ptr<MsGbDevice> &dev = dd.second;
-		if (dev->m_domainID == did) {
-			devMap.emplace(dev->m_deviceID, dev);
-		}
+	vector<shared_ptr<MsGbDevice>> vecDev;
+	FindDev fdev;
+	fdev.type = 0;
+	fdev.domainId = did;
+
+	m_index.Query(fdev, 0, 0, vecDev);
+	for (auto &dev : vecDev) {
+		devMap.emplace(dev->m_deviceID, dev);
 	}
 }
 
@@ -3,8 +3,12 @@
 
 #include "nlohmann/json.hpp"
 #include <string>
-#include <set>
+#include <map>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 using json = nlohmann::json;
@@ -104,18 +108,67 @@ public:
 	int protocol;
 };
 
+#define DEV_SHARD_NUM 16
+
+// secondary indexes over the device registry. each device owns a slot, posting lists hold
+// slots in ascending order. deleted or re-indexed slots are left dead and dropped on compaction
+class MsDevIndex {
+public:
+	void Add(const shared_ptr<MsGbDevice> &dev);
+	void Update(const shared_ptr<MsGbDevice> &dev);
+	void Del(const string &devId);
+	int Query(const FindDev &fdev, int off, int cnt, vector<shared_ptr<MsGbDevice>> &vecDev);
+
+private:
+	class IdxEntry {
+	public:
+		shared_ptr<MsGbDevice> m_dev;
+		int m_type;
+		int m_ptzType;
+		int m_protocol;
+		string m_deviceID;
+		string m_domainID;
+		string m_name;
+		string m_bindIP;
+		string m_url;
+	};
+
+	typedef vector<uint32_t> Posting;
+
+	void AddInternal(const shared_ptr<MsGbDevice> &dev);
+	void DelInternal(const string &devId);
+	void Compact();
+	bool Match(const IdxEntry &e, const FindDev &fdev);
+	void AddGram(unordered_map<uint32_t, Posting> &idx, const string &s, uint32_t slot);
+	const Posting *GetGram(unordered_map<uint32_t, Posting> &idx, const string &s);
+
+	shared_mutex m_mutex;
+	vector<IdxEntry> m_entry;
+	unordered_map<string, uint32_t> m_slot;
+	unordered_map<string, Posting> m_domain;
+	unordered_map<string, Posting> m_bindIP;
+	unordered_map<int, Posting> m_type;
+	unordered_map<int, Posting> m_ptzType;
+	unordered_map<int, Posting> m_protocol;
+	unordered_map<uint32_t, Posting> m_nameGram;
+	unordered_map<uint32_t, Posting> m_idGram;
+	size_t m_dead = 0;
+};
+
 class MsDevMgr {
 public:
 	MsDevMgr() = default;
 
 	void LoadDevice();
 	void AddOrUpdateDevice(shared_ptr<MsGbDevice> dev);
+	void AddOrUpdateDevice(vector<shared_ptr<MsGbDevice>> &devs, int &nAdd, int &nMod);
 	void DelDeviceInMem(set<string> &delDev);
 	void DeleteDevice(set<string> &delDev);
 	void AddGroupDev(const string &devId, vector<string> &addDev);
 	void DelGroupDev(const string &devId, vector<string> &delDev);
 	void GetAllDevice(json &rsp, int page, int size);
 	void ModifyDevice(const string &devId, const ModDev &mm);
+	void SetDeviceStatus(const vector<string> &devIds, const string &status);
 	void OnDetectResult(const string &devId, const string &c, const string &r);
 	void GetOneDev(json &rsp, const string &devId);
 	void GetCondiDev(json &rsp, const FindDev &fdev);
@@ -136,9 +189,24 @@ public:
 	void DelMapIP(const string &fromIP);
 
 private:
-	void GetCondiDevInternal(const FindDev &fdev, vector<shared_ptr<MsGbDevice>> &vecDev);
+	typedef map<string, shared_ptr<MsGbDevice>> DevMap;
+
+	// writers change m_device under m_mutex and then publish a new immutable snapshot,
+	// readers only load the snapshot and never wait for writers. a device once in m_device
+	// is never written again, a change replaces it with a modified copy
+	class DevShard {
+	public:
+		mutex m_mutex;
+		DevMap m_device;
+		shared_ptr<const DevMap> m_snap;
+	};
+
+	DevShard &GetShard(const string &devId);
+	void Publish(DevShard &shard);
 	void WriteMapIP();
-	map<string, shared_ptr<MsGbDevice>> m_device;
+
+	DevShard m_shard[DEV_SHARD_NUM];
+	MsDevIndex m_index;
 	map<string, string> m_netMap;
 
 	static unique_ptr<MsDevMgr> m_instance;
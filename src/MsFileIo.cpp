@@ -0,0 +1,218 @@
+#include "MsFileIo.h"
+#include "MsConfig.h"
+#include "MsLog.h"
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IO_ALIGN 4096
+#define IO_DEF_BUF_BYTES (512 * 1024)
+#define IO_DEF_WINDOW (2 * 1024 * 1024)
+#define IO_MIN_WINDOW (1024 * 1024)
+#define IO_MAX_WINDOW (32 * 1024 * 1024)
+#define IO_DEF_READAHEAD_SEC 4
+
+static atomic<int64_t> g_files{0};
+static atomic<int64_t> g_reads{0};
+static atomic<int64_t> g_bytes{0};
+static atomic<int64_t> g_latencyUs{0};
+static atomic<int64_t> g_maxLatencyUs{0};
+
+static void CountRead(int64_t n, int64_t us) {
+	++g_reads;
+	g_bytes += n;
+	g_latencyUs += us;
+
+	int64_t max = g_maxLatencyUs.load();
+	while (us > max && !g_maxLatencyUs.compare_exchange_weak(max, us)) {
+	}
+}
+
+MsFileIo::~MsFileIo() {
+	if (m_pb) {
+		av_freep(&m_pb->buffer);
+		avio_context_free(&m_pb);
+	}
+
+	if (m_fd >= 0) {
+		close(m_fd);
+		--g_files;
+	}
+
+	if (m_reads) {
+		MS_LOG_DEBUG("file io %s reads:%lld bytes/read:%lld latency:%lldus", m_path.c_str(),
+		             (long long)m_reads, (long long)(m_bytes / m_reads),
+		             (long long)(m_latencyUs / m_reads));
+	}
+}
+
+MsFileIo *MsFileIo::Open(const string &path, int64_t skipFrom, int64_t skipTo) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		MS_LOG_ERROR("open %s err:%d", path.c_str(), errno);
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return nullptr;
+	}
+
+	int bufSize = MsConfig::Instance()->GetConfigInt("vodIoBufBytes");
+	if (bufSize <= 0) {
+		bufSize = IO_DEF_BUF_BYTES;
+	}
+	bufSize = (bufSize + IO_ALIGN - 1) & ~(IO_ALIGN - 1);
+
+	uint8_t *buf = (uint8_t *)av_malloc(bufSize);
+	if (!buf) {
+		close(fd);
+		return nullptr;
+	}
+
+	MsFileIo *io = new MsFileIo();
+	io->m_path = path;
+	io->m_fd = fd;
+	io->m_size = st.st_size;
+	if (skipTo > skipFrom && skipTo <= st.st_size) {
+		io->m_skipFrom = skipFrom;
+		io->m_skipLen = skipTo - skipFrom;
+		io->m_size -= io->m_skipLen;
+	}
+	io->m_window = IO_DEF_WINDOW;
+	++g_files;
+
+	io->m_pb = avio_alloc_context(
+	    buf, bufSize, 0, io,
+	    [](void *opaque, uint8_t *buf, int size) -> int {
+		    return static_cast<MsFileIo *>(opaque)->Read(buf, size);
+	    },
+	    nullptr,
+	    [](void *opaque, int64_t offset, int whence) -> int64_t {
+		    return static_cast<MsFileIo *>(opaque)->Seek(offset, whence);
+	    });
+	if (!io->m_pb) {
+		av_free(buf);
+		delete io;
+		return nullptr;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return io;
+}
+
+void MsFileIo::SetBitRate(int64_t bitRate) {
+	int sec = MsConfig::Instance()->GetConfigInt("vodReadaheadSec");
+	if (sec <= 0) {
+		sec = IO_DEF_READAHEAD_SEC;
+	}
+
+	int64_t window = bitRate > 0 ? bitRate / 8 * sec : IO_DEF_WINDOW;
+	window = window < IO_MIN_WINDOW ? IO_MIN_WINDOW : window;
+	window = window > IO_MAX_WINDOW ? IO_MAX_WINDOW : window;
+	m_window = (window + IO_ALIGN - 1) & ~(IO_ALIGN - 1);
+}
+
+// keep one window prefetched ahead of the reader
+void MsFileIo::Advise() {
+	if (m_adviseEnd < m_pos) {
+		m_adviseEnd = m_pos;
+	}
+
+	if (m_adviseEnd - m_pos < m_window / 2 && m_adviseEnd < m_size) {
+		posix_fadvise(m_fd, this->Phys(m_adviseEnd), m_window, POSIX_FADV_WILLNEED);
+		m_adviseEnd += m_window;
+	}
+}
+
+int MsFileIo::Read(uint8_t *buf, int size) {
+	// end the read on a page boundary, so after the first one every read is aligned
+	int64_t end = (m_pos + size) & ~(int64_t)(IO_ALIGN - 1);
+	if (end > m_pos) {
+		size = end - m_pos;
+	}
+
+	// a read never crosses the left out range
+	if (m_pos < m_skipFrom && m_pos + size > m_skipFrom) {
+		size = m_skipFrom - m_pos;
+	}
+
+	this->Advise();
+
+	auto t1 = chrono::steady_clock::now();
+	ssize_t n = pread(m_fd, buf, size, this->Phys(m_pos));
+	int64_t us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t1)
+	                 .count();
+
+	if (n < 0) {
+		int err = errno;
+		MS_LOG_ERROR("read %s at %lld err:%d", m_path.c_str(), (long long)m_pos, err);
+		return AVERROR(err);
+	} else if (n == 0) {
+		return AVERROR_EOF;
+	}
+
+	m_pos += n;
+	++m_reads;
+	m_bytes += n;
+	m_latencyUs += us;
+	CountRead(n, us);
+
+	return n;
+}
+
+int64_t MsFileIo::Seek(int64_t offset, int whence) {
+	if (whence & AVSEEK_SIZE) {
+		return m_size;
+	}
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		offset += m_pos;
+		break;
+	case SEEK_END:
+		offset += m_size;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (offset < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	// prefetch restarts from the new position
+	if (offset < m_pos || offset > m_adviseEnd) {
+		m_adviseEnd = offset;
+	}
+
+	m_pos = offset;
+	return m_pos;
+}
+
+ssize_t MsFileIo::Pread(int fd, void *buf, size_t size, int64_t pos) {
+	auto t1 = chrono::steady_clock::now();
+	ssize_t n = pread(fd, buf, size, pos);
+	int64_t us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t1)
+	                 .count();
+
+	if (n > 0) {
+		CountRead(n, us);
+	}
+
+	return n;
+}
+
+void MsFileIo::GetStats(SFileIoStats &stats) {
+	stats.m_files = g_files.load();
+	stats.m_reads = g_reads.load();
+	stats.m_bytes = g_bytes.load();
+	stats.m_latencyUs = g_latencyUs.load();
+	stats.m_maxLatencyUs = g_maxLatencyUs.load();
+}
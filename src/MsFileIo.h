@@ -0,0 +1,62 @@
+#ifndef MS_FILE_IO_H
+#define MS_FILE_IO_H
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+using namespace std;
+
+struct SFileIoStats {
+	int64_t m_files;
+	int64_t m_reads;
+	int64_t m_bytes;
+	int64_t m_latencyUs;
+	int64_t m_maxLatencyUs;
+};
+
+// AVIOContext over a local file for vod demuxing. reads are large pread calls ending
+// on page boundaries, the kernel is told the file is read sequentially and the next
+// window ahead of the reader is prefetched with POSIX_FADV_WILLNEED
+class MsFileIo {
+public:
+	~MsFileIo();
+
+	// nullptr if path can not be opened. bytes in [skipFrom, skipTo) are left out, so a
+	// fragmented mp4 can be read as its header followed directly by a later fragment
+	static MsFileIo *Open(const string &path, int64_t skipFrom = 0, int64_t skipTo = 0);
+	AVIOContext *GetPb() { return m_pb; }
+	// size the readahead window for the stream bit rate
+	void SetBitRate(int64_t bitRate);
+
+	// pread counted in the io stats
+	static ssize_t Pread(int fd, void *buf, size_t size, int64_t pos);
+	static void GetStats(SFileIoStats &stats);
+
+private:
+	MsFileIo() = default;
+
+	int Read(uint8_t *buf, int size);
+	int64_t Seek(int64_t offset, int whence);
+	void Advise();
+	int64_t Phys(int64_t pos) { return pos < m_skipFrom ? pos : pos + m_skipLen; }
+
+	string m_path;
+	int m_fd = -1;
+	int64_t m_size = 0;
+	int64_t m_pos = 0;
+	int64_t m_window = 0;
+	int64_t m_adviseEnd = 0;
+	int64_t m_skipFrom = INT64_MAX;
+	int64_t m_skipLen = 0;
+	AVIOContext *m_pb = nullptr;
+
+	int64_t m_reads = 0;
+	int64_t m_bytes = 0;
+	int64_t m_latencyUs = 0;
+};
+
+#endif // MS_FILE_IO_H
@@ -0,0 +1,310 @@
+#include "MsFileProbe.h"
+#include "MsCommon.h"
+#include "MsDbMgr.h"
+#include "MsFileIo.h"
+#include "MsLog.h"
+#include "nlohmann/json.hpp"
+#include <string.h>
+#include <sys/stat.h>
+
+using json = nlohmann::json;
+
+#define PROBE_VERSION 1
+#define PROBE_MAX_KEYS 100000
+
+static int FileStat(const string &path, int64_t &size, int64_t &mtime) {
+	struct stat st;
+	if (stat(path.c_str(), &st)) {
+		return -1;
+	}
+
+	size = st.st_size;
+	mtime = st.st_mtime;
+	return 0;
+}
+
+static int LoadProbe(const string &path, int64_t size, int64_t mtime, json &info) {
+	int ret = -1;
+	sqlite3_stmt *stmt;
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
+
+	int rc = sqlite3_prepare_v2(pSql, "SELECT size, mtime, info FROM t_file_probe WHERE path = ?",
+	                            -1, &stmt, NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_STATIC);
+
+		if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 0) == size &&
+		    sqlite3_column_int64(stmt, 1) == mtime) {
+			const uint8_t *p = (const uint8_t *)sqlite3_column_blob(stmt, 2);
+			int n = sqlite3_column_bytes(stmt, 2);
+
+			info = json::from_cbor(p, p + n, true, false);
+			if (!info.is_discarded() && info.value("ver", 0) == PROBE_VERSION) {
+				ret = 0;
+			}
+		}
+
+		sqlite3_finalize(stmt);
+	}
+
+	MsDbMgr::Instance()->RelReadSql();
+	return ret;
+}
+
+// -1 if the cache does not match what the demuxer found in the header, nothing touched.
+// -2 if the cache is broken after fields were already written
+static int ApplyProbe(AVFormatContext *ctx, json &info) {
+	try {
+		json &streams = info["streams"];
+		if (ctx->nb_streams != streams.size()) {
+			return -1;
+		}
+
+		for (unsigned int i = 0; i < ctx->nb_streams; ++i) {
+			if (ctx->streams[i]->codecpar->codec_type != streams[i]["type"].get<int>()) {
+				return -1;
+			}
+		}
+	} catch (json::exception &e) {
+		return -1;
+	}
+
+	try {
+		for (unsigned int i = 0; i < ctx->nb_streams; ++i) {
+			AVStream *st = ctx->streams[i];
+			AVCodecParameters *par = st->codecpar;
+			json &js = info["streams"][i];
+
+			par->codec_id = (AVCodecID)js["codecId"].get<int>();
+			par->codec_tag = js["codecTag"].get<uint32_t>();
+			par->format = js["format"].get<int>();
+			par->bit_rate = js["bitRate"].get<int64_t>();
+			par->profile = js["profile"].get<int>();
+			par->level = js["level"].get<int>();
+			par->width = js["width"].get<int>();
+			par->height = js["height"].get<int>();
+			par->sample_rate = js["sampleRate"].get<int>();
+			par->frame_size = js["frameSize"].get<int>();
+
+			int channels = js["channels"].get<int>();
+			if (channels && par->ch_layout.nb_channels != channels) {
+				av_channel_layout_uninit(&par->ch_layout);
+				av_channel_layout_default(&par->ch_layout, channels);
+			}
+
+			auto &extra = js["extradata"].get_binary();
+			if (extra.size()) {
+				av_freep(&par->extradata);
+				par->extradata = (uint8_t *)av_mallocz(extra.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+				memcpy(par->extradata, extra.data(), extra.size());
+				par->extradata_size = extra.size();
+			}
+
+			json &afr = js["avgFrameRate"];
+			json &rfr = js["rFrameRate"];
+			st->avg_frame_rate = {afr[0].get<int>(), afr[1].get<int>()};
+			st->r_frame_rate = {rfr[0].get<int>(), rfr[1].get<int>()};
+			if (st->start_time == AV_NOPTS_VALUE) {
+				st->start_time = js["startTime"].get<int64_t>();
+			}
+			if (st->duration == AV_NOPTS_VALUE) {
+				st->duration = js["duration"].get<int64_t>();
+			}
+
+			// demuxers like mov build the index from the header already
+			if (avformat_index_get_entries_count(st) == 0) {
+				for (auto &k : js["keys"]) {
+					av_add_index_entry(st, k[0].get<int64_t>(), k[1].get<int64_t>(),
+					                   k[2].get<int>(), 0, AVINDEX_KEYFRAME);
+				}
+			}
+		}
+
+		ctx->start_time = info["startTime"].get<int64_t>();
+		ctx->duration = info["duration"].get<int64_t>();
+		ctx->bit_rate = info["bitRate"].get<int64_t>();
+	} catch (json::exception &e) {
+		MS_LOG_WARN("probe cache broken:%s", e.what());
+		return -2;
+	}
+
+	return 0;
+}
+
+// demux path through MsFileIo instead of the ffmpeg file protocol
+static int OpenInput(const string &path, AVFormatContext **fmtCtx, const AVInputFormat *ifmt,
+                     AVDictionary **options, int64_t skipFrom = 0, int64_t skipTo = 0) {
+	MsFileIo *io = MsFileIo::Open(path, skipFrom, skipTo);
+	if (!io) {
+		return AVERROR(ENOENT);
+	}
+
+	*fmtCtx = avformat_alloc_context();
+	if (!*fmtCtx) {
+		delete io;
+		return AVERROR(ENOMEM);
+	}
+
+	(*fmtCtx)->pb = io->GetPb();
+	(*fmtCtx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	// the context is freed on failure, the custom pb is not
+	int ret = avformat_open_input(fmtCtx, path.c_str(), ifmt, options);
+	if (ret < 0) {
+		delete io;
+	}
+
+	return ret;
+}
+
+static void SetBitRate(AVFormatContext *fmtCtx) {
+	if (fmtCtx->flags & AVFMT_FLAG_CUSTOM_IO) {
+		static_cast<MsFileIo *>(fmtCtx->pb->opaque)->SetBitRate(fmtCtx->bit_rate);
+	}
+}
+
+int MsFileProbe::Open(const string &path, AVFormatContext **fmtCtx, AVDictionary **options) {
+	int64_t size, mtime;
+	json info;
+	const AVInputFormat *ifmt = nullptr;
+	bool hit = false;
+
+	if (!FileStat(path, size, mtime) && !LoadProbe(path, size, mtime, info)) {
+		hit = true;
+		ifmt = av_find_input_format(info.value("format", "").c_str());
+	}
+
+	int64_t t1 = GetCurMs();
+	int ret = OpenInput(path, fmtCtx, ifmt, options);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (hit) {
+		int r = ApplyProbe(*fmtCtx, info);
+		if (r == 0) {
+			MS_LOG_DEBUG("open %s by probe cache take:%lldms", path.c_str(),
+			             (long long)(GetCurMs() - t1));
+			SetBitRate(*fmtCtx);
+			return 0;
+		}
+
+		if (r == -2) {
+			MsFileProbe::Close(fmtCtx);
+			ret = OpenInput(path, fmtCtx, nullptr, options);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+	}
+
+	// ts and flv find their streams in the packets, not in a header, so a cached probe
+	// can never be matched against them and is not written
+	bool cacheable = (*fmtCtx)->nb_streams > 0 && !((*fmtCtx)->ctx_flags & AVFMTCTX_NOHEADER);
+
+	ret = avformat_find_stream_info(*fmtCtx, NULL);
+	if (ret < 0) {
+		MsFileProbe::Close(fmtCtx);
+		return ret;
+	}
+
+	MS_LOG_DEBUG("probe %s take:%lldms", path.c_str(), (long long)(GetCurMs() - t1));
+	SetBitRate(*fmtCtx);
+	if (cacheable) {
+		MsFileProbe::Save(path, *fmtCtx);
+	}
+	return 0;
+}
+
+int MsFileProbe::OpenFragment(const string &path, int64_t skipFrom, int64_t skipTo,
+                              AVFormatContext **fmtCtx) {
+	// the moov of a fragmented mp4 carries complete codec parameters, no probing needed
+	return OpenInput(path, fmtCtx, av_find_input_format("mp4"), nullptr, skipFrom, skipTo);
+}
+
+void MsFileProbe::Close(AVFormatContext **fmtCtx) {
+	if (!*fmtCtx) {
+		return;
+	}
+
+	MsFileIo *io = nullptr;
+	if ((*fmtCtx)->flags & AVFMT_FLAG_CUSTOM_IO) {
+		io = static_cast<MsFileIo *>((*fmtCtx)->pb->opaque);
+	}
+
+	avformat_close_input(fmtCtx);
+	delete io;
+}
+
+void MsFileProbe::Save(const string &path, AVFormatContext *fmtCtx) {
+	int64_t size, mtime;
+	if (FileStat(path, size, mtime) || !fmtCtx->iformat) {
+		return;
+	}
+
+	json info;
+	string format = fmtCtx->iformat->name;
+	size_t p = format.find(',');
+	if (p != string::npos) {
+		format.erase(p);
+	}
+
+	info["ver"] = PROBE_VERSION;
+	info["format"] = format;
+	info["startTime"] = fmtCtx->start_time;
+	info["duration"] = fmtCtx->duration;
+	info["bitRate"] = fmtCtx->bit_rate;
+	info["streams"] = json::array();
+
+	for (unsigned int i = 0; i < fmtCtx->nb_streams; ++i) {
+		AVStream *st = fmtCtx->streams[i];
+		AVCodecParameters *par = st->codecpar;
+		json js;
+
+		js["type"] = (int)par->codec_type;
+		js["codecId"] = (int)par->codec_id;
+		js["codecTag"] = par->codec_tag;
+		js["format"] = par->format;
+		js["bitRate"] = par->bit_rate;
+		js["profile"] = par->profile;
+		js["level"] = par->level;
+		js["width"] = par->width;
+		js["height"] = par->height;
+		js["sampleRate"] = par->sample_rate;
+		js["frameSize"] = par->frame_size;
+		js["channels"] = par->ch_layout.nb_channels;
+		js["extradata"] = json::binary(
+		    vector<uint8_t>(par->extradata, par->extradata + par->extradata_size));
+		js["timeBase"] = {st->time_base.num, st->time_base.den};
+		js["avgFrameRate"] = {st->avg_frame_rate.num, st->avg_frame_rate.den};
+		js["rFrameRate"] = {st->r_frame_rate.num, st->r_frame_rate.den};
+		js["startTime"] = st->start_time;
+		js["duration"] = st->duration;
+
+		json keys = json::array();
+		if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+			int n = avformat_index_get_entries_count(st);
+			for (int k = 0; k < n && keys.size() < PROBE_MAX_KEYS; ++k) {
+				const AVIndexEntry *e = avformat_index_get_entry(st, k);
+				if (e && (e->flags & AVINDEX_KEYFRAME)) {
+					keys.push_back({e->pos, e->timestamp, (int)e->size});
+				}
+			}
+		}
+		js["keys"] = std::move(keys);
+
+		info["streams"].push_back(std::move(js));
+	}
+
+	vector<uint8_t> blob = json::to_cbor(info);
+
+	MsDbCmd cmd("REPLACE INTO t_file_probe (path, size, mtime, info) VALUES (?, ?, ?, ?)");
+	cmd.Bind(path).Bind(size).Bind(mtime).BindBlob(string(blob.begin(), blob.end()));
+	MsDbMgr::Instance()->PostCmd(cmd);
+}
+
+void MsFileProbe::Remove(const string &path) {
+	MsDbCmd cmd("DELETE FROM t_file_probe WHERE path = ?");
+	cmd.Bind(path);
+	MsDbMgr::Instance()->PostCmd(cmd);
+}
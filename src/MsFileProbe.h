@@ -0,0 +1,28 @@
+#ifndef MS_FILE_PROBE_H
+#define MS_FILE_PROBE_H
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+// probe results of vod files kept in t_file_probe, keyed by path and checked
+// against size and mtime. a hit restores codec parameters and the keyframe
+// index instead of running avformat_find_stream_info
+class MsFileProbe {
+public:
+	// open and probe path, through the cache when it is still valid
+	static int Open(const string &path, AVFormatContext **fmtCtx, AVDictionary **options);
+	// open a fragmented mp4 unprobed, leaving out [skipFrom, skipTo) so reading
+	// continues right after the header at the fragment found at skipTo
+	static int OpenFragment(const string &path, int64_t skipFrom, int64_t skipTo,
+	                        AVFormatContext **fmtCtx);
+	// close a context from Open or OpenFragment, it owns a custom pb
+	static void Close(AVFormatContext **fmtCtx);
+	static void Save(const string &path, AVFormatContext *fmtCtx);
+	static void Remove(const string &path);
+};
+
+#endif // MS_FILE_PROBE_H
@@ -1,117 +1,364 @@
 #include "MsFileSource.h"
 #include "MsCommon.h"
+#include "MsFileProbe.h"
 #include "MsLog.h"
+#include "MsMsgDef.h"
+#include "MsReactor.h"
 #include <thread>
-#include <unistd.h>
 
 extern "C" {
 #include <libavformat/avformat.h>
 }
 
+// gap put between two segments of the output timeline
+#define VOD_SEG_GAP_US 40000
+// recheck interval while paused or waiting on the index
+#define VOD_POLL_MS 100
+
+MsFileSource::~MsFileSource() {
+	if (m_pkt) {
+		av_packet_free(&m_pkt);
+	}
+	if (m_fmtCtx) {
+		MsFileProbe::Close(&m_fmtCtx);
+	}
+}
+
 void MsFileSource::Work() {
-	std::thread worker([this]() { this->OnRun(); });
+	auto self = shared_from_this();
+	std::thread worker([self]() { self->OnRun(); });
 	worker.detach();
 }
 
-void MsFileSource::OnRun() {
+void MsFileSource::Seek(int64_t ms) {
+	{
+		std::lock_guard<std::mutex> lk(m_ctrlMutex);
+		m_seekMs = ms > 0 ? ms : 0;
+		++m_ctrlSeq;
+	}
+	m_ctrlCond.notify_all();
+}
+
+void MsFileSource::Pause(bool pause) {
+	{
+		std::lock_guard<std::mutex> lk(m_ctrlMutex);
+		m_paused = pause;
+		++m_ctrlSeq;
+	}
+	m_ctrlCond.notify_all();
+}
+
+int MsFileSource::SetRate(double rate) {
+	if (rate < 0.5 || rate > 16.0) {
+		return -1;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(m_ctrlMutex);
+		m_newRate = rate;
+		++m_ctrlSeq;
+	}
+	m_ctrlCond.notify_all();
+	return 0;
+}
+
+int MsFileSource::OpenPrivate() {
 	int ret;
-	AVFormatContext *fmt_ctx = NULL;
-	AVPacket *pkt = NULL;
 	AVDictionary *options = NULL;
 
 	av_dict_set(&options, "analyzeduration", "200000", 0);
-	ret = avformat_open_input(&fmt_ctx, m_filename.c_str(), NULL, &options);
+	ret = MsFileProbe::Open(m_filename, &m_fmtCtx, &options);
 	av_dict_free(&options);
 
 	if (ret < 0) {
 		MS_LOG_ERROR("Could not open input url:%s, err:%d", m_filename.c_str(), ret);
-		this->SourceActiveClose();
-		return;
-	}
-
-	ret = avformat_find_stream_info(fmt_ctx, NULL);
-	if (ret < 0) {
-		MS_LOG_ERROR("Could not find stream info url:%s, err:%d", m_filename.c_str(), ret);
-		avformat_close_input(&fmt_ctx);
-		this->SourceActiveClose();
-		return;
+		return -1;
 	}
 
-	ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	ret = av_find_best_stream(m_fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
 	if (ret < 0) {
 		MS_LOG_ERROR("Could not find video stream in url:%s, err:%d", m_filename.c_str(), ret);
-		avformat_close_input(&fmt_ctx);
-		this->SourceActiveClose();
-		return;
+		return -1;
 	}
 
 	m_videoIdx = ret;
-	m_video = fmt_ctx->streams[m_videoIdx];
+	m_video = m_fmtCtx->streams[m_videoIdx];
 	if (m_video->codecpar->codec_id != AV_CODEC_ID_H264 &&
 	    m_video->codecpar->codec_id != AV_CODEC_ID_H265) {
 		MS_LOG_ERROR("not support codec:%d url:%s", m_video->codecpar->codec_id,
 		             m_filename.c_str());
-		avformat_close_input(&fmt_ctx);
-		this->SourceActiveClose();
-		return;
+		return -1;
 	}
 
-	ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+	ret = av_find_best_stream(m_fmtCtx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
 	if (ret >= 0) {
-		if (fmt_ctx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_AAC ||
-		    fmt_ctx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_OPUS) {
+		if (m_fmtCtx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_AAC ||
+		    m_fmtCtx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_OPUS) {
 			m_audioIdx = ret;
-			m_audio = fmt_ctx->streams[m_audioIdx];
+			m_audio = m_fmtCtx->streams[m_audioIdx];
 		}
 	}
 
+	return 0;
+}
+
+int MsFileSource::Open() {
+	m_file = MsVodFile::Get(m_filename);
+	if (!m_file) {
+		return this->OpenPrivate();
+	}
+
+	m_video = m_file->m_video;
+	m_videoIdx = m_file->m_videoIdx;
+	m_audio = m_file->m_audio;
+	m_audioIdx = m_file->m_audioIdx;
+	return 0;
+}
+
+void MsFileSource::OnRun() {
+	if (this->Open()) {
+		this->Finish();
+		return;
+	}
+
 	this->NotifyStreamInfo();
+	m_pkt = av_packet_alloc();
+
+	// only the shared index can be read without blocking a pacer
+	shared_ptr<MsReactor> pacer =
+	    m_file ? MsReactorMgr::Instance()->PickReactor(MS_VOD_PACER) : nullptr;
+	if (pacer) {
+		MsMsg msg;
+		msg.m_msgID = MS_VOD_PACE;
+		msg.m_any = shared_from_this();
+		pacer->EnqueDelayMsg(msg, 0);
+		return;
+	}
+
+	while (true) {
+		int seq;
+		{
+			std::lock_guard<std::mutex> lk(m_ctrlMutex);
+			seq = m_ctrlSeq;
+		}
+
+		int64_t delay = this->Pump(true);
+		if (delay < 0) {
+			break;
+		}
+
+		if (delay > 0) {
+			std::unique_lock<std::mutex> lk(m_ctrlMutex);
+			m_ctrlCond.wait_for(lk, std::chrono::milliseconds(delay), [this, seq]() {
+				return m_isClosing.load() || m_ctrlSeq != seq;
+			});
+		}
+	}
+
+	this->Finish();
+}
+
+void MsFileSource::Finish() {
+	if (m_pkt) {
+		av_packet_free(&m_pkt);
+	}
+	if (m_fmtCtx) {
+		MsFileProbe::Close(&m_fmtCtx);
+	}
+	this->SourceActiveClose();
+}
 
-	pkt = av_packet_alloc();
+int64_t MsFileSource::Pump(bool block) {
+	while (true) {
+		int ret = this->CheckCtrl(block);
+		if (ret < 0) {
+			return -1;
+		} else if (ret > 0) {
+			return VOD_POLL_MS;
+		}
 
-	/* read frames from the file */
-	while (av_read_frame(fmt_ctx, pkt) >= 0 && !m_isClosing.load()) {
-		if (pkt->stream_index == m_videoIdx) {
-			int64_t pts = pkt->pts;
-			if (pts == AV_NOPTS_VALUE) {
-				pts = pkt->dts;
+		if (!m_pending) {
+			ret = this->ReadPacket(m_pkt, block);
+			if (ret == AVERROR(EAGAIN)) {
+				return VOD_POLL_MS;
+			} else if (ret < 0) {
+				return -1;
 			}
-			if (pts == AV_NOPTS_VALUE) {
-				MS_LOG_ERROR("pts dts both AV_NOPTS_VALUE, url:%s", m_filename.c_str());
-				av_packet_unref(pkt);
+
+			if (this->RetimePacket(m_pkt)) {
+				av_packet_unref(m_pkt);
 				continue;
 			}
 
-			pts = av_rescale_q(pts, m_video->time_base, {1, 1000});
-			int64_t now = GetCurMs();
-
-			if (m_lastPts == INT64_MAX) {
-				m_lastPts = pts;
-				m_lastMs = now;
-			} else {
-				int d = pts - m_lastPts;
-				int64_t expect = m_lastMs + d;
-
-				if (expect > now) {
-					if (expect > now + 1000L) {
-						MS_LOG_WARN("expect diff over 1000ms, time rebase");
-						m_lastPts = INT64_MAX;
-					} else {
-						usleep((expect - now) * 1000);
-						m_lastPts = pts;
-						m_lastMs = expect;
-					}
-				}
-			}
+			m_pending = true;
+			m_dueValid = false;
+		}
+
+		if (!m_dueValid) {
+			bool key = m_pkt->stream_index == m_videoIdx && (m_pkt->flags & AV_PKT_FLAG_KEY);
+			m_due = m_pacer.Due(m_pktOutUs, key);
+			m_dueValid = true;
+		}
 
-			this->NotifyStreamPacket(pkt);
-		} else if (m_audioIdx >= 0 && pkt->stream_index == m_audioIdx) {
-			this->NotifyStreamPacket(pkt);
+		int64_t delay = m_due - GetCurMs();
+		if (delay > 0) {
+			return delay;
 		}
-		av_packet_unref(pkt);
+
+		this->NotifyStreamPacket(m_pkt);
+		av_packet_unref(m_pkt);
+		m_pending = false;
 	}
+}
 
-	avformat_close_input(&fmt_ctx);
-	av_packet_free(&pkt);
-	this->SourceActiveClose();
+int MsFileSource::ReadPacket(AVPacket *pkt, bool block) {
+	if (m_file) {
+		int ret = block ? m_file->Wait(m_cursor) : m_file->Peek(m_cursor);
+		if (ret > 0) {
+			return AVERROR(EAGAIN);
+		} else if (ret < 0) {
+			return AVERROR_EOF;
+		}
+		return m_file->ReadPacket(m_cursor++, pkt);
+	}
+
+	return av_read_frame(m_fmtCtx, pkt);
+}
+
+// apply pending seek, rate and pause requests. -1 once closing, 1 while paused
+int MsFileSource::CheckCtrl(bool block) {
+	if (m_isClosing.load()) {
+		return -1;
+	}
+
+	std::unique_lock<std::mutex> lk(m_ctrlMutex);
+
+	if (m_seekMs >= 0) {
+		// a seek past the index would block the pacer, retry once it got there
+		if (!block && m_file && !m_file->Indexed(m_seekMs)) {
+			return 1;
+		}
+
+		int64_t ms = m_seekMs;
+		m_seekMs = -1;
+		lk.unlock();
+		this->DoSeek(ms);
+		lk.lock();
+	}
+
+	if (m_newRate != m_rate) {
+		MS_LOG_INFO("vod %s rate %.2f -> %.2f", m_streamID.c_str(), m_rate, m_newRate);
+		m_rate = m_newRate;
+		m_newSeg = true;
+	}
+
+	if (m_paused) {
+		m_pausing = true;
+		return 1;
+	}
+
+	if (m_pausing) {
+		m_pausing = false;
+		m_pacer.Reset();
+		m_dueValid = false;
+	}
+
+	return 0;
+}
+
+void MsFileSource::SeekInput(int64_t ms) {
+	if (m_file) {
+		m_cursor = m_file->Seek(ms);
+		return;
+	}
+
+	int64_t ts = ms * 1000;
+	if (m_fmtCtx->start_time != AV_NOPTS_VALUE) {
+		ts += m_fmtCtx->start_time;
+	}
+
+	int ret = av_seek_frame(m_fmtCtx, -1, ts, AVSEEK_FLAG_BACKWARD);
+	if (ret < 0) {
+		MS_LOG_WARN("vod %s seek %lldms err:%d", m_streamID.c_str(), (long long)ms, ret);
+	}
+}
+
+void MsFileSource::DoSeek(int64_t ms) {
+	this->SeekInput(ms);
+
+	if (m_pending) {
+		av_packet_unref(m_pkt);
+		m_pending = false;
+	}
+
+	MS_LOG_INFO("vod %s seek to %lldms", m_streamID.c_str(), (long long)ms);
+	m_seekWaitKey = true;
+	m_newSeg = true;
+}
+
+// map pkt onto the output timeline, -1 if it is dropped
+int MsFileSource::RetimePacket(AVPacket *pkt) {
+	bool isVideo = pkt->stream_index == m_videoIdx;
+	if (!isVideo && (m_audioIdx < 0 || pkt->stream_index != m_audioIdx)) {
+		return -1;
+	}
+
+	AVStream *st = isVideo ? m_video : m_audio;
+	bool isKey = pkt->flags & AV_PKT_FLAG_KEY;
+	int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+	if (dts == AV_NOPTS_VALUE) {
+		MS_LOG_ERROR("pts dts both AV_NOPTS_VALUE, url:%s", m_filename.c_str());
+		return -1;
+	}
+
+	if (m_seekWaitKey) {
+		if (!isVideo || !isKey) {
+			return -1;
+		}
+		m_seekWaitKey = false;
+	}
+
+	// audio can not follow a changed rate, above 4x only key frames are sent
+	if (!isVideo && m_rate != 1.0) {
+		return -1;
+	}
+	if (isVideo && m_rate > 4.0 && !isKey) {
+		return -1;
+	}
+
+	int64_t inUs = av_rescale_q(dts, st->time_base, AV_TIME_BASE_Q);
+
+	if (m_newSeg) {
+		// segments start on video so audio never jumps ahead of it
+		if (!isVideo) {
+			return -1;
+		}
+
+		m_newSeg = false;
+		m_segInUs = inUs;
+		m_segOutUs = m_lastOutUs == INT64_MIN ? inUs : m_lastOutUs + VOD_SEG_GAP_US;
+		m_pacer.Reset();
+	} else if (inUs < m_segInUs && !isVideo) {
+		return -1;
+	}
+
+	auto mapTs = [this, st](int64_t ts) -> int64_t {
+		if (ts == AV_NOPTS_VALUE) {
+			return ts;
+		}
+		int64_t us = av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+		us = m_segOutUs + (int64_t)((us - m_segInUs) / m_rate);
+		return av_rescale_q(us, AV_TIME_BASE_Q, st->time_base);
+	};
+
+	pkt->pts = mapTs(pkt->pts);
+	pkt->dts = mapTs(pkt->dts);
+	pkt->pos = -1;
+
+	m_pktOutUs = m_segOutUs + (int64_t)((inUs - m_segInUs) / m_rate);
+	if (m_pktOutUs > m_lastOutUs) {
+		m_lastOutUs = m_pktOutUs;
+	}
+
+	return 0;
 }
@@ -1,24 +1,76 @@
 #ifndef MS_FILE_SOURCE_H
 #define MS_FILE_SOURCE_H
 #include "MsMediaSource.h"
+#include "MsPacer.h"
+#include "MsVodFile.h"
+#include <condition_variable>
 
+// one viewer's cursor over a vod file. packets come from the shared MsVodFile
+// index, or from a demuxer of its own when the file can not be shared
 class MsFileSource : public MsMediaSource, public std::enable_shared_from_this<MsFileSource> {
 public:
-	MsFileSource(const std::string &streamID, const std::string &filename)
-	    : MsMediaSource(streamID), m_filename(filename) {}
+	MsFileSource(const std::string &streamID, const std::string &filename, int64_t startMs = 0)
+	    : MsMediaSource(streamID), m_filename(filename), m_seekMs(startMs > 0 ? startMs : -1) {}
+	~MsFileSource();
 
 	void Work() override;
 	shared_ptr<MsMediaSource> GetSharedPtr() override {
 		return dynamic_pointer_cast<MsMediaSource>(shared_from_this());
 	}
 
+	void Seek(int64_t ms);
+	void Pause(bool pause);
+	int SetRate(double rate);
+
+	// send every packet that is due, ms until the next one or -1 once done.
+	// without block it never waits for the index, so it can run on a shared pacer
+	int64_t Pump(bool block);
+	void Finish();
+
+protected:
+	// input hooks, the base reads one file through the shared index or its own demuxer.
+	// ReadPacket maps packets onto m_video and m_audio, SeekInput takes ms from the start
+	virtual int Open();
+	virtual int ReadPacket(AVPacket *pkt, bool block);
+	virtual void SeekInput(int64_t ms);
+
+	std::string m_filename;
+	AVFormatContext *m_fmtCtx = nullptr;
+	bool m_seekWaitKey = false;
+	bool m_newSeg = true;
+
 private:
 	void OnRun();
+	int OpenPrivate();
+	int CheckCtrl(bool block);
+	void DoSeek(int64_t ms);
+	int RetimePacket(AVPacket *pkt);
 
 private:
-	int64_t m_lastPts = INT64_MAX;
-	int64_t m_lastMs = 0;
-	std::string m_filename;
+	shared_ptr<MsVodFile> m_file;
+	size_t m_cursor = 0;
+
+	std::mutex m_ctrlMutex;
+	std::condition_variable m_ctrlCond;
+	int m_ctrlSeq = 0;
+	int64_t m_seekMs;
+	bool m_paused = false;
+	double m_newRate = 1.0;
+	bool m_pausing = false;
+
+	// output timeline, continuous across seek and rate changes
+	double m_rate = 1.0;
+	int64_t m_segInUs = 0;
+	int64_t m_segOutUs = 0;
+	int64_t m_lastOutUs = INT64_MIN;
+
+	// next packet to send, held until its due time
+	MsPacer m_pacer;
+	AVPacket *m_pkt = nullptr;
+	bool m_pending = false;
+	bool m_dueValid = false;
+	int64_t m_pktOutUs = 0;
+	int64_t m_due = 0;
 };
 
 #endif // MS_FILE_SOURCE_H
@@ -0,0 +1,275 @@
+#include "MsFlvParser.h"
+#include "MsCommon.h"
+#include <string.h>
+
+// a larger tag is taken for a broken stream
+#define FLV_MAX_TAG_SIZE (16 * 1024 * 1024)
+
+enum {
+	FLV_TAG_AUDIO = 8,
+	FLV_TAG_VIDEO = 9,
+};
+
+static const int g_aacRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                 22050, 16000, 12000, 11025, 8000,  7350};
+
+// composition time, signed 24 bits
+static int32_t Cts(const uint8_t *p) {
+	int32_t v = AV_RB24(p);
+	return (v & 0x800000) ? v - 0x1000000 : v;
+}
+
+MsFlvParser::MsFlvParser(const FrameCb &cb) : m_cb(cb), m_pkt(av_packet_alloc()) {}
+
+MsFlvParser::~MsFlvParser() { av_packet_free(&m_pkt); }
+
+int MsFlvParser::Input(const uint8_t *buf, int len) {
+	m_buf.append((const char *)buf, len);
+
+	const uint8_t *p = (const uint8_t *)m_buf.data();
+	size_t left = m_buf.size();
+
+	if (!m_header) {
+		// FLV version flags offset32, then the first previous tag size
+		if (left < 9) {
+			return 0;
+		}
+		if (memcmp(p, "FLV", 3)) {
+			return -1;
+		}
+
+		size_t off = AV_RB32(p + 5) + 4;
+		if (off > 1024) {
+			return -1;
+		}
+		if (left < off) {
+			return 0;
+		}
+		p += off;
+		left -= off;
+		m_header = true;
+	}
+
+	// type size24 ts24 tsext streamid24, data, previous tag size
+	while (left >= 11) {
+		int size = AV_RB24(p + 1);
+		if (size > FLV_MAX_TAG_SIZE) {
+			return -1;
+		}
+		if (left < (size_t)11 + size + 4) {
+			break;
+		}
+
+		int64_t ts = AV_RB24(p + 4) | ((uint32_t)p[7] << 24);
+		this->ParseTag(p[0] & 0x1f, p + 11, size, ts);
+
+		p += 11 + size + 4;
+		left -= 11 + size + 4;
+	}
+
+	m_buf.erase(0, m_buf.size() - left);
+	return 0;
+}
+
+void MsFlvParser::ParseTag(int type, const uint8_t *p, int len, int64_t ts) {
+	if (type == FLV_TAG_VIDEO) {
+		this->ParseVideo(p, len, ts);
+	} else if (type == FLV_TAG_AUDIO) {
+		this->ParseAudio(p, len, ts);
+	}
+	// script data carries nothing the streams need
+}
+
+void MsFlvParser::ParseVideo(const uint8_t *p, int len, int64_t ts) {
+	if (len < 5) {
+		return;
+	}
+
+	int frameType = (p[0] >> 4) & 0x07;
+	int pktType;
+	bool hevc;
+	int32_t cts = 0;
+
+	if (p[0] & 0x80) {
+		// enhanced flv, packet type and fourcc instead of codec id
+		pktType = p[0] & 0x0f;
+		if (!memcmp(p + 1, "hvc1", 4)) {
+			hevc = true;
+		} else if (!memcmp(p + 1, "avc1", 4)) {
+			hevc = false;
+		} else {
+			return;
+		}
+		p += 5;
+		len -= 5;
+
+		// coded frames come with a composition time, coded frames x without
+		if (pktType == 1) {
+			if (len < 3) {
+				return;
+			}
+			cts = Cts(p);
+			p += 3;
+			len -= 3;
+		} else if (pktType == 3) {
+			pktType = 1;
+		}
+	} else {
+		int codec = p[0] & 0x0f;
+		if (codec != 7 && codec != 12) {
+			return;
+		}
+		hevc = codec == 12;
+		pktType = p[1];
+		cts = Cts(p + 2);
+		p += 5;
+		len -= 5;
+	}
+
+	// video info or command frame
+	if (frameType == 5) {
+		return;
+	}
+
+	if (pktType == 0) {
+		this->ParseVideoConfig(p, len, hevc);
+		return;
+	}
+
+	AVCodecID codec = hevc ? AV_CODEC_ID_H265 : AV_CODEC_ID_H264;
+	if (pktType != 1 || m_videoCodec != codec) {
+		return;
+	}
+
+	// length prefixed nalus into annex b
+	string frame;
+	while (len > m_nalLen) {
+		int n = 0;
+		for (int i = 0; i < m_nalLen; ++i) {
+			n = (n << 8) | p[i];
+		}
+		p += m_nalLen;
+		len -= m_nalLen;
+		if (n <= 0 || n > len) {
+			break;
+		}
+
+		frame.append("\x00\x00\x00\x01", 4);
+		frame.append((const char *)p, n);
+		p += n;
+		len -= n;
+	}
+
+	if (frame.size()) {
+		this->Emit(true, (const uint8_t *)frame.data(), frame.size(), ts, ts + cts,
+		           frameType == 1);
+	}
+}
+
+void MsFlvParser::ParseVideoConfig(const uint8_t *p, int len, bool hevc) {
+	string ps;
+	int pos;
+
+	auto append = [&](int count) {
+		for (int i = 0; i < count && pos + 2 <= len; ++i) {
+			int n = AV_RB16(p + pos);
+			pos += 2;
+			if (pos + n > len) {
+				return false;
+			}
+			ps.append("\x00\x00\x00\x01", 4);
+			ps.append((const char *)p + pos, n);
+			pos += n;
+		}
+		return true;
+	};
+
+	if (hevc) {
+		// HEVCDecoderConfigurationRecord, arrays of vps sps pps after 22 bytes
+		if (len < 23) {
+			return;
+		}
+		m_nalLen = (p[21] & 0x03) + 1;
+		int arrays = p[22];
+		pos = 23;
+		for (int i = 0; i < arrays && pos + 3 <= len; ++i) {
+			int count = AV_RB16(p + pos + 1);
+			pos += 3;
+			if (!append(count)) {
+				return;
+			}
+		}
+	} else {
+		// AVCDecoderConfigurationRecord, sps then pps
+		if (len < 7) {
+			return;
+		}
+		m_nalLen = (p[4] & 0x03) + 1;
+		pos = 6;
+		if (!append(p[5] & 0x1f) || pos >= len) {
+			return;
+		}
+		int count = p[pos++];
+		if (!append(count)) {
+			return;
+		}
+	}
+
+	m_videoCodec = hevc ? AV_CODEC_ID_H265 : AV_CODEC_ID_H264;
+	m_ps = ps;
+}
+
+void MsFlvParser::ParseAudio(const uint8_t *p, int len, int64_t ts) {
+	// only aac, the packet type follows the sound format byte
+	if (len < 3 || (p[0] >> 4) != 10) {
+		return;
+	}
+
+	if (p[1] == 1) {
+		if (m_audioCodec == AV_CODEC_ID_AAC) {
+			this->Emit(false, p + 2, len - 2, ts, ts, true);
+		}
+		return;
+	}
+
+	// AudioSpecificConfig, object type 5 bits, frequency index 4, channels 4
+	const uint8_t *c = p + 2;
+	int n = len - 2;
+	if (p[1] != 0 || n < 2) {
+		return;
+	}
+
+	int freqIdx = ((c[0] & 0x07) << 1) | (c[1] >> 7);
+	if (freqIdx == 15) {
+		if (n < 5) {
+			return;
+		}
+		m_sampleRate = ((c[1] & 0x7f) << 17) | (c[2] << 9) | (c[3] << 1) | (c[4] >> 7);
+		m_channels = (c[4] >> 3) & 0x0f;
+	} else if (freqIdx < 13) {
+		m_sampleRate = g_aacRates[freqIdx];
+		m_channels = (c[1] >> 3) & 0x0f;
+	} else {
+		return;
+	}
+
+	m_audioCodec = AV_CODEC_ID_AAC;
+	m_asc.assign((const char *)c, n);
+}
+
+void MsFlvParser::Emit(bool video, const uint8_t *p, int len, int64_t dts, int64_t pts,
+                       bool key) {
+	if (av_new_packet(m_pkt, len) < 0) {
+		return;
+	}
+
+	memcpy(m_pkt->data, p, len);
+	m_pkt->dts = dts;
+	m_pkt->pts = pts;
+	if (key) {
+		m_pkt->flags |= AV_PKT_FLAG_KEY;
+	}
+
+	m_cb(video, m_pkt);
+	av_packet_unref(m_pkt);
+}
@@ -0,0 +1,47 @@
+#ifndef MS_FLV_PARSER_H
+#define MS_FLV_PARSER_H
+#include <functional>
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+// flv body, as an http-flv server sends it, back into frames. h264 and h265 (codec id 12
+// or enhanced flv hvc1) come out as annex b access units with the parameter sets of the
+// sequence header in m_ps, aac as raw frames with m_asc. pts and dts are in ms
+class MsFlvParser {
+public:
+	using FrameCb = function<void(bool video, AVPacket *)>;
+
+	MsFlvParser(const FrameCb &cb);
+	~MsFlvParser();
+
+	// any piece of the stream from its first byte on, -1 when it is not flv
+	int Input(const uint8_t *buf, int len);
+
+public:
+	AVCodecID m_videoCodec = AV_CODEC_ID_NONE;
+	string m_ps;
+	AVCodecID m_audioCodec = AV_CODEC_ID_NONE;
+	string m_asc;
+	int m_sampleRate = 0;
+	int m_channels = 0;
+
+private:
+	void ParseTag(int type, const uint8_t *p, int len, int64_t ts);
+	void ParseVideo(const uint8_t *p, int len, int64_t ts);
+	void ParseAudio(const uint8_t *p, int len, int64_t ts);
+	void ParseVideoConfig(const uint8_t *p, int len, bool hevc);
+	void Emit(bool video, const uint8_t *p, int len, int64_t dts, int64_t pts, bool key);
+
+	FrameCb m_cb;
+	AVPacket *m_pkt;
+	string m_buf;
+	bool m_header = false;
+	int m_nalLen = 4;
+};
+
+#endif // MS_FLV_PARSER_H
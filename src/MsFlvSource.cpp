@@ -0,0 +1,259 @@
+#include "MsFlvSource.h"
+#include "MsCommon.h"
+#include "MsConfig.h"
+#include "MsHttpMsg.h"
+#include "MsLog.h"
+#include "MsParamSets.h"
+#include "MsSocket.h"
+#include <sys/socket.h>
+#include <thread>
+
+// an origin sending nothing for this long is dropped
+#define FLV_DEF_TIMEOUT_SEC 10
+// response headers larger than this are not taken
+#define FLV_MAX_HEADER 8192
+
+MsFlvSource::~MsFlvSource() {
+	if (m_fmtCtx) {
+		avformat_free_context(m_fmtCtx);
+	}
+}
+
+bool MsFlvSource::IsFlvUrl(const string &url) {
+	return url.find("http://") == 0 && url.find(".flv") != string::npos;
+}
+
+void MsFlvSource::Work() {
+	auto self = shared_from_this();
+	std::thread worker([self]() { self->OnRun(); });
+	worker.detach();
+}
+
+void MsFlvSource::OnRun() {
+	int maxTries = ReconnectTries();
+	int tries = 0;
+
+	while (!m_isClosing.load()) {
+		bool played = false;
+		if (this->RunInput(played) < 0 || m_isClosing.load() || !m_infoSent || this->IsIdle()) {
+			break;
+		}
+
+		if (played) {
+			tries = 0;
+		}
+		if (tries >= maxTries) {
+			MS_LOG_ERROR("flv source %s gave up after %d reconnects", m_streamID.c_str(), tries);
+			break;
+		}
+
+		int64_t until = GetCurMs() + ReconnectDelayMs(tries++);
+		MS_LOG_WARN("flv source %s input lost, reconnect %d in %lld ms", m_streamID.c_str(),
+		            tries, (long long)(until - GetCurMs()));
+		while (!m_isClosing.load() && GetCurMs() < until) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+
+	this->SourceActiveClose();
+}
+
+int MsFlvSource::RunInput(bool &played) {
+	// http://host[:port]/path
+	string rest = m_url.substr(7);
+	size_t slash = rest.find('/');
+	string host = rest.substr(0, slash);
+	string path = slash != string::npos ? rest.substr(slash) : "/";
+	string hostPort = host;
+	int port = 80;
+
+	size_t colon = host.find(':');
+	if (colon != string::npos) {
+		port = atoi(host.c_str() + colon + 1);
+		host = host.substr(0, colon);
+	}
+
+	MsSocket sock(AF_INET, SOCK_STREAM, 0);
+	if (sock.Connect(host, port) < 0) {
+		MS_LOG_ERROR("flv source %s connect %s failed", m_streamID.c_str(), hostPort.c_str());
+		return 0;
+	}
+
+	// a stalled origin fails the read instead of hanging it
+	int timeout = MsConfig::Instance()->GetConfigInt("flvTimeoutSec");
+	struct timeval tv = {timeout > 0 ? timeout : FLV_DEF_TIMEOUT_SEC, 0};
+	setsockopt(sock.GetFd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock.GetFd(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	string req = "GET " + path + " HTTP/1.1\r\nHost: " + hostPort +
+	             "\r\nAccept: */*\r\nConnection: close\r\n\r\n";
+	if (sock.BlockSend(req.c_str(), req.size()) < 0) {
+		MS_LOG_ERROR("flv source %s send request failed", m_streamID.c_str());
+		return 0;
+	}
+
+	unique_ptr<char[]> buf = make_unique<char[]>(DEF_BUF_SIZE);
+	string data;
+	int hdrLen = -1;
+	int scanOff = 0;
+
+	while (hdrLen < 0) {
+		int n = sock.Recv(buf.get(), DEF_BUF_SIZE);
+		if (n <= 0 || m_isClosing.load()) {
+			MS_LOG_ERROR("flv source %s no response from %s", m_streamID.c_str(),
+			              hostPort.c_str());
+			return 0;
+		}
+		data.append(buf.get(), n);
+		hdrLen = FindHeaderEnd(data.c_str(), data.size(), scanOff);
+		if (hdrLen < 0 && data.size() > FLV_MAX_HEADER) {
+			MS_LOG_ERROR("flv source %s response header too big", m_streamID.c_str());
+			return -1;
+		}
+	}
+
+	MsHttpMsg rsp;
+	string hdr = data.substr(0, hdrLen);
+	char *p = &hdr[0];
+	rsp.Parse(p);
+	data.erase(0, hdrLen);
+
+	if (rsp.m_status != "200") {
+		MS_LOG_ERROR("flv source %s url:%s status:%s", m_streamID.c_str(), m_url.c_str(),
+		             rsp.m_status.c_str());
+		return 0;
+	}
+
+	bool chunked = rsp.m_transport.m_value.find("chunked") != string::npos;
+	int ret = 0;
+	MsFlvParser parser([&](bool video, AVPacket *pkt) {
+		if (ret == 0 && (ret = this->OnFrame(parser, video, pkt)) == 0 && m_infoSent) {
+			played = true;
+		}
+	});
+
+	if (m_infoSent) {
+		// sinks were set up for the first input, it has to come back the same
+		m_checkCodec = true;
+		MS_LOG_INFO("flv source %s reconnected", m_streamID.c_str());
+		this->NotifyDiscontinuity();
+	}
+
+	// chunked body: hex size line, data, crlf, up to a zero size chunk
+	int64_t chunkLeft = 0;
+	while (ret == 0 && !m_isClosing.load()) {
+		if (!chunked) {
+			if (data.size() && parser.Input((const uint8_t *)data.data(), data.size()) < 0) {
+				ret = -1;
+				break;
+			}
+			data.clear();
+		}
+
+		while (chunked && ret == 0) {
+			if (chunkLeft > 0) {
+				if (data.empty()) {
+					break;
+				}
+				int n = (int)min<int64_t>(chunkLeft, data.size());
+				if (parser.Input((const uint8_t *)data.data(), n) < 0) {
+					ret = -1;
+				}
+				data.erase(0, n);
+				chunkLeft -= n;
+				continue;
+			}
+
+			size_t e = data.find("\r\n");
+			if (e == string::npos) {
+				break;
+			} else if (e == 0) {
+				data.erase(0, 2);
+				continue;
+			}
+
+			chunkLeft = strtoll(data.c_str(), NULL, 16);
+			data.erase(0, e + 2);
+			if (chunkLeft <= 0) {
+				MS_LOG_INFO("flv source %s origin ended the stream", m_streamID.c_str());
+				return 0;
+			}
+		}
+
+		if (ret < 0) {
+			break;
+		}
+
+		int n = sock.Recv(buf.get(), DEF_BUF_SIZE);
+		if (n <= 0) {
+			break;
+		}
+		data.append(buf.get(), n);
+	}
+
+	if (ret < 0) {
+		MS_LOG_ERROR("flv source %s bad input from url:%s", m_streamID.c_str(), m_url.c_str());
+	}
+
+	return ret;
+}
+
+int MsFlvSource::OnFrame(MsFlvParser &parser, bool video, AVPacket *pkt) {
+	if (m_checkCodec) {
+		if (!video) {
+			return 0;
+		}
+		if (parser.m_videoCodec != m_video->codecpar->codec_id ||
+		    (m_audio && parser.m_audioCodec != AV_CODEC_ID_NONE &&
+		     parser.m_audioCodec != m_audio->codecpar->codec_id)) {
+			MS_LOG_ERROR("flv source %s codec changed on reconnect", m_streamID.c_str());
+			return -1;
+		}
+		m_checkCodec = false;
+	}
+
+	if (!m_infoSent) {
+		// the sequence headers all come before the first frame, the streams start at it
+		if (!video || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+			return 0;
+		}
+
+		m_fmtCtx = avformat_alloc_context();
+		AVStream *st = avformat_new_stream(m_fmtCtx, NULL);
+		st->time_base = {1, 1000};
+		st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+		st->codecpar->codec_id = parser.m_videoCodec;
+		MsParamSets::Apply(st->codecpar, parser.m_ps);
+		m_video = st;
+		m_videoIdx = st->index;
+
+		if (parser.m_audioCodec == AV_CODEC_ID_AAC) {
+			AVCodecParameters *par;
+			st = avformat_new_stream(m_fmtCtx, NULL);
+			par = st->codecpar;
+			st->time_base = {1, 1000};
+			par->codec_type = AVMEDIA_TYPE_AUDIO;
+			par->codec_id = AV_CODEC_ID_AAC;
+			par->sample_rate = parser.m_sampleRate;
+			av_channel_layout_default(&par->ch_layout,
+			                          parser.m_channels > 0 ? parser.m_channels : 1);
+			par->extradata =
+			    (uint8_t *)av_mallocz(parser.m_asc.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+			memcpy(par->extradata, parser.m_asc.data(), parser.m_asc.size());
+			par->extradata_size = parser.m_asc.size();
+			m_audio = st;
+			m_audioIdx = st->index;
+		}
+
+		m_infoSent = true;
+		this->NotifyStreamInfo();
+	}
+
+	if (!video && !m_audio) {
+		return 0;
+	}
+
+	pkt->stream_index = video ? m_videoIdx : m_audioIdx;
+	this->NotifyStreamPacket(pkt);
+	return 0;
+}
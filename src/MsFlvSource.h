@@ -0,0 +1,36 @@
+#ifndef MS_FLV_SOURCE_H
+#define MS_FLV_SOURCE_H
+#include "MsFlvParser.h"
+#include "MsMediaSource.h"
+
+// live stream pulled over http-flv, from a camera url or the /live url of the origin
+// media server an edge node relays. one thread per source reads the response on a
+// blocking socket into the native flv parser, a lost input is opened again under the
+// viewers like a pulled rtsp camera
+class MsFlvSource : public MsMediaSource, public std::enable_shared_from_this<MsFlvSource> {
+public:
+	MsFlvSource(const std::string &streamID, const std::string &url)
+	    : MsMediaSource(streamID), m_url(url) {}
+	~MsFlvSource();
+
+	void Work() override;
+	shared_ptr<MsMediaSource> GetSharedPtr() override {
+		return dynamic_pointer_cast<MsMediaSource>(shared_from_this());
+	}
+
+	static bool IsFlvUrl(const string &url);
+
+private:
+	void OnRun();
+	// one input until it ends, -1 when opening it again cannot help
+	int RunInput(bool &played);
+	// -1 when the input does not match the streams of the first one
+	int OnFrame(MsFlvParser &parser, bool video, AVPacket *pkt);
+
+	std::string m_url;
+	AVFormatContext *m_fmtCtx = nullptr;
+	bool m_infoSent = false;
+	bool m_checkCodec = false;
+};
+
+#endif // MS_FLV_SOURCE_H
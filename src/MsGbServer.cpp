@@ -354,7 +354,7 @@ void MsGbServer::HandleKeepalive(const char *domainID, MsSipMsg &rspMsg) {
 	}
 }
 
-void MsGbServer::AddGbDevice(XMLElement *item, const char *domainID, shared_ptr<RegistDomain> dd) {
+shared_ptr<MsGbDevice> MsGbServer::ParseGbDevice(XMLElement *item, const char *domainID) {
 	shared_ptr<MsGbDevice> device = make_shared<MsGbDevice>(GB_DEV);
 
 	device->m_deviceID = item->FirstChildElement("DeviceID")->GetText();
@@ -452,10 +452,17 @@ void MsGbServer::AddGbDevice(XMLElement *item, const char *domainID, shared_ptr<
 		}
 	}
 
-	dd->m_device[device->m_deviceID] = device;
-	MsDevMgr::Instance()->AddOrUpdateDevice(device);
+	return device;
+}
+
+void MsGbServer::AddGbDevice(XMLElement *item, const char *domainID, shared_ptr<RegistDomain> dd) {
+	vector<shared_ptr<MsGbDevice>> devs{this->ParseGbDevice(item, domainID)};
+	int nAdd, nMod;
+
+	MsDevMgr::Instance()->AddOrUpdateDevice(devs, nAdd, nMod);
+	dd->m_device[devs[0]->m_deviceID] = devs[0];
 
-	MS_LOG_DEBUG("add device:%s", device->m_deviceID.c_str());
+	MS_LOG_DEBUG("add device:%s", devs[0]->m_deviceID.c_str());
 }
 
 void MsGbServer::HandleCatalog(XMLElement *root, const char *domainID) {
@@ -486,21 +493,66 @@ void MsGbServer::HandleCatalog(XMLElement *root, const char *domainID) {
 
 	while (item) {
 		++ctx->m_recevd;
-		string devID = item->FirstChildElement("DeviceID")->GetText();
-
-		this->AddGbDevice(item, domainID, ctx->m_domain);
+		ctx->m_catalog.emplace_back(this->ParseGbDevice(item, domainID));
 
 		item = item->NextSiblingElement();
 	}
 
-	if (ctx->m_recevd == ctx->m_sum) {
-		MS_LOG_INFO("catalog sn:%d finish total:%d", nSn, ctx->m_sum);
+	if (ctx->m_recevd >= ctx->m_sum) {
+		shared_ptr<GbSessionCtx> x = ctx;
+
+		this->DelTimer(x->m_timer);
+		m_gbSessionCtx.erase(it);
+		this->ApplyCatalog(nSn, x, x->m_sum > 0);
 	} else {
 		MS_LOG_INFO("catalog sn:%d recv %d/%d", nSn, ctx->m_recevd, ctx->m_sum);
 		this->ResetTimer(ctx->m_timer);
 	}
 }
 
+// apply the accumulated items in one batch, a complete catalog also removes stale devices
+void MsGbServer::ApplyCatalog(int sn, shared_ptr<GbSessionCtx> ctx, bool complete) {
+	int64_t t1 = GetCurMs();
+	int nAdd = 0, nMod = 0;
+	vector<shared_ptr<MsGbDevice>> &items = ctx->m_catalog;
+	map<string, shared_ptr<MsGbDevice>> &devs = ctx->m_domain->m_device;
+
+	MsDevMgr::Instance()->AddOrUpdateDevice(items, nAdd, nMod);
+
+	set<string> delDev;
+	if (complete) {
+		set<string> recvDev;
+		for (auto &dev : items) {
+			recvDev.insert(dev->m_deviceID);
+		}
+
+		for (auto &dev : devs) {
+			if (!recvDev.count(dev.first)) {
+				MS_LOG_DEBUG("catalog refersh del dev:%s", dev.first.c_str());
+				delDev.insert(dev.first);
+			}
+		}
+
+		for (auto &dev : delDev) {
+			devs.erase(dev);
+		}
+
+		if (delDev.size()) {
+			MsDevMgr::Instance()->DeleteDevice(delDev);
+		}
+	}
+
+	for (auto &dev : items) {
+		devs[dev->m_deviceID] = dev;
+	}
+
+	MS_LOG_INFO("catalog sn:%d %s total:%d recv:%d add:%d mod:%d del:%d, take:%lldms "
+	            "apply:%lldms",
+	            sn, complete ? "finish" : "partial", ctx->m_sum, ctx->m_recevd, nAdd, nMod,
+	            (int)delDev.size(), (long long)(t1 - ctx->m_startMs),
+	            (long long)(GetCurMs() - t1));
+}
+
 void MsGbServer::HandleRecord(XMLElement *root, const char *deviceID) {
 	XMLElement *sn = root->FirstChildElement("SN");
 	int nSn = atoi(sn->GetText());
@@ -792,7 +844,7 @@ void MsGbServer::HandleNotify(MsSipMsg &sipMsg, shared_ptr<MsSocket> sock, MsIne
 				item = item->NextSiblingElement();
 				continue;
 			} else if (evt == "OFF" || evt == "VLOST" || evt == "DEFECT") {
-				dev->m_status = "OFF";
+				MsDevMgr::Instance()->SetDeviceStatus({devID}, "OFF");
 			} else if (evt == "DEL") {
 				MS_LOG_DEBUG("event del dev:%s", dev->m_deviceID.c_str());
 				if (dd->m_device.count(dev->m_deviceID)) {
@@ -802,7 +854,7 @@ void MsGbServer::HandleNotify(MsSipMsg &sipMsg, shared_ptr<MsSocket> sock, MsIne
 					MsDevMgr::Instance()->DeleteDevice(dx);
 				}
 			} else if (evt == "ON") {
-				dev->m_status = "ON";
+				MsDevMgr::Instance()->SetDeviceStatus({devID}, "ON");
 			}
 
 			item = item->NextSiblingElement();
@@ -910,14 +962,9 @@ void MsGbServer::InitCatalog(const string &domainID) {
 	}
 
 	shared_ptr<RegistDomain> &d = it->second;
-	map<string, shared_ptr<MsGbDevice>> &devs = d->m_device;
 	MsSipContact &contact = d->m_contact;
 	MsSipMsg catalog;
 
-	for (auto &dev : devs) {
-		dev.second->m_refreshed = false;
-	}
-
 	BuildSipMsg(m_ip, m_port, m_gbServerId, contact.GetIP(), contact.GetPort(), contact.GetID(),
 	            this->GenCSeq(), "MESSAGE", catalog);
 
@@ -941,6 +988,7 @@ void MsGbServer::InitCatalog(const string &domainID) {
 
 	ctx->m_timer = this->AddTimer(catMsg, 60);
 	ctx->m_recevd = ctx->m_sum = 0;
+	ctx->m_startMs = GetCurMs();
 	ctx->m_domain = d;
 
 	m_gbSessionCtx.emplace(m_cseq, ctx);
@@ -1269,9 +1317,11 @@ void MsGbServer::ClearDomain(shared_ptr<RegistDomain> domain) {
 	this->DelTimer(domain->m_timer);
 	domain->m_timer = 0;
 
+	vector<string> devIds;
 	for (auto &dd : domain->m_device) {
-		dd.second->m_status = "OFF";
+		devIds.push_back(dd.first);
 	}
+	MsDevMgr::Instance()->SetDeviceStatus(devIds, "OFF");
 
 	for (auto it = m_inviteCtx.begin(); it != m_inviteCtx.end();) {
 		shared_ptr<InviteCtx> ctx = it->second;
@@ -1328,29 +1378,13 @@ void MsGbServer::OnCataTimeout(int sn) {
 	auto it = m_gbSessionCtx.find(sn);
 
 	if (it != m_gbSessionCtx.end()) {
-		shared_ptr<GbSessionCtx> &ctx = it->second;
-
-		if (ctx->m_recevd < ctx->m_sum || ctx->m_sum == 0) {
-			return;
-		}
-
-		set<string> delDev;
-		map<string, shared_ptr<MsGbDevice>> &devs = ctx->m_domain->m_device;
+		shared_ptr<GbSessionCtx> ctx = it->second;
+		m_gbSessionCtx.erase(it);
 
-		for (auto &dev : devs) {
-			if (!dev.second->m_refreshed) {
-				MS_LOG_DEBUG("catalog refersh del dev:%s", dev.second->m_deviceID.c_str());
-				delDev.insert(dev.second->m_deviceID);
-			}
+		// keep what has been received, but never delete on an incomplete catalog
+		if (ctx->m_catalog.size()) {
+			this->ApplyCatalog(sn, ctx, false);
 		}
-
-		for (auto &dev : delDev) {
-			devs.erase(dev);
-		}
-
-		MsDevMgr::Instance()->DeleteDevice(delDev);
-
-		m_gbSessionCtx.erase(it);
 	}
 }
 
@@ -73,6 +73,7 @@ private:
 		map<string, shared_ptr<MsGbDevice>> m_device;
 	};
 
+	shared_ptr<MsGbDevice> ParseGbDevice(XMLElement *item, const char *domainID);
 	void AddGbDevice(XMLElement *item, const char *domainID, shared_ptr<RegistDomain> dd);
 	void DoPtz(shared_ptr<RegistDomain> domain, string devID, string ptzCmd, int timeout);
 	void ClearDomain(shared_ptr<RegistDomain> domain);
@@ -82,11 +83,15 @@ private:
 		int m_sum = 0;
 		int m_recevd = 0;
 		int m_timer = 0;
+		int64_t m_startMs = 0;
 		json m_record;
 		MsMsg m_req;
 		shared_ptr<RegistDomain> m_domain;
+		vector<shared_ptr<MsGbDevice>> m_catalog;
 	};
 
+	void ApplyCatalog(int sn, shared_ptr<GbSessionCtx> ctx, bool complete);
+
 	class InviteCtx {
 	public:
 		~InviteCtx() { MS_LOG_INFO("invite call:%s ctx destory", m_rsp.m_callID.m_value.c_str()); }
@@ -4,7 +4,8 @@
 #include <string.h>
 
 MsGbServerHandler::MsGbServerHandler(const shared_ptr<MsIGbServer> &server)
-    : m_server(server), m_bufSize(DEF_BUF_SIZE), m_bufOff(0) {
+    : m_server(server), m_bufSize(DEF_BUF_SIZE), m_bufOff(0), m_scanOff(0),
+      m_hdrLen(0), m_cntLen(-1) {
 	m_bufPtr = make_unique<char[]>(m_bufSize);
 }
 
@@ -27,68 +28,93 @@ void MsGbServerHandler::HandleRead(shared_ptr<MsEvent> evt) {
 
 	m_bufOff += recv;
 	m_bufPtr[m_bufOff] = '\0';
-	int oriTotal = m_bufOff;
 	char *p2 = m_bufPtr.get();
 
 	while (m_bufOff > 0) {
-		if (!IsHeaderComplete(p2)) {
-			if (m_bufOff == m_bufSize - 1) // header too large, reset buf
-			{
-				MS_LOG_DEBUG("gb server buf full: %s", m_bufPtr.get());
-				m_bufOff = 0;
-			} else if (m_bufOff) {
-				if (p2 != m_bufPtr.get()) {
+		if (!m_hdrLen) {
+			int hdrLen = FindHeaderEnd(p2, m_bufOff, m_scanOff);
+			if (hdrLen < 0) {
+				if (m_bufOff == m_bufSize - 1) // header too large, reset buf
+				{
+					MS_LOG_DEBUG("gb server buf full: %s", m_bufPtr.get());
+					m_bufOff = 0;
+					m_scanOff = 0;
+				} else if (p2 != m_bufPtr.get()) {
 					MS_LOG_DEBUG("gb server left:%d msg:%s", m_bufOff, p2);
 					memmove(m_bufPtr.get(), p2, m_bufOff);
 				}
+				return;
+			}
+
+			m_hdrLen = hdrLen;
+			m_cntLen = -1;
+		}
+
+		// body still incomplete, wait without parsing again
+		if (m_cntLen >= 0 && m_bufOff < m_hdrLen + m_cntLen) {
+			if (p2 != m_bufPtr.get()) {
+				memmove(m_bufPtr.get(), p2, m_bufOff);
 			}
 			return;
 		}
 
-		char *oriP2 = p2;
 		MsSipMsg sipMsg;
-		sipMsg.Parse(p2);
-		int cntLen = sipMsg.m_contentLength.GetIntVal();
-		int left = m_bufOff - (p2 - oriP2);
-
-		if (left < cntLen) {
-			p2 = oriP2;
-			if (m_bufOff && p2 != m_bufPtr.get()) {
-				MS_LOG_DEBUG("gb server need len:%d left:%d cnt:%s", cntLen, left, p2);
+		if (sipMsg.Parse(p2, m_hdrLen) < 0) {
+			MS_LOG_WARN("gb server invalid msg:%.*s", m_hdrLen, p2);
+			p2 += m_hdrLen;
+			m_bufOff -= m_hdrLen;
+			m_hdrLen = 0;
+			continue;
+		}
+
+		int cntLen = atoi(sipMsg.m_contentLength.m_value.c_str());
+		if (cntLen < 0 || m_hdrLen + cntLen > m_bufSize - 1) {
+			MS_LOG_WARN("gb server invalid content len:%d", cntLen);
+			m_bufOff = 0;
+			m_hdrLen = 0;
+			return;
+		}
+
+		if (m_bufOff < m_hdrLen + cntLen) {
+			m_cntLen = cntLen;
+			if (p2 != m_bufPtr.get()) {
+				MS_LOG_DEBUG("gb server need len:%d left:%d", cntLen, m_bufOff - m_hdrLen);
 				memmove(m_bufPtr.get(), p2, m_bufOff);
 			}
 			return;
 		}
 
-		MS_LOG_VERBS("recv:\n%s", oriP2);
+		MS_LOG_VERBS("recv:\n%.*s", m_hdrLen + cntLen, p2);
+
+		char *body = p2 + m_hdrLen;
+		p2 = body + cntLen;
+		m_bufOff -= m_hdrLen + cntLen;
+		m_hdrLen = 0;
 
-		if (sipMsg.m_vias.back().HasRport() && !isTcp) {
+		if (!sipMsg.m_vias.empty() && sipMsg.m_vias.back().HasRport() && !isTcp) {
 			sipMsg.m_vias.back().Rebuild(sipMsg.m_vias.back().GetTransport(),
 			                             sipMsg.m_vias.back().GetBranch(), m_recvAddr);
 		}
 
 		if (sipMsg.m_status.size()) {
-			m_server->HandleResponse(sipMsg, sock, p2, cntLen);
+			m_server->HandleResponse(sipMsg, sock, body, cntLen);
 		} else if (sipMsg.m_method == "REGISTER") {
 			m_server->HandleRegist(sipMsg, sock, m_recvAddr);
 		} else if (sipMsg.m_method == "MESSAGE") {
-			m_server->HandleMessage(sipMsg, sock, m_recvAddr, p2, cntLen);
+			m_server->HandleMessage(sipMsg, sock, m_recvAddr, body, cntLen);
 		} else if (sipMsg.m_method == "INVITE") {
-			m_server->HandleInvite(sipMsg, sock, m_recvAddr, p2, cntLen);
+			m_server->HandleInvite(sipMsg, sock, m_recvAddr, body, cntLen);
 		} else if (sipMsg.m_method == "BYE") {
 			m_server->HandleBye(sipMsg, sock, m_recvAddr);
 		} else if (sipMsg.m_method == "ACK") {
 			m_server->HandleAck(sipMsg);
 		} else if (sipMsg.m_method == "NOTIFY") {
-			m_server->HandleNotify(sipMsg, sock, m_recvAddr, p2, cntLen);
+			m_server->HandleNotify(sipMsg, sock, m_recvAddr, body, cntLen);
 		} else if (sipMsg.m_method == "CANCEL") {
 			m_server->HandleCancel(sipMsg, sock, m_recvAddr);
 		} else {
 			MS_LOG_WARN("unknown:%s", sipMsg.m_method.c_str());
 		}
-
-		p2 += cntLen;
-		m_bufOff -= (p2 - oriP2);
 	}
 }
 
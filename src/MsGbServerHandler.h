@@ -49,6 +49,9 @@ private:
 	unique_ptr<char[]> m_bufPtr;
 	int m_bufSize;
 	int m_bufOff;
+	int m_scanOff; // resume offset of header end search
+	int m_hdrLen;  // header length of the pending msg, 0 if not found yet
+	int m_cntLen;  // body length of the pending msg
 	MsInetAddr m_recvAddr;
 };
 
@@ -5,6 +5,9 @@
 #include "MsPortAllocator.h"
 #include <thread>
 
+// a call sending no rtp for this long is lost
+#define GB_DEF_RTP_TIMEOUT_SEC 10
+
 extern "C" {
 #include <libavformat/avformat.h>
 }
@@ -56,8 +59,7 @@ public:
 					if (m_source->ProcessRtp(xbuf + 2, pktLen) < 0) {
 						MS_LOG_WARN("gb source closing, stop process rtp");
 						m_bufOff = 0;
-						m_source->DelEvent(evt);
-						m_source->SourceActiveClose();
+						m_source->InputLost("closing");
 						return;
 					}
 					xbuf += pktLen + 2;
@@ -73,8 +75,7 @@ public:
 			if (m_source->ProcessRtp((uint8_t *)m_bufPtr.get(), m_bufOff) < 0) {
 				MS_LOG_WARN("gb source closing, stop process rtp");
 				m_bufOff = 0;
-				m_source->DelEvent(evt);
-				m_source->SourceActiveClose();
+				m_source->InputLost("closing");
 				return;
 			}
 			m_bufOff = 0;
@@ -89,8 +90,7 @@ public:
 
 	void HandleClose(shared_ptr<MsEvent> evt) override {
 		// Handle RTP packet close
-		m_source->DelEvent(evt);
-		m_source->SourceActiveClose();
+		m_source->InputLost("rtp closed");
 	}
 
 private:
@@ -123,8 +123,7 @@ public:
 			shared_ptr<MsEvent> rtpEvt =
 			    make_shared<MsEvent>(clientSock, MS_FD_READ | MS_FD_CLOSE, rtpHandler);
 
-			m_source->AddEvent(rtpEvt);
-			m_source->DelEvent(evt);
+			m_source->SetRtpEvent(rtpEvt);
 			m_source = nullptr;
 		}
 	}
@@ -132,8 +131,7 @@ public:
 	void HandleClose(shared_ptr<MsEvent> evt) override {
 		// Handle RTP packet close
 		if (m_source) {
-			m_source->DelEvent(evt);
-			m_source->SourceActiveClose();
+			m_source->InputLost("rtp closed");
 			m_source = nullptr;
 		}
 	}
@@ -154,8 +152,7 @@ public:
 
 	void HandleClose(shared_ptr<MsEvent> evt) override {
 		if (m_source) {
-			m_source->DelEvent(evt);
-			m_source->SourceActiveClose();
+			m_source->InputLost("rtp closed");
 			m_source = nullptr;
 		}
 	}
@@ -168,8 +165,7 @@ public:
 			shared_ptr<MsEvent> msEvent =
 			    make_shared<MsEvent>(sock, MS_FD_READ | MS_FD_CLOSE, evtHandler);
 
-			m_source->AddEvent(msEvent);
-			m_source->DelEvent(evt);
+			m_source->SetRtpEvent(msEvent);
 			m_source = nullptr;
 		}
 	}
@@ -178,7 +174,16 @@ private:
 	shared_ptr<MsGbSource> m_source;
 };
 
+MsGbSource::~MsGbSource() {
+	if (m_fmtCtx) {
+		avformat_free_context(m_fmtCtx);
+	}
+}
+
 void MsGbSource::Work() {
+	int timeout = MsConfig::Instance()->GetConfigInt("rtpTimeoutSec");
+	m_timeoutMs = (int64_t)(timeout > 0 ? timeout : GB_DEF_RTP_TIMEOUT_SEC) * 1000;
+
 	MsReactor::Run();
 
 	std::thread worker([this]() { this->OnRun(); });
@@ -283,7 +288,7 @@ void MsGbSource::HandleMsg(MsMsg &msg) {
 						    dynamic_pointer_cast<MsGbSource>(shared_from_this()));
 						shared_ptr<MsEvent> msEvent = make_shared<MsEvent>(
 						    m_rtpSock, MS_FD_CONNECT | MS_FD_CLOSE, evtHandler);
-						this->AddEvent(msEvent);
+						this->SetRtpEvent(msEvent);
 						m_rtpSock = nullptr;
 					} else {
 						MS_LOG_WARN("rtsp connect %s:%d err:%d", ip.c_str(), port, MS_LAST_ERROR);
@@ -294,7 +299,7 @@ void MsGbSource::HandleMsg(MsMsg &msg) {
 					    dynamic_pointer_cast<MsGbSource>(shared_from_this()));
 					shared_ptr<MsEvent> msEvent =
 					    make_shared<MsEvent>(m_rtpSock, MS_FD_READ | MS_FD_CLOSE, evtHandler);
-					this->AddEvent(msEvent);
+					this->SetRtpEvent(msEvent);
 					m_rtpSock = nullptr;
 				}
 			}
@@ -312,12 +317,34 @@ void MsGbSource::HandleMsg(MsMsg &msg) {
 			MS_LOG_WARN("gb source invite:%s call:%s transport:%d sdp:%s", m_ctx->gbID.c_str(),
 			            m_ctx->gbCallID.c_str(), xtransport, p);
 
-			this->SourceActiveClose();
+			this->InputLost("bad invite answer");
 		} else { // Failed
-			this->SourceActiveClose();
+			this->InputLost("invite failed");
 		}
 	} break;
 
+	case MS_GB_SOURCE_LOST:
+		// a lost reported by the ps thread of a call already replaced is stale
+		if (m_psThread) {
+			this->InputLost("ps input ended");
+		}
+		break;
+
+	case MS_GB_SOURCE_RETRY:
+		if (m_isClosing.load()) {
+			this->SourceActiveClose();
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_ringBuffer->clear();
+			m_lost.store(false);
+		}
+		m_firstPkt = true;
+		this->OnRun();
+		break;
+
 	default:
 		MsReactor::HandleMsg(msg);
 		break;
@@ -339,7 +366,7 @@ void MsGbSource::OnRun() {
 		shared_ptr<MsEvent> rtpEvt =
 		    make_shared<MsEvent>(rtpSock, MS_FD_READ | MS_FD_CLOSE, rtpHandler);
 
-		this->AddEvent(rtpEvt);
+		this->SetRtpEvent(rtpEvt);
 	} else if (transport == EN_TCP_PASSIVE) {
 		rtpSock->Listen();
 
@@ -349,7 +376,7 @@ void MsGbSource::OnRun() {
 		shared_ptr<MsEvent> rtpEvt =
 		    make_shared<MsEvent>(rtpSock, MS_FD_ACCEPT | MS_FD_CLOSE, rtpHandler);
 
-		this->AddEvent(rtpEvt);
+		this->SetRtpEvent(rtpEvt);
 	} else // tcp active
 	{
 		rtpSock->SetNonBlock();
@@ -385,6 +412,8 @@ void MsGbSource::PsParseThread() {
 	AVDictionary *options = NULL;
 	size_t avio_ctx_buffer_size = 4096;
 	int ret = 0;
+	int videoIdx, audioIdx = -1;
+	AVStream *video, *audio = nullptr;
 
 	if (!(fmt_ctx = avformat_alloc_context())) {
 		MS_LOG_ERROR("Could not allocate format context");
@@ -436,12 +465,13 @@ void MsGbSource::PsParseThread() {
 		goto end;
 	}
 
-	m_videoIdx = ret;
-	m_video = fmt_ctx->streams[m_videoIdx];
-	if (m_video->codecpar->codec_id != AV_CODEC_ID_H264 &&
-	    m_video->codecpar->codec_id != AV_CODEC_ID_H265) {
-		MS_LOG_ERROR("not support codec:%d url:%s", m_video->codecpar->codec_id,
+	videoIdx = ret;
+	video = fmt_ctx->streams[videoIdx];
+	if (video->codecpar->codec_id != AV_CODEC_ID_H264 &&
+	    video->codecpar->codec_id != AV_CODEC_ID_H265) {
+		MS_LOG_ERROR("not support codec:%d url:%s", video->codecpar->codec_id,
 		             m_streamID.c_str());
+		m_giveUp = true;
 		goto end;
 	}
 
@@ -449,25 +479,54 @@ void MsGbSource::PsParseThread() {
 	if (ret >= 0) {
 		if (fmt_ctx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_AAC ||
 		    fmt_ctx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_OPUS) {
-			m_audioIdx = ret;
-			m_audio = fmt_ctx->streams[m_audioIdx];
+			audioIdx = ret;
+			audio = fmt_ctx->streams[audioIdx];
 		}
 	}
 
-	this->NotifyStreamInfo();
+	if (m_fmtCtx) {
+		// a new call under the sinks of the first one, it has to carry the same codecs
+		if (!m_audio) {
+			audio = nullptr;
+			audioIdx = -1;
+		}
+		if (video->codecpar->codec_id != m_video->codecpar->codec_id ||
+		    (audio && audio->codecpar->codec_id != m_audio->codecpar->codec_id)) {
+			MS_LOG_ERROR("gb source %s codec changed on reconnect", m_streamID.c_str());
+			m_giveUp = true;
+			goto end;
+		}
+		MS_LOG_INFO("gb source %s reconnected", m_streamID.c_str());
+		this->NotifyDiscontinuity();
+	} else {
+		m_fmtCtx = avformat_alloc_context();
+		m_video = CopyStream(m_fmtCtx, video);
+		m_videoIdx = m_video->index;
+		if (audio) {
+			m_audio = CopyStream(m_fmtCtx, audio);
+			m_audioIdx = m_audio->index;
+		}
+		m_infoSent = true;
+		this->NotifyStreamInfo();
+	}
 
 	pkt = av_packet_alloc();
 
 	/* read frames from the file */
 	while (av_read_frame(fmt_ctx, pkt) >= 0 && !m_isClosing.load()) {
-		if (pkt->stream_index == m_videoIdx || pkt->stream_index == m_audioIdx) {
-			// if (pkt->stream_index == m_videoIdx) {
+		if (pkt->stream_index == videoIdx || pkt->stream_index == audioIdx) {
+			// if (pkt->stream_index == videoIdx) {
 			// 	MS_LOG_DEBUG("gb source video pkt pts:%ld dts:%ld key:%d", pkt->pts, pkt->dts,
 			// 	             pkt->flags & AV_PKT_FLAG_KEY);
-			// } else if (pkt->stream_index == m_audioIdx) {
+			// } else if (pkt->stream_index == audioIdx) {
 			// 	MS_LOG_DEBUG("gb source audio pkt pts:%ld dts:%ld size:%d", pkt->pts, pkt->dts,
 			// 	             pkt->size);
 			// }
+			AVStream *in = pkt->stream_index == videoIdx ? video : audio;
+			AVStream *out = pkt->stream_index == videoIdx ? m_video : m_audio;
+			av_packet_rescale_ts(pkt, in->time_base, out->time_base);
+			pkt->stream_index = out->index;
+			m_tries = 0;
 			this->NotifyStreamPacket(pkt);
 		}
 		av_packet_unref(pkt);
@@ -484,15 +543,26 @@ end:
 		fmt_ctx = nullptr;
 	}
 	av_packet_free(&pkt);
-	if (!m_isClosing.load())
-		this->SourceActiveClose();
+	// the reactor decides whether the call is set up again
+	if (!m_isClosing.load() && !m_lost.load()) {
+		MsMsg msg;
+		msg.m_msgID = MS_GB_SOURCE_LOST;
+		this->EnqueMsg(msg);
+	}
 }
 
 int MsGbSource::ReadBuffer(uint8_t *buf, int buf_size) {
 	std::unique_lock<std::mutex> lock(m_mutex);
-	m_condVar.wait(lock, [this]() { return m_ringBuffer->size() > 0 || m_isClosing.load(); });
+	// a camera sending nothing ends the input like a closed connection
+	if (!m_condVar.wait_for(lock, std::chrono::milliseconds(m_timeoutMs), [this]() {
+		    return m_ringBuffer->size() > 0 || m_isClosing.load() || m_lost.load();
+	    })) {
+		MS_LOG_WARN("gb source %s no rtp for %lld ms", m_streamID.c_str(),
+		            (long long)m_timeoutMs);
+		return AVERROR_EOF;
+	}
 
-	if (m_isClosing.load()) {
+	if (m_isClosing.load() || m_lost.load()) {
 		return AVERROR_EOF;
 	}
 
@@ -585,6 +655,60 @@ int MsGbSource::ProcessRtp(uint8_t *buf, int len) {
 	return this->WriteBuffer(buf, len);
 }
 
+void MsGbSource::SetRtpEvent(shared_ptr<MsEvent> evt) {
+	if (m_rtpEvt) {
+		this->DelEvent(m_rtpEvt);
+	}
+	m_rtpEvt = evt;
+	this->AddEvent(evt);
+}
+
+void MsGbSource::InputLost(const char *reason) {
+	if (m_rtpEvt) {
+		this->DelEvent(m_rtpEvt);
+		m_rtpEvt = nullptr;
+	}
+	m_rtpSock = nullptr;
+
+	if (m_psThread) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_lost.store(true);
+		}
+		m_condVar.notify_all();
+		if (m_psThread->joinable()) {
+			m_psThread->join();
+		}
+		m_psThread.reset();
+	}
+
+	// playback calls would start over, only live ones are set up again
+	if (!m_isClosing.load() && !m_giveUp && m_infoSent && m_ctx && m_ctx->type == 0 &&
+	    !this->IsIdle() && m_tries < ReconnectTries()) {
+		int delay = ReconnectDelayMs(m_tries++);
+		MS_LOG_WARN("gb source %s lost: %s, reconnect %d in %d ms", m_streamID.c_str(), reason,
+		            m_tries.load(), delay);
+
+		if (m_ctx->gbCallID.size()) {
+			MsMsg bye;
+			bye.m_msgID = MS_STOP_INVITE_CALL;
+			bye.m_strVal = m_ctx->gbCallID;
+			bye.m_dstType = MS_GB_SERVER;
+			bye.m_dstID = 1;
+			this->PostMsg(bye);
+			m_ctx->gbCallID.clear();
+		}
+
+		MsMsg msg;
+		msg.m_msgID = MS_GB_SOURCE_RETRY;
+		this->EnqueDelayMsg(msg, delay);
+		return;
+	}
+
+	MS_LOG_INFO("gb source %s closed: %s", m_streamID.c_str(), reason);
+	this->SourceActiveClose();
+}
+
 void MsGbSource::UpdateVideoInfo() {
 	if (m_ctx && m_video && m_ctx->type == 0) {
 		ModDev m;
@@ -602,6 +726,14 @@ void MsGbSource::SourceActiveClose() {
 	this->PostExit();
 }
 
+// a playback is opened under a new stream id each time, only live calls linger
+int MsGbSource::GetLingerMs() {
+	if (!m_ctx || m_ctx->type != 0) {
+		return 0;
+	}
+	return MsConfig::Instance()->GetConfigInt("gbLingerSec") * 1000;
+}
+
 void MsGbSource::OnSinksEmpty() {
 	m_isClosing.store(true);
 	m_condVar.notify_all();
@@ -15,7 +15,7 @@ public:
 	    : MsMediaSource(streamID), MsReactor(MS_GB_SOURCE, id), m_ctx(ctx),
 	      m_ringBuffer(std::make_unique<MsRingBuffer>(DEF_BUF_SIZE)) {}
 
-	~MsGbSource() {}
+	~MsGbSource();
 
 	void Work() override;
 	shared_ptr<MsMediaSource> GetSharedPtr() override {
@@ -25,10 +25,14 @@ public:
 	void Exit() override;
 	void HandleMsg(MsMsg &msg) override;
 	int ProcessRtp(uint8_t *buf, int len);
+	// on the source reactor, the rtp input ended or could not be set up
+	void InputLost(const char *reason);
+	void SetRtpEvent(shared_ptr<MsEvent> evt);
 
 	void UpdateVideoInfo() override;
 	void SourceActiveClose() override;
 	void OnSinksEmpty() override;
+	int GetLingerMs() override;
 
 private:
 	void OnRun();
@@ -48,6 +52,16 @@ private:
 
 	shared_ptr<SGbContext> m_ctx;
 	shared_ptr<MsSocket> m_rtpSock; // for tcp active
+	shared_ptr<MsEvent> m_rtpEvt;
+
+	// live calls are set up again when a call that played is lost
+	AVFormatContext *m_fmtCtx = nullptr;
+	std::atomic_bool m_lost{false};
+	bool m_infoSent = false;
+	bool m_giveUp = false;
+	// reset by the ps thread, counted on the reactor
+	std::atomic<int> m_tries{0};
+	int64_t m_timeoutMs = 0;
 };
 
 #endif // MS_GB_SOURCE_H
@@ -0,0 +1,70 @@
+#include "MsHashRing.h"
+#include <set>
+
+MsHashRing::MsHashRing(int vnodes) : m_vnodes(vnodes) {}
+
+// fnv-1a, then the murmur3 finalizer to spread close keys over the ring
+uint32_t MsHashRing::Hash(const string &s) {
+	uint64_t h = 14695981039346656037ULL;
+	for (unsigned char c : s) {
+		h = (h ^ c) * 1099511628211ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (uint32_t)h;
+}
+
+void MsHashRing::SetNode(int id, int weight) {
+	auto it = m_weights.find(id);
+	if (it != m_weights.end() && it->second == weight) {
+		return;
+	}
+
+	this->RemoveNode(id);
+	m_weights[id] = weight;
+	for (int i = 0; i < m_vnodes * weight; ++i) {
+		// a taken point stays with its first node, the next one is tried
+		string vnode = to_string(id) + "#" + to_string(i);
+		for (uint32_t h = Hash(vnode); !m_ring.emplace(h, id).second; ++h) {
+		}
+	}
+}
+
+void MsHashRing::RemoveNode(int id) {
+	if (!m_weights.erase(id)) {
+		return;
+	}
+
+	for (auto it = m_ring.begin(); it != m_ring.end();) {
+		if (it->second == id) {
+			it = m_ring.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+vector<int> MsHashRing::Lookup(const string &key) {
+	vector<int> nodes;
+	set<int> seen;
+
+	if (m_ring.empty()) {
+		return nodes;
+	}
+
+	auto it = m_ring.lower_bound(Hash(key));
+	for (size_t n = 0; n < m_ring.size() && nodes.size() < m_weights.size(); ++n, ++it) {
+		if (it == m_ring.end()) {
+			it = m_ring.begin();
+		}
+		if (seen.insert(it->second).second) {
+			nodes.push_back(it->second);
+		}
+	}
+
+	return nodes;
+}
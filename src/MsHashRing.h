@@ -0,0 +1,32 @@
+#ifndef MS_HASH_RING_H
+#define MS_HASH_RING_H
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// consistent hash of keys onto node ids. a node sits on the ring at vnodes points per unit
+// of weight, so adding or removing one only moves the keys of its own arcs. points come
+// from a fixed hash and stay the same across restarts
+class MsHashRing {
+public:
+	MsHashRing(int vnodes);
+
+	// add a node, or place it again when its weight changed
+	void SetNode(int id, int weight);
+	void RemoveNode(int id);
+	bool HasNode(int id) { return m_weights.count(id) > 0; }
+	// all nodes in ring order from the point of key, each once
+	vector<int> Lookup(const string &key);
+
+private:
+	static uint32_t Hash(const string &s);
+
+	int m_vnodes;
+	map<uint32_t, int> m_ring;
+	map<int, int> m_weights;
+};
+
+#endif // MS_HASH_RING_H
@@ -1,6 +1,7 @@
 #include "MsHttpHandler.h"
 #include "MsCommon.h"
 #include "MsEvent.h"
+#include "MsHttpUpload.h"
 #include "MsLog.h"
 #include "MsMsgDef.h"
 #include "nlohmann/json.hpp"
@@ -37,6 +38,14 @@ MsHttpHandler::~MsHttpHandler() {}
 void MsHttpHandler::HandleRead(shared_ptr<MsEvent> evt) {
 	MsSocket *sock = evt->GetSocket();
 
+	if (m_upload) {
+		int recv = sock->Recv(m_bufPtr.get(), m_bufSize - 1);
+		if (recv > 0) {
+			this->FeedUpload(evt, m_bufPtr.get(), recv);
+		}
+		return;
+	}
+
 	int recv = sock->Recv(m_bufPtr.get() + m_bufOff, m_bufSize - 1 - m_bufOff);
 
 	if (recv <= 0) {
@@ -105,11 +114,12 @@ void MsHttpHandler::HandleRead(shared_ptr<MsEvent> evt) {
 	char *p2 = m_bufPtr.get();
 
 	while (m_bufOff) {
-		if (!IsHeaderComplete(p2)) {
+		if (FindHeaderEnd(p2, m_bufOff, m_scanOff) < 0) {
 			if (m_bufOff) {
 				if (m_bufOff > 16384) {
 					MS_LOG_ERROR("left buf over 16k, reset");
 					m_bufOff = 0;
+					m_scanOff = 0;
 				} else if (p2 != m_bufPtr.get()) {
 					MS_LOG_DEBUG("http buf left:%d", m_bufOff);
 					memmove(m_bufPtr.get(), p2, m_bufOff);
@@ -125,6 +135,14 @@ void MsHttpHandler::HandleRead(shared_ptr<MsEvent> evt) {
 		msg.Parse(p2);
 
 		int cntLen = msg.m_contentLength.GetIntVal();
+
+		// uploads are streamed to disk, the body never goes through m_bufPtr as a whole
+		if (msg.m_method == "POST" && msg.m_uri.find("/file/upload") == 0) {
+			int left = m_bufOff - (p2 - oriP2);
+			this->StartUpload(evt, msg, p2, left, cntLen);
+			return;
+		}
+
 		// if cntLen over 1.5GB, reject
 		if (cntLen < 0 || cntLen > 0x60000000) {
 			MS_LOG_ERROR("content len err:%d", cntLen);
@@ -213,9 +231,9 @@ void MsHttpHandler::HandleRead(shared_ptr<MsEvent> evt) {
 		}
 #endif
 
-		// if uri start with /live, /vod, /gbvod, let HttpStream handle it
+		// if uri start with /live, /vod, /gbvod, /recvod, let HttpStream handle it
 		if (msg.m_uri.find("/live") == 0 || msg.m_uri.find("/vod") == 0 ||
-		    msg.m_uri.find("/gbvod") == 0) {
+		    msg.m_uri.find("/gbvod") == 0 || msg.m_uri.find("/recvod") == 0) {
 			shared_ptr<SHttpTransferMsg> httpMsg = make_shared<SHttpTransferMsg>();
 			httpMsg->httpMsg = msg;
 			httpMsg->sock = evt->GetSharedSocket();
@@ -249,4 +267,52 @@ void MsHttpHandler::HandleRead(shared_ptr<MsEvent> evt) {
 	}
 }
 
+void MsHttpHandler::StartUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len,
+                                int cntLen) {
+	string err;
+
+	m_bufOff = 0;
+	m_upload = MsHttpUpload::Create(msg.m_contentType.m_value, cntLen, err);
+	if (!m_upload) {
+		MS_LOG_WARN("reject upload len:%d, %s", cntLen, err.c_str());
+		json rsp;
+		rsp["code"] = 1;
+		rsp["msg"] = err;
+		SendHttpRspEx(evt->GetSocket(), rsp.dump());
+		m_server->DelEvent(evt);
+		return;
+	}
+
+	MS_LOG_INFO("start upload len:%d", cntLen);
+	m_upMsg = msg;
+	this->FeedUpload(evt, body, len);
+}
+
+void MsHttpHandler::FeedUpload(shared_ptr<MsEvent> evt, const char *data, int len) {
+	// the upload result closes the connection, a request pipelined after the body could
+	// never be answered, so the upload is rejected instead of dropping it unseen
+	const char *err = nullptr;
+	if (len > m_upload->Left()) {
+		err = "data after body";
+	} else if (len > 0 && m_upload->Feed(data, len)) {
+		err = m_upload->GetError().c_str();
+	}
+
+	if (err) {
+		MS_LOG_WARN("upload err:%s", err);
+		json rsp;
+		rsp["code"] = 1;
+		rsp["msg"] = err;
+		SendHttpRspEx(evt->GetSocket(), rsp.dump());
+		m_upload.reset();
+		m_server->DelEvent(evt);
+		return;
+	}
+
+	if (m_upload->Left() == 0) {
+		shared_ptr<MsHttpUpload> upload = std::move(m_upload);
+		m_server->HandleUpload(evt, m_upMsg, upload);
+	}
+}
+
 void MsHttpHandler::HandleClose(shared_ptr<MsEvent> evt) { m_server->DelEvent(evt); }
@@ -4,10 +4,14 @@
 #include "MsHttpMsg.h"
 #include "MsReactor.h"
 
+class MsHttpUpload;
+
 class MsIHttpServer : public MsReactor {
 public:
 	using MsReactor::MsReactor;
 	virtual void HandleHttpReq(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) = 0;
+	virtual void HandleUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg,
+	                          shared_ptr<MsHttpUpload> upload) = 0;
 };
 
 class MsHttpAcceptHandler : public MsEventHandler {
@@ -30,12 +34,19 @@ public:
 	void HandleClose(shared_ptr<MsEvent> evt);
 
 private:
+	void StartUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len, int cntLen);
+	void FeedUpload(shared_ptr<MsEvent> evt, const char *data, int len);
+
 	bool m_firstRecv = true;
 	shared_ptr<MsIHttpServer> m_server;
 
 	unique_ptr<char[]> m_bufPtr;
 	int m_bufSize;
 	int m_bufOff;
+	int m_scanOff = 0;
+
+	MsHttpMsg m_upMsg;
+	shared_ptr<MsHttpUpload> m_upload;
 };
 
 #endif // MS_HTTP_HANDLER_H
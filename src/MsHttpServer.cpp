@@ -2,9 +2,16 @@
 #include "MsConfig.h"
 #include "MsDbMgr.h"
 #include "MsDevMgr.h"
+#include "MsFileIo.h"
+#include "MsFileProbe.h"
+#include "MsFileSource.h"
 #include "MsHttpHandler.h"
+#include "MsHttpUpload.h"
 #include "MsLog.h"
+#include "MsRecordMgr.h"
+#include "MsResManager.h"
 #include <fstream>
+#include <sys/socket.h>
 #include <thread>
 
 extern "C" {
@@ -16,9 +23,120 @@ extern "C" {
 #include "MsSslSock.h"
 #endif
 
+// media nodes report their load this often, one missing three reports is dropped
+#define NODE_REPORT_SEC 5
+// ring points of a node per unit of weight
+#define NODE_VNODES 160
+// a node past this share over the average load passes new devices on along the ring
+#define NODE_LOAD_BOUND 1.25
+// a source costs like this many viewers, for its input and the work to demux it
+#define NODE_SOURCE_COST 4
+// weights are kept to this, a node gets at most NODE_VNODES * NODE_MAX_WEIGHT ring points
+#define NODE_MAX_WEIGHT 16
+
 using httpHandle = void (MsHttpServer::*)(shared_ptr<MsEvent>, MsHttpMsg &, char *, int);
 
 map<int, shared_ptr<SMediaNode>> MsHttpServer::m_mediaNode;
+MsHashRing MsHttpServer::m_ring(NODE_VNODES);
+
+// busy share of all cpus since the last call, in percent
+static int CpuUsage() {
+	static int64_t lastTotal = 0, lastIdle = 0;
+	int64_t v[8] = {0};
+
+	ifstream fs("/proc/stat");
+	string cpu;
+	fs >> cpu;
+	for (int i = 0; i < 8 && fs; ++i) {
+		fs >> v[i];
+	}
+
+	// user nice system idle iowait irq softirq steal
+	int64_t total = 0, idle = v[3] + v[4];
+	for (int i = 0; i < 8; ++i) {
+		total += v[i];
+	}
+
+	int usage = 0;
+	if (lastTotal && total > lastTotal) {
+		usage = (int)(100 - (idle - lastIdle) * 100 / (total - lastTotal));
+	}
+	lastTotal = total;
+	lastIdle = idle;
+	return usage;
+}
+
+static int NodeWeight(int64_t w) {
+	return w < 1 ? 1 : (w > NODE_MAX_WEIGHT ? NODE_MAX_WEIGHT : (int)w);
+}
+
+// a load report comes from the network, every field must be there with its type
+static bool NodeReportValid(const json &j) {
+	if (!j.is_object()) {
+		return false;
+	}
+
+	for (auto key : {"nodeId", "httpPort", "sources", "sinks", "inKbps", "outKbps", "cpu",
+	                 "weight"}) {
+		if (!j.contains(key) || !j[key].is_number_integer()) {
+			return false;
+		}
+	}
+
+	for (auto key : {"nodeIP", "httpMediaIP"}) {
+		if (!j.contains(key) || !j[key].is_string()) {
+			return false;
+		}
+	}
+
+	if (!j.contains("streams") || !j["streams"].is_array()) {
+		return false;
+	}
+	for (auto &s : j["streams"]) {
+		if (!s.is_string()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// weighted load, every mbps in or out counts like a viewer, a busy cpu scales it up
+static double NodeLoad(const SMediaNode &n) {
+	double load = (n.m_sources + n.m_pending) * NODE_SOURCE_COST + n.m_sinks + n.m_pending +
+	              (n.m_inKbps + n.m_outKbps) / 1000.0;
+	return load * (100 + n.m_cpu) / 100 / n.m_weight;
+}
+
+// the report is sent off the reactor, a master that is away only delays this thread
+static void PostNodeLoad(const string &master, const string &body) {
+	thread([master, body]() {
+		string host = master;
+		int port = 80;
+		size_t colon = host.find(':');
+		if (colon != string::npos) {
+			port = atoi(host.c_str() + colon + 1);
+			host = host.substr(0, colon);
+		}
+
+		MsSocket sock(AF_INET, SOCK_STREAM, 0);
+		if (sock.Connect(host, port) < 0) {
+			MS_LOG_WARN("report load to %s failed", master.c_str());
+			return;
+		}
+
+		struct timeval tv = {NODE_REPORT_SEC, 0};
+		setsockopt(sock.GetFd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		string req = "POST /sys/node HTTP/1.1\r\nHost: " + master +
+		             "\r\nContent-Type: application/json\r\nContent-Length: " +
+		             to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+		char rsp[512];
+		if (sock.BlockSend(req.c_str(), req.size()) == 0) {
+			sock.Recv(rsp, sizeof(rsp));
+		}
+	}).detach();
+}
 
 static void JsonToDev(shared_ptr<MsGbDevice> dev, int type, json &j) {
 	dev->m_deviceID = j["deviceId"].is_null() ? "" : j["deviceId"].get<string>();
@@ -56,11 +174,14 @@ void MsHttpServer::Run() {
 
 	string httpIp = config->GetConfigStr("httpIP");
 	int httpPort = config->GetConfigInt("httpPort");
+	if (config->GetConfigInt("nodeId") > 0) {
+		m_nodeId = config->GetConfigInt("nodeId");
+	}
 	this->OnNodeTimer();
 
 	MsMsg msg;
 	msg.m_msgID = MS_MEDIA_NODE_TIMER;
-	this->AddTimer(msg, 30, true);
+	this->AddTimer(msg, NODE_REPORT_SEC, true);
 
 	MsInetAddr bindAddr(AF_INET, httpIp, httpPort);
 
@@ -163,121 +284,36 @@ void MsHttpServer::QueryPreset(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bo
 }
 
 void MsHttpServer::FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
-	if (msg.m_method != "POST") {
-		json rsp;
-		rsp["code"] = 1;
-		rsp["msg"] = "method not allowed";
-		SendHttpRspEx(evt->GetSocket(), rsp.dump());
-		return;
-	}
-
-	std::string contentType = msg.m_contentType.m_value;
-	std::string boundary_prefix = "boundary=";
-	size_t b_pos = contentType.find(boundary_prefix);
-	if (b_pos == std::string::npos) {
-		json rsp;
-		rsp["code"] = 1;
-		rsp["msg"] = "boundary not found";
-		SendHttpRspEx(evt->GetSocket(), rsp.dump());
-		return;
-	}
-
-	std::string boundary = "--" + contentType.substr(b_pos + boundary_prefix.length());
-
-	auto find_mem = [](const char *haystack, int hlen, const char *needle, int nlen) -> int {
-		if (hlen < nlen)
-			return -1;
-		for (int i = 0; i <= hlen - nlen; ++i) {
-			if (memcmp(haystack + i, needle, nlen) == 0)
-				return i;
-		}
-		return -1;
-	};
-
-	int start_pos = find_mem(body, len, boundary.c_str(), boundary.length());
-	if (start_pos == -1) {
-		json rsp;
-		rsp["code"] = 1;
-		rsp["msg"] = "invalid body";
-		SendHttpRspEx(evt->GetSocket(), rsp.dump());
-		return;
-	}
-
-	int curr_pos = start_pos;
-	std::vector<std::string> filenames;
-
-	while (true) {
-		curr_pos += boundary.length();
-		if (curr_pos + 2 > len)
-			break;
-
-		if (memcmp(body + curr_pos, "--", 2) == 0)
-			break;
-		if (memcmp(body + curr_pos, "\r\n", 2) != 0)
-			break;
-
-		curr_pos += 2; // skip \r\n
-
-		int header_end = find_mem(body + curr_pos, len - curr_pos, "\r\n\r\n", 4);
-		if (header_end == -1)
-			break;
-		header_end += curr_pos;
-
-		std::string headers(body + curr_pos, header_end - curr_pos);
-		int content_start = header_end + 4;
-
-		int next_boundary = find_mem(body + content_start, len - content_start, boundary.c_str(),
-		                             boundary.length());
-		if (next_boundary == -1)
-			break;
-		next_boundary += content_start;
-
-		int content_end = next_boundary - 2; // remove preceding \r\n
-		int content_len = content_end - content_start;
-
-		std::string filename;
-		std::string disp_prefix = "Content-Disposition:";
-		size_t disp_pos = headers.find(disp_prefix);
-		if (disp_pos != std::string::npos) {
-			size_t fn_pos = headers.find("filename=\"", disp_pos);
-			if (fn_pos != std::string::npos) {
-				fn_pos += 10;
-				size_t fn_end = headers.find("\"", fn_pos);
-				if (fn_end != std::string::npos) {
-					filename = headers.substr(fn_pos, fn_end - fn_pos);
-				}
-			}
-		}
+	// POST bodies are streamed by MsHttpHandler and end up in HandleUpload
+	json rsp;
+	rsp["code"] = 1;
+	rsp["msg"] = "method not allowed";
+	SendHttpRspEx(evt->GetSocket(), rsp.dump());
+}
 
-		if (!filename.empty() && content_len > 0) {
-			std::ofstream ofs("files/" + filename, std::ios::binary);
-			if (ofs.is_open()) {
-				ofs.write(body + content_start, content_len);
-				ofs.close();
-				filenames.push_back(filename);
-			}
-		}
+void MsHttpServer::HandleUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg,
+                                shared_ptr<MsHttpUpload> upload) {
+	// probe and db insert can take seconds on a big file, keep them off the reactor
+	thread(MsHttpServer::FinishUpload, evt, upload).detach();
+}
 
-		curr_pos = next_boundary;
-	}
+void MsHttpServer::FinishUpload(shared_ptr<MsEvent> evt, shared_ptr<MsHttpUpload> upload) {
+	string filename, file_path, err;
 
-	if (filenames.size() > 1) {
-		// too many, can only handle one, return error and delete files
-		for (const auto &fname : filenames) {
-			std::remove(("files/" + fname).c_str());
-		}
+	if (upload->Commit(filename, file_path, err)) {
 		json rsp;
 		rsp["code"] = 1;
-		rsp["msg"] = "only one file allowed";
+		rsp["msg"] = err;
 		SendHttpRspEx(evt->GetSocket(), rsp.dump());
 		return;
 	}
 
+	// probing through MsFileProbe leaves the result cached for the vod source
 	AVFormatContext *fmt_ctx = nullptr;
-	std::string file_path = "files/" + filenames[0];
-	int ret = avformat_open_input(&fmt_ctx, file_path.c_str(), nullptr, nullptr);
+	int ret = MsFileProbe::Open(file_path, &fmt_ctx, nullptr);
 	if (ret < 0) {
 		std::remove(file_path.c_str());
+		MsFileProbe::Remove(file_path);
 		json rsp;
 		rsp["code"] = 1;
 		rsp["msg"] = "open file failed";
@@ -285,16 +321,6 @@ void MsHttpServer::FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 		return;
 	}
 
-	if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
-		avformat_close_input(&fmt_ctx);
-		std::remove(file_path.c_str());
-		json rsp;
-		rsp["code"] = 1;
-		rsp["msg"] = "find stream info failed";
-		SendHttpRspEx(evt->GetSocket(), rsp.dump());
-		return;
-	}
-
 	string codec;
 	string resolution;
 	double frame_rate = 0.0;
@@ -313,8 +339,9 @@ void MsHttpServer::FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 	}
 
 	if (fmt_ctx->duration <= 0 || frame_rate <= 0.0) {
-		avformat_close_input(&fmt_ctx);
+		MsFileProbe::Close(&fmt_ctx);
 		std::remove(file_path.c_str());
+		MsFileProbe::Remove(file_path);
 		json rsp;
 		rsp["code"] = 1;
 		rsp["msg"] = "invalid format";
@@ -323,7 +350,7 @@ void MsHttpServer::FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 	}
 
 	double duration_sec = fmt_ctx->duration * av_q2d(AV_TIME_BASE_Q);
-	avformat_close_input(&fmt_ctx);
+	MsFileProbe::Close(&fmt_ctx);
 
 	std::ifstream in(file_path, std::ios::ate | std::ios::binary);
 	long long fsize = 0;
@@ -332,22 +359,31 @@ void MsHttpServer::FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 		in.close();
 	}
 
-	char *zErrMsg = 0;
+	// the file name comes from the client, bound instead of put into the sql
+	sqlite3_stmt *stmt;
 	auto pSql = MsDbMgr::Instance()->GetSql();
-	std::string sql =
-	    "INSERT INTO t_file (name, size, codec, res, duration, frame_rate) VALUES ('" +
-	    filenames[0] + "', " + std::to_string(fsize) + ", '" + codec + "', '" + resolution + "', " +
-	    std::to_string(duration_sec) + ", " + std::to_string(frame_rate) + ")";
-
-	sqlite3_exec(pSql, sql.c_str(), NULL, 0, &zErrMsg);
-	if (zErrMsg) {
-		MS_LOG_ERROR("insert t_file error: %s", zErrMsg);
+	int rc = sqlite3_prepare_v2(pSql,
+	                            "INSERT INTO t_file (name, size, codec, res, duration, frame_rate) "
+	                            "VALUES (?, ?, ?, ?, ?, ?)",
+	                            -1, &stmt, NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 2, fsize);
+		sqlite3_bind_text(stmt, 3, codec.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, resolution.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_double(stmt, 5, duration_sec);
+		sqlite3_bind_double(stmt, 6, frame_rate);
+		rc = sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+	}
+
+	if (rc != SQLITE_DONE) {
+		MS_LOG_ERROR("insert t_file error: %s", sqlite3_errmsg(pSql));
 		json rsp;
 		rsp["code"] = 1;
 		rsp["msg"] = "database error";
 		SendHttpRspEx(evt->GetSocket(), rsp.dump());
 
-		sqlite3_free(zErrMsg);
 		MsDbMgr::Instance()->RelSql();
 		return;
 	}
@@ -358,7 +394,7 @@ void MsHttpServer::FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 
 	json r, rsp;
 	r["fileId"] = file_id;
-	r["fileName"] = filenames[0];
+	r["fileName"] = filename;
 	r["size"] = fsize;
 	r["codec"] = codec;
 	r["resolution"] = resolution;
@@ -376,8 +412,7 @@ void MsHttpServer::FileProcess(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bo
 			json ji = json::parse(body);
 			int64_t fileId = ji["fileId"].get<int64_t>();
 
-			char *zErrMsg = 0;
-			auto pSql = MsDbMgr::Instance()->GetSql();
+			auto pSql = MsDbMgr::Instance()->GetReadSql();
 			// select file name
 			std::string sql = "SELECT name FROM t_file WHERE file_id = " + std::to_string(fileId);
 			sqlite3_stmt *stmt;
@@ -391,24 +426,24 @@ void MsHttpServer::FileProcess(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bo
 					if (std::remove(filepath.c_str()) != 0) {
 						MS_LOG_WARN("delete file:%s error", filepath.c_str());
 					}
+					MsFileProbe::Remove(filepath);
 				}
 				sqlite3_finalize(stmt);
 			}
 
-			// delete record from db
-			sql = "DELETE FROM t_file WHERE file_id = " + std::to_string(fileId);
-			sqlite3_exec(pSql, sql.c_str(), NULL, 0, &zErrMsg);
-			if (zErrMsg) {
-				MS_LOG_ERROR("delete t_file error: %s", zErrMsg);
-				sqlite3_free(zErrMsg);
-			}
-
-			MsDbMgr::Instance()->RelSql();
-
-			json rsp;
-			rsp["code"] = 0;
-			rsp["msg"] = "success";
-			SendHttpRsp(evt->GetSocket(), rsp.dump());
+			MsDbMgr::Instance()->RelReadSql();
+
+			// delete record from db, answered once committed so a list that follows misses it
+			MsDbCmd cmd("DELETE FROM t_file WHERE file_id = ?");
+			cmd.Bind(fileId);
+			shared_ptr<MsSocket> sock = evt->GetSharedSocket();
+			cmd.m_cb = [sock](int rc, int64_t rowid) {
+				json rsp;
+				rsp["code"] = rc == SQLITE_DONE ? 0 : 1;
+				rsp["msg"] = rc == SQLITE_DONE ? "success" : "db error";
+				SendHttpRsp(sock.get(), rsp.dump());
+			};
+			MsDbMgr::Instance()->PostCmd(cmd);
 		} catch (json::exception &e) {
 			MS_LOG_WARN("json err:%s", e.what());
 			json rsp;
@@ -422,8 +457,7 @@ void MsHttpServer::FileProcess(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bo
 		string fileIdStr;
 		GetParam("fileId", fileIdStr, msg.m_uri);
 
-		char *zErrMsg = 0;
-		auto pSql = MsDbMgr::Instance()->GetSql();
+		auto pSql = MsDbMgr::Instance()->GetReadSql();
 		std::string sql =
 		    "SELECT file_id, name, size, codec, res, duration, frame_rate FROM t_file";
 		if (!fileIdStr.empty()) {
@@ -447,7 +481,7 @@ void MsHttpServer::FileProcess(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bo
 			}
 			sqlite3_finalize(stmt);
 		}
-		MsDbMgr::Instance()->RelSql();
+		MsDbMgr::Instance()->RelReadSql();
 
 		json rsp;
 		rsp["code"] = 0;
@@ -478,8 +512,7 @@ void MsHttpServer::FileUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body,
 
 	int64_t fileId = std::stoll(fileIdStr);
 	// query file name from db
-	char *zErrMsg = 0;
-	auto pSql = MsDbMgr::Instance()->GetSql();
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
 	std::string sql = "SELECT name FROM t_file WHERE file_id = " + std::to_string(fileId);
 	sqlite3_stmt *stmt;
 	int rc = sqlite3_prepare_v2(pSql, sql.c_str(), -1, &stmt, NULL);
@@ -491,7 +524,7 @@ void MsHttpServer::FileUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body,
 		}
 		sqlite3_finalize(stmt);
 	}
-	MsDbMgr::Instance()->RelSql();
+	MsDbMgr::Instance()->RelReadSql();
 	if (filename.empty()) {
 		rsp["code"] = 1;
 		rsp["msg"] = "file not found";
@@ -523,6 +556,42 @@ void MsHttpServer::FileUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body,
 	sprintf(bb, "%s://%s:%d/vod/%s/flv/%s", protocol.c_str(), ip.c_str(), mn->httpPort, rid.c_str(),
 	        filename.c_str());
 	r["httpFlvUrl"] = bb;
+	r["streamId"] = rid;
+
+	rsp["code"] = 0;
+	rsp["msg"] = "success";
+	rsp["result"] = r;
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
+void MsHttpServer::FileIoStats(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	json rsp, r;
+	SFileIoStats st;
+	MsFileIo::GetStats(st);
+
+	r["openFiles"] = st.m_files;
+	r["reads"] = st.m_reads;
+	r["bytes"] = st.m_bytes;
+	r["bytesPerRead"] = st.m_reads ? st.m_bytes / st.m_reads : 0;
+	r["avgLatencyUs"] = st.m_reads ? st.m_latencyUs / st.m_reads : 0;
+	r["maxLatencyUs"] = st.m_maxLatencyUs;
+
+	rsp["code"] = 0;
+	rsp["msg"] = "success";
+	rsp["result"] = r;
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
+void MsHttpServer::LingerStats(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	json rsp, r;
+	SLingerStats st;
+	MsMediaSource::GetLingerStats(st);
+
+	r["started"] = st.m_started;
+	r["hits"] = st.m_hits;
+	r["expired"] = st.m_expired;
+	r["lingering"] = st.m_lingering;
+	r["hitRate"] = st.m_started ? (double)st.m_hits / st.m_started : 0.0;
 
 	rsp["code"] = 0;
 	rsp["msg"] = "success";
@@ -530,6 +599,139 @@ void MsHttpServer::FileUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body,
 	SendHttpRsp(evt->GetSocket(), rsp.dump());
 }
 
+void MsHttpServer::FileControl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	json rsp;
+	string streamId, action, pos, rate;
+	GetParam("streamId", streamId, msg.m_uri);
+	GetParam("action", action, msg.m_uri);
+	GetParam("pos", pos, msg.m_uri);
+	GetParam("rate", rate, msg.m_uri);
+
+	rsp["code"] = 0;
+	rsp["msg"] = "success";
+
+	auto source = dynamic_pointer_cast<MsFileSource>(
+	    MsResManager::GetInstance().GetMediaSource(streamId));
+	if (!source) {
+		rsp["code"] = 1;
+		rsp["msg"] = "vod stream not found";
+	} else if (action == "seek" && pos.size()) {
+		source->Seek((int64_t)(atof(pos.c_str()) * 1000));
+	} else if (action == "pause") {
+		source->Pause(true);
+	} else if (action == "resume") {
+		source->Pause(false);
+	} else if (action == "rate" && rate.size()) {
+		if (source->SetRate(atof(rate.c_str()))) {
+			rsp["code"] = 1;
+			rsp["msg"] = "rate out of range";
+		}
+	} else {
+		rsp["code"] = 1;
+		rsp["msg"] = "param error";
+	}
+
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
+void MsHttpServer::RecordStart(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	json rsp;
+	rsp["code"] = 0;
+	rsp["msg"] = "success";
+
+	try {
+		json j = json::parse(body);
+		string streamId = j["streamId"].get<string>();
+
+		bool isJt = streamId.size() > 3 && streamId.substr(streamId.size() - 3) == "_jt";
+		if (!isJt && !MsDevMgr::Instance()->FindDevice(streamId) &&
+		    !MsResManager::GetInstance().GetMediaSource(streamId)) {
+			rsp["code"] = 1;
+			rsp["msg"] = "stream not exist";
+		} else {
+			MsRecordMgr::Instance()->Start(streamId);
+		}
+	} catch (json::exception &e) {
+		MS_LOG_WARN("json err:%s", e.what());
+		rsp["code"] = 1;
+		rsp["msg"] = "json error";
+	}
+
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
+void MsHttpServer::RecordStop(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	json rsp;
+	rsp["code"] = 0;
+	rsp["msg"] = "success";
+
+	try {
+		json j = json::parse(body);
+		string streamId = j["streamId"].get<string>();
+
+		if (MsRecordMgr::Instance()->Stop(streamId)) {
+			rsp["code"] = 1;
+			rsp["msg"] = "not recording";
+		}
+	} catch (json::exception &e) {
+		MS_LOG_WARN("json err:%s", e.what());
+		rsp["code"] = 1;
+		rsp["msg"] = "json error";
+	}
+
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
+void MsHttpServer::RecordList(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	// startTime and endTime are unix seconds, segments overlapping the range are listed
+	string streamId, startTime, endTime;
+	GetParam("streamId", streamId, msg.m_uri);
+	GetParam("startTime", startTime, msg.m_uri);
+	GetParam("endTime", endTime, msg.m_uri);
+
+	int64_t startMs = startTime.size() ? atoll(startTime.c_str()) * 1000 : 0;
+	int64_t endMs = endTime.size() ? atoll(endTime.c_str()) * 1000 : INT64_MAX;
+
+	string sql = "SELECT id, stream_id, path, start_ms, end_ms, size FROM t_record "
+	             "WHERE end_ms > ? AND start_ms < ?";
+	if (streamId.size()) {
+		sql += " AND stream_id = ?";
+	}
+	sql += " ORDER BY start_ms";
+
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
+	sqlite3_stmt *stmt;
+	json result = json::array();
+	int rc = sqlite3_prepare_v2(pSql, sql.c_str(), -1, &stmt, NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_int64(stmt, 1, startMs);
+		sqlite3_bind_int64(stmt, 2, endMs);
+		if (streamId.size()) {
+			sqlite3_bind_text(stmt, 3, streamId.c_str(), -1, SQLITE_TRANSIENT);
+		}
+
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			json r;
+			r["id"] = sqlite3_column_int64(stmt, 0);
+			r["streamId"] = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+			r["path"] = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2));
+			r["startTime"] = sqlite3_column_int64(stmt, 3) / 1000;
+			r["endTime"] = sqlite3_column_int64(stmt, 4) / 1000;
+			r["size"] = sqlite3_column_int64(stmt, 5);
+			result.push_back(r);
+		}
+		sqlite3_finalize(stmt);
+	}
+	MsDbMgr::Instance()->RelReadSql();
+
+	json rsp;
+	rsp["code"] = 0;
+	rsp["msg"] = "success";
+	rsp["recording"] = streamId.size() && MsRecordMgr::Instance()->IsRecording(streamId);
+	rsp["result"] = result;
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
 void MsHttpServer::QueryRecord(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
 	try {
 		json ji = json::parse(body);
@@ -612,6 +814,67 @@ void MsHttpServer::OnNodeTimer() {
 	mn->httpMediaIP = config->GetConfigStr("httpMediaIP");
 	mn->nodeIp = config->GetConfigStr("localBindIP");
 	mn->idle = 0;
+
+	// load of this node
+	int64_t now = GetCurMs();
+	int64_t in, out;
+	vector<string> streams;
+	MsResManager::GetInstance().GetLoad(mn->m_sources, mn->m_sinks, streams);
+	MsMediaSource::GetTraffic(in, out);
+	if (m_loadMs && now > m_loadMs) {
+		// bits per ms are kbps
+		mn->m_inKbps = (in - m_inBytes) * 8 / (now - m_loadMs);
+		mn->m_outKbps = (out - m_outBytes) * 8 / (now - m_loadMs);
+	}
+	m_inBytes = in;
+	m_outBytes = out;
+	m_loadMs = now;
+	mn->m_cpu = CpuUsage();
+	mn->m_weight = NodeWeight(config->GetConfigInt("nodeWeight"));
+	mn->m_streams = set<string>(streams.begin(), streams.end());
+	mn->m_reportMs = now;
+	mn->m_pending = 0;
+
+	// nodes that stopped reporting get no more streams
+	for (auto it = m_mediaNode.begin(); it != m_mediaNode.end();) {
+		if (now - it->second->m_reportMs > NODE_REPORT_SEC * 3000) {
+			MS_LOG_WARN("media node:%d %s lost", it->first, it->second->nodeIp.c_str());
+			it = m_mediaNode.erase(it);
+		} else {
+			++it;
+		}
+	}
+	SyncRing();
+
+	// a node of a cluster reports its load to the server handing out the urls
+	string master = config->GetConfigStr("nodeMaster");
+	if (master.size()) {
+		json j;
+		j["nodeId"] = m_nodeId;
+		j["nodeIP"] = mn->nodeIp;
+		j["httpPort"] = mn->httpPort;
+		j["httpMediaIP"] = mn->httpMediaIP;
+		j["sources"] = mn->m_sources;
+		j["sinks"] = mn->m_sinks;
+		j["inKbps"] = mn->m_inKbps;
+		j["outKbps"] = mn->m_outKbps;
+		j["cpu"] = mn->m_cpu;
+		j["weight"] = mn->m_weight;
+		j["streams"] = streams;
+		PostNodeLoad(master, j.dump());
+	}
+}
+
+void MsHttpServer::SyncRing() {
+	for (auto &nn : m_mediaNode) {
+		m_ring.SetNode(nn.first, nn.second->m_weight);
+	}
+
+	for (int id : m_ring.Lookup("")) {
+		if (!m_mediaNode.count(id)) {
+			m_ring.RemoveNode(id);
+		}
+	}
 }
 
 shared_ptr<SMediaNode> MsHttpServer::GetBestMediaNode(const string &devId, const string &bindIP) {
@@ -628,24 +891,43 @@ shared_ptr<SMediaNode> MsHttpServer::GetBestMediaNode(const string &devId, const
 		}
 	}
 
-	shared_ptr<SMediaNode> curNode;
-
-	for (auto it = m_mediaNode.begin(); it != m_mediaNode.end(); ++it) {
-		curNode = it->second;
+	// a second viewer goes where the source already runs
+	double total = 0;
+	for (auto &it : m_mediaNode) {
+		if (it.second->m_streams.count(devId)) {
+			return it.second;
+		}
+		total += NodeLoad(*it.second);
+	}
 
-		if (!curNode->m_lastUsed) {
-			curNode->m_lastUsed = 1;
-			return curNode;
+	// the device's own node on the ring, or the next one along it with room, so a device
+	// keeps its node and joining or leaving nodes only move their share of devices
+	double bound = total / m_mediaNode.size() * NODE_LOAD_BOUND + NODE_SOURCE_COST;
+	shared_ptr<SMediaNode> mn, least;
+	for (int id : m_ring.Lookup(devId)) {
+		auto it = m_mediaNode.find(id);
+		if (it == m_mediaNode.end()) {
+			continue;
+		}
+		if (NodeLoad(*it->second) <= bound) {
+			mn = it->second;
+			break;
+		}
+		if (!least || NodeLoad(*it->second) < NodeLoad(*least)) {
+			least = it->second;
 		}
 	}
 
-	for (auto it = m_mediaNode.begin(); it != m_mediaNode.end(); ++it) {
-		it->second->m_lastUsed = 0;
+	if (!mn) {
+		mn = least;
+	}
+	if (!mn) {
+		return nullptr;
 	}
 
-	curNode = m_mediaNode.begin()->second;
-	curNode->m_lastUsed = 1;
-	return curNode;
+	// counted until the node reports again, a burst is not all sent to one node
+	++mn->m_pending;
+	return mn;
 }
 
 void MsHttpServer::AddDevice(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
@@ -833,11 +1115,18 @@ void MsHttpServer::HandleHttpReq(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *
 
 	    {"/file/upload", &MsHttpServer::FileUpload},
 	    {"/file/url", &MsHttpServer::FileUrl},
+	    {"/file/control", &MsHttpServer::FileControl},
+	    {"/file/io", &MsHttpServer::FileIoStats},
 	    {"/file", &MsHttpServer::FileProcess},
 
+	    {"/record/start", &MsHttpServer::RecordStart},
+	    {"/record/stop", &MsHttpServer::RecordStop},
+	    {"/record", &MsHttpServer::RecordList},
+
 	    {"/sys/node", &MsHttpServer::GetMediaNode},
 	    {"/sys/config", &MsHttpServer::SetSysConfig},
 	    {"/sys/netmap", &MsHttpServer::NetMapConfig},
+	    {"/sys/linger", &MsHttpServer::LingerStats},
 	};
 
 	string uri;
@@ -972,6 +1261,12 @@ void MsHttpServer::SetSysConfig(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *b
 			MsConfig::Instance()->SetConfigInt("detectInterval", j["detectInterval"].get<int>());
 		}
 
+		if (j.count("warmStreams")) {
+			string tt = j["warmStreams"];
+			MsConfig::Instance()->SetConfigStr("warmStreams", tt);
+			MsResManager::GetInstance().SetWarmStreams(tt);
+		}
+
 		jRsp["code"] = 0;
 		jRsp["msg"] = "success";
 	} catch (json::exception &e) {
@@ -1061,6 +1356,26 @@ void MsHttpServer::GetLiveUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 	SendHttpRsp(evt->GetSocket(), jRsp.dump());
 }
 
+// whether segments recorded here overlap [startMs, endMs)
+static bool HasLocalRecord(const string &streamID, int64_t startMs, int64_t endMs) {
+	bool has = false;
+	sqlite3_stmt *stmt;
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
+	int rc = sqlite3_prepare_v2(pSql,
+	                            "SELECT 1 FROM t_record WHERE stream_id = ? AND end_ms > ? AND "
+	                            "start_ms < ? LIMIT 1",
+	                            -1, &stmt, NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, streamID.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int64(stmt, 2, startMs);
+		sqlite3_bind_int64(stmt, 3, endMs);
+		has = sqlite3_step(stmt) == SQLITE_ROW;
+		sqlite3_finalize(stmt);
+	}
+	MsDbMgr::Instance()->RelReadSql();
+	return has;
+}
+
 void MsHttpServer::GetPlaybackUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
 	json jRsp;
 
@@ -1095,7 +1410,21 @@ void MsHttpServer::GetPlaybackUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char
 		string keyId = bb;
 		string emptyIP;
 
-		shared_ptr<SMediaNode> mn = this->GetBestMediaNode(keyId, emptyIP);
+		// recordings kept here play at once, without an INVITE round trip to the device.
+		// "source": "device" still asks the device
+		string from = j["source"].is_null() ? "" : j["source"].get<string>();
+		bool local = from != "device" && HasLocalRecord(devID, nSt * 1000, nEt * 1000);
+
+		// the segments are in this node's t_record, the url must point here
+		shared_ptr<SMediaNode> mn;
+		if (local) {
+			auto it = m_mediaNode.find(m_nodeId);
+			if (it != m_mediaNode.end()) {
+				mn = it->second;
+			}
+		} else {
+			mn = this->GetBestMediaNode(keyId, emptyIP);
+		}
 		if (!mn.get()) {
 			MS_LOG_ERROR("no media node");
 			jRsp["code"] = 1;
@@ -1117,19 +1446,33 @@ void MsHttpServer::GetPlaybackUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char
 		string protocol = "http";
 #endif
 
+		const char *vodType = local ? "recvod" : "gbvod";
+		if (local) {
+			sprintf(bb, "%s-%ld-%ld", devID.c_str(), nSt, nEt);
+			keyId = bb;
+		}
+
 		json r;
-		sprintf(bb, "rtsp://%s:%d/gbvod/%s/%s", ip.c_str(), mn->httpPort, rid.c_str(),
+		sprintf(bb, "rtsp://%s:%d/%s/%s/%s", ip.c_str(), mn->httpPort, vodType, rid.c_str(),
 		        keyId.c_str());
 		r["rtspUrl"] = bb;
 
-		sprintf(bb, "%s://%s:%d/gbvod/%s/%s.ts", protocol.c_str(), ip.c_str(), mn->httpPort,
-		        rid.c_str(), keyId.c_str());
+		sprintf(bb, "%s://%s:%d/%s/%s/%s.ts", protocol.c_str(), ip.c_str(), mn->httpPort,
+		        vodType, rid.c_str(), keyId.c_str());
 		r["httpTsUrl"] = bb;
 
-		sprintf(bb, "%s://%s:%d/gbvod/%s/%s.flv", protocol.c_str(), ip.c_str(), mn->httpPort,
-		        rid.c_str(), keyId.c_str());
+		sprintf(bb, "%s://%s:%d/%s/%s/%s.flv", protocol.c_str(), ip.c_str(), mn->httpPort,
+		        vodType, rid.c_str(), keyId.c_str());
 		r["httpFlvUrl"] = bb;
 
+		if (local) {
+			sprintf(bb, "%s://%s:%d/rtc/whep/recvod/%s/%s", protocol.c_str(), ip.c_str(),
+			        mn->httpPort, rid.c_str(), keyId.c_str());
+			r["rtcUrl"] = bb;
+		}
+		r["source"] = local ? "local" : "device";
+		r["streamId"] = rid;
+
 		jRsp["code"] = 0;
 		jRsp["msg"] = "success";
 		jRsp["result"] = r;
@@ -1148,8 +1491,30 @@ void MsHttpServer::GetDevList(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *bod
 	string deviceId;
 	GetParam("deviceId", deviceId, msg.m_uri);
 
-	if (deviceId.size()) {
+	FindDev fdev;
+	string type, ptzType, protocol, page, size;
+	GetParam("name", fdev.name, msg.m_uri);
+	GetParam("domainId", fdev.domainId, msg.m_uri);
+	GetParam("bindIP", fdev.bindIP, msg.m_uri);
+	GetParam("type", type, msg.m_uri);
+	GetParam("ptzType", ptzType, msg.m_uri);
+	GetParam("protocol", protocol, msg.m_uri);
+	GetParam("page", page, msg.m_uri);
+	GetParam("size", size, msg.m_uri);
+
+	fdev.type = atoi(type.c_str());
+	fdev.ptzType = atoi(ptzType.c_str());
+	fdev.protocol = atoi(protocol.c_str());
+	fdev.page = atoi(page.c_str());
+	fdev.size = atoi(size.c_str());
+
+	if (deviceId.size() && fdev.page <= 0) {
 		MsDevMgr::Instance()->GetOneDev(rsp, deviceId);
+	} else if (fdev.name.size() || fdev.domainId.size() || fdev.bindIP.size() || fdev.type ||
+	           fdev.ptzType || fdev.protocol || fdev.page > 0) {
+		// with page set, deviceId is a substring filter
+		fdev.deviceId = deviceId;
+		MsDevMgr::Instance()->GetCondiDev(rsp, fdev);
 	} else {
 		MsDevMgr::Instance()->GetAllDevice(rsp, 0, 0);
 	}
@@ -1177,13 +1542,27 @@ void MsHttpServer::GetRegistDomain(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char
 }
 
 void MsHttpServer::GetMediaNode(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	if (msg.m_method == "POST") {
+		return this->NodeReport(evt, msg, body, len);
+	}
+
 	json j;
+	int64_t now = GetCurMs();
 
 	for (auto &nn : m_mediaNode) {
 		json nd;
+		nd["nodeId"] = nn.first;
 		nd["nodeIP"] = nn.second->nodeIp;
 		nd["httpPort"] = nn.second->httpPort;
 		nd["httpMediaIP"] = nn.second->httpMediaIP;
+		nd["sources"] = nn.second->m_sources;
+		nd["sinks"] = nn.second->m_sinks;
+		nd["inKbps"] = nn.second->m_inKbps;
+		nd["outKbps"] = nn.second->m_outKbps;
+		nd["cpu"] = nn.second->m_cpu;
+		nd["weight"] = nn.second->m_weight;
+		nd["load"] = NodeLoad(*nn.second);
+		nd["reportAgo"] = now - nn.second->m_reportMs;
 		j["result"].emplace_back(nd);
 	}
 
@@ -1193,6 +1572,62 @@ void MsHttpServer::GetMediaNode(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *b
 	SendHttpRsp(evt->GetSocket(), j.dump());
 }
 
+void MsHttpServer::NodeReport(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
+	json rsp;
+
+	try {
+		json j = json::parse(body);
+		if (!NodeReportValid(j)) {
+			MS_LOG_WARN("media node report invalid");
+			rsp["code"] = 1;
+			rsp["msg"] = "invalid report";
+			return SendHttpRsp(evt->GetSocket(), rsp.dump());
+		}
+
+		int id = j["nodeId"].get<int>();
+		if (id == m_nodeId) {
+			MS_LOG_ERROR("media node:%d %s uses the id of this node", id,
+			             j["nodeIP"].get<string>().c_str());
+			rsp["code"] = 1;
+			rsp["msg"] = "node id in use";
+			return SendHttpRsp(evt->GetSocket(), rsp.dump());
+		}
+
+		shared_ptr<SMediaNode> &mn = m_mediaNode[id];
+		if (!mn) {
+			mn = make_shared<SMediaNode>();
+			mn->node_id = id;
+			mn->m_lastUsed = 0;
+			mn->idle = 0;
+			MS_LOG_INFO("media node:%d %s joined", id, j["nodeIP"].get<string>().c_str());
+		}
+
+		mn->nodeIp = j["nodeIP"].get<string>();
+		mn->httpPort = j["httpPort"].get<int>();
+		mn->httpMediaIP = j["httpMediaIP"].get<string>();
+		mn->m_sources = j["sources"].get<int>();
+		mn->m_sinks = j["sinks"].get<int>();
+		mn->m_inKbps = j["inKbps"].get<int64_t>();
+		mn->m_outKbps = j["outKbps"].get<int64_t>();
+		mn->m_cpu = j["cpu"].get<int>();
+		mn->m_weight = NodeWeight(j["weight"].get<int64_t>());
+		mn->m_streams = j["streams"].get<set<string>>();
+		mn->m_reportMs = GetCurMs();
+		mn->m_pending = 0;
+		SyncRing();
+
+		rsp["code"] = 0;
+		rsp["msg"] = "success";
+	} catch (json::exception &e) {
+		MS_LOG_WARN("json err:%s", e.what());
+
+		rsp["code"] = 1;
+		rsp["msg"] = "json error";
+	}
+
+	SendHttpRsp(evt->GetSocket(), rsp.dump());
+}
+
 void MsHttpServer::PtzControl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len) {
 	json rsp;
 
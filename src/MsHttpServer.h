@@ -1,6 +1,7 @@
 #ifndef MS_HTTP_SERVER_H
 #define MS_HTTP_SERVER_H
 #include "MsHttpHandler.h"
+#include "MsHashRing.h"
 #include "MsHttpMsg.h"
 #include "MsMsgDef.h"
 #include "MsOnvifHandler.h"
@@ -17,6 +18,7 @@ public:
 	void Run();
 	void HandleMsg(MsMsg &msg);
 	void HandleHttpReq(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void HandleUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, shared_ptr<MsHttpUpload> upload);
 
 private:
 	void OnNodeTimer();
@@ -34,12 +36,20 @@ private:
 	void DelDevice(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void GetGbServer(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void GetMediaNode(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void NodeReport(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void PtzControl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void NetMapConfig(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void QueryPreset(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void FileUpload(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	static void FinishUpload(shared_ptr<MsEvent> evt, shared_ptr<MsHttpUpload> upload);
 	void FileProcess(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 	void FileUrl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void FileIoStats(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void LingerStats(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void FileControl(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void RecordStart(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void RecordStop(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
+	void RecordList(shared_ptr<MsEvent> evt, MsHttpMsg &msg, char *body, int len);
 
 private:
 	map<int, shared_ptr<MsEvent>> m_evts;
@@ -47,8 +57,15 @@ private:
 
 	int m_seqID = 0;
 	int m_nodeId = 1;
+	int64_t m_loadMs = 0;
+	int64_t m_inBytes = 0;
+	int64_t m_outBytes = 0;
 
 	static map<int, shared_ptr<SMediaNode>> m_mediaNode;
+	// devices onto m_mediaNode, kept in step with it by SyncRing
+	static MsHashRing m_ring;
+
+	static void SyncRing();
 
 	shared_ptr<SMediaNode> GetBestMediaNode(const string &devId, const string &bindIP);
 };
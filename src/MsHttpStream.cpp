@@ -5,6 +5,7 @@
 #include "MsLog.h"
 #include "MsMsgDef.h"
 #include "MsResManager.h"
+#include "MsSourceFactory.h"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
@@ -43,8 +44,12 @@ void MsHttpStream::HandleStreamMsg(shared_ptr<SHttpTransferMsg> httpMsg) {
 	}
 
 	if (s[1] == "live") {
-		std::vector<std::string> params = SplitString(s[2], ".");
+		std::vector<std::string> params = SplitString(s[2].substr(0, s[2].find('?')), ".");
 		std::string streamID = params[0];
+		std::string type = s[1], streamInfo;
+		if (MsSourceFactory::ParseTimeshift(msg.m_uri, streamID, streamInfo)) {
+			type = "timeshift";
+		}
 		std::string format = (params.size() > 1) ? params[1] : "flv";
 
 		if (format != "flv" && format != "ts") {
@@ -60,7 +65,7 @@ void MsHttpStream::HandleStreamMsg(shared_ptr<SHttpTransferMsg> httpMsg) {
 		    std::make_shared<MsHttpSink>(format, streamID, ++m_seqID, sock);
 
 		std::shared_ptr<MsMediaSource> source =
-		    MsResManager::GetInstance().GetOrCreateMediaSource(s[1], streamID, "", sink);
+		    MsResManager::GetInstance().GetOrCreateMediaSource(type, streamID, streamInfo, sink);
 
 		if (!source) {
 			MS_LOG_WARN("create source failed for stream: %s", streamID.c_str());
@@ -100,9 +105,9 @@ void MsHttpStream::HandleStreamMsg(shared_ptr<SHttpTransferMsg> httpMsg) {
 			return;
 		}
 
-	} else if (s[1] == "gbvod") {
+	} else if (s[1] == "gbvod" || s[1] == "recvod") {
 		if (s.size() < 4) {
-			MS_LOG_WARN("invalid gbvod uri:%s", msg.m_uri.c_str());
+			MS_LOG_WARN("invalid %s uri:%s", s[1].c_str(), msg.m_uri.c_str());
 			json rsp;
 			rsp["code"] = 1;
 			rsp["msg"] = "invalid uri";
@@ -0,0 +1,291 @@
+#include "MsHttpUpload.h"
+#include "MsCommon.h"
+#include "MsConfig.h"
+#include "MsLog.h"
+#include <errno.h>
+#include <string.h>
+
+#define UPLOAD_MAX_HEADER 8192
+#define UPLOAD_DEF_MAX_BYTES 0x60000000
+#define UPLOAD_DEF_INFLIGHT_BYTES 0x7fffffff
+
+atomic<int64_t> MsHttpUpload::m_inflight(0);
+
+MsHttpUpload::MsHttpUpload(const string &boundary, int64_t total)
+    : m_state(UP_PREAMBLE), m_delim("\r\n--" + boundary), m_total(total), m_left(total),
+      m_fp(nullptr), m_partSize(0) {
+	// the first delimiter has no leading CRLF
+	m_buf = "\r\n";
+}
+
+MsHttpUpload::~MsHttpUpload() {
+	if (m_fp) {
+		fclose(m_fp);
+	}
+
+	for (auto &tmp : m_tmpFiles) {
+		remove(tmp.c_str());
+	}
+
+	m_inflight -= m_total;
+}
+
+shared_ptr<MsHttpUpload> MsHttpUpload::Create(const string &contentType, int64_t total,
+                                              string &err) {
+	size_t p = contentType.find("boundary=");
+	if (p == string::npos) {
+		err = "boundary not found";
+		return nullptr;
+	}
+
+	string boundary = contentType.substr(p + 9);
+	p = boundary.find(';');
+	if (p != string::npos) {
+		boundary.erase(p);
+	}
+	if (boundary.size() > 1 && boundary.front() == '"' && boundary.back() == '"') {
+		boundary = boundary.substr(1, boundary.size() - 2);
+	}
+	if (boundary.empty() || boundary.size() > 70) {
+		err = "invalid boundary";
+		return nullptr;
+	}
+
+	MsConfig *config = MsConfig::Instance();
+	int64_t maxBytes = config->GetConfigInt("uploadMaxBytes");
+	int64_t maxInflight = config->GetConfigInt("uploadInflightBytes");
+
+	if (maxBytes <= 0) {
+		maxBytes = UPLOAD_DEF_MAX_BYTES;
+	}
+	if (maxInflight <= 0) {
+		maxInflight = UPLOAD_DEF_INFLIGHT_BYTES;
+	}
+
+	if (total <= 0) {
+		err = "invalid body";
+		return nullptr;
+	}
+
+	if (total > maxBytes) {
+		err = "file too large";
+		return nullptr;
+	}
+
+	if (m_inflight.fetch_add(total) + total > maxInflight) {
+		m_inflight -= total;
+		err = "server busy";
+		return nullptr;
+	}
+
+	return make_shared<MsHttpUpload>(boundary, total);
+}
+
+int MsHttpUpload::Feed(const char *data, int len) {
+	if (m_state == UP_ERROR) {
+		return -1;
+	}
+
+	m_left -= len;
+
+	if (m_state == UP_DONE) {
+		// epilogue
+		return 0;
+	}
+
+	m_buf.append(data, len);
+
+	size_t off = 0;
+	bool more = true;
+
+	while (more) {
+		switch (m_state) {
+		case UP_PREAMBLE:
+		case UP_DATA: {
+			const char *d = m_delim.Find(m_buf.data() + off, m_buf.size() - off);
+			if (!d) {
+				// keep a tail that may be the start of a split delimiter
+				size_t keep = m_delim.Size() - 1;
+				size_t avail = m_buf.size() - off;
+				if (avail > keep) {
+					if (m_state == UP_DATA && WritePart(m_buf.data() + off, avail - keep)) {
+						more = false;
+						break;
+					}
+					off += avail - keep;
+				}
+				more = false;
+				break;
+			}
+
+			size_t pos = d - m_buf.data();
+			if (m_state == UP_DATA) {
+				if (WritePart(m_buf.data() + off, pos - off)) {
+					more = false;
+					break;
+				}
+				ClosePart();
+			}
+
+			off = pos + m_delim.Size();
+			m_state = UP_DELIM;
+		} break;
+
+		case UP_DELIM:
+			if (m_buf.size() - off < 2) {
+				more = false;
+			} else if (!memcmp(m_buf.data() + off, "--", 2)) {
+				m_state = UP_DONE;
+				more = false;
+			} else if (!memcmp(m_buf.data() + off, "\r\n", 2)) {
+				off += 2;
+				m_state = UP_HEADER;
+			} else {
+				SetError("invalid body");
+				more = false;
+			}
+			break;
+
+		case UP_HEADER: {
+			const char *e = MsMemFind(m_buf.data() + off, m_buf.size() - off, "\r\n\r\n", 4);
+			if (!e) {
+				if (m_buf.size() - off > UPLOAD_MAX_HEADER) {
+					SetError("invalid body");
+				}
+				more = false;
+				break;
+			}
+
+			size_t pos = e - m_buf.data();
+			if (this->OpenPart(m_buf.substr(off, pos - off))) {
+				more = false;
+				break;
+			}
+
+			off = pos + 4;
+			m_state = UP_DATA;
+		} break;
+
+		default:
+			more = false;
+			break;
+		}
+	}
+
+	if (m_state == UP_ERROR) {
+		return -1;
+	}
+
+	if (m_state == UP_DONE) {
+		m_buf.clear();
+	} else {
+		m_buf.erase(0, off);
+	}
+
+	if (m_left <= 0 && m_state != UP_DONE) {
+		return SetError("invalid body");
+	}
+
+	return 0;
+}
+
+int MsHttpUpload::OpenPart(const string &headers) {
+	static atomic<int> seq(0);
+
+	string filename;
+	size_t p = headers.find("filename=\"");
+	if (p != string::npos) {
+		p += 10;
+		size_t e = headers.find('"', p);
+		if (e != string::npos) {
+			filename = headers.substr(p, e - p);
+		}
+	}
+
+	if (filename.empty()) {
+		// plain form field, dropped
+		return 0;
+	}
+
+	p = filename.find_last_of("/\\");
+	if (p != string::npos) {
+		filename = filename.substr(p + 1);
+	}
+	if (filename.empty() || filename == "." || filename == "..") {
+		return SetError("invalid file name");
+	}
+
+	string tmp = "files/.upload_" + to_string(GetCurMs()) + "_" + to_string(seq++);
+	m_fp = fopen(tmp.c_str(), "wb");
+	if (!m_fp) {
+		MS_LOG_ERROR("open %s err:%d", tmp.c_str(), errno);
+		return SetError("open file failed");
+	}
+
+	m_names.push_back(filename);
+	m_tmpFiles.push_back(tmp);
+	m_partSize = 0;
+	return 0;
+}
+
+int MsHttpUpload::WritePart(const char *data, int len) {
+	if (!m_fp || len <= 0) {
+		return 0;
+	}
+
+	if (fwrite(data, 1, len, m_fp) != (size_t)len) {
+		MS_LOG_ERROR("write %s err:%d", m_tmpFiles.back().c_str(), errno);
+		return SetError("write file failed");
+	}
+
+	m_partSize += len;
+	return 0;
+}
+
+void MsHttpUpload::ClosePart() {
+	if (!m_fp) {
+		return;
+	}
+
+	fclose(m_fp);
+	m_fp = nullptr;
+
+	if (m_partSize == 0) {
+		remove(m_tmpFiles.back().c_str());
+		m_tmpFiles.pop_back();
+		m_names.pop_back();
+	}
+}
+
+int MsHttpUpload::SetError(const char *err) {
+	if (m_state != UP_ERROR) {
+		m_err = err;
+		m_state = UP_ERROR;
+	}
+
+	return -1;
+}
+
+int MsHttpUpload::Commit(string &name, string &path, string &err) {
+	if (m_state != UP_DONE || m_names.empty()) {
+		err = "invalid body";
+		return -1;
+	}
+
+	if (m_names.size() > 1) {
+		err = "only one file allowed";
+		return -1;
+	}
+
+	name = m_names[0];
+	path = "files/" + name;
+
+	if (rename(m_tmpFiles[0].c_str(), path.c_str())) {
+		MS_LOG_ERROR("rename %s err:%d", path.c_str(), errno);
+		err = "save file failed";
+		return -1;
+	}
+
+	m_tmpFiles.clear();
+	return 0;
+}
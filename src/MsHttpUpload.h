@@ -0,0 +1,60 @@
+#ifndef MS_HTTP_UPLOAD_H
+#define MS_HTTP_UPLOAD_H
+#include "MsSearch.h"
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// multipart/form-data receiver fed straight from the socket, file parts are
+// written to temp files under files/ as the bytes arrive
+class MsHttpUpload {
+public:
+	MsHttpUpload(const string &boundary, int64_t total);
+	~MsHttpUpload();
+
+	// checks the per-upload and global in-flight budget, nullptr with err on reject
+	static shared_ptr<MsHttpUpload> Create(const string &contentType, int64_t total, string &err);
+
+	int Feed(const char *data, int len);
+	int64_t Left() const { return m_left; }
+	bool IsFinished() const { return m_state == UP_DONE; }
+	const string &GetError() const { return m_err; }
+
+	// move the single uploaded file to files/<name>
+	int Commit(string &name, string &path, string &err);
+
+private:
+	enum {
+		UP_PREAMBLE,
+		UP_DELIM,
+		UP_HEADER,
+		UP_DATA,
+		UP_DONE,
+		UP_ERROR,
+	};
+
+	int OpenPart(const string &headers);
+	int WritePart(const char *data, int len);
+	void ClosePart();
+	int SetError(const char *err);
+
+	int m_state;
+	MsMemSearcher m_delim;
+	string m_buf;
+	string m_err;
+	int64_t m_total;
+	int64_t m_left;
+
+	FILE *m_fp;
+	int64_t m_partSize;
+	vector<string> m_names;
+	vector<string> m_tmpFiles;
+
+	static atomic<int64_t> m_inflight;
+};
+
+#endif // MS_HTTP_UPLOAD_H
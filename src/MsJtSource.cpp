@@ -1,5 +1,6 @@
 #include "MsJtSource.h"
 #include "MsPortAllocator.h"
+#include "MsSearch.h"
 #include <thread>
 
 class MsJtSourceHandler : public MsEventHandler {
@@ -51,60 +52,54 @@ public:
 		m_bufOff += n;
 
 		// Process received data (parsing JT packets and forwarding to sinks)
-		while (m_bufOff > 4) {
-			uint8_t *data = m_bufPtr.get();
-			int startPos = -1;
-			// Find 0x30 0x31 0x63 0x64
-			for (int i = 0; i <= m_bufOff - 4; ++i) {
-				if (data[i] == 0x30 && data[i + 1] == 0x31 && data[i + 2] == 0x63 &&
-				    data[i + 3] == 0x64) {
-					startPos = i;
-					break;
-				}
-			}
+		uint8_t *data = m_bufPtr.get();
+		int pos = 0;
 
-			if (startPos == -1) {
-				if (m_bufOff > 3) {
-					int keep = 3;
-					memmove(data, data + m_bufOff - keep, keep);
-					m_bufOff = keep;
-				}
+		while (m_bufOff - pos > 4) {
+			// Find 0x30 0x31 0x63 0x64
+			const char *hdr = MsMemFind((const char *)data + pos, m_bufOff - pos, "01cd", 4);
+			if (!hdr) {
+				// keep a tail that may be the start of a split header
+				pos = m_bufOff - 3;
 				break;
 			}
 
-			if (startPos > 0) {
-				memmove(data, data + startPos, m_bufOff - startPos);
-				m_bufOff -= startPos;
-			}
+			pos = (const uint8_t *)hdr - data;
+			uint8_t *pkt = data + pos;
 
-			if (m_bufOff < 30) {
+			if (m_bufOff - pos < 30) {
 				break;
 			}
 
-			uint16_t bodyLen = ((uint16_t)data[28] << 8) | data[29];
+			uint16_t bodyLen = ((uint16_t)pkt[28] << 8) | pkt[29];
 			int packetLen = 30 + bodyLen;
-			if (m_bufOff < packetLen) {
+			if (m_bufOff - pos < packetLen) {
 				break;
 			}
 
-			uint8_t dataType = (data[15] >> 4) & 0x0F;
-			uint16_t seq = ((uint16_t)data[6] << 8) | data[7];
+			uint8_t dataType = (pkt[15] >> 4) & 0x0F;
+			uint16_t seq = ((uint16_t)pkt[6] << 8) | pkt[7];
 			uint64_t timestamp = 0;
 			for (int i = 0; i < 8; i++) {
-				timestamp = (timestamp << 8) | data[16 + i];
+				timestamp = (timestamp << 8) | pkt[16 + i];
 			}
 
 			char sim[13];
-			snprintf(sim, sizeof(sim), "%02x%02x%02x%02x%02x%02x", data[8], data[9], data[10],
-			         data[11], data[12], data[13]);
+			snprintf(sim, sizeof(sim), "%02x%02x%02x%02x%02x%02x", pkt[8], pkt[9], pkt[10],
+			         pkt[11], pkt[12], pkt[13]);
 
 			MS_LOG_INFO("Recv JT1078: sim=%s seq=%d type=%d ts=%lu len=%d", sim, seq, dataType,
 			            timestamp, bodyLen);
 
-			m_source->PrepareRtp(dataType, seq, timestamp, data, bodyLen);
+			m_source->PrepareRtp(dataType, seq, timestamp, pkt, bodyLen);
+
+			pos += packetLen;
+		}
 
-			memmove(data, data + packetLen, m_bufOff - packetLen);
-			m_bufOff -= packetLen;
+		// one move per recv instead of one per packet
+		if (pos > 0) {
+			memmove(data, data + pos, m_bufOff - pos);
+			m_bufOff -= pos;
 		}
 	}
 
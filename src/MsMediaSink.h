@@ -2,7 +2,9 @@
 #define MS_MEDIA_SINK_H
 
 #include "MsLog.h"
+#include <memory>
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -14,6 +16,12 @@ using IO_WRITE_BUF_TYPE = const uint8_t;
 using IO_WRITE_BUF_TYPE = uint8_t;
 #endif
 
+// rtp packets of one frame, shared by the sinks sending them
+using MsRtpPkts = std::shared_ptr<const std::vector<std::string>>;
+
+// sink type of the always-on keeper, the source caches its gop for viewers to start from
+#define MS_WARM_SINK "warm"
+
 class MsMediaSink {
 public:
 	MsMediaSink(const std::string &type, const std::string &streamID, int sinkID)
@@ -26,7 +34,14 @@ public:
 	virtual void OnStreamInfo(AVStream *video, int videoIdx, AVStream *audio, int audioIdx);
 
 	virtual void OnSourceClose() = 0;
+	// the source reconnected its input, packets go on from the next key frame with
+	// timestamps following the last ones
+	virtual void OnDiscontinuity() {}
 	virtual void OnStreamPacket(AVPacket *pkt) = 0;
+	// a webrtc sink takes each frame packetized once for all such sinks, with the packet it
+	// came from. aac audio is transcoded to opus first, its packets are in 1/48000
+	virtual bool WantRtp() { return false; }
+	virtual void OnRtpPacket(AVPacket *pkt, const MsRtpPkts &rtp) {}
 
 public:
 	std::string m_type;
@@ -1,5 +1,30 @@
 #include "MsMediaSource.h"
+#include "MsConfig.h"
+#include "MsCommon.h"
+#include "MsOpusTranscoder.h"
 #include "MsResManager.h"
+#include "MsRtpPacketizer.h"
+#include <random>
+
+// a pulled source reconnects this many times before its viewers are dropped
+#define MS_DEF_RECONNECT_TRIES 10
+#define MS_DEF_RECONNECT_MAX_SEC 30
+// the key frame after a discontinuity follows the last packet by about a frame
+#define MS_REBASE_GAP_US 40000
+// a longer gop is not cached, a viewer coming back waits for the next key frame
+#define MS_GOP_CACHE_BYTES (8 * 1024 * 1024)
+
+static std::atomic<int64_t> g_lingerStarted{0};
+static std::atomic<int64_t> g_lingerHits{0};
+static std::atomic<int64_t> g_lingerExpired{0};
+static std::atomic<int64_t> g_lingering{0};
+static std::atomic<int64_t> g_inBytes{0};
+static std::atomic<int64_t> g_outBytes{0};
+
+MsMediaSource::~MsMediaSource() {
+	this->ClearGop();
+	MS_LOG_INFO("media source %s destroyed", m_streamID.c_str());
+}
 
 void MsMediaSource::AddSink(std::shared_ptr<MsMediaSink> sink) {
 	if (!sink || m_isClosing.load()) {
@@ -11,10 +36,29 @@ void MsMediaSource::AddSink(std::shared_ptr<MsMediaSink> sink) {
 		MsResManager::GetInstance().AddMediaSource(m_streamID, this->GetSharedPtr());
 	}
 
+	if (m_lingerUntil) {
+		this->StopLinger(true);
+	}
+
 	m_sinks.push_back(sink);
+	if (sink->m_type == MS_WARM_SINK) {
+		m_keepGop = true;
+	}
 	if (m_video || m_audio) {
 		sink->OnStreamInfo(m_video, m_videoIdx, m_audio, m_audioIdx);
 	}
+
+	// copies, sinks change timestamps and stream indexes of what they get
+	for (auto p : m_gop) {
+		AVPacket *pkt = av_packet_clone(p);
+		if (pkt) {
+			sink->OnStreamPacket(pkt);
+			av_packet_free(&pkt);
+		}
+	}
+	if (sink->WantRtp()) {
+		this->ReplayGopRtp(sink);
+	}
 }
 
 void MsMediaSource::RemoveSink(const std::string &type, int sinkID) {
@@ -30,7 +74,17 @@ void MsMediaSource::RemoveSinkNoLock(const std::string &type, int sinkID) {
 		}
 	}
 
-	if (m_sinks.empty()) {
+	if (!m_sinks.empty() || m_lingerUntil) {
+		return;
+	}
+
+	int linger = m_isClosing.load() ? 0 : this->GetLingerMs();
+	if (linger > 0) {
+		MS_LOG_INFO("media source %s linger %d ms", m_streamID.c_str(), linger);
+		m_lingerUntil = GetCurMs() + linger;
+		++g_lingerStarted;
+		++g_lingering;
+	} else {
 		this->OnSinksEmpty();
 	}
 }
@@ -38,6 +92,22 @@ void MsMediaSource::RemoveSinkNoLock(const std::string &type, int sinkID) {
 void MsMediaSource::NotifyStreamInfo() {
 	this->UpdateVideoInfo();
 	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	this->ClearGop();
+	this->ResetRtp();
+	m_keepGop = this->GetLingerMs() > 0;
+	for (auto &sink : m_sinks) {
+		if (sink && sink->m_type == MS_WARM_SINK) {
+			m_keepGop = true;
+		}
+	}
+	if (m_timeshiftOn && m_video) {
+		// viewers of the old ring play out what it has
+		if (m_timeshift) {
+			m_timeshift->Close();
+		}
+		m_timeshift =
+		    make_shared<MsTimeshift>(m_streamID, m_video, m_videoIdx, m_audio, m_audioIdx);
+	}
 	for (auto &sink : m_sinks) {
 		if (sink) {
 			sink->OnStreamInfo(m_video, m_videoIdx, m_audio, m_audioIdx);
@@ -47,6 +117,14 @@ void MsMediaSource::NotifyStreamInfo() {
 
 void MsMediaSource::NotifySourceClose() {
 	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	if (m_lingerUntil) {
+		this->StopLinger(false);
+	}
+	this->ClearGop();
+	this->ResetRtp();
+	if (m_timeshift) {
+		m_timeshift->Close();
+	}
 	for (auto &sink : m_sinks) {
 		if (sink) {
 			sink->OnSourceClose();
@@ -71,16 +149,295 @@ string MsMediaSource::GetAudioCodec() {
 
 void MsMediaSource::NotifyStreamPacket(AVPacket *pkt) {
 	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	if (!this->RebasePacket(pkt)) {
+		return;
+	}
+	g_inBytes += pkt->size;
+	g_outBytes += (int64_t)pkt->size * m_sinks.size();
+	this->PushTimeshift(pkt);
+	if (m_keepGop) {
+		this->CacheGop(pkt);
+	}
 	for (auto &sink : m_sinks) {
 		if (sink) {
 			sink->OnStreamPacket(pkt);
 		}
 	}
+	this->PacketizeRtp(pkt);
 	if (m_sinks.empty()) {
+		if (m_lingerUntil && GetCurMs() < m_lingerUntil) {
+			return;
+		}
+		if (m_lingerUntil) {
+			MS_LOG_INFO("media source %s linger expired", m_streamID.c_str());
+			this->StopLinger(false);
+			++g_lingerExpired;
+		}
 		this->OnSinksEmpty();
 	}
 }
 
+void MsMediaSource::NotifyDiscontinuity() {
+	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	MS_LOG_INFO("media source %s discontinuity", m_streamID.c_str());
+	m_waitKey = true;
+	this->ClearGop();
+	// the decoder state is of the old input, opus starts again from the rebased timestamps
+	m_opus.reset();
+	for (auto &sink : m_sinks) {
+		if (sink) {
+			sink->OnDiscontinuity();
+		}
+	}
+}
+
+bool MsMediaSource::RebasePacket(AVPacket *pkt) {
+	bool isVideo = pkt->stream_index == m_videoIdx;
+	AVStream *st = isVideo ? m_video : m_audio;
+	int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+
+	if (!st || (!isVideo && pkt->stream_index != m_audioIdx) || ts == AV_NOPTS_VALUE) {
+		return !m_waitKey;
+	}
+
+	if (m_waitKey) {
+		if (!isVideo || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+			return false;
+		}
+		m_waitKey = false;
+		m_rebased = true;
+		m_shiftUs =
+		    m_lastUs[0] + MS_REBASE_GAP_US - av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+	}
+
+	if (m_shiftUs) {
+		int64_t shift = av_rescale_q(m_shiftUs, AV_TIME_BASE_Q, st->time_base);
+		if (pkt->pts != AV_NOPTS_VALUE) {
+			pkt->pts += shift;
+		}
+		if (pkt->dts != AV_NOPTS_VALUE) {
+			pkt->dts += shift;
+		}
+		ts += shift;
+	}
+
+	int64_t us = av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+	int64_t &last = m_lastUs[isVideo ? 0 : 1];
+
+	// audio of the new input overlapping what was already sent
+	if (m_rebased && !isVideo && us < last) {
+		return false;
+	}
+	if (us > last) {
+		last = us;
+	}
+
+	return true;
+}
+
+AVStream *MsMediaSource::CopyStream(AVFormatContext *ctx, AVStream *in) {
+	AVStream *st = avformat_new_stream(ctx, NULL);
+	if (st) {
+		avcodec_parameters_copy(st->codecpar, in->codecpar);
+		st->time_base = in->time_base;
+	}
+	return st;
+}
+
+void MsMediaSource::CacheGop(AVPacket *pkt) {
+	bool key = pkt->stream_index == m_videoIdx && (pkt->flags & AV_PKT_FLAG_KEY);
+
+	if (key) {
+		this->ClearGop();
+	} else if (m_gop.empty()) {
+		return;
+	}
+
+	// the gop is too long to keep, wait for the next one
+	if (m_gopBytes + pkt->size > MS_GOP_CACHE_BYTES) {
+		this->ClearGop();
+		return;
+	}
+
+	AVPacket *p = av_packet_clone(pkt);
+	if (p) {
+		m_gop.push_back(p);
+		m_gopBytes += p->size;
+	}
+}
+
+void MsMediaSource::ClearGop() {
+	for (auto p : m_gop) {
+		av_packet_free(&p);
+	}
+	m_gop.clear();
+	m_gopBytes = 0;
+}
+
+void MsMediaSource::StopLinger(bool hit) {
+	if (hit) {
+		MS_LOG_INFO("media source %s linger hit", m_streamID.c_str());
+		++g_lingerHits;
+	}
+	m_lingerUntil = 0;
+	--g_lingering;
+}
+
+void MsMediaSource::PacketizeRtp(AVPacket *pkt) {
+	bool video = pkt->stream_index == m_videoIdx;
+	if (!video && (!m_audio || pkt->stream_index != m_audioIdx)) {
+		return;
+	}
+
+	bool want = false;
+	for (auto &sink : m_sinks) {
+		if (sink && sink->WantRtp()) {
+			want = true;
+			break;
+		}
+	}
+
+	if (!want) {
+		this->ResetRtp();
+		return;
+	}
+
+	if (video || m_audio->codecpar->codec_id != AV_CODEC_ID_AAC) {
+		this->SendRtp(video, pkt);
+		return;
+	}
+
+	if (!m_opus) {
+		if (m_opusFailed) {
+			return;
+		}
+		m_opus = make_shared<MsOpusTranscoder>(m_streamID);
+		if (m_opus->Init(m_audio) < 0) {
+			MS_LOG_ERROR("media source %s no opus for webrtc viewers", m_streamID.c_str());
+			m_opus.reset();
+			m_opusFailed = true;
+			return;
+		}
+	}
+
+	std::vector<AVPacket *> opusPkts;
+	m_opus->Transcode(pkt, opusPkts);
+	for (auto p : opusPkts) {
+		p->stream_index = m_audioIdx;
+		this->SendRtp(false, p);
+		av_packet_free(&p);
+	}
+}
+
+void MsMediaSource::SendRtp(bool video, AVPacket *pkt) {
+	int i = video ? 0 : 1;
+	if (!m_rtp[i] && !m_rtpFailed[i]) {
+		m_rtp[i] = this->NewPacketizer(video);
+		m_rtpFailed[i] = !m_rtp[i];
+	}
+	if (!m_rtp[i]) {
+		return;
+	}
+
+	MsRtpPkts rtp = m_rtp[i]->Packetize(pkt);
+	if (rtp->empty()) {
+		return;
+	}
+	for (auto &sink : m_sinks) {
+		if (sink && sink->WantRtp()) {
+			sink->OnRtpPacket(pkt, rtp);
+		}
+	}
+}
+
+void MsMediaSource::ReplayGopRtp(std::shared_ptr<MsMediaSink> &sink) {
+	if (!m_video || m_gop.empty()) {
+		return;
+	}
+
+	// the live packetizers are past the gop, it goes through packetizers of its own. aac of
+	// the gop is not transcoded, opus starts with the live packets
+	shared_ptr<MsRtpPacketizer> rtp[2] = {this->NewPacketizer(true), nullptr};
+	if (m_audio && m_audio->codecpar->codec_id != AV_CODEC_ID_AAC) {
+		rtp[1] = this->NewPacketizer(false);
+	}
+
+	for (auto p : m_gop) {
+		int i = p->stream_index == m_videoIdx ? 0 : 1;
+		if (!rtp[i]) {
+			continue;
+		}
+		MsRtpPkts pkts = rtp[i]->Packetize(p);
+		if (!pkts->empty()) {
+			sink->OnRtpPacket(p, pkts);
+		}
+	}
+}
+
+void MsMediaSource::ResetRtp() {
+	m_rtp[0].reset();
+	m_rtp[1].reset();
+	m_rtpFailed[0] = m_rtpFailed[1] = false;
+	m_opus.reset();
+	m_opusFailed = false;
+}
+
+shared_ptr<MsRtpPacketizer> MsMediaSource::NewPacketizer(bool video) {
+	AVStream *st = video ? m_video : m_audio;
+	auto rtp = make_shared<MsRtpPacketizer>(m_streamID);
+	int ret;
+
+	if (video || st->codecpar->codec_id != AV_CODEC_ID_AAC) {
+		ret = rtp->Init(st->codecpar, st->time_base);
+	} else {
+		AVCodecParameters *par = avcodec_parameters_alloc();
+		MsOpusTranscoder::SetOutParams(par);
+		ret = rtp->Init(par, {1, MS_OPUS_RATE});
+		avcodec_parameters_free(&par);
+	}
+
+	return ret < 0 ? nullptr : rtp;
+}
+
+bool MsMediaSource::IsIdle() {
+	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	return m_sinks.empty();
+}
+
+void MsMediaSource::GetLingerStats(SLingerStats &stats) {
+	stats.m_started = g_lingerStarted.load();
+	stats.m_hits = g_lingerHits.load();
+	stats.m_expired = g_lingerExpired.load();
+	stats.m_lingering = g_lingering.load();
+}
+
+void MsMediaSource::GetTraffic(int64_t &inBytes, int64_t &outBytes) {
+	inBytes = g_inBytes.load();
+	outBytes = g_outBytes.load();
+}
+
+int MsMediaSource::GetSinkCount() {
+	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	return m_sinks.size();
+}
+
+int MsMediaSource::ReconnectTries() {
+	int n = MsConfig::Instance()->GetConfigInt("reconnectTries");
+	return n < 0 ? 0 : (n ? n : MS_DEF_RECONNECT_TRIES);
+}
+
+int MsMediaSource::ReconnectDelayMs(int n) {
+	static std::mt19937 gen(std::random_device{}());
+	static std::mutex mtx;
+	int maxSec = MsConfig::Instance()->GetConfigInt("reconnectMaxSec");
+	int64_t maxMs = (int64_t)(maxSec > 0 ? maxSec : MS_DEF_RECONNECT_MAX_SEC) * 1000;
+	int64_t ms = n < 16 ? std::min<int64_t>(1000LL << n, maxMs) : maxMs;
+
+	// half fixed, half random
+	std::lock_guard<std::mutex> lock(mtx);
+	return ms / 2 + std::uniform_int_distribution<int64_t>(0, ms / 2)(gen);
+}
+
 void MsMediaSource::SourceActiveClose() {
 	m_isClosing.store(true);
 	MsResManager::GetInstance().RemoveMediaSource(m_streamID);
@@ -88,3 +445,13 @@ void MsMediaSource::SourceActiveClose() {
 }
 
 void MsMediaSource::OnSinksEmpty() { m_isClosing.store(true); }
+
+void MsMediaSource::EnableTimeshift() {
+	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	m_timeshiftOn = MsConfig::Instance()->GetConfigInt("timeshiftSec") > 0;
+}
+
+shared_ptr<MsTimeshift> MsMediaSource::GetTimeshift() {
+	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	return m_timeshift;
+}
@@ -3,6 +3,7 @@
 
 #include "MsLog.h"
 #include "MsMediaSink.h"
+#include "MsTimeshift.h"
 #include <atomic>
 #include <memory>
 #include <mutex>
@@ -13,11 +14,21 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
+class MsOpusTranscoder;
+class MsRtpPacketizer;
+
+struct SLingerStats {
+	int64_t m_started;
+	int64_t m_hits;
+	int64_t m_expired;
+	int64_t m_lingering;
+};
+
 class MsMediaSource {
 public:
 	MsMediaSource(const std::string &streamID) : m_streamID(streamID) {}
 
-	virtual ~MsMediaSource() { MS_LOG_INFO("media source %s destroyed", m_streamID.c_str()); }
+	virtual ~MsMediaSource();
 
 	virtual void AddSink(std::shared_ptr<MsMediaSink> sink);
 	void RemoveSink(const std::string &type, int sinkID);
@@ -29,12 +40,53 @@ public:
 	string GetStreamID() { return m_streamID; }
 	virtual void UpdateVideoInfo() {}
 	virtual void NotifyStreamPacket(AVPacket *pkt);
+	// the input was lost and opened again on the same streams. sinks keep playing: packets
+	// are held back to the next key frame and moved on from the last timestamps sent
+	void NotifyDiscontinuity();
 	virtual void SourceActiveClose();
 	virtual void OnSinksEmpty();
+	// how long the source keeps running after its last viewer left, so a viewer coming
+	// back attaches at once and starts from the cached gop. 0 stops it right away
+	virtual int GetLingerMs() { return 0; }
+	// no viewer attached, a lingering source does not reconnect a lost input
+	bool IsIdle();
 	virtual void Work() = 0;
 	virtual shared_ptr<MsMediaSource> GetSharedPtr() = 0;
 
+	// live sources keep the last timeshiftSec for delayed viewers when it is configured
+	void EnableTimeshift();
+	shared_ptr<MsTimeshift> GetTimeshift();
+
+	// times a pulled source reopens a lost input, 0 when reconnectTries disables it
+	static int ReconnectTries();
+	// wait before retry n from 0, doubling up to reconnectMaxSec, jittered so the sources
+	// of one camera or platform do not come back all at once
+	static int ReconnectDelayMs(int n);
+
+	static void GetLingerStats(SLingerStats &stats);
+	// bytes of all live packets taken in, and handed to sinks, since startup
+	static void GetTraffic(int64_t &inBytes, int64_t &outBytes);
+	int GetSinkCount();
+
 protected:
+	bool RebasePacket(AVPacket *pkt);
+	void CacheGop(AVPacket *pkt);
+	void ClearGop();
+	void StopLinger(bool hit);
+	void PacketizeRtp(AVPacket *pkt);
+	void SendRtp(bool video, AVPacket *pkt);
+	void ReplayGopRtp(std::shared_ptr<MsMediaSink> &sink);
+	void ResetRtp();
+	shared_ptr<MsRtpPacketizer> NewPacketizer(bool video);
+	// the streams sinks see outlive the inputs opened under them
+	static AVStream *CopyStream(AVFormatContext *ctx, AVStream *in);
+
+	void PushTimeshift(AVPacket *pkt) {
+		if (m_timeshift) {
+			m_timeshift->Push(pkt);
+		}
+	}
+
 	std::atomic_bool m_isClosing{false};
 	AVStream *m_video = nullptr;
 	int m_videoIdx = -1;
@@ -43,6 +95,24 @@ protected:
 	std::string m_streamID;
 	std::mutex m_sinkMutex;
 	std::vector<std::shared_ptr<MsMediaSink>> m_sinks;
+	// guarded by m_sinkMutex, timestamps after a discontinuity are moved by m_shiftUs
+	bool m_waitKey = false;
+	bool m_rebased = false;
+	int64_t m_shiftUs = 0;
+	int64_t m_lastUs[2] = {0, 0};
+	// guarded by m_sinkMutex, packets since the last key frame of a source that lingers
+	int64_t m_lingerUntil = 0;
+	bool m_keepGop = false;
+	std::vector<AVPacket *> m_gop;
+	int64_t m_gopBytes = 0;
+	// guarded by m_sinkMutex, a new ring is started when the stream info changes
+	bool m_timeshiftOn = false;
+	shared_ptr<MsTimeshift> m_timeshift;
+	// guarded by m_sinkMutex, run while a sink wants rtp. aac is transcoded to opus first
+	shared_ptr<MsRtpPacketizer> m_rtp[2];
+	bool m_rtpFailed[2] = {false, false};
+	shared_ptr<MsOpusTranscoder> m_opus;
+	bool m_opusFailed = false;
 };
 
 #endif // MS_MEDIA_SOURCE_H
@@ -3,6 +3,7 @@
 #include "MsHttpMsg.h"
 #include <future>
 #include <memory>
+#include <set>
 #include <stdint.h>
 #include <string>
 
@@ -36,6 +37,12 @@ enum MS_MSG_ID {
 	MS_SOCK_TRANSFER_MSG,
 	MS_JT_SOCKET_CLOSE,
 	MS_JT_REQ_TIMEOUT,
+	MS_VOD_PACE,
+	MS_RTSP_CLIENT_START,
+	MS_RTSP_CLIENT_TICK,
+	MS_RTSP_CLIENT_RETRY,
+	MS_GB_SOURCE_LOST,
+	MS_GB_SOURCE_RETRY,
 };
 
 enum MS_SERVICE_TYPE {
@@ -48,6 +55,8 @@ enum MS_SERVICE_TYPE {
 	MS_RTC_SERVER,
 	MS_JT_SERVER,
 	MS_RTMP_SERVER,
+	MS_VOD_PACER,
+	MS_RTSP_CLIENT,
 };
 
 enum TRASNSPORT { EN_UDP = 0, EN_TCP_ACTIVE, EN_TCP_PASSIVE };
@@ -97,6 +106,18 @@ struct SMediaNode {
 	int httpPort;
 	string httpMediaIP;
 	string nodeIp;
+
+	// load as last reported by the node
+	int64_t m_reportMs = 0;
+	int m_sources = 0;
+	int m_sinks = 0;
+	int64_t m_inKbps = 0;
+	int64_t m_outKbps = 0;
+	int m_cpu = 0;
+	int m_weight = 1;
+	set<string> m_streams;
+	// streams sent to the node since its last report
+	int m_pending = 0;
 };
 
 class SPtzCmd {
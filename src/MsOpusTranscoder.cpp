@@ -0,0 +1,220 @@
+#include "MsOpusTranscoder.h"
+#include "MsLog.h"
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+}
+
+MsOpusTranscoder::~MsOpusTranscoder() {
+	if (m_aacDecCtx) {
+		avcodec_free_context(&m_aacDecCtx);
+	}
+	if (m_opusEncCtx) {
+		avcodec_free_context(&m_opusEncCtx);
+	}
+	if (m_swrCtx) {
+		swr_free(&m_swrCtx);
+	}
+	if (m_decodedFrame) {
+		av_frame_free(&m_decodedFrame);
+	}
+	if (m_opusFrame) {
+		av_frame_free(&m_opusFrame);
+	}
+	if (m_audioFifo) {
+		av_audio_fifo_free(m_audioFifo);
+	}
+}
+
+void MsOpusTranscoder::SetOutParams(AVCodecParameters *par) {
+	par->codec_type = AVMEDIA_TYPE_AUDIO;
+	par->codec_id = AV_CODEC_ID_OPUS;
+	par->sample_rate = MS_OPUS_RATE;
+#if LIBAVUTIL_VERSION_MAJOR >= 58
+	AVChannelLayout chLayout = AV_CHANNEL_LAYOUT_STEREO;
+	av_channel_layout_copy(&par->ch_layout, &chLayout);
+#else
+	par->channels = 2;
+	par->channel_layout = AV_CH_LAYOUT_STEREO;
+#endif
+}
+
+int MsOpusTranscoder::Init(AVStream *aac) {
+	int ret;
+
+	m_inTimeBase = aac->time_base;
+
+	// Initialize AAC decoder
+	const AVCodec *aacDecoder = avcodec_find_decoder(AV_CODEC_ID_AAC);
+	if (!aacDecoder) {
+		MS_LOG_ERROR("opus:%s AAC decoder not found", m_streamID.c_str());
+		return -1;
+	}
+
+	m_aacDecCtx = avcodec_alloc_context3(aacDecoder);
+	if (!m_aacDecCtx) {
+		MS_LOG_ERROR("opus:%s failed to allocate AAC decoder context", m_streamID.c_str());
+		return -1;
+	}
+
+	ret = avcodec_parameters_to_context(m_aacDecCtx, aac->codecpar);
+	if (ret < 0) {
+		MS_LOG_ERROR("opus:%s failed to copy AAC codec parameters", m_streamID.c_str());
+		return -1;
+	}
+
+	ret = avcodec_open2(m_aacDecCtx, aacDecoder, nullptr);
+	if (ret < 0) {
+		MS_LOG_ERROR("opus:%s failed to open AAC decoder", m_streamID.c_str());
+		return -1;
+	}
+
+	// Initialize Opus encoder
+	const AVCodec *opusEncoder = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+	if (!opusEncoder) {
+		MS_LOG_ERROR("opus:%s Opus encoder not found", m_streamID.c_str());
+		return -1;
+	}
+
+	m_opusEncCtx = avcodec_alloc_context3(opusEncoder);
+	if (!m_opusEncCtx) {
+		MS_LOG_ERROR("opus:%s failed to allocate Opus encoder context", m_streamID.c_str());
+		return -1;
+	}
+
+	// Configure Opus encoder - WebRTC typically uses 48kHz stereo
+	m_opusEncCtx->sample_rate = MS_OPUS_RATE;
+	m_opusEncCtx->bit_rate = 64000;
+	m_opusEncCtx->sample_fmt = AV_SAMPLE_FMT_FLT;
+	m_opusEncCtx->time_base = (AVRational){1, MS_OPUS_RATE};
+
+#if LIBAVUTIL_VERSION_MAJOR >= 58
+	AVChannelLayout chLayout = AV_CHANNEL_LAYOUT_STEREO;
+	av_channel_layout_copy(&m_opusEncCtx->ch_layout, &chLayout);
+#else
+	m_opusEncCtx->channels = 2;
+	m_opusEncCtx->channel_layout = AV_CH_LAYOUT_STEREO;
+#endif
+
+	ret = avcodec_open2(m_opusEncCtx, opusEncoder, nullptr);
+	if (ret < 0) {
+		char errbuf[AV_ERROR_MAX_STRING_SIZE] = {0};
+		av_strerror(ret, errbuf, sizeof(errbuf));
+		MS_LOG_ERROR("opus:%s failed to open Opus encoder: %s", m_streamID.c_str(), errbuf);
+		return -1;
+	}
+
+	m_swrCtx = swr_alloc();
+	av_opt_set_chlayout(m_swrCtx, "in_chlayout", &m_aacDecCtx->ch_layout, 0);
+	av_opt_set_int(m_swrCtx, "in_sample_rate", m_aacDecCtx->sample_rate, 0);
+	av_opt_set_sample_fmt(m_swrCtx, "in_sample_fmt", m_aacDecCtx->sample_fmt, 0);
+
+	av_opt_set_chlayout(m_swrCtx, "out_chlayout", &m_opusEncCtx->ch_layout, 0);
+	av_opt_set_int(m_swrCtx, "out_sample_rate", m_opusEncCtx->sample_rate, 0);
+	av_opt_set_sample_fmt(m_swrCtx, "out_sample_fmt", m_opusEncCtx->sample_fmt, 0);
+
+	ret = swr_init(m_swrCtx);
+	if (ret < 0) {
+		MS_LOG_ERROR("opus:%s failed to initialize SwrContext", m_streamID.c_str());
+		return -1;
+	}
+
+	// FIFO to buffer samples until we have enough for one Opus frame
+	m_audioFifo =
+	    av_audio_fifo_alloc(m_opusEncCtx->sample_fmt, m_opusEncCtx->ch_layout.nb_channels, 4096);
+
+	// Allocate frames
+	m_decodedFrame = av_frame_alloc();
+	m_opusFrame = av_frame_alloc();
+
+	// Pre-allocate Opus frame buffer
+	m_opusFrame->nb_samples = m_opusEncCtx->frame_size;
+	m_opusFrame->format = m_opusEncCtx->sample_fmt;
+	m_opusFrame->ch_layout = m_opusEncCtx->ch_layout;
+	m_opusFrame->sample_rate = m_opusEncCtx->sample_rate;
+
+	ret = av_frame_get_buffer(m_opusFrame, 0);
+	if (ret < 0) {
+		MS_LOG_ERROR("opus:%s failed to allocate resampled frame buffer", m_streamID.c_str());
+		return -1;
+	}
+
+	MS_LOG_INFO("opus:%s AAC to Opus transcoder initialized, AAC %dHz -> Opus %dHz",
+	            m_streamID.c_str(), m_aacDecCtx->sample_rate, m_opusEncCtx->sample_rate);
+
+	return 0;
+}
+
+void MsOpusTranscoder::Transcode(AVPacket *pkt, vector<AVPacket *> &opusPkts) {
+	int ret;
+
+	ret = avcodec_send_packet(m_aacDecCtx, pkt);
+	if (ret < 0) {
+		MS_LOG_DEBUG("opus:%s error:%d sending AAC packet to decoder", m_streamID.c_str(), ret);
+		return;
+	}
+
+	// Receive decoded frame
+	ret = avcodec_receive_frame(m_aacDecCtx, m_decodedFrame);
+	if (ret < 0) {
+		MS_LOG_DEBUG("opus:%s error:%d receiving decoded frame", m_streamID.c_str(), ret);
+		return;
+	}
+
+	// output runs on from the first input, viewers joining later all see the same clock
+	if (m_nextOpusPts == AV_NOPTS_VALUE) {
+		m_nextOpusPts = pkt->pts != AV_NOPTS_VALUE
+		                    ? av_rescale_q(pkt->pts, m_inTimeBase, m_opusEncCtx->time_base)
+		                    : 0;
+	}
+
+	int dst_nb_samples = av_rescale_rnd(
+	    swr_get_delay(m_swrCtx, m_aacDecCtx->sample_rate) + m_decodedFrame->nb_samples,
+	    m_opusEncCtx->sample_rate, m_aacDecCtx->sample_rate, AV_ROUND_UP);
+
+	uint8_t **converted_data = nullptr;
+	int linesize;
+	av_samples_alloc_array_and_samples(&converted_data, &linesize,
+	                                   m_opusEncCtx->ch_layout.nb_channels, dst_nb_samples,
+	                                   m_opusEncCtx->sample_fmt, 0);
+
+	// Convert
+	int converted_count =
+	    swr_convert(m_swrCtx, converted_data, dst_nb_samples,
+	                (const uint8_t **)m_decodedFrame->data, m_decodedFrame->nb_samples);
+
+	// C. Write to FIFO
+	av_audio_fifo_write(m_audioFifo, (void **)converted_data, converted_count);
+
+	if (converted_data) {
+		av_freep(&converted_data[0]);
+		av_freep(&converted_data);
+	}
+
+	// D. Encode from FIFO
+	// Opus frame size is usually 960 samples (20ms at 48kHz)
+	while (av_audio_fifo_size(m_audioFifo) >= m_opusEncCtx->frame_size) {
+		// Pull data from FIFO
+		if (av_frame_make_writable(m_opusFrame) < 0) {
+			MS_LOG_WARN("opus:%s Opus frame not writable", m_streamID.c_str());
+			break;
+		}
+		av_audio_fifo_read(m_audioFifo, (void **)m_opusFrame->data, m_opusEncCtx->frame_size);
+
+		// Set PTS
+		m_opusFrame->pts = m_nextOpusPts;
+		m_nextOpusPts += m_opusFrame->nb_samples;
+		// Send to Encoder
+		if (avcodec_send_frame(m_opusEncCtx, m_opusFrame) == 0) {
+			AVPacket *out_pkt = av_packet_alloc();
+			while (avcodec_receive_packet(m_opusEncCtx, out_pkt) == 0) {
+				opusPkts.push_back(out_pkt);
+				out_pkt = av_packet_alloc();
+			}
+			av_packet_free(&out_pkt);
+		}
+	}
+
+	av_frame_unref(m_decodedFrame);
+}
@@ -0,0 +1,45 @@
+#ifndef MS_OPUS_TRANSCODER_H
+#define MS_OPUS_TRANSCODER_H
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
+#include <libswresample/swresample.h>
+}
+
+using namespace std;
+
+#define MS_OPUS_RATE 48000
+
+// aac of one source into 20ms opus frames, 48kHz stereo as webrtc takes it. a source runs
+// one for all its viewers that want opus, pts are in 1/MS_OPUS_RATE from the first input
+class MsOpusTranscoder {
+public:
+	MsOpusTranscoder(const string &streamID) : m_streamID(streamID) {}
+	~MsOpusTranscoder();
+
+	int Init(AVStream *aac);
+	// opus packets the aac packet completes, the caller frees them
+	void Transcode(AVPacket *pkt, vector<AVPacket *> &opusPkts);
+
+	// codec parameters of the output, for muxers set up before the first packet. the time
+	// base is 1/MS_OPUS_RATE
+	static void SetOutParams(AVCodecParameters *par);
+
+private:
+	string m_streamID;
+	AVRational m_inTimeBase = {1, 1000};
+
+	AVCodecContext *m_aacDecCtx = nullptr;
+	AVCodecContext *m_opusEncCtx = nullptr;
+	SwrContext *m_swrCtx = nullptr;
+	AVFrame *m_decodedFrame = nullptr;
+	AVFrame *m_opusFrame = nullptr;
+	AVAudioFifo *m_audioFifo = nullptr;
+	int64_t m_nextOpusPts = AV_NOPTS_VALUE;
+};
+
+#endif // MS_OPUS_TRANSCODER_H
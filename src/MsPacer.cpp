@@ -0,0 +1,59 @@
+#include "MsPacer.h"
+#include "MsCommon.h"
+#include "MsConfig.h"
+#include "MsLog.h"
+
+#define PACER_MAX_BURST_US 5000000
+#define PACER_MAX_AHEAD_MS 1000
+#define PACER_MAX_LATE_MS 1000
+
+MsPacer::MsPacer()
+    : m_leadUs(0), m_anchored(false), m_gopBurst(false), m_anchorMs(0), m_anchorUs(0) {
+	int burst = MsConfig::Instance()->GetConfigInt("vodBurstMs");
+	m_burstUs = burst < 0 ? -1 : (int64_t)burst * 1000;
+	if (m_burstUs > PACER_MAX_BURST_US) {
+		m_burstUs = PACER_MAX_BURST_US;
+	}
+}
+
+void MsPacer::Reset() { m_anchored = false; }
+
+int64_t MsPacer::Due(int64_t dtsUs, bool videoKey) {
+	int64_t now = GetCurMs();
+
+	if (!m_anchored) {
+		m_anchored = true;
+		m_anchorMs = now;
+		m_anchorUs = dtsUs;
+		m_gopBurst = m_burstUs < 0;
+		m_leadUs = m_gopBurst ? 0 : m_burstUs;
+		return now;
+	}
+
+	if (m_gopBurst) {
+		// the lead is the length of the first gop, known once the next key frame shows up
+		int64_t d = dtsUs - m_anchorUs;
+		if (videoKey && d > 0) {
+			m_gopBurst = false;
+			m_leadUs = d < PACER_MAX_BURST_US ? d : PACER_MAX_BURST_US;
+		} else if (d < PACER_MAX_BURST_US) {
+			return now;
+		} else {
+			m_gopBurst = false;
+			m_leadUs = PACER_MAX_BURST_US;
+		}
+	}
+
+	int64_t realMs = m_anchorMs + (dtsUs - m_anchorUs) / 1000;
+	int64_t due = realMs - m_leadUs / 1000;
+
+	// a dts jump or a stalled sender, start over from this packet without a new burst
+	if (due > now + PACER_MAX_AHEAD_MS || realMs < now - PACER_MAX_LATE_MS) {
+		MS_LOG_WARN("pacer rebase, drift:%lldms", (long long)(due - now));
+		m_anchorMs = now;
+		m_anchorUs = dtsUs - m_leadUs;
+		due = now;
+	}
+
+	return due;
+}
@@ -0,0 +1,26 @@
+#ifndef MS_PACER_H
+#define MS_PACER_H
+#include <stdint.h>
+
+// real time schedule for the packets of one stream, keyed to dts against the monotonic
+// clock. due times are taken from a fixed anchor so late wakeups never add up, the first
+// vodBurstMs of media (the first gop when < 0) go out at once after every Reset
+class MsPacer {
+public:
+	MsPacer();
+
+	// re-anchor on the next packet, with a fresh burst
+	void Reset();
+	// wall ms at which the packet with dts in us should be sent
+	int64_t Due(int64_t dtsUs, bool videoKey);
+
+private:
+	int64_t m_burstUs;
+	int64_t m_leadUs;
+	bool m_anchored;
+	bool m_gopBurst;
+	int64_t m_anchorMs;
+	int64_t m_anchorUs;
+};
+
+#endif // MS_PACER_H
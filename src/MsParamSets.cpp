@@ -0,0 +1,304 @@
+#include "MsParamSets.h"
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace {
+
+// reads an rbsp, emulation prevention bytes already removed
+class MsBitReader {
+public:
+	MsBitReader(const vector<uint8_t> &buf) : m_buf(buf) {}
+
+	uint32_t Bits(int n) {
+		uint32_t v = 0;
+		while (n--) {
+			v <<= 1;
+			if (m_pos < m_buf.size() * 8) {
+				v |= (m_buf[m_pos >> 3] >> (7 - (m_pos & 7))) & 1;
+			} else {
+				m_over = true;
+			}
+			++m_pos;
+		}
+		return v;
+	}
+
+	void Skip(int n) { m_pos += n; }
+
+	uint32_t Ue() {
+		int zeros = 0;
+		while (!this->Bits(1)) {
+			if (++zeros > 31 || m_over) {
+				m_over = true;
+				return 0;
+			}
+		}
+		return ((1u << zeros) - 1) + this->Bits(zeros);
+	}
+
+	int32_t Se() {
+		uint32_t v = this->Ue();
+		return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+	}
+
+	bool Over() { return m_over || m_pos > m_buf.size() * 8; }
+
+private:
+	const vector<uint8_t> &m_buf;
+	size_t m_pos = 0;
+	bool m_over = false;
+};
+
+void ForEachNalu(const uint8_t *data, int size, const function<void(const uint8_t *, int)> &fn) {
+	const uint8_t *nal = nullptr;
+	int i = 0;
+
+	while (i + 3 <= size) {
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+			if (nal) {
+				int end = i;
+				while (end > nal - data && data[end - 1] == 0) {
+					--end;
+				}
+				fn(nal, data + end - nal);
+			}
+			i += 3;
+			nal = data + i;
+		} else {
+			++i;
+		}
+	}
+
+	if (nal && nal < data + size) {
+		fn(nal, data + size - nal);
+	}
+}
+
+int NaluType(const uint8_t *nal, bool hevc) { return hevc ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f; }
+
+// payload of a nalu without its header and emulation prevention bytes
+vector<uint8_t> ToRbsp(const uint8_t *nal, int size, int skip) {
+	vector<uint8_t> rbsp;
+	int zeros = 0;
+
+	rbsp.reserve(size);
+	for (int i = skip; i < size; ++i) {
+		if (zeros >= 2 && nal[i] == 3) {
+			zeros = 0;
+			continue;
+		}
+		zeros = nal[i] ? 0 : zeros + 1;
+		rbsp.push_back(nal[i]);
+	}
+
+	return rbsp;
+}
+
+void SkipScalingList(MsBitReader &br, int size) {
+	int last = 8, next = 8;
+	for (int j = 0; j < size; ++j) {
+		if (next) {
+			next = (last + br.Se() + 256) % 256;
+		}
+		last = next ? next : last;
+	}
+}
+
+int ParseH264Sps(const uint8_t *nal, int size, int &width, int &height) {
+	vector<uint8_t> rbsp = ToRbsp(nal, size, 1);
+	MsBitReader br(rbsp);
+
+	int profile = br.Bits(8);
+	br.Skip(16);
+	br.Ue();
+
+	int chroma = 1;
+	bool sepPlane = false;
+	if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+	    profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+	    profile == 139 || profile == 134 || profile == 135) {
+		chroma = br.Ue();
+		if (chroma == 3) {
+			sepPlane = br.Bits(1);
+		}
+		br.Ue();
+		br.Ue();
+		br.Skip(1);
+		if (br.Bits(1)) {
+			for (int i = 0; i < (chroma == 3 ? 12 : 8); ++i) {
+				if (br.Bits(1)) {
+					SkipScalingList(br, i < 6 ? 16 : 64);
+				}
+			}
+		}
+	}
+
+	br.Ue();
+	int pocType = br.Ue();
+	if (pocType == 0) {
+		br.Ue();
+	} else if (pocType == 1) {
+		br.Skip(1);
+		br.Se();
+		br.Se();
+		int n = br.Ue();
+		for (int i = 0; i < n && !br.Over(); ++i) {
+			br.Se();
+		}
+	}
+
+	br.Ue();
+	br.Skip(1);
+	int mbWidth = br.Ue() + 1;
+	int mapHeight = br.Ue() + 1;
+	int frameMbsOnly = br.Bits(1);
+	if (!frameMbsOnly) {
+		br.Skip(1);
+	}
+	br.Skip(1);
+
+	int cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+	if (br.Bits(1)) {
+		cropLeft = br.Ue();
+		cropRight = br.Ue();
+		cropTop = br.Ue();
+		cropBottom = br.Ue();
+	}
+
+	if (br.Over()) {
+		return -1;
+	}
+
+	int unitX = 1, unitY = 2 - frameMbsOnly;
+	if (chroma && !sepPlane) {
+		unitX = chroma == 3 ? 1 : 2;
+		unitY *= chroma == 1 ? 2 : 1;
+	}
+
+	width = mbWidth * 16 - unitX * (cropLeft + cropRight);
+	height = (2 - frameMbsOnly) * mapHeight * 16 - unitY * (cropTop + cropBottom);
+	return width > 0 && height > 0 ? 0 : -1;
+}
+
+int ParseH265Sps(const uint8_t *nal, int size, int &width, int &height) {
+	vector<uint8_t> rbsp = ToRbsp(nal, size, 2);
+	MsBitReader br(rbsp);
+
+	br.Skip(4);
+	int maxSubLayers = br.Bits(3);
+	br.Skip(1);
+
+	// profile_tier_level
+	br.Skip(96);
+	int subProfile = 0, subLevel = 0;
+	for (int i = 0; i < maxSubLayers; ++i) {
+		subProfile |= br.Bits(1) << i;
+		subLevel |= br.Bits(1) << i;
+	}
+	if (maxSubLayers > 0) {
+		br.Skip(2 * (8 - maxSubLayers));
+	}
+	for (int i = 0; i < maxSubLayers; ++i) {
+		if (subProfile & (1 << i)) {
+			br.Skip(88);
+		}
+		if (subLevel & (1 << i)) {
+			br.Skip(8);
+		}
+	}
+
+	br.Ue();
+	int chroma = br.Ue();
+	if (chroma == 3) {
+		br.Skip(1);
+	}
+
+	width = br.Ue();
+	height = br.Ue();
+	if (br.Bits(1)) {
+		int subW = (chroma == 1 || chroma == 2) ? 2 : 1;
+		int subH = chroma == 1 ? 2 : 1;
+		int left = br.Ue(), right = br.Ue(), top = br.Ue(), bottom = br.Ue();
+		width -= subW * (left + right);
+		height -= subH * (top + bottom);
+	}
+
+	if (br.Over()) {
+		return -1;
+	}
+
+	return width > 0 && height > 0 ? 0 : -1;
+}
+
+} // namespace
+
+bool MsParamSets::Collect(const uint8_t *data, int size, bool hevc, string &ps) {
+	// vps, sps, pps
+	bool have[3] = {false, false, false};
+	int base = hevc ? 32 : 6;
+
+	auto mark = [&](const uint8_t *nal, int len) {
+		int idx = NaluType(nal, hevc) - base;
+		if (idx >= 0 && idx < 3) {
+			have[idx] = true;
+		}
+	};
+
+	ForEachNalu((const uint8_t *)ps.data(), ps.size(), mark);
+	ForEachNalu(data, size, [&](const uint8_t *nal, int len) {
+		int idx = NaluType(nal, hevc) - base;
+		if (idx < 0 || idx > 2 || have[idx] || len < (hevc ? 3 : 2)) {
+			return;
+		}
+		have[idx] = true;
+		ps.append("\x00\x00\x00\x01", 4);
+		ps.append((const char *)nal, len);
+	});
+
+	return (!hevc || have[0]) && have[1] && have[2];
+}
+
+int MsParamSets::GetSize(const uint8_t *data, int size, bool hevc, int &width, int &height) {
+	int ret = -1;
+
+	ForEachNalu(data, size, [&](const uint8_t *nal, int len) {
+		if (ret == 0 || NaluType(nal, hevc) != (hevc ? 33 : 7)) {
+			return;
+		}
+		ret = hevc ? ParseH265Sps(nal, len, width, height) : ParseH264Sps(nal, len, width, height);
+	});
+
+	return ret;
+}
+
+int MsParamSets::Apply(AVCodecParameters *par, const string &ps) {
+	bool hevc = par->codec_id == AV_CODEC_ID_H265;
+
+	if (par->codec_id != AV_CODEC_ID_H264 && !hevc) {
+		return -1;
+	}
+
+	if (par->extradata_size <= 0 && ps.size()) {
+		par->extradata = (uint8_t *)av_mallocz(ps.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+		if (!par->extradata) {
+			return -1;
+		}
+		memcpy(par->extradata, ps.data(), ps.size());
+		par->extradata_size = ps.size();
+	}
+
+	if (par->width > 0 && par->height > 0) {
+		return 0;
+	}
+
+	int width, height;
+	if (GetSize(par->extradata, par->extradata_size, hevc, width, height) < 0 &&
+	    GetSize((const uint8_t *)ps.data(), ps.size(), hevc, width, height) < 0) {
+		return -1;
+	}
+
+	par->width = width;
+	par->height = height;
+	return 0;
+}
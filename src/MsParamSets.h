@@ -0,0 +1,26 @@
+#ifndef MS_PARAM_SETS_H
+#define MS_PARAM_SETS_H
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+// h264/h265 parameter sets in annex b form, as the rtsp demuxer builds them from the
+// sprop fields of the sdp or as they come in band, so codec parameters can be set
+// without avformat_find_stream_info
+class MsParamSets {
+public:
+	// append the vps/sps/pps nalus of an annex b buffer not yet in ps, with start codes.
+	// true once ps holds all the sets the codec needs
+	static bool Collect(const uint8_t *data, int size, bool hevc, string &ps);
+	// coded size from the sps of annex b param sets
+	static int GetSize(const uint8_t *data, int size, bool hevc, int &width, int &height);
+	// fill the size of par from its extradata, or from ps which also becomes the
+	// extradata when there is none
+	static int Apply(AVCodecParameters *par, const string &ps = "");
+};
+
+#endif // MS_PARAM_SETS_H
@@ -0,0 +1,542 @@
+#include "MsRecordMgr.h"
+#include "MsCommon.h"
+#include "MsConfig.h"
+#include "MsDbMgr.h"
+#include "MsLog.h"
+#include "MsResManager.h"
+#include "nlohmann/json.hpp"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+#define REC_DEF_SEG_SEC 60
+#define REC_DEF_SEG_MB 256
+#define REC_DEF_KEEP_DAYS 7
+#define REC_DEF_PREALLOC (16 * 1024 * 1024)
+#define REC_IO_BUF_SIZE (64 * 1024)
+#define REC_DRAIN_MS 200
+#define REC_RETRY_MS 10000
+#define REC_RETENTION_MS 60000
+
+unique_ptr<MsRecordMgr> MsRecordMgr::m_instance;
+mutex MsRecordMgr::m_instMutex;
+
+static int64_t WallMs() {
+	return chrono::duration_cast<chrono::milliseconds>(
+	           chrono::system_clock::now().time_since_epoch())
+	    .count();
+}
+
+MsRecordMgr::MsRecordMgr() : m_segUs(0), m_segBytes(0), m_exit(false), m_seqID(0) {}
+
+MsRecordMgr::~MsRecordMgr() { this->Exit(); }
+
+int MsRecordMgr::Init() {
+	MsConfig *config = MsConfig::Instance();
+
+	m_path = config->GetConfigStr("recordPath");
+	if (m_path.empty()) {
+		m_path = "record";
+	}
+
+	int segSec = config->GetConfigInt("recordSegSec");
+	int segMB = config->GetConfigInt("recordSegMB");
+	m_segUs = (int64_t)(segSec > 0 ? segSec : REC_DEF_SEG_SEC) * 1000000;
+	m_segBytes = (int64_t)(segMB > 0 ? segMB : REC_DEF_SEG_MB) * 1024 * 1024;
+
+	mkdir(m_path.c_str(), 0755);
+
+	sqlite3_stmt *stmt;
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
+	int rc = sqlite3_prepare_v2(pSql, "SELECT stream_id FROM t_record_task", -1, &stmt, NULL);
+	if (rc == SQLITE_OK) {
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			m_tasks[(const char *)sqlite3_column_text(stmt, 0)] = STask();
+		}
+		sqlite3_finalize(stmt);
+	}
+	MsDbMgr::Instance()->RelReadSql();
+
+	MS_LOG_INFO("record path:%s tasks:%d", m_path.c_str(), (int)m_tasks.size());
+
+	m_worker = make_unique<thread>(&MsRecordMgr::OnRun, this);
+	return 0;
+}
+
+int MsRecordMgr::Start(const string &streamID) {
+	{
+		lock_guard<mutex> lk(m_mutex);
+		if (m_tasks.count(streamID)) {
+			return 0;
+		}
+		m_tasks[streamID] = STask();
+	}
+
+	MsDbCmd cmd("INSERT OR IGNORE INTO t_record_task (stream_id) VALUES (?)");
+	cmd.Bind(streamID);
+	MsDbMgr::Instance()->PostCmd(cmd);
+
+	m_cond.notify_one();
+	return 0;
+}
+
+int MsRecordMgr::Stop(const string &streamID) {
+	shared_ptr<MsRecordSink> sink;
+
+	{
+		lock_guard<mutex> lk(m_mutex);
+		auto it = m_tasks.find(streamID);
+		if (it == m_tasks.end()) {
+			return -1;
+		}
+
+		sink = it->second.m_sink;
+		m_tasks.erase(it);
+		if (sink) {
+			m_closing.push_back(sink->m_session);
+		}
+	}
+
+	if (sink) {
+		sink->DetachSource();
+		sink->OnSourceClose();
+	}
+
+	MsDbCmd cmd("DELETE FROM t_record_task WHERE stream_id = ?");
+	cmd.Bind(streamID);
+	MsDbMgr::Instance()->PostCmd(cmd);
+
+	m_cond.notify_one();
+	return 0;
+}
+
+bool MsRecordMgr::IsRecording(const string &streamID) {
+	lock_guard<mutex> lk(m_mutex);
+	return m_tasks.count(streamID) > 0;
+}
+
+void MsRecordMgr::Exit() {
+	{
+		lock_guard<mutex> lk(m_mutex);
+		m_exit = true;
+	}
+	m_cond.notify_one();
+
+	if (m_worker && m_worker->joinable()) {
+		m_worker->join();
+	}
+}
+
+void MsRecordMgr::OnRun() {
+	int64_t lastRetention = 0;
+
+	while (true) {
+		vector<shared_ptr<MsRecordSession>> sessions;
+		vector<string> attach;
+		bool exit;
+
+		{
+			unique_lock<mutex> lk(m_mutex);
+			m_cond.wait_for(lk, chrono::milliseconds(REC_DRAIN_MS));
+			exit = m_exit;
+
+			int64_t now = GetCurMs();
+			for (auto &it : m_tasks) {
+				if (it.second.m_sink) {
+					sessions.push_back(it.second.m_sink->m_session);
+				} else if (now >= it.second.m_retryMs && !exit) {
+					attach.push_back(it.first);
+				}
+			}
+
+			sessions.insert(sessions.end(), m_closing.begin(), m_closing.end());
+			m_closing.clear();
+		}
+
+		for (auto &s : sessions) {
+			if (exit) {
+				lock_guard<mutex> lk(s->m_mutex);
+				s->m_closed = true;
+			}
+			this->Drain(s);
+		}
+
+		if (exit) {
+			break;
+		}
+
+		// the source went away, attach again after a pause
+		{
+			lock_guard<mutex> lk(m_mutex);
+			for (auto &it : m_tasks) {
+				auto &task = it.second;
+				if (task.m_sink) {
+					lock_guard<mutex> slk(task.m_sink->m_session->m_mutex);
+					if (task.m_sink->m_session->m_closed) {
+						MS_LOG_WARN("record %s source closed, retry later", it.first.c_str());
+						// packets queued after the last drain and the open segment
+						m_closing.push_back(task.m_sink->m_session);
+						task.m_sink = nullptr;
+						task.m_retryMs = GetCurMs() + REC_RETRY_MS;
+					}
+				}
+			}
+		}
+
+		for (auto &id : attach) {
+			this->Attach(id);
+		}
+
+		if (GetCurMs() - lastRetention >= REC_RETENTION_MS) {
+			lastRetention = GetCurMs();
+			this->Retention();
+		}
+	}
+}
+
+void MsRecordMgr::Attach(const string &streamID) {
+	auto session = make_shared<MsRecordSession>(streamID);
+	auto sink = make_shared<MsRecordSink>(streamID, ++m_seqID, session);
+	auto source = MsResManager::GetInstance().GetOrCreateMediaSource("live", streamID, "", sink);
+
+	bool stopped = false;
+	{
+		lock_guard<mutex> lk(m_mutex);
+		auto it = m_tasks.find(streamID);
+		if (it == m_tasks.end()) {
+			stopped = true;
+		} else if (!source) {
+			it->second.m_retryMs = GetCurMs() + REC_RETRY_MS;
+		} else {
+			it->second.m_sink = sink;
+		}
+	}
+
+	if (!source) {
+		MS_LOG_WARN("record %s no source, retry later", streamID.c_str());
+	} else if (stopped) {
+		sink->DetachSource();
+	} else {
+		MS_LOG_INFO("record %s attached", streamID.c_str());
+	}
+}
+
+void MsRecordMgr::Drain(shared_ptr<MsRecordSession> &session) {
+	MsRecordSession *s = session.get();
+	deque<AVPacket *> pkts;
+	AVCodecParameters *videoPar = nullptr;
+	AVCodecParameters *audioPar = nullptr;
+	int infoSeq;
+	bool closed;
+
+	{
+		lock_guard<mutex> lk(s->m_mutex);
+		pkts.swap(s->m_queue);
+		s->m_queBytes = 0;
+		closed = s->m_closed;
+		infoSeq = s->m_infoSeq;
+
+		if (infoSeq != s->m_segInfoSeq) {
+			videoPar = avcodec_parameters_alloc();
+			avcodec_parameters_copy(videoPar, s->m_videoPar);
+			if (s->m_audioPar) {
+				audioPar = avcodec_parameters_alloc();
+				avcodec_parameters_copy(audioPar, s->m_audioPar);
+			}
+			s->m_segVideoTb = s->m_videoTb;
+			s->m_segAudioTb = s->m_audioTb;
+		}
+	}
+
+	// queued packets always belong to the newest parameters
+	if (infoSeq != s->m_segInfoSeq) {
+		s->CloseSegment();
+		avcodec_parameters_free(&s->m_segVideoPar);
+		avcodec_parameters_free(&s->m_segAudioPar);
+		s->m_segVideoPar = videoPar;
+		s->m_segAudioPar = audioPar;
+		s->m_segInfoSeq = infoSeq;
+	}
+
+	for (auto pkt : pkts) {
+		if (!pkt) {
+			s->CloseSegment();
+			continue;
+		}
+		this->WritePacket(s, pkt);
+		av_packet_free(&pkt);
+	}
+
+	if (closed) {
+		s->CloseSegment();
+	}
+}
+
+void MsRecordMgr::WritePacket(MsRecordSession *s, AVPacket *pkt) {
+	bool isVideo = pkt->stream_index == 0;
+	AVRational tb = isVideo ? s->m_segVideoTb : s->m_segAudioTb;
+	int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+	int64_t us = av_rescale_q(dts, tb, AV_TIME_BASE_Q);
+	bool key = isVideo && (pkt->flags & AV_PKT_FLAG_KEY);
+
+	// roll on a key frame by duration or size, or when the timestamps went back
+	if (s->m_fmtCtx && key &&
+	    (us - s->m_baseUs >= m_segUs || s->m_written >= m_segBytes || us < s->m_lastUs)) {
+		s->CloseSegment();
+	}
+
+	if (!s->m_fmtCtx) {
+		if (!key || this->OpenSegment(s, us)) {
+			return;
+		}
+	}
+
+	if (us < s->m_baseUs || (!isVideo && s->m_fmtCtx->nb_streams < 2)) {
+		return;
+	}
+
+	AVStream *out = s->m_fmtCtx->streams[pkt->stream_index];
+	int64_t off = av_rescale_q(s->m_baseUs, AV_TIME_BASE_Q, tb);
+	if (pkt->pts != AV_NOPTS_VALUE) {
+		pkt->pts -= off;
+	}
+	if (pkt->dts != AV_NOPTS_VALUE) {
+		pkt->dts -= off;
+	}
+	av_packet_rescale_ts(pkt, tb, out->time_base);
+	pkt->pos = -1;
+
+	int64_t outDts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+	if (outDts <= s->m_lastDts[pkt->stream_index]) {
+		return;
+	}
+	s->m_lastDts[pkt->stream_index] = outDts;
+
+	int ret = av_write_frame(s->m_fmtCtx, pkt);
+	if (ret < 0) {
+		MS_LOG_WARN("record %s write frame err:%d", s->m_streamID.c_str(), ret);
+	} else if (key) {
+		// a key frame flushes the previous fragment and starts its own, so the pb position
+		// is where its moof goes. the first one follows the delayed moov, 0 plays from start
+		int64_t pos = s->m_keys.empty() ? 0 : avio_tell(s->m_fmtCtx->pb);
+		s->m_keys.emplace_back((us - s->m_baseUs) / 1000, pos);
+	}
+
+	if (us > s->m_lastUs) {
+		s->m_lastUs = us;
+	}
+}
+
+int MsRecordMgr::OpenSegment(MsRecordSession *s, int64_t us) {
+	if (!s->m_segVideoPar) {
+		return -1;
+	}
+
+	string dir = s->m_streamID;
+	for (auto &c : dir) {
+		if (!isalnum((unsigned char)c) && c != '-' && c != '_') {
+			c = '_';
+		}
+	}
+	dir = m_path + "/" + dir;
+	mkdir(dir.c_str(), 0755);
+
+	int64_t now = WallMs();
+	string path = dir + "/" + to_string(now) + ".mp4";
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		MS_LOG_ERROR("record open %s err:%d", path.c_str(), errno);
+		return -1;
+	}
+
+	// reserve the expected segment size up front so the file stays contiguous
+	int64_t prealloc = REC_DEF_PREALLOC;
+	if (s->m_byteRate > 0) {
+		prealloc = s->m_byteRate * (m_segUs / 1000000) * 11 / 10;
+	}
+	if (prealloc > m_segBytes) {
+		prealloc = m_segBytes;
+	}
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, prealloc)) {
+		MS_LOG_DEBUG("record fallocate %s err:%d", path.c_str(), errno);
+	}
+
+	AVFormatContext *ctx = nullptr;
+	AVIOContext *pb = nullptr;
+	AVDictionary *opts = nullptr;
+	AVStream *st;
+	int ret;
+
+	s->m_fd = fd;
+	s->m_written = 0;
+
+	avformat_alloc_output_context2(&ctx, nullptr, "mp4", nullptr);
+	pb = avio_alloc_context(
+	    static_cast<unsigned char *>(av_malloc(REC_IO_BUF_SIZE)), REC_IO_BUF_SIZE, 1, s, nullptr,
+	    [](void *opaque, IO_WRITE_BUF_TYPE *buf, int size) -> int {
+		    MsRecordSession *s = static_cast<MsRecordSession *>(opaque);
+		    int left = size;
+		    while (left > 0) {
+			    ssize_t n = write(s->m_fd, buf + (size - left), left);
+			    if (n < 0) {
+				    if (errno == EINTR) {
+					    continue;
+				    }
+				    MS_LOG_ERROR("record write %s err:%d", s->m_path.c_str(), errno);
+				    return AVERROR(EIO);
+			    }
+			    left -= n;
+		    }
+		    s->m_written += size;
+		    return size;
+	    },
+	    nullptr);
+
+	if (!ctx || !pb) {
+		MS_LOG_ERROR("record alloc mp4 context failed");
+		goto err;
+	}
+
+	ctx->pb = pb;
+	ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	st = avformat_new_stream(ctx, NULL);
+	avcodec_parameters_copy(st->codecpar, s->m_segVideoPar);
+	st->codecpar->codec_tag = 0;
+	st->time_base = s->m_segVideoTb;
+
+	if (s->m_segAudioPar) {
+		st = avformat_new_stream(ctx, NULL);
+		avcodec_parameters_copy(st->codecpar, s->m_segAudioPar);
+		st->codecpar->codec_tag = 0;
+		st->time_base = s->m_segAudioTb;
+	}
+
+	// fragments keep the file playable while it grows and after a crash, delay_moov
+	// waits for the first packet when the source has no extradata
+	av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+delay_moov+default_base_moof", 0);
+	ret = avformat_write_header(ctx, &opts);
+	av_dict_free(&opts);
+	if (ret < 0) {
+		MS_LOG_ERROR("record write header %s err:%d", path.c_str(), ret);
+		goto err;
+	}
+
+	s->m_fmtCtx = ctx;
+	s->m_path = path;
+	s->m_startMs = now;
+	s->m_baseUs = us;
+	s->m_lastUs = us;
+	s->m_lastDts[0] = INT64_MIN;
+	s->m_lastDts[1] = INT64_MIN;
+	s->m_keys.clear();
+
+	MS_LOG_DEBUG("record %s new segment %s", s->m_streamID.c_str(), path.c_str());
+	return 0;
+
+err:
+	if (pb) {
+		av_freep(&pb->buffer);
+		avio_context_free(&pb);
+	}
+	if (ctx) {
+		avformat_free_context(ctx);
+	}
+	close(fd);
+	s->m_fd = -1;
+	unlink(path.c_str());
+	return -1;
+}
+
+// drop segments older than recordKeepDays, then the oldest ones while over recordQuotaMB
+void MsRecordMgr::Retention() {
+	int days = MsConfig::Instance()->GetConfigInt("recordKeepDays");
+	int64_t quota = (int64_t)MsConfig::Instance()->GetConfigInt("recordQuotaMB") * 1024 * 1024;
+	int64_t before = WallMs() - (int64_t)(days > 0 ? days : REC_DEF_KEEP_DAYS) * 86400000;
+
+	vector<pair<int64_t, string>> del;
+	sqlite3_stmt *stmt;
+	// segments still in the db queue are left for the next round
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
+
+	int rc = sqlite3_prepare_v2(pSql, "SELECT id, path FROM t_record WHERE end_ms < ?", -1, &stmt,
+	                            NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_int64(stmt, 1, before);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			del.emplace_back(sqlite3_column_int64(stmt, 0),
+			                 (const char *)sqlite3_column_text(stmt, 1));
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	if (quota > 0) {
+		int64_t total = 0;
+		rc = sqlite3_prepare_v2(pSql, "SELECT SUM(size) FROM t_record WHERE end_ms >= ?", -1,
+		                        &stmt, NULL);
+		if (rc == SQLITE_OK) {
+			sqlite3_bind_int64(stmt, 1, before);
+			if (sqlite3_step(stmt) == SQLITE_ROW) {
+				total = sqlite3_column_int64(stmt, 0);
+			}
+			sqlite3_finalize(stmt);
+		}
+
+		if (total > quota) {
+			rc = sqlite3_prepare_v2(pSql,
+			                        "SELECT id, path, size FROM t_record WHERE end_ms >= ? "
+			                        "ORDER BY start_ms LIMIT 1000",
+			                        -1, &stmt, NULL);
+			if (rc == SQLITE_OK) {
+				sqlite3_bind_int64(stmt, 1, before);
+				while (total > quota && sqlite3_step(stmt) == SQLITE_ROW) {
+					del.emplace_back(sqlite3_column_int64(stmt, 0),
+					                 (const char *)sqlite3_column_text(stmt, 1));
+					total -= sqlite3_column_int64(stmt, 2);
+				}
+				sqlite3_finalize(stmt);
+			}
+		}
+	}
+
+	MsDbMgr::Instance()->RelReadSql();
+
+	if (del.empty()) {
+		return;
+	}
+
+	vector<MsDbCmd> cmds;
+	for (auto &d : del) {
+		if (unlink(d.second.c_str()) && errno != ENOENT) {
+			MS_LOG_WARN("record remove %s err:%d", d.second.c_str(), errno);
+			continue;
+		}
+
+		MsDbCmd cmd("DELETE FROM t_record WHERE id = ?");
+		cmd.Bind(d.first);
+		cmds.push_back(cmd);
+	}
+
+	MS_LOG_INFO("record retention removed %d segments", (int)cmds.size());
+	MsDbMgr::Instance()->PostCmd(cmds);
+}
+
+MsRecordMgr *MsRecordMgr::Instance() {
+	if (MsRecordMgr::m_instance.get()) {
+		return MsRecordMgr::m_instance.get();
+	} else {
+		lock_guard<mutex> lk(MsRecordMgr::m_instMutex);
+
+		if (MsRecordMgr::m_instance.get()) {
+			return MsRecordMgr::m_instance.get();
+		} else {
+			MsRecordMgr::m_instance = make_unique<MsRecordMgr>();
+			return MsRecordMgr::m_instance.get();
+		}
+	}
+}
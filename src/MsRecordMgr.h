@@ -0,0 +1,58 @@
+#ifndef MS_RECORD_MGR_H
+#define MS_RECORD_MGR_H
+#include "MsRecordSink.h"
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// continuous recording of live streams into fragmented mp4 segments under recordPath.
+// sinks only queue packets, muxing, disk writes, segment rolling and retention all run
+// on the record thread. tasks are kept in t_record_task and reattached when the source
+// goes away, segments are listed in t_record
+class MsRecordMgr {
+public:
+	MsRecordMgr();
+	~MsRecordMgr();
+
+	int Init();
+	int Start(const string &streamID);
+	int Stop(const string &streamID);
+	bool IsRecording(const string &streamID);
+	void Exit();
+
+	static MsRecordMgr *Instance();
+
+private:
+	struct STask {
+		shared_ptr<MsRecordSink> m_sink;
+		int64_t m_retryMs = 0;
+	};
+
+	void OnRun();
+	void Attach(const string &streamID);
+	void Drain(shared_ptr<MsRecordSession> &session);
+	void WritePacket(MsRecordSession *s, AVPacket *pkt);
+	int OpenSegment(MsRecordSession *s, int64_t us);
+	void Retention();
+
+	string m_path;
+	int64_t m_segUs;
+	int64_t m_segBytes;
+
+	mutex m_mutex;
+	condition_variable m_cond;
+	bool m_exit;
+	int m_seqID;
+	map<string, STask> m_tasks;
+	vector<shared_ptr<MsRecordSession>> m_closing;
+	unique_ptr<thread> m_worker;
+
+	static unique_ptr<MsRecordMgr> m_instance;
+	static mutex m_instMutex;
+};
+
+#endif // MS_RECORD_MGR_H
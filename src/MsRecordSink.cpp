@@ -0,0 +1,160 @@
+#include "MsRecordSink.h"
+#include "MsConfig.h"
+#include "MsDbMgr.h"
+#include "MsLog.h"
+#include "nlohmann/json.hpp"
+#include <errno.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+#define REC_DEF_QUEUE_BYTES (16 * 1024 * 1024)
+
+MsRecordSession::~MsRecordSession() {
+	this->CloseSegment();
+	this->ClearQueue();
+	avcodec_parameters_free(&m_videoPar);
+	avcodec_parameters_free(&m_audioPar);
+	avcodec_parameters_free(&m_segVideoPar);
+	avcodec_parameters_free(&m_segAudioPar);
+}
+
+// finish the open segment and list it in t_record, an empty one is removed
+void MsRecordSession::CloseSegment() {
+	if (!m_fmtCtx) {
+		return;
+	}
+
+	av_write_trailer(m_fmtCtx);
+	avio_flush(m_fmtCtx->pb);
+	av_freep(&m_fmtCtx->pb->buffer);
+	avio_context_free(&m_fmtCtx->pb);
+	avformat_free_context(m_fmtCtx);
+	m_fmtCtx = nullptr;
+
+	// give back what the preallocation reserved past the end
+	if (ftruncate(m_fd, m_written)) {
+		MS_LOG_DEBUG("record truncate %s err:%d", m_path.c_str(), errno);
+	}
+	close(m_fd);
+	m_fd = -1;
+
+	int64_t durMs = (m_lastUs - m_baseUs) / 1000;
+	if (durMs <= 0 || m_written <= 0) {
+		unlink(m_path.c_str());
+		return;
+	}
+
+	m_byteRate = m_written * 1000 / durMs;
+
+	vector<uint8_t> keys = json::to_cbor(m_keys);
+
+	MsDbCmd cmd("INSERT INTO t_record (stream_id, path, start_ms, end_ms, size, keys) "
+	            "VALUES (?, ?, ?, ?, ?, ?)");
+	cmd.Bind(m_streamID)
+	    .Bind(m_path)
+	    .Bind(m_startMs)
+	    .Bind(m_startMs + durMs)
+	    .Bind(m_written)
+	    .BindBlob(string(keys.begin(), keys.end()));
+	MsDbMgr::Instance()->PostCmd(cmd);
+}
+
+
+void MsRecordSession::ClearQueue() {
+	for (auto pkt : m_queue) {
+		av_packet_free(&pkt);
+	}
+	m_queue.clear();
+	m_queBytes = 0;
+}
+
+MsRecordSink::MsRecordSink(const string &streamID, int sinkID,
+                           shared_ptr<MsRecordSession> session)
+    : MsMediaSink("record", streamID, sinkID), m_session(session) {
+	m_maxBytes = MsConfig::Instance()->GetConfigInt("recordQueueBytes");
+	if (m_maxBytes <= 0) {
+		m_maxBytes = REC_DEF_QUEUE_BYTES;
+	}
+}
+
+void MsRecordSink::OnStreamInfo(AVStream *video, int videoIdx, AVStream *audio, int audioIdx) {
+	if (!video) {
+		return;
+	}
+
+	MsMediaSink::OnStreamInfo(video, videoIdx, audio, audioIdx);
+
+	lock_guard<mutex> lk(m_session->m_mutex);
+
+	// packets queued so far belong to the old parameters
+	m_session->ClearQueue();
+	m_session->m_waitKey = true;
+
+	avcodec_parameters_free(&m_session->m_videoPar);
+	avcodec_parameters_free(&m_session->m_audioPar);
+
+	m_session->m_videoPar = avcodec_parameters_alloc();
+	avcodec_parameters_copy(m_session->m_videoPar, video->codecpar);
+	m_session->m_videoTb = video->time_base;
+
+	if (audio) {
+		m_session->m_audioPar = avcodec_parameters_alloc();
+		avcodec_parameters_copy(m_session->m_audioPar, audio->codecpar);
+		m_session->m_audioTb = audio->time_base;
+	}
+
+	++m_session->m_infoSeq;
+}
+
+void MsRecordSink::OnSourceClose() {
+	lock_guard<mutex> lk(m_session->m_mutex);
+	m_session->m_closed = true;
+}
+
+// the segment start times are wall clock, the outage would otherwise shift all that follows
+void MsRecordSink::OnDiscontinuity() {
+	lock_guard<mutex> lk(m_session->m_mutex);
+	if (!m_session->m_closed && (m_session->m_queue.empty() || m_session->m_queue.back())) {
+		m_session->m_queue.push_back(nullptr);
+	}
+}
+
+void MsRecordSink::OnStreamPacket(AVPacket *pkt) {
+	bool isVideo = pkt->stream_index == m_videoIdx;
+	if (!isVideo && (!m_audio || pkt->stream_index != m_audioIdx)) {
+		return;
+	}
+
+	if (pkt->dts == AV_NOPTS_VALUE && pkt->pts == AV_NOPTS_VALUE) {
+		return;
+	}
+
+	lock_guard<mutex> lk(m_session->m_mutex);
+	if (m_session->m_closed || !m_session->m_infoSeq) {
+		return;
+	}
+
+	if (m_session->m_waitKey) {
+		if (!isVideo || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+			return;
+		}
+		m_session->m_waitKey = false;
+	}
+
+	// the disk fell behind, drop up to the next key frame rather than stall the source
+	if (m_session->m_queBytes + pkt->size > m_maxBytes) {
+		MS_LOG_WARN("record %s queue full, drop to next key frame", m_streamID.c_str());
+		m_session->m_waitKey = true;
+		return;
+	}
+
+	AVPacket *p = av_packet_clone(pkt);
+	if (!p) {
+		return;
+	}
+
+	p->stream_index = isVideo ? 0 : 1;
+	m_session->m_queue.push_back(p);
+	m_session->m_queBytes += p->size;
+}
@@ -0,0 +1,70 @@
+#ifndef MS_RECORD_SINK_H
+#define MS_RECORD_SINK_H
+#include "MsMediaSink.h"
+#include <deque>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// queue between a recorded source and the record thread. the sink side fields are
+// guarded by m_mutex, the segment fields below them belong to the record thread only
+class MsRecordSession {
+public:
+	MsRecordSession(const string &streamID) : m_streamID(streamID) {}
+	~MsRecordSession();
+
+	void ClearQueue();
+	// record thread, or the last owner when the session is dropped with a segment open
+	void CloseSegment();
+
+	string m_streamID;
+
+	mutex m_mutex;
+	AVCodecParameters *m_videoPar = nullptr;
+	AVCodecParameters *m_audioPar = nullptr;
+	AVRational m_videoTb = {1, 90000};
+	AVRational m_audioTb = {1, 90000};
+	int m_infoSeq = 0;
+	bool m_closed = false;
+	bool m_waitKey = true;
+	// a null packet marks a discontinuity of the source, the segment is cut there
+	deque<AVPacket *> m_queue;
+	int64_t m_queBytes = 0;
+
+	// record thread
+	AVCodecParameters *m_segVideoPar = nullptr;
+	AVCodecParameters *m_segAudioPar = nullptr;
+	AVRational m_segVideoTb = {1, 90000};
+	AVRational m_segAudioTb = {1, 90000};
+	int m_segInfoSeq = 0;
+	AVFormatContext *m_fmtCtx = nullptr;
+	int m_fd = -1;
+	string m_path;
+	int64_t m_written = 0;
+	int64_t m_startMs = 0;
+	int64_t m_baseUs = 0;
+	int64_t m_lastUs = 0;
+	int64_t m_lastDts[2] = {INT64_MIN, INT64_MIN};
+	int64_t m_byteRate = 0;
+	// key frames of the open segment, ms from its start and offset of their fragment
+	vector<pair<int64_t, int64_t>> m_keys;
+};
+
+// copies packets of a live source into its MsRecordSession, never blocks the source
+class MsRecordSink : public MsMediaSink {
+public:
+	MsRecordSink(const string &streamID, int sinkID, shared_ptr<MsRecordSession> session);
+
+	void OnStreamInfo(AVStream *video, int videoIdx, AVStream *audio, int audioIdx) override;
+	void OnSourceClose() override;
+	void OnDiscontinuity() override;
+	void OnStreamPacket(AVPacket *pkt) override;
+
+	shared_ptr<MsRecordSession> m_session;
+
+private:
+	int64_t m_maxBytes;
+};
+
+#endif // MS_RECORD_SINK_H
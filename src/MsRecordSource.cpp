@@ -0,0 +1,282 @@
+#include "MsRecordSource.h"
+#include "MsDbMgr.h"
+#include "MsFileIo.h"
+#include "MsFileProbe.h"
+#include "MsLog.h"
+#include "nlohmann/json.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavutil/intreadwrite.h>
+}
+
+using json = nlohmann::json;
+
+// offset of the first moof box in a fragmented mp4, the header ends there
+static int64_t FindFirstMoof(int fd, int64_t size) {
+	int64_t off = 0;
+	uint8_t hdr[16];
+
+	while (off + 8 <= size) {
+		if (MsFileIo::Pread(fd, hdr, sizeof(hdr), off) < 8) {
+			return -1;
+		}
+
+		if (!memcmp(hdr + 4, "moof", 4)) {
+			return off;
+		}
+
+		int64_t len = AV_RB32(hdr);
+		if (len == 1) {
+			len = AV_RB64(hdr + 8);
+		}
+		if (len < 8) {
+			return -1;
+		}
+		off += len;
+	}
+
+	return -1;
+}
+
+static bool IsMoof(int fd, int64_t pos) {
+	uint8_t hdr[8];
+	return MsFileIo::Pread(fd, hdr, sizeof(hdr), pos) == 8 && !memcmp(hdr + 4, "moof", 4);
+}
+
+MsRecordSource::~MsRecordSource() {
+	if (m_infoCtx) {
+		MsFileProbe::Close(&m_infoCtx);
+	}
+}
+
+int MsRecordSource::LoadSegs() {
+	sqlite3_stmt *stmt;
+	auto pSql = MsDbMgr::Instance()->GetReadSql();
+	int rc = sqlite3_prepare_v2(pSql,
+	                            "SELECT path, start_ms, end_ms, keys FROM t_record WHERE "
+	                            "stream_id = ? AND end_ms > ? AND start_ms < ? ORDER BY start_ms",
+	                            -1, &stmt, NULL);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, m_filename.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int64(stmt, 2, m_startMs);
+		sqlite3_bind_int64(stmt, 3, m_endMs);
+
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			SRecordSeg seg;
+			seg.m_path = (const char *)sqlite3_column_text(stmt, 0);
+			seg.m_startMs = sqlite3_column_int64(stmt, 1);
+			seg.m_endMs = sqlite3_column_int64(stmt, 2);
+
+			const uint8_t *p = (const uint8_t *)sqlite3_column_blob(stmt, 3);
+			int n = sqlite3_column_bytes(stmt, 3);
+			if (p && n > 0) {
+				try {
+					seg.m_keys = json::from_cbor(p, p + n)
+					                 .get<std::vector<std::pair<int64_t, int64_t>>>();
+				} catch (json::exception &e) {
+					MS_LOG_WARN("record %s bad key index", seg.m_path.c_str());
+				}
+			}
+
+			m_segs.push_back(seg);
+		}
+		sqlite3_finalize(stmt);
+	}
+	MsDbMgr::Instance()->RelReadSql();
+
+	return m_segs.empty() ? -1 : 0;
+}
+
+void MsRecordSource::Locate(int64_t wallMs, size_t &idx, int64_t &offMs) {
+	for (idx = 0; idx + 1 < m_segs.size(); ++idx) {
+		if (m_segs[idx].m_endMs > wallMs) {
+			break;
+		}
+	}
+
+	offMs = wallMs - m_segs[idx].m_startMs;
+	if (offMs < 0) {
+		offMs = 0;
+	}
+}
+
+// open segment idx at the key frame at or before offMs
+int MsRecordSource::OpenSeg(size_t idx, int64_t offMs) {
+	SRecordSeg &seg = m_segs[idx];
+	int64_t keyMs = 0;
+	int64_t keyPos = 0;
+
+	for (auto &k : seg.m_keys) {
+		if (k.first > offMs) {
+			break;
+		}
+		keyMs = k.first;
+		keyPos = k.second;
+	}
+
+	// leave out the fragments before the key frame, the demuxer then starts right there
+	int64_t headEnd = 0;
+	if (keyPos > 0) {
+		int fd = open(seg.m_path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd >= 0 && !fstat(fd, &st)) {
+			headEnd = FindFirstMoof(fd, st.st_size);
+			if (headEnd <= 0 || headEnd > keyPos || !IsMoof(fd, keyPos)) {
+				headEnd = 0;
+				keyPos = 0;
+			}
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	AVFormatContext *ctx = nullptr;
+	int ret = MsFileProbe::OpenFragment(seg.m_path, headEnd, keyPos, &ctx);
+	if (ret < 0) {
+		MS_LOG_WARN("record open %s err:%d", seg.m_path.c_str(), ret);
+		return -1;
+	}
+
+	if (offMs > 0 && keyPos <= 0) {
+		ret = av_seek_frame(ctx, -1, offMs * 1000, AVSEEK_FLAG_BACKWARD);
+		if (ret < 0) {
+			MS_LOG_WARN("record seek %s %lldms err:%d", seg.m_path.c_str(), (long long)offMs,
+			            ret);
+		}
+	}
+
+	MS_LOG_DEBUG("record %s open %s at key %lldms", m_streamID.c_str(), seg.m_path.c_str(),
+	             (long long)keyMs);
+
+	// the sinks keep pointing at the streams of the first segment
+	if (m_fmtCtx) {
+		if (!m_infoCtx) {
+			m_infoCtx = m_fmtCtx;
+		} else {
+			MsFileProbe::Close(&m_fmtCtx);
+		}
+	}
+
+	m_fmtCtx = ctx;
+	m_segIdx = idx;
+	m_seekWaitKey = true;
+	m_newSeg = true;
+	return 0;
+}
+
+int MsRecordSource::Open() {
+	if (this->LoadSegs()) {
+		MS_LOG_WARN("no record of %s in range", m_filename.c_str());
+		return -1;
+	}
+
+	size_t idx;
+	int64_t offMs;
+	this->Locate(m_startMs, idx, offMs);
+
+	for (; idx < m_segs.size(); ++idx, offMs = 0) {
+		if (!this->OpenSeg(idx, offMs)) {
+			break;
+		}
+	}
+
+	if (!m_fmtCtx) {
+		return -1;
+	}
+
+	for (unsigned i = 0; i < m_fmtCtx->nb_streams; ++i) {
+		AVStream *st = m_fmtCtx->streams[i];
+		if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && !m_video) {
+			m_videoIdx = i;
+			m_video = st;
+		} else if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && !m_audio &&
+		           (st->codecpar->codec_id == AV_CODEC_ID_AAC ||
+		            st->codecpar->codec_id == AV_CODEC_ID_OPUS)) {
+			m_audioIdx = i;
+			m_audio = st;
+		}
+	}
+
+	if (!m_video) {
+		MS_LOG_ERROR("no video in record of %s", m_filename.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+int MsRecordSource::ReadPacket(AVPacket *pkt, bool block) {
+	while (true) {
+		int ret = av_read_frame(m_fmtCtx, pkt);
+		if (ret < 0) {
+			if (ret == AVERROR(EAGAIN)) {
+				return ret;
+			}
+
+			// continue with the next segment, skip those removed meanwhile
+			size_t idx = m_segIdx + 1;
+			while (idx < m_segs.size() && m_segs[idx].m_startMs < m_endMs) {
+				if (!this->OpenSeg(idx, 0)) {
+					break;
+				}
+				++idx;
+			}
+			if (idx >= m_segs.size() || m_segs[idx].m_startMs >= m_endMs) {
+				return AVERROR_EOF;
+			}
+			continue;
+		}
+
+		AVStream *in = m_fmtCtx->streams[pkt->stream_index];
+		AVStream *out = nullptr;
+		int outIdx = -1;
+		if (in->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+			out = m_video;
+			outIdx = m_videoIdx;
+		} else if (in->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && m_audio &&
+		           in->codecpar->codec_id == m_audio->codecpar->codec_id) {
+			out = m_audio;
+			outIdx = m_audioIdx;
+		}
+
+		if (!out) {
+			av_packet_unref(pkt);
+			continue;
+		}
+
+		if (in->codecpar->codec_id != out->codecpar->codec_id) {
+			MS_LOG_WARN("record %s codec changed in %s", m_streamID.c_str(),
+			            m_segs[m_segIdx].m_path.c_str());
+			av_packet_unref(pkt);
+			return AVERROR_EOF;
+		}
+
+		// stop at the end of the range
+		int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+		if (dts != AV_NOPTS_VALUE &&
+		    m_segs[m_segIdx].m_startMs + av_rescale_q(dts, in->time_base, {1, 1000}) >
+		        m_endMs) {
+			av_packet_unref(pkt);
+			return AVERROR_EOF;
+		}
+
+		av_packet_rescale_ts(pkt, in->time_base, out->time_base);
+		pkt->stream_index = outIdx;
+		return 0;
+	}
+}
+
+void MsRecordSource::SeekInput(int64_t ms) {
+	size_t idx;
+	int64_t offMs;
+	this->Locate(m_startMs + ms, idx, offMs);
+
+	if (this->OpenSeg(idx, offMs)) {
+		MS_LOG_WARN("record %s seek %lldms failed", m_streamID.c_str(), (long long)ms);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef MS_RECORD_SOURCE_H
+#define MS_RECORD_SOURCE_H
+#include "MsFileSource.h"
+#include <vector>
+
+// plays the local recordings of a stream between two wall clock times. segments are
+// stitched into one timeline, gaps between them are left out. a start or seek opens
+// the segment right at the fragment of the nearest key frame from its t_record index.
+// seek positions are ms of wall clock from startMs
+class MsRecordSource : public MsFileSource {
+public:
+	MsRecordSource(const std::string &streamID, const std::string &recStreamID,
+	               int64_t startMs, int64_t endMs)
+	    : MsFileSource(streamID, recStreamID), m_startMs(startMs), m_endMs(endMs) {}
+	~MsRecordSource();
+
+protected:
+	int Open() override;
+	int ReadPacket(AVPacket *pkt, bool block) override;
+	void SeekInput(int64_t ms) override;
+
+private:
+	struct SRecordSeg {
+		std::string m_path;
+		int64_t m_startMs;
+		int64_t m_endMs;
+		std::vector<std::pair<int64_t, int64_t>> m_keys;
+	};
+
+	int LoadSegs();
+	void Locate(int64_t wallMs, size_t &idx, int64_t &offMs);
+	int OpenSeg(size_t idx, int64_t offMs);
+
+	int64_t m_startMs;
+	int64_t m_endMs;
+	std::vector<SRecordSeg> m_segs;
+	size_t m_segIdx = 0;
+	// the first opened segment, its streams were handed to the sinks
+	AVFormatContext *m_infoCtx = nullptr;
+};
+
+#endif // MS_RECORD_SOURCE_H
@@ -1,5 +1,24 @@
 #include "MsResManager.h"
+#include "MsCommon.h"
+#include "MsConfig.h"
 #include "MsSourceFactory.h"
+#include <set>
+
+#define MS_WARM_CHECK_MS 100
+#define MS_DEF_WARM_STAGGER_MS 200
+
+// holds an always-on source open, packets only tell that the source played
+class MsWarmSink : public MsMediaSink {
+public:
+	MsWarmSink(const std::string &streamID, int sinkID)
+	    : MsMediaSink(MS_WARM_SINK, streamID, sinkID) {}
+
+	void OnSourceClose() override { m_closed = true; }
+	void OnStreamPacket(AVPacket *pkt) override { m_played = true; }
+
+	std::atomic<bool> m_closed{false};
+	std::atomic<bool> m_played{false};
+};
 
 // Static member initialization
 std::mutex MsResManager::m_instanceMutex;
@@ -46,6 +65,24 @@ std::shared_ptr<MsMediaSource> MsResManager::GetMediaSource(const std::string &k
 	return nullptr;
 }
 
+void MsResManager::GetLoad(int &sources, int &sinks, std::vector<std::string> &streams) {
+	std::vector<std::shared_ptr<MsMediaSource>> all;
+	{
+		std::lock_guard<std::mutex> lock(m_mapMutex);
+		for (auto &it : m_mediaSources) {
+			streams.push_back(it.first);
+			all.push_back(it.second);
+		}
+	}
+
+	// sink locks are not taken under the map lock, sources add themselves holding theirs
+	sources = all.size();
+	sinks = 0;
+	for (auto &s : all) {
+		sinks += s->GetSinkCount();
+	}
+}
+
 shared_ptr<MsMediaSource> MsResManager::GetOrCreateMediaSource(const std::string &type,
                                                                const std::string &streamID,
                                                                const std::string &streamInfo,
@@ -62,6 +99,7 @@ shared_ptr<MsMediaSource> MsResManager::GetOrCreateMediaSource(const std::string
 				MS_LOG_WARN("create source failed for stream: %s", streamID.c_str());
 				return nullptr;
 			} else {
+				source->EnableTimeshift();
 				source->AddSink(sink);
 				source->Work();
 				return source;
@@ -99,8 +137,129 @@ shared_ptr<MsMediaSource> MsResManager::GetOrCreateMediaSource(const std::string
 			source->Work();
 			return source;
 		}
+	} else if (type == "timeshift") {
+		source = MsSourceFactory::CreateTimeshiftSource(streamID, streamInfo);
+		if (!source) {
+			MS_LOG_WARN("create source failed for stream: %s", streamID.c_str());
+			return nullptr;
+		} else {
+			source->AddSink(sink);
+			source->Work();
+			return source;
+		}
+	} else if (type == "recvod") {
+		source = this->GetMediaSource(streamID);
+		if (source) {
+			MS_LOG_WARN("recvod source already exists for stream: %s", streamID.c_str());
+			return nullptr;
+		}
+
+		source = MsSourceFactory::CreateRecvodSource(streamID, streamInfo);
+		if (!source) {
+			MS_LOG_WARN("create source failed for stream: %s", streamID.c_str());
+			return nullptr;
+		} else {
+			source->AddSink(sink);
+			source->Work();
+			return source;
+		}
 	} else {
 		MS_LOG_WARN("unsupported source type: %s", type.c_str());
 		return nullptr;
 	}
 }
+
+void MsResManager::StartWarm() {
+	if (m_warmWorker) {
+		return;
+	}
+
+	int stagger = MsConfig::Instance()->GetConfigInt("warmStaggerMs");
+	m_warmStagger = stagger > 0 ? stagger : MS_DEF_WARM_STAGGER_MS;
+	m_warmStreams = MsConfig::Instance()->GetConfigStr("warmStreams");
+
+	m_warmWorker = std::make_unique<std::thread>(&MsResManager::WarmRun, this);
+	m_warmWorker->detach();
+}
+
+void MsResManager::SetWarmStreams(const std::string &streams) {
+	{
+		std::lock_guard<std::mutex> lk(m_warmMutex);
+		m_warmStreams = streams;
+	}
+	m_warmCond.notify_one();
+}
+
+void MsResManager::WarmRun() {
+	int64_t nextMs = 0;
+
+	while (true) {
+		std::string streams;
+		int stagger;
+
+		// woken by a new list, or on the check interval for retries
+		{
+			std::unique_lock<std::mutex> lk(m_warmMutex);
+			m_warmCond.wait_for(lk, std::chrono::milliseconds(MS_WARM_CHECK_MS));
+			streams = m_warmStreams;
+			stagger = m_warmStagger;
+		}
+
+		std::set<std::string> ids;
+		for (auto &id : SplitString(streams, ",")) {
+			size_t b = id.find_first_not_of(" \t");
+			size_t e = id.find_last_not_of(" \t");
+			if (b != std::string::npos) {
+				ids.insert(id.substr(b, e - b + 1));
+			}
+		}
+
+		for (auto it = m_warm.begin(); it != m_warm.end();) {
+			if (ids.count(it->first)) {
+				++it;
+				continue;
+			}
+			MS_LOG_INFO("warm %s removed", it->first.c_str());
+			if (it->second.m_sink) {
+				it->second.m_sink->DetachSource();
+			}
+			it = m_warm.erase(it);
+		}
+
+		int64_t now = GetCurMs();
+		for (auto &id : ids) {
+			SWarm &warm = m_warm[id];
+
+			if (warm.m_sink && warm.m_sink->m_closed) {
+				// a source that played starts over from the shortest wait
+				if (warm.m_sink->m_played) {
+					warm.m_tries = 0;
+				}
+				warm.m_sink = nullptr;
+				warm.m_retryMs = now + MsMediaSource::ReconnectDelayMs(warm.m_tries++);
+				MS_LOG_WARN("warm %s source closed, retry in %lld ms", id.c_str(),
+				            (long long)(warm.m_retryMs - now));
+			}
+
+			// one startup per stagger, a long list does not send its invites in a burst
+			if (!warm.m_sink && now >= warm.m_retryMs && now >= nextMs) {
+				this->WarmAttach(id, warm);
+				nextMs = now + stagger;
+			}
+		}
+	}
+}
+
+void MsResManager::WarmAttach(const std::string &streamID, SWarm &warm) {
+	auto sink = std::make_shared<MsWarmSink>(streamID, ++m_warmSeq);
+	auto source = this->GetOrCreateMediaSource("live", streamID, "", sink);
+
+	if (!source) {
+		warm.m_retryMs = GetCurMs() + MsMediaSource::ReconnectDelayMs(warm.m_tries++);
+		MS_LOG_WARN("warm %s no source, retry later", streamID.c_str());
+		return;
+	}
+
+	warm.m_sink = sink;
+	MS_LOG_INFO("warm %s attached", streamID.c_str());
+}
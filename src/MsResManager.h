@@ -2,7 +2,11 @@
 #define MS_RES_MANAGER_H
 
 #include "MsMediaSource.h"
+#include <condition_variable>
 #include <map>
+#include <thread>
+
+class MsWarmSink;
 
 class MsResManager {
 public:
@@ -17,6 +21,16 @@ public:
 	                                                 const std::string &streamInfo,
 	                                                 shared_ptr<MsMediaSink> sink);
 
+	// keep the live sources of warmStreams running from startup, each under a sink of
+	// its own so the first viewer starts from the cached gop. a source that fails is
+	// opened again after the reconnect backoff, startups are spread by warmStaggerMs
+	void StartWarm();
+	// new warmStreams from /sys/config, handed to the warm thread
+	void SetWarmStreams(const std::string &streams);
+
+	// sources running and sinks attached to them, ids of the sources
+	void GetLoad(int &sources, int &sinks, std::vector<std::string> &streams);
+
 private:
 	MsResManager() = default;
 	~MsResManager() = default;
@@ -29,6 +43,24 @@ private:
 
 	std::mutex m_mapMutex;
 	std::map<std::string, std::shared_ptr<MsMediaSource>> m_mediaSources;
+
+	struct SWarm {
+		std::shared_ptr<MsWarmSink> m_sink;
+		int m_tries = 0;
+		int64_t m_retryMs = 0;
+	};
+
+	void WarmRun();
+	void WarmAttach(const std::string &streamID, SWarm &warm);
+
+	std::mutex m_warmMutex;
+	std::condition_variable m_warmCond;
+	std::map<std::string, SWarm> m_warm;
+	// guarded by m_warmMutex, the warm thread never reads MsConfig
+	std::string m_warmStreams;
+	int m_warmStagger = 0;
+	int m_warmSeq = 0;
+	std::unique_ptr<std::thread> m_warmWorker;
 };
 
 #endif // MS_RES_MANAGER_H
@@ -2,6 +2,7 @@
 #include "MsCommon.h"
 #include "MsConfig.h"
 #include "MsResManager.h"
+#include "MsSourceFactory.h"
 #include "MsRtcSink.h"
 
 void MsRtcServer::Run() {
@@ -334,18 +335,41 @@ void MsRtcServer::WhipProcess(shared_ptr<SHttpTransferMsg> rtcMsg) {
 				track->onMessage(
 				    [peerConn](rtc::binary message) {
 					    if (peerConn) {
-						    auto rtp = reinterpret_cast<rtc::RtpHeader *>(message.data());
-						    if (rtp->payloadType() == peerConn->_videoPt ||
-						        rtp->payloadType() == peerConn->_audioPt) {
-							    peerConn->WriteBuffer(message.data(), message.size());
-						    }
+						    peerConn->OnRtp(reinterpret_cast<const uint8_t *>(message.data()),
+						                    message.size());
 					    }
 				    },
 				    nullptr);
 			}
 
+			// retransmissions of the video come as rtx when the offer has it
+			if (mediaType == "video") {
+				std::lock_guard<std::mutex> lock(m_mtx);
+				auto it = m_pcMap.find(sessionId);
+				if (it != m_pcMap.end() && it->second->_videoTrack == track) {
+					string apt = to_string(it->second->_videoPt);
+					for (auto &pt : media.payloadTypes()) {
+						rtc::Description::Media::RtpMap *rtpMap = nullptr;
+						try {
+							rtpMap = media.rtpMap(pt);
+						} catch (...) {
+							continue;
+						}
+						if (rtpMap->format != "rtx") {
+							continue;
+						}
+						for (auto &fmtp : rtpMap->fmtps) {
+							if (MsRtpDepack::FmtpValue(fmtp, "apt") == apt) {
+								it->second->_videoRtxPt = pt;
+							}
+						}
+					}
+				}
+			}
+
 			track->setDescription(std::move(media));
 
+			shared_ptr<MsRtcSource> ready;
 			{
 				std::lock_guard<std::mutex> lock(m_mtx);
 				auto it = m_pcMap.find(sessionId);
@@ -355,11 +379,13 @@ void MsRtcServer::WhipProcess(shared_ptr<SHttpTransferMsg> rtcMsg) {
 					if (peerConn->_receivedTracks == peerConn->_expectedTracks) {
 						MS_LOG_INFO("pc:%s all %d tracks received", sessionId.c_str(),
 						            peerConn->_expectedTracks);
-						peerConn->m_rtpThread =
-						    std::make_unique<std::thread>(&MsRtcSource::StartRtpDemux, peerConn);
+						ready = peerConn;
 					}
 				}
 			}
+			if (ready) {
+				ready->StartDepack();
+			}
 		});
 
 		pc->onLocalDescription([](rtc::Description description) {});
@@ -450,8 +476,9 @@ void MsRtcServer::WhepProcess(shared_ptr<SHttpTransferMsg> rtcMsg) {
 	shared_ptr<MsSocket> &sock = rtcMsg->sock;
 	string &sdp = rtcMsg->body;
 	if (msg.m_method == "POST") {
-		// Parse stream ID from URI: /whep/{streamId}
-		string streamId;
+		// Parse stream ID from URI: /whep/{streamId}, or /whep/recvod/{streamId}/{streamInfo}
+		// for local recordings
+		string streamId, type = "live", streamInfo;
 		size_t pos = msg.m_uri.find("whep/");
 		if (pos != string::npos) {
 			string path = msg.m_uri.substr(pos + 5); // after "whep/"
@@ -461,6 +488,15 @@ void MsRtcServer::WhepProcess(shared_ptr<SHttpTransferMsg> rtcMsg) {
 				path = path.substr(0, qpos);
 			}
 			streamId = path;
+
+			vector<string> s = SplitString(path, "/");
+			if (s.size() == 3 && s[0] == "recvod") {
+				type = s[0];
+				streamId = s[1];
+				streamInfo = s[2];
+			} else if (MsSourceFactory::ParseTimeshift(msg.m_uri, streamId, streamInfo)) {
+				type = "timeshift";
+			}
 		}
 
 		if (streamId.empty()) {
@@ -512,7 +548,7 @@ void MsRtcServer::WhepProcess(shared_ptr<SHttpTransferMsg> rtcMsg) {
 
 		// Check if the source exists
 		auto source =
-		    MsResManager::GetInstance().GetOrCreateMediaSource("live", streamId, "", rtcSink);
+		    MsResManager::GetInstance().GetOrCreateMediaSource(type, streamId, streamInfo, rtcSink);
 
 		if (!source) {
 			MS_LOG_WARN("whep stream %s not found", streamId.c_str());
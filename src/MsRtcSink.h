@@ -8,12 +8,6 @@
 #include <queue>
 #include <thread>
 
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavutil/audio_fifo.h>
-#include <libswresample/swresample.h>
-}
-
 class MsRtcSink : public MsMediaSink, public enable_shared_from_this<MsRtcSink> {
 public:
 	MsRtcSink(const std::string &type, const std::string &streamID, int sinkID,
@@ -23,11 +17,12 @@ public:
 
 	void OnStreamInfo(AVStream *video, int videoIdx, AVStream *audio, int audioIdx) override;
 	void OnSourceClose() override;
-	void OnStreamPacket(AVPacket *pkt) override;
+	// frames come packetized by the source through OnRtpPacket
+	void OnStreamPacket(AVPacket *pkt) override {}
+	bool WantRtp() override { return !m_error && (_videoPt || _audioPt); }
+	void OnRtpPacket(AVPacket *pkt, const MsRtpPkts &rtp) override;
 	void SinkActiveClose();
 
-	int WriteBuffer(const uint8_t *buf, int buf_size, int8_t isVideo);
-
 	// Setup WebRTC related info before adding to source
 	void SetupWebRTC(const string &offerSdp, const string &httpVersion, const string &location,
 	                 std::function<void(const string &)> onWhepPeerClosed);
@@ -54,42 +49,32 @@ public:
 private:
 	void SinkReleaseRes();
 	int CreateTracksAndAnswer();
-	int InitAacToOpusTranscoder();
-	void ReleaseTranscoder();
-	void ProcessPkt(AVPacket *pkt);
-	void TranscodeAAC(AVPacket *pkt, std::vector<AVPacket *> &opusPkts);
+
+	struct SRtcFrame {
+		bool m_video;
+		bool m_key;
+		int64_t m_ms;
+		MsRtpPkts m_rtp;
+	};
+
+	void SendFrame(const SRtcFrame &frame);
+	// the shared packet with payload type, seq, ssrc and timestamp base of this peer
+	void SendRtp(const string &rtp, bool video);
+	// of the audio packets this sink gets, opus from the source when it transcodes
+	AVRational AudioTimeBase();
 
 	bool m_streamReady = false;
 	bool m_error = false;
 	bool m_firstVideo = true;
-	bool m_firstAudio = true;
-	int64_t m_firstVideoPts = 0;
-	int64_t m_firstVideoDts = 0;
-	int64_t m_firstAudioPts = 0;
-	int64_t m_firstAudioDts = 0;
 	bool m_needTranscode = false;
 
-	std::queue<AVPacket *> m_queAudioPkts;
-	std::queue<AVPacket *> m_queVideoPkts;
-	std::unique_ptr<std::thread> m_muxThread;
-
-	AVFormatContext *m_videoFmtCtx = nullptr;
-	AVFormatContext *m_audioFmtCtx = nullptr;
-	AVIOContext *m_videoPb = nullptr;
-	AVIOContext *m_audioPb = nullptr;
-	AVStream *m_outVideo = nullptr;
-	AVStream *m_outAudio = nullptr;
-	int m_outVideoIdx = 0;
-	int m_outAudioIdx = 0;
+	std::queue<SRtcFrame> m_queAudio;
+	std::queue<SRtcFrame> m_queVideo;
 
-	// AAC to Opus transcoding
-	AVCodecContext *m_aacDecCtx = nullptr;
-	AVCodecContext *m_opusEncCtx = nullptr;
-	SwrContext *m_swrCtx = nullptr;
-	AVFrame *m_decodedFrame = nullptr;
-	AVFrame *m_opusFrame = nullptr;
-	AVAudioFifo *m_audioFifo = nullptr;
-	int64_t m_nextOpusPts = 0;
+	// per track, video first
+	uint16_t m_seq[2] = {0, 0};
+	bool m_firstRtp[2] = {true, true};
+	uint32_t m_tsBase[2] = {0, 0};
 };
 
 #endif // MS_RTC_SINK_H
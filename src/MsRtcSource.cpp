@@ -1,16 +1,45 @@
 #include "MsRtcSource.h"
+#include "MsCommon.h"
 #include "MsMsg.h"
+#include "MsParamSets.h"
 #include "MsReactor.h"
 #include "MsResManager.h"
-#include <sstream>
+
+// key frames are asked for after losses at most this often
+#define RTC_KEY_REQ_INTERVAL_MS 500
+// how long a gap is waited for before the packets after it go on
+#define RTC_JITTER_MS 20
+// packets held at most, a key frame burst behind a gap goes on early
+#define RTC_JITTER_PKTS 256
+// larger gaps are not nacked, the window just moves on
+#define RTC_NACK_MAX 64
+
+// rtx (rfc 4588) back into the packet it repeats: payload type of the media, original seq
+static bool UnwrapRtx(const uint8_t *buf, int len, int pt, string &out) {
+	int hdr = 12 + (buf[0] & 0x0f) * 4;
+	if ((buf[0] & 0x10) && len >= hdr + 4) {
+		hdr += 4 + AV_RB16(buf + hdr + 2) * 4;
+	}
+	if (buf[0] & 0x20) {
+		len -= buf[len - 1];
+	}
+	// padding only packets probe bandwidth
+	if (len <= hdr + 2) {
+		return false;
+	}
+
+	out.assign((const char *)buf, hdr);
+	out.append((const char *)buf + hdr + 2, len - hdr - 2);
+	out[0] &= ~0x20;
+	out[1] = (out[1] & 0x80) | pt;
+	memcpy(&out[2], buf + hdr, 2);
+	return true;
+}
 
 MsRtcSource::~MsRtcSource() {
 	MS_LOG_INFO("~MsRtcSource %s", _sessionId.c_str());
-	while (m_rtcDataQue.size()) {
-		m_rtcDataQue.pop();
-	}
-	while (m_recyleQue.size()) {
-		m_recyleQue.pop();
+	if (m_fmtCtx) {
+		avformat_free_context(m_fmtCtx);
 	}
 }
 
@@ -31,28 +60,23 @@ void MsRtcSource::AddSink(std::shared_ptr<MsMediaSink> sink) {
 
 void MsRtcSource::NotifyStreamPacket(AVPacket *pkt) {
 	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	this->PushTimeshift(pkt);
 	for (auto &sink : m_sinks) {
 		if (sink) {
 			sink->OnStreamPacket(pkt);
 		}
 	}
+	this->PacketizeRtp(pkt);
 }
 
 void MsRtcSource::SourceActiveClose() {
 	m_isClosing.store(true);
-	m_condVar.notify_all();
 
 	try {
 		_pc->close();
 	} catch (...) {
 	}
 
-	if (m_rtpThread) {
-		if (m_rtpThread->joinable())
-			m_rtpThread->join();
-		m_rtpThread.reset();
-	}
-
 	if (_sock) {
 		_sock.reset();
 	}
@@ -60,237 +84,217 @@ void MsRtcSource::SourceActiveClose() {
 	MsMediaSource::SourceActiveClose();
 }
 
-void MsRtcSource::GenerateSdp() {
-	std::stringstream ss;
-	ss << "v=0\r\n";
-	ss << "o=- 0 0 IN IP4 127.0.0.1\r\n";
-	ss << "c=IN IP4 127.0.0.1\r\n";
-
-	if (_videoPt > 0) {
-		ss << "m=video 0 RTP/AVP " << _videoPt << "\r\n";
-		ss << "a=rtpmap:" << _videoPt << " " << _videoCodec << "/90000\r\n";
-		for (size_t i = 0; i < _videoFmts.size(); ++i) {
-			ss << "a=fmtp:" << _videoPt << " " << _videoFmts[i];
-			ss << "\r\n";
-		}
-	}
+void MsRtcSource::StartDepack() {
+	// the stream starts at a video key frame, without video nothing is taken
+	if (_videoPt <= 0) {
+		MS_LOG_ERROR("pc:%s no video stream found", _sessionId.c_str());
 
-	if (_audioPt > 0) {
-		ss << "m=audio 0 RTP/AVP " << _audioPt << "\r\n";
-		int clockRate = 48000;
-		ss << "a=rtpmap:" << _audioPt << " " << _audioCodec << "/" << clockRate << "/2\r\n";
-		for (size_t i = 0; i < _audioFmts.size(); ++i) {
-			ss << "a=fmtp:" << _audioPt << " " << _audioFmts[i];
-			ss << "\r\n";
-		}
+		MsMsg msg;
+		msg.m_msgID = MS_RTC_PEER_CLOSED;
+		msg.m_strVal = _sessionId;
+		msg.m_dstType = MS_RTC_SERVER;
+		msg.m_dstID = 1;
+		MsReactorMgr::Instance()->PostMsg(msg);
+		return;
 	}
 
-	_sdp = ss.str();
-	MS_LOG_DEBUG("pc:%s generated sdp:\n%s", _sessionId.c_str(), _sdp.c_str());
-}
+	std::unique_lock<std::mutex> lock(m_rtpMtx);
+	m_fmtCtx = avformat_alloc_context();
 
-void MsRtcSource::StartRtpDemux() {
-	int rtp_buff_size = 1500;
-	AVIOContext *rtp_avio_context = nullptr;
-	AVIOContext *sdp_avio_context = nullptr;
-	AVFormatContext *fmtCtx = nullptr;
-	AVPacket *pkt = nullptr;
-	bool fisrtVideoPkt = true;
+	AVStream *vst = avformat_new_stream(m_fmtCtx, NULL);
+	vst->time_base = {1, 90000};
+	vst->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+	vst->codecpar->codec_id = _videoCodec == "H265" ? AV_CODEC_ID_H265 : AV_CODEC_ID_H264;
+	m_video = vst;
+	m_videoIdx = vst->index;
 
-	this->GenerateSdp();
-	MsResManager::GetInstance().AddMediaSource(_sessionId, this->GetSharedPtr());
+	m_depack[0] = make_unique<MsRtpDepack>(vst->codecpar->codec_id, vst->index,
+	                                       [this](AVPacket *pkt) { this->OnFrame(0, pkt); });
+	m_depack[0]->SetLossCb([this](uint16_t seq, int count) { this->OnLoss(0, seq, count); });
 
-	sdp_avio_context = avio_alloc_context(
-	    static_cast<unsigned char *>(av_malloc(_sdp.size())), _sdp.size(), 0, this,
-	    [](void *opaque, uint8_t *buf, int buf_size) -> int {
-		    auto rpc = static_cast<MsRtcSource *>(opaque);
-		    if (rpc->_readSdpPos >= (int)rpc->_sdp.size()) {
-			    return AVERROR_EOF;
-		    }
-
-		    int left = rpc->_sdp.size() - rpc->_readSdpPos;
-		    if (buf_size > left) {
-			    buf_size = left;
-		    }
-
-		    memcpy(buf, rpc->_sdp.c_str() + rpc->_readSdpPos, buf_size);
-		    rpc->_readSdpPos += buf_size;
-		    return buf_size;
-	    },
-	    NULL, NULL);
-
-	rtp_avio_context = avio_alloc_context(
-	    static_cast<unsigned char *>(av_malloc(rtp_buff_size)), rtp_buff_size, 1, this,
-	    [](void *opaque, uint8_t *buf, int buf_size) -> int {
-		    // This is RTP Packet
-		    auto rpc = static_cast<MsRtcSource *>(opaque);
-		    return rpc->ReadBuffer(buf, buf_size);
-	    },
-	    // Ignore RTCP Packets. Must be set
-	    [](void *, IO_WRITE_BUF_TYPE *, int buf_size) -> int { return buf_size; }, NULL);
-
-	fmtCtx = avformat_alloc_context();
-	fmtCtx->pb = sdp_avio_context;
-
-	AVDictionary *options = nullptr;
-	av_dict_set(&options, "sdp_flags", "custom_io", 0);
-	av_dict_set_int(&options, "reorder_queue_size", 0, 0);
-	av_dict_set(&options, "protocol_whitelist", "file,rtp,udp", 0);
-
-	int ret = avformat_open_input(&fmtCtx, "", nullptr, &options);
-	av_dict_free(&options);
-
-	if (ret != 0) {
-		MS_LOG_ERROR("pc:%s avformat_open_input failed:%d", _sessionId.c_str(), ret);
-		goto err;
+	if (_audioPt > 0) {
+		AVStream *st = avformat_new_stream(m_fmtCtx, NULL);
+		AVCodecParameters *par = st->codecpar;
+		st->time_base = {1, 48000};
+		par->codec_type = AVMEDIA_TYPE_AUDIO;
+		par->codec_id = AV_CODEC_ID_OPUS;
+		par->sample_rate = 48000;
+		av_channel_layout_default(&par->ch_layout, 2);
+		m_audio = st;
+		m_audioIdx = st->index;
+
+		m_depack[1] = make_unique<MsRtpDepack>(par->codec_id, st->index,
+		                                       [this](AVPacket *pkt) { this->OnFrame(1, pkt); });
 	}
+	lock.unlock();
 
-	// release sdp avio context
-	av_freep(&sdp_avio_context->buffer);
-	avio_context_free(&sdp_avio_context);
-	sdp_avio_context = nullptr;
-
-	fmtCtx->pb = rtp_avio_context;
+	this->EnableTimeshift();
+	MsResManager::GetInstance().AddMediaSource(_sessionId, this->GetSharedPtr());
+}
 
-	if ((ret = avformat_find_stream_info(fmtCtx, nullptr)) != 0) {
-		// log error
-		MS_LOG_ERROR("pc:%s avformat_find_stream_info failed:%d", _sessionId.c_str(), ret);
-		goto err;
+void MsRtcSource::OnRtp(const uint8_t *buf, int len) {
+	if (len < 12 || m_isClosing.load()) {
+		return;
 	}
 
-	ret = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
-	if (ret < 0) {
-		MS_LOG_ERROR("pc:%s no video stream found", _sessionId.c_str());
-		goto err;
-	}
-	m_videoIdx = ret;
-	m_video = fmtCtx->streams[m_videoIdx];
-
-	ret = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-	if (ret >= 0) {
-		AVCodecParameters *codecPar = fmtCtx->streams[ret]->codecpar;
-		if (codecPar->codec_id == AV_CODEC_ID_OPUS || codecPar->codec_id == AV_CODEC_ID_AAC) {
-			m_audioIdx = ret;
-			m_audio = fmtCtx->streams[m_audioIdx];
+	int pt = buf[1] & 0x7f;
+	std::lock_guard<std::mutex> lock(m_rtpMtx);
+	if (pt == _videoPt && m_depack[0]) {
+		m_jitter[0].m_ssrc = AV_RB32(buf + 8);
+		this->Push(0, buf, len);
+	} else if (pt == _audioPt && m_depack[1]) {
+		this->Push(1, buf, len);
+	} else if (pt == _videoRtxPt && _videoRtxPt > 0 && m_depack[0]) {
+		string pkt;
+		if (UnwrapRtx(buf, len, _videoPt, pkt)) {
+			this->Push(0, (const uint8_t *)pkt.data(), pkt.size());
 		}
 	}
+}
 
-	this->NotifyStreamInfo();
-
-	pkt = av_packet_alloc();
-
-	/* read frames from the file */
-	while (av_read_frame(fmtCtx, pkt) >= 0 && !m_isClosing.load()) {
-		if (pkt->stream_index == m_videoIdx || pkt->stream_index == m_audioIdx) {
-			// if (pkt->stream_index == m_videoIdx) {
-			// 	MS_LOG_DEBUG("rtc source video pkt pts:%ld dts:%ld key:%d", pkt->pts, pkt->dts,
-			// 	             pkt->flags & AV_PKT_FLAG_KEY);
-			// } else if (pkt->stream_index == m_audioIdx) {
-			// 	MS_LOG_DEBUG("rtc source audio pkt pts:%ld dts:%ld size:%d", pkt->pts, pkt->dts,
-			// 	             pkt->size);
-			// }
-
-			if (pkt->stream_index == m_videoIdx) {
-				if (fisrtVideoPkt) {
-					fisrtVideoPkt = false;
-					// TODO: quick fix for some RTSP stream with first pkt pts=dts=AV_NOPTS_VALUE
-					//       need better solution
-					if (pkt->pts == AV_NOPTS_VALUE) {
-						MS_LOG_WARN("first video pkt pts is AV_NOPTS_VALUE, set to 0");
-						pkt->pts = 0;
-						if (pkt->dts == AV_NOPTS_VALUE) {
-							pkt->dts = 0;
-						}
-					}
-				}
-			}
+void MsRtcSource::Push(int track, const uint8_t *buf, int len) {
+	SJitter &j = m_jitter[track];
+	uint16_t seq = AV_RB16(buf + 2);
+	int64_t ext = j.m_high < 0 ? seq : j.m_high + (int16_t)(seq - (uint16_t)j.m_high);
 
-			this->NotifyStreamPacket(pkt);
-		}
-		av_packet_unref(pkt);
+	if (j.m_next < 0) {
+		j.m_next = ext;
+		j.m_high = ext;
+	}
+	// passed on already or given up
+	if (ext < j.m_next) {
+		return;
 	}
 
-err:
-	if (fmtCtx) {
-		if (fmtCtx->pb) {
-			av_freep(&fmtCtx->pb->buffer);
-			avio_context_free(&fmtCtx->pb);
+	if (ext - j.m_high > RTC_JITTER_PKTS) {
+		// a jump in seq, what is held goes on and the depacketizer sees the loss
+		j.m_gapMs = 0;
+		for (auto &it : j.m_pkts) {
+			m_depack[track]->Input((const uint8_t *)it.second.data(), it.second.size());
 		}
-		avformat_free_context(fmtCtx);
-		fmtCtx = nullptr;
+		j.m_pkts.clear();
+		j.m_next = ext;
+	} else if (ext > j.m_high + 1) {
+		this->SendNack(track, j.m_high + 1, ext - j.m_high - 1);
 	}
+	if (ext > j.m_high) {
+		j.m_high = ext;
+	}
+
+	j.m_pkts.emplace(ext, string((const char *)buf, len));
+	this->Drain(track);
+}
+
+void MsRtcSource::Drain(int track) {
+	SJitter &j = m_jitter[track];
+	int64_t now = GetCurMs();
 
-	av_packet_free(&pkt);
+	while (j.m_pkts.size()) {
+		auto it = j.m_pkts.begin();
+		if (it->first != j.m_next) {
+			if (!j.m_gapMs) {
+				j.m_gapMs = now;
+			}
+			if (now - j.m_gapMs < RTC_JITTER_MS && j.m_pkts.size() < RTC_JITTER_PKTS) {
+				break;
+			}
+			// the gap stays, the depacketizer reports it and a key frame is asked for
+			j.m_next = it->first;
+		}
 
-	MsMsg msg;
-	msg.m_msgID = MS_RTC_PEER_CLOSED;
-	msg.m_strVal = _sessionId;
-	msg.m_dstType = MS_RTC_SERVER;
-	msg.m_dstID = 1;
-	MsReactorMgr::Instance()->PostMsg(msg);
+		j.m_gapMs = 0;
+		m_depack[track]->Input((const uint8_t *)it->second.data(), it->second.size());
+		j.m_next++;
+		j.m_pkts.erase(it);
+	}
 }
 
-void MsRtcSource::WriteBuffer(const void *buf, int size) {
-	if (m_isClosing.load()) {
+// generic nack (rfc 4585), one fci per 17 packets. browsers retransmit video only
+void MsRtcSource::SendNack(int track, int64_t from, int count) {
+	if (track || !_videoTrack || count > RTC_NACK_MAX) {
 		return;
 	}
 
-	std::unique_lock<std::mutex> lock(m_queMtx);
-	if (m_recyleQue.size() > 0) {
-		SData &sd = m_recyleQue.front();
-		if (sd.m_capacity >= size) {
-
-			memcpy(sd.m_uBuf.get(), buf, size);
-			sd.m_len = size;
-			m_rtcDataQue.emplace(std::move(sd));
-			m_recyleQue.pop();
-			lock.unlock();
-			m_condVar.notify_one();
-			return;
-		} else {
-			// not enough capacity
-			m_recyleQue.pop();
+	vector<uint16_t> fci;
+	for (int64_t s = from, end = from + count; s < end; s += 17) {
+		uint16_t blp = 0;
+		for (int i = 1; i <= 16 && s + i < end; ++i) {
+			blp |= 1 << (i - 1);
 		}
+		fci.push_back((uint16_t)s);
+		fci.push_back(blp);
 	}
 
-	SData sd;
-	sd.m_uBuf = std::make_unique<uint8_t[]>(size);
-	sd.m_len = size;
-	sd.m_capacity = size;
-	memcpy(sd.m_uBuf.get(), buf, size);
-	m_rtcDataQue.emplace(std::move(sd));
-	lock.unlock();
-	m_condVar.notify_one();
+	rtc::binary nack(12 + fci.size() * 2);
+	uint8_t *p = reinterpret_cast<uint8_t *>(nack.data());
+	p[0] = 0x81;
+	p[1] = 205;
+	AV_WB16(p + 2, 2 + fci.size() / 2);
+	AV_WB32(p + 4, 1);
+	AV_WB32(p + 8, m_jitter[track].m_ssrc);
+	for (size_t i = 0; i < fci.size(); ++i) {
+		AV_WB16(p + 12 + i * 2, fci[i]);
+	}
+
+	try {
+		_videoTrack->send(std::move(nack));
+	} catch (const std::exception &e) {
+		MS_LOG_WARN("pc:%s send nack failed:%s", _sessionId.c_str(), e.what());
+	}
 }
 
-int MsRtcSource::ReadBuffer(uint8_t *buf, int buf_size) {
-	std::unique_lock<std::mutex> lock(m_queMtx);
-	m_condVar.wait(lock, [this]() { return m_rtcDataQue.size() > 0 || m_isClosing.load(); });
+void MsRtcSource::OnFrame(int track, AVPacket *pkt) {
+	AVStream *st = track ? m_audio : m_video;
+	int64_t now = GetCurMs();
 
-	if (m_isClosing.load()) {
-		return AVERROR_EOF;
+	// tracks start from 0 each, shifted by when they started against the first one
+	if (!m_started[track]) {
+		m_started[track] = true;
+		if (!m_firstMs) {
+			m_firstMs = now;
+		}
+		m_offset[track] = av_rescale_q(now - m_firstMs, {1, 1000}, st->time_base);
 	}
 
-	if (m_rtcDataQue.size() <= 0) {
-		return AVERROR(EAGAIN);
-	}
+	pkt->pts += m_offset[track];
+	pkt->dts += m_offset[track];
 
-	SData &sd = m_rtcDataQue.front();
-	int toRead = buf_size;
-	if (toRead > sd.m_len) {
-		toRead = sd.m_len;
-	}
+	// browsers send the parameter sets with every key frame, the streams start at the first
+	if (!m_infoSent) {
+		bool hevc = m_video->codecpar->codec_id == AV_CODEC_ID_H265;
+		if (track || !MsParamSets::Collect(pkt->data, pkt->size, hevc, m_ps)) {
+			if (!track) {
+				this->RequestKeyframe();
+			}
+			return;
+		}
 
-	memcpy(buf, sd.m_uBuf.get(), toRead);
-	if (toRead < sd.m_len) {
-		memmove(sd.m_uBuf.get(), sd.m_uBuf.get() + toRead, sd.m_len - toRead);
+		MsParamSets::Apply(m_video->codecpar, m_ps);
+		m_infoSent = true;
+		this->NotifyStreamInfo();
 	}
-	sd.m_len -= toRead;
 
-	if (sd.m_len == 0) {
-		m_recyleQue.emplace(std::move(sd));
-		m_rtcDataQue.pop();
+	this->NotifyStreamPacket(pkt);
+}
+
+void MsRtcSource::OnLoss(int track, uint16_t seq, int count) {
+	MS_LOG_DEBUG("pc:%s track:%d lost %d packets from seq:%u", _sessionId.c_str(), track, count,
+	             seq);
+
+	// the window gave up on these, nacked or not, a key frame ends the damage
+	this->RequestKeyframe();
+}
+
+void MsRtcSource::RequestKeyframe() {
+	int64_t now = GetCurMs();
+	if (!_videoTrack || now - m_keyReqMs < RTC_KEY_REQ_INTERVAL_MS) {
+		return;
 	}
 
-	return toRead;
+	m_keyReqMs = now;
+	try {
+		_videoTrack->requestKeyframe();
+	} catch (const std::exception &e) {
+		MS_LOG_WARN("pc:%s request key frame failed:%s", _sessionId.c_str(), e.what());
+	}
 }
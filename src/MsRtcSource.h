@@ -3,8 +3,13 @@
 
 #include "MsMediaSource.h"
 #include "MsMsgDef.h"
+#include "MsRtpDepack.h"
 #include "rtc/rtc.hpp"
+#include <map>
 
+// whip publisher. its rtp is depacketized in the message callbacks of the tracks, frames go
+// to the sinks from there without a thread or queue of their own. a short window per track
+// puts packets back in seq order and waits for the ones nacked
 struct MsRtcSource : public MsMediaSource, public enable_shared_from_this<MsRtcSource> {
 	MsRtcSource(const string &sessionId) : MsMediaSource(sessionId), _sessionId(sessionId) {}
 	~MsRtcSource();
@@ -16,31 +21,54 @@ struct MsRtcSource : public MsMediaSource, public enable_shared_from_this<MsRtcS
 	void OnSinksEmpty() override {}
 	shared_ptr<MsMediaSource> GetSharedPtr() override { return shared_from_this(); }
 
-	void GenerateSdp();
-	void StartRtpDemux();
-	void WriteBuffer(const void *buf, int size);
-	int ReadBuffer(uint8_t *buf, int buf_size);
+	// all tracks are known, the streams are set up and rtp taken from now on
+	void StartDepack();
+	// one rtp packet of a track
+	void OnRtp(const uint8_t *buf, int len);
 
 	shared_ptr<rtc::PeerConnection> _pc;
 	shared_ptr<rtc::Track> _videoTrack;
 	shared_ptr<rtc::Track> _audioTrack;
 	shared_ptr<MsSocket> _sock;
 	int _videoPt = 0;
+	int _videoRtxPt = 0;
 	int _audioPt = 0;
 	int _expectedTracks = 0;
 	int _receivedTracks = 0;
-	int _readSdpPos = 0;
 	string _sessionId;
 	string _videoCodec;
 	string _audioCodec;
-	string _sdp;
 	vector<string> _videoFmts;
 	vector<string> _audioFmts;
-	std::queue<SData> m_rtcDataQue;
-	std::queue<SData> m_recyleQue;
-	std::mutex m_queMtx;
-	std::condition_variable m_condVar;
-	std::unique_ptr<std::thread> m_rtpThread;
+
+private:
+	// packets of one track waiting for a gap before them to fill, by extended seq
+	struct SJitter {
+		map<int64_t, string> m_pkts;
+		int64_t m_next = -1;
+		int64_t m_high = -1;
+		int64_t m_gapMs = 0;
+		uint32_t m_ssrc = 0;
+	};
+
+	void Push(int track, const uint8_t *buf, int len);
+	void Drain(int track);
+	void SendNack(int track, int64_t from, int count);
+	void OnFrame(int track, AVPacket *pkt);
+	void OnLoss(int track, uint16_t seq, int count);
+	void RequestKeyframe();
+
+	// guards the depacketizers and what they feed, video first
+	std::mutex m_rtpMtx;
+	AVFormatContext *m_fmtCtx = nullptr;
+	unique_ptr<MsRtpDepack> m_depack[2];
+	SJitter m_jitter[2];
+	bool m_started[2] = {false, false};
+	int64_t m_offset[2] = {0, 0};
+	int64_t m_firstMs = 0;
+	bool m_infoSent = false;
+	string m_ps;
+	int64_t m_keyReqMs = 0;
 };
 
-#endif // MS_RTC_SOURCE_H
\ No newline at end of file
+#endif // MS_RTC_SOURCE_H
@@ -28,11 +28,13 @@ void MsRtmpSource::AddSink(std::shared_ptr<MsMediaSink> sink) {
 
 void MsRtmpSource::NotifyStreamPacket(AVPacket *pkt) {
 	std::lock_guard<std::mutex> lock(m_sinkMutex);
+	this->PushTimeshift(pkt);
 	for (auto &sink : m_sinks) {
 		if (sink) {
 			sink->OnStreamPacket(pkt);
 		}
 	}
+	this->PacketizeRtp(pkt);
 }
 
 void MsRtmpSource::SourceActiveClose() {
@@ -58,6 +60,7 @@ void MsRtmpSource::FlvParseThread() {
 	size_t avio_ctx_buffer_size = 4096;
 	int ret = 0;
 
+	this->EnableTimeshift();
 	MsResManager::GetInstance().AddMediaSource(m_streamID, this->GetSharedPtr());
 
 	if (!(fmt_ctx = avformat_alloc_context())) {
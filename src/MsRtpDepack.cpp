@@ -0,0 +1,328 @@
+#include "MsRtpDepack.h"
+#include "MsCommon.h"
+#include <string.h>
+#include <strings.h>
+
+string MsRtpDepack::FmtpValue(const string &fmtp, const char *key) {
+	size_t n = strlen(key);
+
+	for (size_t p = 0; p < fmtp.size(); ++p) {
+		p = fmtp.find_first_not_of("; ", p);
+		if (p == string::npos) {
+			break;
+		}
+
+		if (!strncasecmp(fmtp.c_str() + p, key, n) && fmtp[p + n] == '=') {
+			size_t e = fmtp.find(';', p);
+			return fmtp.substr(p + n + 1, e == string::npos ? e : e - p - n - 1);
+		}
+
+		p = fmtp.find(';', p);
+		if (p == string::npos) {
+			break;
+		}
+	}
+
+	return string();
+}
+
+// a numeric fmtp parameter, -1 when absent
+static int FmtpInt(const string &fmtp, const char *key) {
+	string v = MsRtpDepack::FmtpValue(fmtp, key);
+	return v.empty() ? -1 : atoi(v.c_str());
+}
+
+MsRtpDepack::MsRtpDepack(AVCodecID codec, int streamIdx, const FrameCb &cb)
+    : m_codec(codec), m_streamIdx(streamIdx), m_cb(cb), m_pkt(av_packet_alloc()) {}
+
+MsRtpDepack::~MsRtpDepack() { av_packet_free(&m_pkt); }
+
+void MsRtpDepack::SetAacFmtp(const string &fmtp) {
+	int v;
+
+	if ((v = FmtpInt(fmtp, "sizelength")) >= 0) {
+		m_sizeLength = v;
+	}
+	if ((v = FmtpInt(fmtp, "indexlength")) >= 0) {
+		m_indexLength = v;
+	}
+	if ((v = FmtpInt(fmtp, "indexdeltalength")) >= 0) {
+		m_indexDeltaLength = v;
+	}
+}
+
+int MsRtpDepack::Input(const uint8_t *buf, int len) {
+	if (len < 12 || (buf[0] >> 6) != 2) {
+		return -1;
+	}
+
+	bool marker = buf[1] & 0x80;
+	uint16_t seq = AV_RB16(buf + 2);
+	uint32_t ts = AV_RB32(buf + 4);
+	int hdr = 12 + (buf[0] & 0x0f) * 4;
+
+	if (buf[0] & 0x10) {
+		if (len < hdr + 4) {
+			return -1;
+		}
+		hdr += 4 + AV_RB16(buf + hdr + 2) * 4;
+	}
+
+	if (buf[0] & 0x20) {
+		len -= buf[len - 1];
+	}
+
+	bool lost = false;
+	if (m_first) {
+		m_first = false;
+		m_lastTs = ts;
+	} else {
+		int16_t d = seq - m_seq;
+		// duplicate or reordered too late
+		if (d <= 0) {
+			return 0;
+		}
+		lost = d > 1;
+		if (lost && m_lossCb) {
+			m_lossCb(m_seq + 1, d - 1);
+		}
+		m_ts += (int32_t)(ts - m_lastTs);
+		m_lastTs = ts;
+	}
+	m_seq = seq;
+
+	// padding only packets keep seq and ts going, a loss before one counts for the next payload
+	if (len <= hdr) {
+		m_gap = m_gap || lost;
+		return 0;
+	}
+	lost = lost || m_gap;
+	m_gap = false;
+
+	const uint8_t *p = buf + hdr;
+	len -= hdr;
+
+	if (m_codec == AV_CODEC_ID_AAC) {
+		if (lost) {
+			m_broken = true;
+		}
+		this->InputAac(p, len, marker);
+		return 0;
+	} else if (m_codec != AV_CODEC_ID_H264 && m_codec != AV_CODEC_ID_H265) {
+		this->Emit(p, len, m_ts, true);
+		return 0;
+	}
+
+	// the previous frame may have lost its tail, this one its head
+	if (lost) {
+		m_broken = true;
+	}
+	if (m_ts != m_frameTs) {
+		this->Flush();
+		m_frameTs = m_ts;
+		m_broken = lost;
+	}
+
+	if (m_codec == AV_CODEC_ID_H264) {
+		this->InputH264(p, len);
+	} else {
+		this->InputH265(p, len);
+	}
+
+	if (marker) {
+		this->Flush();
+	}
+
+	return 0;
+}
+
+void MsRtpDepack::InputH264(const uint8_t *p, int len) {
+	int type = p[0] & 0x1f;
+
+	if (type >= 1 && type <= 23) {
+		this->AppendNalu(nullptr, 0, p, len);
+	} else if (type == 24) { // stap-a
+		++p;
+		--len;
+		while (len > 2) {
+			int n = AV_RB16(p);
+			p += 2;
+			len -= 2;
+			if (n <= 0 || n > len) {
+				m_broken = true;
+				break;
+			}
+			this->AppendNalu(nullptr, 0, p, n);
+			p += n;
+			len -= n;
+		}
+	} else if (type == 28) { // fu-a
+		if (len < 3) {
+			m_broken = true;
+			return;
+		}
+
+		uint8_t fu = p[1];
+		uint8_t nal = (p[0] & 0xe0) | (fu & 0x1f);
+		if (fu & 0x80) {
+			this->AppendNalu(&nal, 1, p + 2, len - 2);
+			m_inFu = true;
+		} else if (m_inFu) {
+			m_frame.append((const char *)p + 2, len - 2);
+		} else {
+			m_broken = true;
+		}
+
+		if (fu & 0x40) {
+			m_inFu = false;
+		}
+	}
+}
+
+void MsRtpDepack::InputH265(const uint8_t *p, int len) {
+	if (len < 3) {
+		m_broken = true;
+		return;
+	}
+
+	int type = (p[0] >> 1) & 0x3f;
+
+	if (type < 48) {
+		this->AppendNalu(nullptr, 0, p, len);
+	} else if (type == 48) { // aggregation packet, without donl
+		p += 2;
+		len -= 2;
+		while (len > 2) {
+			int n = AV_RB16(p);
+			p += 2;
+			len -= 2;
+			if (n <= 0 || n > len) {
+				m_broken = true;
+				break;
+			}
+			this->AppendNalu(nullptr, 0, p, n);
+			p += n;
+			len -= n;
+		}
+	} else if (type == 49) { // fragmentation unit
+		uint8_t fu = p[2];
+		uint8_t nal[2] = {(uint8_t)((p[0] & 0x81) | ((fu & 0x3f) << 1)), p[1]};
+		if (fu & 0x80) {
+			this->AppendNalu(nal, 2, p + 3, len - 3);
+			m_inFu = true;
+		} else if (m_inFu) {
+			m_frame.append((const char *)p + 3, len - 3);
+		} else {
+			m_broken = true;
+		}
+
+		if (fu & 0x40) {
+			m_inFu = false;
+		}
+	}
+}
+
+void MsRtpDepack::InputAac(const uint8_t *p, int len, bool marker) {
+	if (m_sizeLength <= 0) {
+		this->Emit(p, len, m_ts, true);
+		return;
+	}
+
+	if (len < 2) {
+		return;
+	}
+
+	int hdrBits = AV_RB16(p);
+	int hdrBytes = (hdrBits + 7) / 8;
+	if (2 + hdrBytes > len) {
+		return;
+	}
+
+	const uint8_t *hdr = p + 2;
+	const uint8_t *data = hdr + hdrBytes;
+	int left = len - 2 - hdrBytes;
+	int pos = 0;
+
+	auto bits = [&](int n) {
+		int v = 0;
+		for (int i = 0; i < n; ++i, ++pos) {
+			v = (v << 1) | ((hdr[pos >> 3] >> (7 - (pos & 7))) & 1);
+		}
+		return v;
+	};
+
+	for (int n = 0; pos + m_sizeLength <= hdrBits; ++n) {
+		int size = bits(m_sizeLength);
+		int idxLen = n ? m_indexDeltaLength : m_indexLength;
+		if (pos + idxLen > hdrBits) {
+			break;
+		}
+		pos += idxLen;
+
+		// an au larger than a packet, au-size is that of the whole au
+		if (size > left) {
+			if (m_frame.empty()) {
+				m_frameTs = m_ts;
+			}
+			m_frame.append((const char *)data, left);
+			if (marker) {
+				if ((int)m_frame.size() == size && !m_broken) {
+					this->Emit((const uint8_t *)m_frame.data(), size, m_frameTs, true);
+				}
+				m_frame.clear();
+				m_broken = false;
+			}
+			return;
+		}
+
+		this->Emit(data, size, m_ts + n * 1024, true);
+		data += size;
+		left -= size;
+	}
+
+	m_frame.clear();
+	m_broken = false;
+}
+
+void MsRtpDepack::AppendNalu(const uint8_t *hdr, int hdrLen, const uint8_t *p, int len) {
+	const uint8_t *h = hdrLen ? hdr : p;
+	int type = m_codec == AV_CODEC_ID_H264 ? h[0] & 0x1f : (h[0] >> 1) & 0x3f;
+
+	if (m_codec == AV_CODEC_ID_H264 ? type == 5 : (type >= 16 && type <= 21)) {
+		m_key = true;
+	}
+
+	m_frame.append("\x00\x00\x00\x01", 4);
+	if (hdrLen) {
+		m_frame.append((const char *)hdr, hdrLen);
+	}
+	m_frame.append((const char *)p, len);
+}
+
+void MsRtpDepack::Flush() {
+	if (m_frame.size() && !m_broken) {
+		this->Emit((const uint8_t *)m_frame.data(), m_frame.size(), m_frameTs, m_key);
+	}
+
+	m_frame.clear();
+	m_key = false;
+	m_broken = false;
+	m_inFu = false;
+}
+
+void MsRtpDepack::Emit(const uint8_t *p, int len, int64_t pts, bool key) {
+	if (av_new_packet(m_pkt, len) < 0) {
+		return;
+	}
+
+	memcpy(m_pkt->data, p, len);
+	m_pkt->pts = pts;
+	m_pkt->dts = pts;
+	m_pkt->stream_index = m_streamIdx;
+	if (key) {
+		m_pkt->flags |= AV_PKT_FLAG_KEY;
+	}
+
+	m_cb(m_pkt);
+	av_packet_unref(m_pkt);
+}
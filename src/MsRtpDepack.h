@@ -0,0 +1,65 @@
+#ifndef MS_RTP_DEPACK_H
+#define MS_RTP_DEPACK_H
+#include <functional>
+#include <string>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+// rtp packets of one track back into frames. h264 (rfc 6184) and h265 (rfc 7798) come out
+// as annex b access units, aac (rfc 3640 mpeg4-generic) and opus as raw frames. pts counts
+// in the rtp clock from the first packet. a frame that lost packets is dropped
+class MsRtpDepack {
+public:
+	using FrameCb = function<void(AVPacket *)>;
+	// count packets missing from seq on, for a nack or a key frame request
+	using LossCb = function<void(uint16_t seq, int count)>;
+
+	MsRtpDepack(AVCodecID codec, int streamIdx, const FrameCb &cb);
+	~MsRtpDepack();
+
+	// value of key in a fmtp line, empty when absent
+	static string FmtpValue(const string &fmtp, const char *key);
+
+	// au header layout of an aac fmtp, sizelength=13;indexlength=3 when not given
+	void SetAacFmtp(const string &fmtp);
+	void SetLossCb(const LossCb &cb) { m_lossCb = cb; }
+	// one rtp packet with its header
+	int Input(const uint8_t *buf, int len);
+
+private:
+	void InputH264(const uint8_t *p, int len);
+	void InputH265(const uint8_t *p, int len);
+	void InputAac(const uint8_t *p, int len, bool marker);
+	void AppendNalu(const uint8_t *hdr, int hdrLen, const uint8_t *p, int len);
+	void Flush();
+	void Emit(const uint8_t *p, int len, int64_t pts, bool key);
+
+	AVCodecID m_codec;
+	int m_streamIdx;
+	FrameCb m_cb;
+	LossCb m_lossCb;
+	AVPacket *m_pkt;
+
+	bool m_first = true;
+	bool m_gap = false;
+	uint16_t m_seq = 0;
+	uint32_t m_lastTs = 0;
+	int64_t m_ts = 0;
+
+	// access unit being put together
+	string m_frame;
+	int64_t m_frameTs = 0;
+	bool m_key = false;
+	bool m_broken = false;
+	bool m_inFu = false;
+
+	int m_sizeLength = 13;
+	int m_indexLength = 3;
+	int m_indexDeltaLength = 3;
+};
+
+#endif // MS_RTP_DEPACK_H
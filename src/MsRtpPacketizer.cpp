@@ -0,0 +1,103 @@
+#include "MsRtpPacketizer.h"
+#include "MsCommon.h"
+#include "MsLog.h"
+
+MsRtpPacketizer::~MsRtpPacketizer() {
+	if (m_fmtCtx) {
+		if (m_fmtCtx->pb) {
+			av_freep(&m_fmtCtx->pb->buffer);
+			avio_context_free(&m_fmtCtx->pb);
+		}
+		avformat_free_context(m_fmtCtx);
+	}
+}
+
+int MsRtpPacketizer::Init(const AVCodecParameters *par, AVRational timeBase) {
+	if (par->codec_id != AV_CODEC_ID_H264 && par->codec_id != AV_CODEC_ID_H265 &&
+	    par->codec_id != AV_CODEC_ID_OPUS) {
+		MS_LOG_WARN("rtp:%s codec %s not for webrtc", m_streamID.c_str(),
+		            avcodec_get_name(par->codec_id));
+		return -1;
+	}
+
+	int bufSize = 2048;
+	AVIOContext *pb = avio_alloc_context(
+	    static_cast<unsigned char *>(av_malloc(bufSize)), bufSize, 1, this, nullptr,
+	    [](void *opaque, IO_WRITE_BUF_TYPE *buf, int size) -> int {
+		    return static_cast<MsRtpPacketizer *>(opaque)->OnWrite(buf, size);
+	    },
+	    nullptr);
+	if (!pb) {
+		return -1;
+	}
+	// the rtp muxer flushes every packet on its own
+	pb->max_packet_size = MS_RTP_MTU;
+
+	avformat_alloc_output_context2(&m_fmtCtx, nullptr, "rtp", nullptr);
+	if (!m_fmtCtx) {
+		av_freep(&pb->buffer);
+		avio_context_free(&pb);
+		return -1;
+	}
+	m_fmtCtx->pb = pb;
+	m_fmtCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	m_out = avformat_new_stream(m_fmtCtx, NULL);
+	if (!m_out || avcodec_parameters_copy(m_out->codecpar, par) < 0) {
+		return -1;
+	}
+	m_out->codecpar->codec_tag = 0;
+	m_out->time_base = timeBase;
+	m_inTimeBase = timeBase;
+
+	// payload type and ssrc are the ones of each viewer
+	AVDictionary *opts = nullptr;
+	av_dict_set(&opts, "payload_type", par->codec_type == AVMEDIA_TYPE_VIDEO ? "96" : "111", 0);
+	av_dict_set(&opts, "rtpflags", "skip_rtcp", 0);
+	int ret = avformat_write_header(m_fmtCtx, &opts);
+	av_dict_free(&opts);
+	if (ret < 0) {
+		MS_LOG_ERROR("rtp:%s write header failed:%d", m_streamID.c_str(), ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+MsRtpPkts MsRtpPacketizer::Packetize(AVPacket *pkt) {
+	auto rtp = make_shared<vector<string>>();
+	int64_t pts = pkt->pts;
+	int64_t dts = pkt->dts;
+	int64_t duration = pkt->duration;
+	int64_t pos = pkt->pos;
+	int idx = pkt->stream_index;
+
+	av_packet_rescale_ts(pkt, m_inTimeBase, m_out->time_base);
+	pkt->stream_index = 0;
+	pkt->pos = -1;
+	m_ts = (uint32_t)pkt->pts;
+	m_cur = rtp.get();
+
+	int ret = av_write_frame(m_fmtCtx, pkt);
+	if (ret < 0) {
+		MS_LOG_DEBUG("rtp:%s write frame failed:%d", m_streamID.c_str(), ret);
+	}
+
+	m_cur = nullptr;
+	pkt->pts = pts;
+	pkt->dts = dts;
+	pkt->duration = duration;
+	pkt->pos = pos;
+	pkt->stream_index = idx;
+	return rtp;
+}
+
+int MsRtpPacketizer::OnWrite(const uint8_t *buf, int size) {
+	if (!m_cur || size < 12) {
+		return size;
+	}
+
+	m_cur->emplace_back((const char *)buf, size);
+	AV_WB32(&m_cur->back()[4], m_ts);
+	return size;
+}
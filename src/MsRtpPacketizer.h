@@ -0,0 +1,32 @@
+#ifndef MS_RTP_PACKETIZER_H
+#define MS_RTP_PACKETIZER_H
+#include "MsMediaSink.h"
+
+// payload size webrtc peers take without fragmentation
+#define MS_RTP_MTU 1200
+
+// one stream of a source into rtp packets for webrtc: h264, h265 or opus. the source runs
+// one per track for all its whep viewers, each of them only rewrites payload type, seq and
+// ssrc. the rtp timestamp is the pts in the rtp clock, with no random base
+class MsRtpPacketizer {
+public:
+	MsRtpPacketizer(const std::string &streamID) : m_streamID(streamID) {}
+	~MsRtpPacketizer();
+
+	int Init(const AVCodecParameters *par, AVRational timeBase);
+	// packets in the time base given to Init, left as they came: the gop cache and the other
+	// sinks share them
+	MsRtpPkts Packetize(AVPacket *pkt);
+
+private:
+	int OnWrite(const uint8_t *buf, int size);
+
+	std::string m_streamID;
+	AVRational m_inTimeBase = {1, 1000};
+	AVFormatContext *m_fmtCtx = nullptr;
+	AVStream *m_out = nullptr;
+	std::vector<std::string> *m_cur = nullptr;
+	uint32_t m_ts = 0;
+};
+
+#endif // MS_RTP_PACKETIZER_H
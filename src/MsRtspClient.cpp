@@ -0,0 +1,34 @@
+#include "MsRtspClient.h"
+#include "MsMsgDef.h"
+#include "MsRtspSource.h"
+
+// keepalive and timeouts of the sessions are checked at this interval
+#define RTSP_TICK_MS 1000
+
+void MsRtspClient::HandleMsg(MsMsg &msg) {
+	switch (msg.m_msgID) {
+	case MS_RTSP_CLIENT_START: {
+		auto source = any_cast<shared_ptr<MsRtspSource>>(msg.m_any);
+		source->ClientStart(shared_from_this());
+
+		msg.m_msgID = MS_RTSP_CLIENT_TICK;
+		this->EnqueDelayMsg(msg, RTSP_TICK_MS);
+	} break;
+
+	case MS_RTSP_CLIENT_TICK: {
+		auto source = any_cast<shared_ptr<MsRtspSource>>(msg.m_any);
+		if (source->ClientTick()) {
+			this->EnqueDelayMsg(msg, RTSP_TICK_MS);
+		}
+	} break;
+
+	case MS_RTSP_CLIENT_RETRY: {
+		auto source = any_cast<shared_ptr<MsRtspSource>>(msg.m_any);
+		source->ClientConnect();
+	} break;
+
+	default:
+		MsReactor::HandleMsg(msg);
+		break;
+	}
+}
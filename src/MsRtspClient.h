@@ -0,0 +1,14 @@
+#ifndef MS_RTSP_CLIENT_H
+#define MS_RTSP_CLIENT_H
+#include "MsReactor.h"
+
+// shared reactor running the rtsp sessions of pulled cameras, rtspClientThreads of them
+// are started, 0 keeps a libavformat thread per camera
+class MsRtspClient : public MsReactor {
+public:
+	MsRtspClient(int type, int id) : MsReactor(type, id) {}
+
+	void HandleMsg(MsMsg &msg) override;
+};
+
+#endif // MS_RTSP_CLIENT_H
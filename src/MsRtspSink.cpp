@@ -1,7 +1,9 @@
 #include "MsRtspSink.h"
 #include "MsEvent.h"
+#include "MsFileSource.h"
 #include "MsLog.h"
 #include "MsResManager.h"
+#include "MsSourceFactory.h"
 #include <thread>
 
 class MsRtspHandler : public MsEventHandler {
@@ -32,10 +34,11 @@ public:
 		char *p2 = m_bufPtr.get();
 
 		while (m_bufOff > 0) {
-			if (!IsHeaderComplete(p2)) {
+			if (FindHeaderEnd(p2, m_bufOff, m_scanOff) < 0) {
 				if (m_bufOff == m_bufSize - 1) {
 					MS_LOG_ERROR("rtsp header too big:%d %s", m_bufOff, m_bufPtr.get());
 					m_bufOff = 0;
+					m_scanOff = 0;
 				} else if (m_bufOff && p2 != m_bufPtr.get()) {
 					memmove(m_bufPtr.get(), p2, m_bufOff);
 				}
@@ -104,6 +107,7 @@ public:
 	unique_ptr<char[]> m_bufPtr;
 	int m_bufSize;
 	int m_bufOff;
+	int m_scanOff = 0;
 
 private:
 	shared_ptr<MsReactor> m_reactor;
@@ -153,7 +157,7 @@ int MsRtspServer::HandleOptions(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
 	rsp.m_reason = "OK";
 	rsp.m_version = msg.m_version;
 	rsp.m_cseq = msg.m_cseq;
-	rsp.m_public.SetValue("OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, "
+	rsp.m_public.SetValue("OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, "
 	                      "SET_PARAMETER, GET_PARAMETER");
 
 	SendRtspMsg(rsp, evt->GetSocket());
@@ -185,14 +189,18 @@ int MsRtspServer::HandleDescribe(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
 	}
 
 	if (s[1] == "live") {
-		std::string streamID = s[2];
+		std::string streamID = s[2].substr(0, s[2].find('?'));
 		std::string format = "rtsp";
+		std::string type = s[1], streamInfo;
+		if (MsSourceFactory::ParseTimeshift(msg.m_uri, streamID, streamInfo)) {
+			type = "timeshift";
+		}
 
 		std::shared_ptr<MsMediaSink> sink =
 		    std::make_shared<MsRtspSink>(format, streamID, ++m_seqID, evt->GetSharedSocket(), msg);
 
 		std::shared_ptr<MsMediaSource> source =
-		    MsResManager::GetInstance().GetOrCreateMediaSource(s[1], streamID, "", sink);
+		    MsResManager::GetInstance().GetOrCreateMediaSource(type, streamID, streamInfo, sink);
 
 		if (!source) {
 			MS_LOG_WARN("create source failed for stream: %s", streamID.c_str());
@@ -204,9 +212,9 @@ int MsRtspServer::HandleDescribe(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
 
 		this->DelEvent(evt);
 		return 0;
-	} else if (s[1] == "vod") {
+	} else if (s[1] == "vod" || s[1] == "recvod") {
 		if (s.size() < 4) {
-			MS_LOG_WARN("invalid vod uri:%s", msg.m_uri.c_str());
+			MS_LOG_WARN("invalid %s uri:%s", s[1].c_str(), msg.m_uri.c_str());
 			rsp.m_status = "404";
 			rsp.m_reason = "Not Found";
 			SendRtspMsg(rsp, evt->GetSocket());
@@ -223,14 +231,6 @@ int MsRtspServer::HandleDescribe(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
 		// check media source exists
 		auto source =
 		    MsResManager::GetInstance().GetOrCreateMediaSource(s[1], streamID, filename, sink);
-		if (source) {
-			MS_LOG_WARN("vod source already exists for stream: %s", streamID.c_str());
-			rsp.m_status = "403";
-			rsp.m_reason = "Forbidden";
-			SendRtspMsg(rsp, evt->GetSocket());
-			return -1;
-		}
-
 		if (!source) {
 			MS_LOG_WARN("create VOD source failed for stream: %s", streamID.c_str());
 			rsp.m_status = "404";
@@ -342,6 +342,22 @@ int MsRtspSink::HandlePlay(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
 	rsp.m_status = "200";
 	rsp.m_reason = "OK";
 	rsp.m_session = msg.m_session;
+
+	auto vod = dynamic_pointer_cast<MsFileSource>(
+	    MsResManager::GetInstance().GetMediaSource(m_streamID));
+	if (vod) {
+		// Range: npt=<sec>- moves the cursor, npt=now- or none just resumes
+		const string &range = msg.m_range.m_value;
+		if (msg.m_range.m_exist && !range.compare(0, 4, "npt=") && isdigit(range[4])) {
+			int64_t ms = (int64_t)(atof(range.c_str() + 4) * 1000);
+			if (m_playing || ms > 0) {
+				vod->Seek(ms);
+			}
+			rsp.m_range = msg.m_range;
+		}
+		vod->Pause(false);
+	}
+
 	string data;
 	rsp.Dump(data);
 	this->WriteBuffer((const uint8_t *)data.c_str(), data.size(), -1);
@@ -390,11 +406,20 @@ int MsRtspSink::HandleOthers(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
 }
 
 int MsRtspSink::HandlePause(MsRtspMsg &msg, shared_ptr<MsEvent> evt) {
-	// return not implemented
 	MsRtspMsg rsp;
 	string data;
-	rsp.m_reason = "Not Implemented";
-	rsp.m_status = "501";
+
+	// only vod can pause, live stays not implemented
+	auto vod = dynamic_pointer_cast<MsFileSource>(
+	    MsResManager::GetInstance().GetMediaSource(m_streamID));
+	if (vod) {
+		vod->Pause(true);
+		rsp.m_reason = "OK";
+		rsp.m_status = "200";
+	} else {
+		rsp.m_reason = "Not Implemented";
+		rsp.m_status = "501";
+	}
 	rsp.m_version = msg.m_version;
 	rsp.m_cseq = msg.m_cseq;
 	rsp.m_session = msg.m_session;
@@ -1,13 +1,98 @@
 #include "MsRtspSource.h"
+#include "MsCommon.h"
+#include "MsConfig.h"
 #include "MsDevMgr.h"
 #include "MsLog.h"
+#include "MsMd5.h"
+#include "MsMsgDef.h"
+#include "MsParamSets.h"
+#include "MsPortAllocator.h"
+#include <netdb.h>
 #include <thread>
 
+// a pulled camera sending nothing for this long is dropped
+#define RTSP_DEF_TIMEOUT_SEC 10
+// session timeout when the server gives none
+#define RTSP_DEF_SESSION_SEC 60
+// room for one interleaved frame of the largest size
+#define RTSP_BUF_SIZE (2 * DEF_BUF_SIZE)
+
+class MsRtspClientHandler : public MsEventHandler {
+public:
+	MsRtspClientHandler(shared_ptr<MsRtspSource> source) : m_source(source) {}
+
+	void HandleRead(shared_ptr<MsEvent> evt) override { m_source->OnTcpData(evt); }
+	void HandleWrite(shared_ptr<MsEvent> evt) override { m_source->OnConnected(evt); }
+	void HandleClose(shared_ptr<MsEvent> evt) override {
+		m_source->ClientStop("connection closed");
+	}
+
+private:
+	shared_ptr<MsRtspSource> m_source;
+};
+
+class MsRtspUdpHandler : public MsEventHandler {
+public:
+	MsRtspUdpHandler(shared_ptr<MsRtspSource> source, int track)
+	    : m_source(source), m_track(track), m_bufPtr(make_unique<char[]>(DEF_BUF_SIZE)) {}
+
+	void HandleRead(shared_ptr<MsEvent> evt) override {
+		int n = evt->GetSocket()->Recv(m_bufPtr.get(), DEF_BUF_SIZE);
+		if (n > 0) {
+			m_source->OnRtp(m_track, (uint8_t *)m_bufPtr.get(), n);
+		}
+	}
+
+	void HandleClose(shared_ptr<MsEvent> evt) override {}
+
+private:
+	shared_ptr<MsRtspSource> m_source;
+	int m_track;
+	unique_ptr<char[]> m_bufPtr;
+};
+
+static bool IsRtspUrl(const string &url) {
+	return url.find("rtsp://") == 0 || url.find("RTSP://") == 0;
+}
+
+static string Md5Hex(const string &s) {
+	unsigned char md5[16];
+	unsigned char hex[32];
+	Ms_MD5_CTX ctx;
+
+	Ms_MD5Init(&ctx);
+	Ms_MD5Update(&ctx, (unsigned char *)s.data(), s.size());
+	Ms_MD5Final(md5, &ctx);
+	CvtToHex(md5, hex);
+
+	return string((char *)hex, 32);
+}
+
+MsRtspSource::~MsRtspSource() {
+	if (m_fmtCtx) {
+		avformat_free_context(m_fmtCtx);
+	}
+}
+
 void MsRtspSource::Work() {
+	shared_ptr<MsReactor> client =
+	    IsRtspUrl(m_url) ? MsReactorMgr::Instance()->PickReactor(MS_RTSP_CLIENT) : nullptr;
+	if (client) {
+		MsMsg msg;
+		msg.m_msgID = MS_RTSP_CLIENT_START;
+		msg.m_any = shared_from_this();
+		client->EnqueMsg(msg);
+		return;
+	}
+
 	std::thread worker([this]() { this->OnRun(); });
 	worker.detach();
 }
 
+int MsRtspSource::GetLingerMs() {
+	return MsConfig::Instance()->GetConfigInt("rtspLingerSec") * 1000;
+}
+
 void MsRtspSource::UpdateVideoInfo() {
 	if (m_video == nullptr) {
 		MS_LOG_WARN("video stream is null, cannot update device info");
@@ -22,85 +107,172 @@ void MsRtspSource::UpdateVideoInfo() {
 }
 
 void MsRtspSource::OnRun() {
+	int maxTries = ReconnectTries();
+	int tries = 0;
+
+	while (!m_isClosing.load()) {
+		bool played = false;
+		if (this->RunInput(played) < 0 || m_isClosing.load() || !m_infoSent || this->IsIdle()) {
+			break;
+		}
+
+		if (played) {
+			tries = 0;
+		}
+		if (tries >= maxTries) {
+			MS_LOG_ERROR("rtsp source %s gave up after %d reconnects", m_streamID.c_str(), tries);
+			break;
+		}
+
+		int64_t until = GetCurMs() + ReconnectDelayMs(tries++);
+		MS_LOG_WARN("rtsp source %s input lost, reconnect %d in %lld ms", m_streamID.c_str(),
+		            tries, (long long)(until - GetCurMs()));
+		while (!m_isClosing.load() && GetCurMs() < until) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+
+	this->SourceActiveClose();
+}
+
+int MsRtspSource::RunInput(bool &played) {
 	int ret;
 	AVFormatContext *fmt_ctx = NULL;
 	AVPacket *pkt = NULL;
 	AVDictionary *options = NULL;
 	bool fisrtVideoPkt = true;
+	bool isRtsp = IsRtspUrl(m_url);
+	// rtsp codec parameters come from the sdp, probing packets is only needed for
+	// other urls or when rtspProbe asks for it
+	bool probe = !isRtsp || MsConfig::Instance()->GetConfigInt("rtspProbe") > 0;
+	bool waitPs = false;
+	bool reopen = m_fmtCtx != nullptr;
+	int videoIdx, audioIdx = -1;
+	AVStream *video, *audio = nullptr;
+	string ps;
+	int64_t t1 = GetCurMs();
 
 	// Add rtsp_transport=tcp option if URL is RTSP
-	if (m_url.find("rtsp://") == 0 || m_url.find("RTSP://") == 0) {
+	if (isRtsp) {
+		int timeout = MsConfig::Instance()->GetConfigInt("rtspTimeoutSec");
 		av_dict_set(&options, "rtsp_transport", "tcp", 0);
+		// a camera that stops sending fails the read instead of hanging it
+		av_dict_set_int(&options, "timeout",
+		                (int64_t)(timeout > 0 ? timeout : RTSP_DEF_TIMEOUT_SEC) * 1000000, 0);
 	}
 
-	av_dict_set(&options, "analyzeduration", "200000", 0);
+	if (probe) {
+		av_dict_set(&options, "analyzeduration", "200000", 0);
+	}
 	ret = avformat_open_input(&fmt_ctx, m_url.c_str(), NULL, &options);
 	av_dict_free(&options);
 
 	if (ret < 0) {
 		MS_LOG_ERROR("Could not open input url:%s, err:%d", m_url.c_str(), ret);
-		this->SourceActiveClose();
-		return;
+		return 0;
 	}
 
-	ret = avformat_find_stream_info(fmt_ctx, NULL);
-	if (ret < 0) {
+	if (probe && (ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
 		MS_LOG_ERROR("Could not find stream info url:%s, err:%d", m_url.c_str(), ret);
 		avformat_close_input(&fmt_ctx);
-		this->SourceActiveClose();
-		return;
+		return 0;
 	}
 
 	ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
 	if (ret < 0) {
 		MS_LOG_ERROR("Could not find video stream in url:%s, err:%d", m_url.c_str(), ret);
 		avformat_close_input(&fmt_ctx);
-		this->SourceActiveClose();
-		return;
+		return 0;
 	}
 
-	m_videoIdx = ret;
-	m_video = fmt_ctx->streams[m_videoIdx];
-	if (m_video->codecpar->codec_id != AV_CODEC_ID_H264 &&
-	    m_video->codecpar->codec_id != AV_CODEC_ID_H265) {
-		MS_LOG_ERROR("not support codec:%d url:%s", m_video->codecpar->codec_id, m_url.c_str());
+	videoIdx = ret;
+	video = fmt_ctx->streams[videoIdx];
+	if (video->codecpar->codec_id != AV_CODEC_ID_H264 &&
+	    video->codecpar->codec_id != AV_CODEC_ID_H265) {
+		MS_LOG_ERROR("not support codec:%d url:%s", video->codecpar->codec_id, m_url.c_str());
 		avformat_close_input(&fmt_ctx);
-		this->SourceActiveClose();
-		return;
+		return -1;
 	}
 
 	ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
 	if (ret >= 0) {
 		if (fmt_ctx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_AAC ||
 		    fmt_ctx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_OPUS) {
-			m_audioIdx = ret;
-			m_audio = fmt_ctx->streams[m_audioIdx];
+			audioIdx = ret;
+			audio = fmt_ctx->streams[audioIdx];
 		}
 	}
 
-	this->NotifyStreamInfo();
+	if (reopen) {
+		// sinks were set up for the first input, it has to come back the same
+		if (!m_audio) {
+			audio = nullptr;
+			audioIdx = -1;
+		}
+		if (video->codecpar->codec_id != m_video->codecpar->codec_id ||
+		    (audio && audio->codecpar->codec_id != m_audio->codecpar->codec_id)) {
+			MS_LOG_ERROR("rtsp source %s codec changed on reconnect", m_streamID.c_str());
+			avformat_close_input(&fmt_ctx);
+			return -1;
+		}
+		MS_LOG_INFO("rtsp source %s reconnected in %lld ms", m_streamID.c_str(),
+		            (long long)(GetCurMs() - t1));
+		this->NotifyDiscontinuity();
+	} else {
+		m_fmtCtx = avformat_alloc_context();
+		m_video = CopyStream(m_fmtCtx, video);
+		m_videoIdx = m_video->index;
+		if (audio) {
+			m_audio = CopyStream(m_fmtCtx, audio);
+			m_audioIdx = m_audio->index;
+		}
+
+		// without sprop parameter sets in the sdp wait for them in band
+		MsParamSets::Apply(m_video->codecpar);
+		if (!probe && m_video->codecpar->extradata_size <= 0) {
+			MS_LOG_INFO("no parameter sets in sdp, wait in band url:%s", m_url.c_str());
+			waitPs = true;
+		} else {
+			MS_LOG_DEBUG("stream info in %lld ms url:%s", (long long)(GetCurMs() - t1),
+			             m_url.c_str());
+			m_infoSent = true;
+			this->NotifyStreamInfo();
+		}
+	}
 
 	pkt = av_packet_alloc();
 
 	/* read frames from the file */
 	while (av_read_frame(fmt_ctx, pkt) >= 0 && !m_isClosing.load()) {
-		if (pkt->stream_index == m_videoIdx || pkt->stream_index == m_audioIdx) {
+		if (waitPs && pkt->stream_index == videoIdx) {
+			bool hevc = m_video->codecpar->codec_id == AV_CODEC_ID_H265;
+			if (MsParamSets::Collect(pkt->data, pkt->size, hevc, ps)) {
+				MsParamSets::Apply(m_video->codecpar, ps);
+				MS_LOG_DEBUG("stream info in %lld ms url:%s", (long long)(GetCurMs() - t1),
+				             m_url.c_str());
+				m_infoSent = true;
+				this->NotifyStreamInfo();
+				waitPs = false;
+			}
+		}
+
+		if (!waitPs && (pkt->stream_index == videoIdx || pkt->stream_index == audioIdx)) {
 			// log video pts dts
-			// if (pkt->stream_index == m_videoIdx) {
+			// if (pkt->stream_index == videoIdx) {
 			// 	MS_LOG_DEBUG(
 			// 	    "video pkt pts:%ld dts:%ld key:%d",
-			// 	    pkt->pts * 1000L * m_video->time_base.num / m_video->time_base.den,
-			// 	    pkt->dts * 1000L * m_video->time_base.num / m_video->time_base.den,
+			// 	    pkt->pts * 1000L * video->time_base.num / video->time_base.den,
+			// 	    pkt->dts * 1000L * video->time_base.num / video->time_base.den,
 			// 	    pkt->flags & AV_PKT_FLAG_KEY);
-			// } else if (pkt->stream_index == m_audioIdx) {
+			// } else if (pkt->stream_index == audioIdx) {
 			// 	MS_LOG_DEBUG(
 			// 	    "audio pkt pts:%ld dts:%ld size:%d",
-			// 	    pkt->pts * 1000L * m_audio->time_base.num / m_audio->time_base.den,
-			// 	    pkt->dts * 1000L * m_audio->time_base.num / m_audio->time_base.den,
+			// 	    pkt->pts * 1000L * audio->time_base.num / audio->time_base.den,
+			// 	    pkt->dts * 1000L * audio->time_base.num / audio->time_base.den,
 			// 	    pkt->size);
 			// }
 
-			if (pkt->stream_index == m_videoIdx) {
+			if (pkt->stream_index == videoIdx) {
 				if (fisrtVideoPkt) {
 					fisrtVideoPkt = false;
 					// TODO: quick fix for some RTSP stream with first pkt pts=dts=AV_NOPTS_VALUE
@@ -113,7 +285,13 @@ void MsRtspSource::OnRun() {
 						}
 					}
 				}
+				av_packet_rescale_ts(pkt, video->time_base, m_video->time_base);
+				pkt->stream_index = m_videoIdx;
+			} else {
+				av_packet_rescale_ts(pkt, audio->time_base, m_audio->time_base);
+				pkt->stream_index = m_audioIdx;
 			}
+			played = true;
 			this->NotifyStreamPacket(pkt);
 		}
 		av_packet_unref(pkt);
@@ -121,5 +299,755 @@ void MsRtspSource::OnRun() {
 
 	avformat_close_input(&fmt_ctx);
 	av_packet_free(&pkt);
+	return 0;
+}
+
+void MsRtspSource::ClientStart(shared_ptr<MsReactor> reactor) {
+	MsConfig *config = MsConfig::Instance();
+	int timeout = config->GetConfigInt("rtspTimeoutSec");
+	string rest = m_url.substr(7);
+	size_t slash = rest.find('/');
+	string host = rest.substr(0, slash);
+
+	m_reactor = reactor;
+	m_udp = config->GetConfigInt("rtspClientUdp") > 0;
+	m_timeoutMs = (int64_t)(timeout > 0 ? timeout : RTSP_DEF_TIMEOUT_SEC) * 1000;
+	m_buf = make_unique<char[]>(RTSP_BUF_SIZE);
+
+	// rtsp://[user[:pass]@]host[:port]/path
+	size_t at = host.rfind('@');
+	if (at != string::npos) {
+		string cred = host.substr(0, at);
+		size_t c = cred.find(':');
+		m_user = cred.substr(0, c);
+		if (c != string::npos) {
+			m_pass = cred.substr(c + 1);
+		}
+		host = host.substr(at + 1);
+	}
+
+	m_reqUrl = "rtsp://" + host + (slash != string::npos ? rest.substr(slash) : "/");
+
+	size_t colon = host.find(':');
+	if (colon != string::npos) {
+		m_port = atoi(host.c_str() + colon + 1);
+		host = host.substr(0, colon);
+	}
+	m_host = host;
+
+	this->ClientConnect();
+}
+
+void MsRtspSource::ClientConnect() {
+	string host = m_host;
+
+	m_retrying = false;
+	if (m_stopped) {
+		return;
+	}
+
+	m_state = RTSP_CONNECT;
+	m_keepMs = RTSP_DEF_SESSION_SEC * 1000 / 2;
+	m_startMs = GetCurMs();
+	m_lastRecvMs = m_startMs;
+
+	// cameras are mostly given by address, a name is resolved blocking the reactor
+	struct in_addr inAddr;
+	if (inet_pton(AF_INET, host.c_str(), &inAddr) != 1) {
+		struct addrinfo hints = {}, *result;
+		char ip[64] = {0};
+
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.c_str(), NULL, &hints, &result)) {
+			this->ClientStop("resolve failed");
+			return;
+		}
+		inet_ntop(AF_INET, &((struct sockaddr_in *)result->ai_addr)->sin_addr, ip, sizeof(ip));
+		freeaddrinfo(result);
+		host = ip;
+	}
+
+	shared_ptr<MsSocket> sock = make_shared<MsSocket>(AF_INET, SOCK_STREAM, 0);
+	shared_ptr<MsEventHandler> handler = make_shared<MsRtspClientHandler>(shared_from_this());
+	MsInetAddr addr(AF_INET, host, m_port);
+
+	sock->SetNonBlock();
+	if (sock->Connect(addr) == 0) {
+		m_evt = make_shared<MsEvent>(sock, MS_FD_READ | MS_FD_CLOSE, handler);
+		m_reactor->AddEvent(m_evt);
+		m_state = RTSP_OPTIONS;
+		this->SendState();
+	} else if (MS_LAST_ERROR == EINPROGRESS) {
+		m_evt = make_shared<MsEvent>(sock, MS_FD_CONNECT | MS_FD_CLOSE, handler);
+		m_reactor->AddEvent(m_evt);
+	} else {
+		MS_LOG_ERROR("rtsp client %s connect err:%d", m_streamID.c_str(), MS_LAST_ERROR);
+		this->ClientStop("connect failed");
+	}
+}
+
+bool MsRtspSource::ClientTick() {
+	if (m_stopped) {
+		return false;
+	}
+
+	int64_t now = GetCurMs();
+
+	if (m_isClosing.load()) {
+		this->ClientStop("no viewer");
+		return false;
+	}
+
+	if (m_retrying) {
+		return true;
+	}
+
+	if (now - m_lastRecvMs > m_timeoutMs) {
+		this->ClientStop("timeout");
+		return !m_stopped;
+	}
+
+	if (m_state == RTSP_PLAYING && now - m_lastKeepMs >= m_keepMs) {
+		m_lastKeepMs = now;
+		if (this->SendRequest(m_getParam ? "GET_PARAMETER" : "OPTIONS", m_playUrl) < 0) {
+			this->ClientStop("send failed");
+			return !m_stopped;
+		}
+	}
+
+	return true;
+}
+
+void MsRtspSource::ClientStop(const char *reason, bool retry) {
+	// while waiting to reconnect only the viewers leaving end it
+	if (m_stopped || (m_retrying && !m_isClosing.load())) {
+		return;
+	}
+
+	this->ClientClose();
+
+	// viewers stay attached while a camera that played comes back
+	if (retry && !m_retrying && m_infoSent && !m_isClosing.load() && !this->IsIdle() &&
+	    m_tries < ReconnectTries()) {
+		int delay = ReconnectDelayMs(m_tries++);
+		MS_LOG_WARN("rtsp client %s lost: %s, reconnect %d in %d ms", m_streamID.c_str(), reason,
+		            m_tries, delay);
+
+		MsMsg msg;
+		msg.m_msgID = MS_RTSP_CLIENT_RETRY;
+		msg.m_any = shared_from_this();
+		m_reactor->EnqueDelayMsg(msg, delay);
+		m_retrying = true;
+		return;
+	}
+
+	m_stopped = true;
+	m_retrying = false;
+	MS_LOG_INFO("rtsp client %s stop: %s", m_streamID.c_str(), reason);
 	this->SourceActiveClose();
 }
+
+// the connection and rtp sockets of the session, the streams are kept
+void MsRtspSource::ClientClose() {
+	if (m_evt && m_session.size()) {
+		this->SendRequest("TEARDOWN", m_playUrl);
+	}
+
+	for (auto &t : m_tracks) {
+		if (t.m_udpEvt) {
+			m_reactor->DelEvent(t.m_udpEvt);
+			t.m_udpEvt = nullptr;
+		}
+	}
+
+	if (m_evt) {
+		m_reactor->DelEvent(m_evt);
+		m_evt = nullptr;
+	}
+
+	m_state = RTSP_CONNECT;
+	m_bufOff = 0;
+	m_session.clear();
+	m_authTried = false;
+	m_setupIdx = 0;
+	m_firstMs = 0;
+}
+
+void MsRtspSource::OnConnected(shared_ptr<MsEvent> evt) {
+	if (m_state != RTSP_CONNECT || evt != m_evt) {
+		return;
+	}
+
+	int err = 0;
+	socklen_t len = sizeof(err);
+	getsockopt(evt->GetSocket()->GetFd(), SOL_SOCKET, SO_ERROR, &err, &len);
+	if (err) {
+		MS_LOG_ERROR("rtsp client %s connect err:%d", m_streamID.c_str(), err);
+		this->ClientStop("connect failed");
+		return;
+	}
+
+	evt->SetEvent(MS_FD_READ | MS_FD_CLOSE);
+	m_reactor->ModEvent(evt);
+	m_state = RTSP_OPTIONS;
+	this->SendState();
+}
+
+void MsRtspSource::OnTcpData(shared_ptr<MsEvent> evt) {
+	// events of a closed session may still be reported once
+	if (evt != m_evt) {
+		return;
+	}
+
+	int n = evt->GetSocket()->Recv(m_buf.get() + m_bufOff, RTSP_BUF_SIZE - 1 - m_bufOff);
+	if (n <= 0) {
+		if (n == 0 || (MS_LAST_ERROR != EAGAIN && MS_LAST_ERROR != EINTR)) {
+			this->ClientStop("connection closed");
+		}
+		return;
+	}
+
+	m_bufOff += n;
+	m_buf[m_bufOff] = '\0';
+	m_lastRecvMs = GetCurMs();
+
+	char *p = m_buf.get();
+	int left = m_bufOff;
+
+	while (left > 0 && m_evt) {
+		// interleaved $ channel len16
+		if (p[0] == '$') {
+			if (left < 4) {
+				break;
+			}
+
+			int len = AV_RB16(p + 2);
+			if (left < 4 + len) {
+				break;
+			}
+
+			for (size_t i = 0; i < m_tracks.size(); ++i) {
+				if (m_tracks[i].m_channel == (uint8_t)p[1]) {
+					this->OnRtp(i, (uint8_t *)p + 4, len);
+				}
+			}
+
+			p += 4 + len;
+			left -= 4 + len;
+			continue;
+		}
+
+		// lost sync, look for the next frame or message
+		if (p[0] < 'A' || p[0] > 'Z') {
+			++p;
+			--left;
+			continue;
+		}
+
+		int scanOff = 0;
+		int hdrLen = FindHeaderEnd(p, left, scanOff);
+		if (hdrLen < 0) {
+			if (left >= RTSP_BUF_SIZE - 1) {
+				this->ClientStop("rtsp header too big");
+				return;
+			}
+			break;
+		}
+
+		MsRtspMsg rsp;
+		char *p2 = p;
+		rsp.Parse(p2);
+
+		int cntLen = atoi(rsp.m_contentLength.m_value.c_str());
+		if (hdrLen + cntLen > left) {
+			if (hdrLen + cntLen >= RTSP_BUF_SIZE - 1) {
+				this->ClientStop("rtsp body too big");
+				return;
+			}
+			break;
+		}
+
+		MS_LOG_VERBS("rtsp client %s recv:%.*s", m_streamID.c_str(), hdrLen, p);
+		this->HandleResponse(rsp, p + hdrLen, cntLen);
+
+		p += hdrLen + cntLen;
+		left -= hdrLen + cntLen;
+	}
+
+	if (!m_evt) {
+		return;
+	}
+
+	if (left && p != m_buf.get()) {
+		memmove(m_buf.get(), p, left);
+	}
+	m_bufOff = left;
+}
+
+void MsRtspSource::OnRtp(int track, const uint8_t *buf, int len) {
+	if (!m_evt) {
+		return;
+	}
+
+	if (m_isClosing.load()) {
+		this->ClientStop("no viewer");
+		return;
+	}
+
+	m_lastRecvMs = GetCurMs();
+	if (track >= 0 && track < (int)m_tracks.size()) {
+		m_tracks[track].m_depack->Input(buf, len);
+	}
+}
+
+int MsRtspSource::SendRequest(const string &method, const string &uri, const string &transport) {
+	MsRtspMsg req;
+
+	req.m_method = method;
+	req.m_uri = uri;
+	req.m_version = "RTSP/1.0";
+	req.m_cseq.SetIntVal(++m_cseq);
+
+	if (transport.size()) {
+		req.m_transport.SetValue(transport);
+	}
+	if (m_session.size()) {
+		req.m_session.SetValue(m_session);
+	}
+	if (method == "DESCRIBE") {
+		req.m_accept.SetValue("application/sdp");
+	} else if (method == "PLAY") {
+		req.m_range.SetValue("npt=0.000-");
+	}
+
+	string auth = this->AuthValue(method, uri);
+	if (auth.size()) {
+		req.m_auth.SetValue(auth);
+	}
+
+	if (SendRtspMsg(req, m_evt->GetSocket()) < 0) {
+		return -1;
+	}
+
+	return m_cseq;
+}
+
+// the request of the current state, sent again after a 401
+void MsRtspSource::SendState() {
+	int ret = 0;
+
+	switch (m_state) {
+	case RTSP_OPTIONS:
+		ret = this->SendRequest("OPTIONS", m_reqUrl);
+		break;
+
+	case RTSP_DESCRIBE:
+		ret = this->SendRequest("DESCRIBE", m_reqUrl);
+		break;
+
+	case RTSP_SETUP: {
+		STrack &t = m_tracks[m_setupIdx];
+		string transport;
+
+		if (m_udp) {
+			if (!t.m_udpEvt) {
+				string ip;
+				shared_ptr<MsSocket> sock =
+				    MsPortAllocator::Instance()->AllocPort(SOCK_DGRAM, ip, t.m_port);
+				if (!sock) {
+					this->ClientStop("no udp port");
+					return;
+				}
+
+				sock->SetNonBlock();
+				shared_ptr<MsEventHandler> handler =
+				    make_shared<MsRtspUdpHandler>(shared_from_this(), (int)m_setupIdx);
+				t.m_udpEvt = make_shared<MsEvent>(sock, MS_FD_READ, handler);
+				m_reactor->AddEvent(t.m_udpEvt);
+			}
+
+			// rtcp is not read, its port is only announced
+			transport = "RTP/AVP;unicast;client_port=" + to_string(t.m_port) + "-" +
+			            to_string(t.m_port + 1);
+		} else {
+			transport = "RTP/AVP/TCP;unicast;interleaved=" + to_string(m_setupIdx * 2) + "-" +
+			            to_string(m_setupIdx * 2 + 1);
+		}
+
+		ret = this->SendRequest("SETUP", t.m_control, transport);
+	} break;
+
+	case RTSP_PLAY:
+		ret = this->SendRequest("PLAY", m_playUrl);
+		break;
+
+	default:
+		return;
+	}
+
+	if (ret < 0) {
+		this->ClientStop("send failed");
+		return;
+	}
+
+	m_stateCseq = ret;
+}
+
+void MsRtspSource::HandleResponse(MsRtspMsg &rsp, const char *body, int len) {
+	int status = atoi(rsp.m_status.c_str());
+
+	// answers to keepalives, and requests of the server
+	if (m_state == RTSP_PLAYING || atoi(rsp.m_cseq.m_value.c_str()) != m_stateCseq) {
+		return;
+	}
+
+	if (status == 401 && !m_authTried && m_user.size() && rsp.m_wwwAuth.m_exist) {
+		m_wwwAuth.SetValue(rsp.m_wwwAuth.m_value);
+		m_authTried = true;
+		m_cnonce = GenRandStr(16);
+		m_authNc = 0;
+		this->SendState();
+		return;
+	}
+
+	// some cameras do not answer OPTIONS properly, DESCRIBE tells
+	if (status != 200 && m_state != RTSP_OPTIONS) {
+		MS_LOG_ERROR("rtsp client %s state:%d status:%d", m_streamID.c_str(), m_state, status);
+		this->ClientStop("request failed");
+		return;
+	}
+
+	m_authTried = false;
+
+	switch (m_state) {
+	case RTSP_OPTIONS:
+		m_getParam = rsp.m_public.m_value.find("GET_PARAMETER") != string::npos;
+		m_state = RTSP_DESCRIBE;
+		break;
+
+	case RTSP_DESCRIBE:
+		m_baseUrl = rsp.m_contentBase.m_exist ? rsp.m_contentBase.m_value : m_reqUrl;
+		if (this->ParseSdp(string(body, len)) < 0) {
+			this->ClientStop("unusable sdp", false);
+			return;
+		}
+		m_state = RTSP_SETUP;
+		m_setupIdx = 0;
+		break;
+
+	case RTSP_SETUP: {
+		string &session = rsp.m_session.m_value;
+		string &transport = rsp.m_transport.m_value;
+
+		if (m_session.empty() && session.size()) {
+			m_session = session.substr(0, session.find(';'));
+			size_t p = session.find("timeout=");
+			if (p != string::npos && atoi(session.c_str() + p + 8) > 0) {
+				m_keepMs = atoi(session.c_str() + p + 8) * 1000 / 2;
+			}
+		}
+
+		if (!m_udp) {
+			size_t p = transport.find("interleaved=");
+			m_tracks[m_setupIdx].m_channel =
+			    p != string::npos ? atoi(transport.c_str() + p + 12) : m_setupIdx * 2;
+		}
+
+		if (++m_setupIdx == m_tracks.size()) {
+			m_state = RTSP_PLAY;
+		}
+	} break;
+
+	case RTSP_PLAY:
+		m_state = RTSP_PLAYING;
+		m_lastKeepMs = GetCurMs();
+		MS_LOG_INFO("rtsp client %s playing in %lld ms", m_streamID.c_str(),
+		            (long long)(m_lastKeepMs - m_startMs));
+		if (m_infoSent) {
+			// a reconnect, the sinks go on with this session
+			this->NotifyDiscontinuity();
+		} else if (!m_waitPs) {
+			m_infoSent = true;
+			this->NotifyStreamInfo();
+		}
+		return;
+	}
+
+	this->SendState();
+}
+
+int MsRtspSource::ParseSdp(const string &sdp) {
+	struct SMedia {
+		string m_type;
+		int m_pt = -1;
+		string m_codec;
+		int m_clock = 0;
+		int m_channels = 1;
+		string m_fmtp;
+		string m_control;
+	};
+
+	vector<SMedia> medias;
+	string control;
+
+	for (auto &line : SplitString(sdp, "\n")) {
+		string l = line.substr(0, line.find_last_not_of("\r ") + 1);
+		SMedia *m = medias.size() ? &medias.back() : nullptr;
+
+		if (!l.compare(0, 2, "m=")) {
+			medias.emplace_back();
+			medias.back().m_type = l.substr(2, l.find(' ') - 2);
+			size_t p = l.find("AVP ");
+			if (p != string::npos) {
+				medias.back().m_pt = atoi(l.c_str() + p + 4);
+			}
+		} else if (!l.compare(0, 10, "a=control:")) {
+			(m ? m->m_control : control) = l.substr(10);
+		} else if (m && !l.compare(0, 9, "a=rtpmap:") && atoi(l.c_str() + 9) == m->m_pt) {
+			// a=rtpmap:<pt> <name>/<clock>[/<channels>]
+			vector<string> v = SplitString(l.substr(l.find(' ') + 1), "/");
+			m->m_codec = v[0];
+			m->m_clock = v.size() > 1 ? atoi(v[1].c_str()) : 0;
+			m->m_channels = v.size() > 2 ? atoi(v[2].c_str()) : 1;
+		} else if (m && !l.compare(0, 7, "a=fmtp:") && atoi(l.c_str() + 7) == m->m_pt) {
+			m->m_fmtp = l.substr(l.find(' ') + 1);
+		}
+	}
+
+	SMedia *video = nullptr, *audio = nullptr;
+	for (auto &m : medias) {
+		const char *c = m.m_codec.c_str();
+		if (m.m_clock <= 0) {
+			continue;
+		}
+
+		if (!video && m.m_type == "video" &&
+		    (!strcasecmp(c, "H264") || !strcasecmp(c, "H265") || !strcasecmp(c, "HEVC"))) {
+			video = &m;
+		} else if (!audio && m.m_type == "audio" &&
+		           (!strcasecmp(c, "MPEG4-GENERIC") || !strcasecmp(c, "OPUS"))) {
+			audio = &m;
+		}
+	}
+
+	if (!video) {
+		MS_LOG_ERROR("rtsp client %s sdp:%s", m_streamID.c_str(), sdp.c_str());
+		return -1;
+	}
+
+	auto codecOf = [](SMedia *m) {
+		if (!strcasecmp(m->m_codec.c_str(), "H264")) {
+			return AV_CODEC_ID_H264;
+		} else if (m->m_type == "video") {
+			return AV_CODEC_ID_H265;
+		}
+		return strcasecmp(m->m_codec.c_str(), "OPUS") ? AV_CODEC_ID_AAC : AV_CODEC_ID_OPUS;
+	};
+
+	// a reconnect sets up the streams the sinks already hold, they have to match
+	bool reopen = m_fmtCtx != nullptr;
+	if (reopen) {
+		if (!m_audio) {
+			audio = nullptr;
+		}
+		for (SMedia *m : {video, audio}) {
+			AVStream *st = m == video ? m_video : m_audio;
+			if (m && (codecOf(m) != st->codecpar->codec_id || m->m_clock != st->time_base.den)) {
+				MS_LOG_ERROR("rtsp client %s stream changed, sdp:%s", m_streamID.c_str(),
+				             sdp.c_str());
+				return -1;
+			}
+		}
+		m_tracks.clear();
+	} else {
+		m_fmtCtx = avformat_alloc_context();
+	}
+
+	m_playUrl = this->TrackUrl(control);
+
+	for (SMedia *m : {video, audio}) {
+		if (!m) {
+			continue;
+		}
+
+		AVStream *st = reopen ? (m == video ? m_video : m_audio)
+		                      : avformat_new_stream(m_fmtCtx, NULL);
+		AVCodecParameters *par = st->codecpar;
+		int idx = (int)m_tracks.size();
+
+		m_tracks.emplace_back();
+		STrack &t = m_tracks.back();
+		t.m_stream = st;
+		t.m_control = this->TrackUrl(m->m_control);
+
+		if (reopen) {
+			// parameter sets of the first session stay, cameras repeat them in band
+		} else if (m == video) {
+			bool hevc = codecOf(m) == AV_CODEC_ID_H265;
+			string sprop, sets;
+
+			st->time_base = {1, m->m_clock};
+			par->codec_type = AVMEDIA_TYPE_VIDEO;
+			par->codec_id = codecOf(m);
+
+			// sprop-parameter-sets, or sprop-vps/sps/pps, comma separated base64
+			for (const char *key : {"sprop-vps", "sprop-sps", "sprop-pps"}) {
+				string v = MsRtpDepack::FmtpValue(m->m_fmtp, hevc ? key : "sprop-parameter-sets");
+				for (auto &b64 : SplitString(v, ",")) {
+					vector<unsigned char> nal;
+					b64.append((4 - b64.size() % 4) % 4, '=');
+					DecodeBase64(b64, nal);
+					if (nal.size()) {
+						sprop.append("\x00\x00\x00\x01", 4);
+						sprop.append((const char *)nal.data(), nal.size());
+					}
+				}
+				if (!hevc) {
+					break;
+				}
+			}
+
+			if (MsParamSets::Collect((const uint8_t *)sprop.data(), sprop.size(), hevc, sets)) {
+				MsParamSets::Apply(par, sets);
+			} else {
+				MS_LOG_INFO("rtsp client %s no parameter sets in sdp, wait in band",
+				            m_streamID.c_str());
+				m_waitPs = true;
+			}
+
+			m_video = st;
+			m_videoIdx = st->index;
+		} else {
+			bool opus = codecOf(m) == AV_CODEC_ID_OPUS;
+
+			st->time_base = {1, m->m_clock};
+			par->codec_type = AVMEDIA_TYPE_AUDIO;
+			par->codec_id = codecOf(m);
+			par->sample_rate = m->m_clock;
+			av_channel_layout_default(&par->ch_layout, m->m_channels > 0 ? m->m_channels : 1);
+
+			// AudioSpecificConfig as hex
+			string config = MsRtpDepack::FmtpValue(m->m_fmtp, "config");
+			if (!opus && config.size() >= 4) {
+				int n = config.size() / 2;
+				par->extradata = (uint8_t *)av_mallocz(n + AV_INPUT_BUFFER_PADDING_SIZE);
+				for (int i = 0; i < n; ++i) {
+					par->extradata[i] = strtol(config.substr(i * 2, 2).c_str(), NULL, 16);
+				}
+				par->extradata_size = n;
+			}
+
+			m_audio = st;
+			m_audioIdx = st->index;
+		}
+
+		t.m_depack = make_unique<MsRtpDepack>(
+		    par->codec_id, st->index, [this, idx](AVPacket *pkt) { this->OnFrame(idx, pkt); });
+		if (par->codec_id == AV_CODEC_ID_AAC) {
+			t.m_depack->SetAacFmtp(m->m_fmtp);
+		}
+	}
+
+	return 0;
+}
+
+void MsRtspSource::OnFrame(int track, AVPacket *pkt) {
+	STrack &t = m_tracks[track];
+	int64_t now = GetCurMs();
+
+	// tracks start from 0 each, shifted by when they started against the first one
+	if (!t.m_started) {
+		t.m_started = true;
+		if (!m_firstMs) {
+			m_firstMs = now;
+		}
+		t.m_offset = av_rescale_q(now - m_firstMs, {1, 1000}, t.m_stream->time_base);
+	}
+
+	pkt->pts += t.m_offset;
+	pkt->dts += t.m_offset;
+
+	if (m_waitPs) {
+		bool hevc = m_video->codecpar->codec_id == AV_CODEC_ID_H265;
+		if (t.m_stream != m_video || !MsParamSets::Collect(pkt->data, pkt->size, hevc, m_ps)) {
+			return;
+		}
+
+		MsParamSets::Apply(m_video->codecpar, m_ps);
+		m_waitPs = false;
+		m_infoSent = true;
+		this->NotifyStreamInfo();
+	}
+
+	if (m_infoSent) {
+		m_tries = 0;
+		this->NotifyStreamPacket(pkt);
+	}
+}
+
+string MsRtspSource::AuthValue(const string &method, const string &uri) {
+	if (!m_wwwAuth.m_exist || m_user.empty()) {
+		return string();
+	}
+
+	if (!strncasecmp(m_wwwAuth.m_value.c_str(), "Basic", 5)) {
+		string cred = m_user + ":" + m_pass;
+		return "Basic " + EncodeBase64((const unsigned char *)cred.data(), cred.size());
+	}
+
+	string realm = m_wwwAuth.GetAttr("realm");
+	string nonce = m_wwwAuth.GetAttr("nonce");
+	string opaque = m_wwwAuth.GetAttr("opaque");
+	string ha1 = Md5Hex(m_user + ":" + realm + ":" + m_pass);
+	string ha2 = Md5Hex(method + ":" + uri);
+
+	// qop is a list like "auth,auth-int", only auth is done
+	bool qopAuth = false;
+	string qop = m_wwwAuth.GetAttr("qop");
+	for (size_t pos = 0; pos <= qop.size();) {
+		size_t end = qop.find(',', pos);
+		if (end == string::npos) {
+			end = qop.size();
+		}
+		string tok = qop.substr(pos, end - pos);
+		tok.erase(0, tok.find_first_not_of(" \t"));
+		tok.erase(tok.find_last_not_of(" \t") + 1);
+		if (tok == "auth") {
+			qopAuth = true;
+			break;
+		}
+		pos = end + 1;
+	}
+
+	string value = "Digest username=\"" + m_user + "\", realm=\"" + realm + "\", nonce=\"" +
+	               nonce + "\", uri=\"" + uri + "\"";
+
+	if (qopAuth) {
+		char nc[16];
+		snprintf(nc, sizeof(nc), "%08x", ++m_authNc);
+		string resp = Md5Hex(ha1 + ":" + nonce + ":" + nc + ":" + m_cnonce + ":auth:" + ha2);
+		value += ", qop=auth, nc=" + string(nc) + ", cnonce=\"" + m_cnonce + "\", response=\"" +
+		         resp + "\"";
+	} else {
+		value += ", response=\"" + Md5Hex(ha1 + ":" + nonce + ":" + ha2) + "\"";
+	}
+
+	if (opaque.size()) {
+		value += ", opaque=\"" + opaque + "\"";
+	}
+
+	return value;
+}
+
+string MsRtspSource::TrackUrl(const string &control) {
+	if (control.empty() || control == "*") {
+		return m_baseUrl;
+	}
+
+	if (!strncasecmp(control.c_str(), "rtsp://", 7)) {
+		return control;
+	}
+
+	return m_baseUrl + (m_baseUrl.back() == '/' ? "" : "/") + control;
+}
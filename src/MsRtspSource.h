@@ -1,23 +1,106 @@
 #ifndef MS_RTSP_SOURCE_H
 #define MS_RTSP_SOURCE_H
+#include "MsEvent.h"
 #include "MsMediaSource.h"
+#include "MsReactor.h"
+#include "MsRtpDepack.h"
+#include "MsRtspMsg.h"
 
 class MsRtspSource : public MsMediaSource, public std::enable_shared_from_this<MsRtspSource> {
 public:
 	MsRtspSource(const std::string &streamID, const std::string &url)
 	    : MsMediaSource(streamID), m_url(url) {}
+	~MsRtspSource();
 
 	void Work() override;
 	void UpdateVideoInfo() override;
+	int GetLingerMs() override;
 	shared_ptr<MsMediaSource> GetSharedPtr() override {
 		return dynamic_pointer_cast<MsMediaSource>(shared_from_this());
 	}
 
+	// native client session, started on an MsRtspClient reactor and only run there
+	void ClientStart(shared_ptr<MsReactor> reactor);
+	void ClientConnect();
+	// keepalive, timeouts and viewers gone, false once the session stopped
+	bool ClientTick();
+	// a session that played is set up again after a backoff when retry allows it
+	void ClientStop(const char *reason, bool retry = true);
+	void OnConnected(shared_ptr<MsEvent> evt);
+	void OnTcpData(shared_ptr<MsEvent> evt);
+	void OnRtp(int track, const uint8_t *buf, int len);
+
 private:
 	void OnRun();
+	// one input until it ends, -1 when opening it again cannot help
+	int RunInput(bool &played);
+
+	int SendRequest(const string &method, const string &uri, const string &transport = "");
+	void SendState();
+	void ClientClose();
+	void HandleResponse(MsRtspMsg &rsp, const char *body, int len);
+	int ParseSdp(const string &sdp);
+	void OnFrame(int track, AVPacket *pkt);
+	string AuthValue(const string &method, const string &uri);
+	string TrackUrl(const string &control);
 
 private:
+	enum { RTSP_CONNECT, RTSP_OPTIONS, RTSP_DESCRIBE, RTSP_SETUP, RTSP_PLAY, RTSP_PLAYING };
+
+	struct STrack {
+		AVStream *m_stream = nullptr;
+		unique_ptr<MsRtpDepack> m_depack;
+		string m_control;
+		int m_channel = -1;
+		int m_port = 0;
+		shared_ptr<MsEvent> m_udpEvt;
+		bool m_started = false;
+		int64_t m_offset = 0;
+	};
+
 	std::string m_url;
+
+	shared_ptr<MsReactor> m_reactor;
+	shared_ptr<MsEvent> m_evt;
+	unique_ptr<char[]> m_buf;
+	int m_bufOff = 0;
+	int m_state = RTSP_CONNECT;
+	bool m_stopped = false;
+	bool m_udp = false;
+	int m_tries = 0;
+	bool m_retrying = false;
+	string m_host;
+	int m_port = 554;
+
+	// request url without credentials
+	string m_reqUrl;
+	string m_baseUrl;
+	string m_playUrl;
+	string m_user;
+	string m_pass;
+	MsComAuth m_wwwAuth{"WWW-Authenticate"};
+	bool m_authTried = false;
+	// qop=auth digest, nc counts the requests sent with the nonce
+	string m_cnonce;
+	int m_authNc = 0;
+
+	int m_cseq = 0;
+	int m_stateCseq = 0;
+	string m_session;
+	bool m_getParam = false;
+	size_t m_setupIdx = 0;
+	int64_t m_startMs = 0;
+	int64_t m_timeoutMs = 0;
+	int64_t m_keepMs = 0;
+	int64_t m_lastRecvMs = 0;
+	int64_t m_lastKeepMs = 0;
+	int64_t m_firstMs = 0;
+
+	AVFormatContext *m_fmtCtx = nullptr;
+	vector<STrack> m_tracks;
+	bool m_infoSent = false;
+	bool m_waitPs = false;
+	string m_ps;
 };
 
 #endif // MS_RTSP_SOURCE_H
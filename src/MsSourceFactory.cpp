@@ -1,20 +1,36 @@
 #include "MsSourceFactory.h"
 #include "MsDevMgr.h"
+#include "MsConfig.h"
 #include "MsFileSource.h"
+#include "MsFlvSource.h"
 #include "MsGbSource.h"
 #include "MsJtSource.h"
 #include "MsLog.h"
+#include "MsRecordSource.h"
+#include "MsResManager.h"
 #include "MsRtspSource.h"
+#include "MsTimeshiftSource.h"
 #include <fstream>
 
 static int m_seqID = 1;
 static std::mutex m_mutex;
 
 std::shared_ptr<MsMediaSource> MsSourceFactory::CreateLiveSource(const std::string &streamID) {
+	// if streamID ends with _jt, it is a JT source
+	bool jt = streamID.size() > 3 && streamID.substr(streamID.size() - 3) == "_jt";
+
+	// an edge node pulls cameras once from the origin instead of opening them itself
+	std::string origin = MsConfig::Instance()->GetConfigStr("relayOrigin");
+	if (origin.size() && !jt) {
+		if (origin.back() == '/') {
+			origin.pop_back();
+		}
+		return std::make_shared<MsFlvSource>(streamID, origin + "/live/" + streamID + ".flv");
+	}
+
 	auto device = MsDevMgr::Instance()->FindDevice(streamID);
 	if (!device) {
-		// if streamID ends with _jt, it is a JT source
-		if (streamID.size() > 3 && streamID.substr(streamID.size() - 3) == "_jt") {
+		if (jt) {
 			return std::make_shared<MsJtSource>(streamID);
 		}
 
@@ -30,6 +46,9 @@ std::shared_ptr<MsMediaSource> MsSourceFactory::CreateLiveSource(const std::stri
 			return nullptr;
 		}
 
+		if (MsFlvSource::IsFlvUrl(url)) {
+			return std::make_shared<MsFlvSource>(streamID, url);
+		}
 		return std::make_shared<MsRtspSource>(streamID, url);
 	} break;
 
@@ -51,7 +70,13 @@ std::shared_ptr<MsMediaSource> MsSourceFactory::CreateLiveSource(const std::stri
 
 std::shared_ptr<MsMediaSource> MsSourceFactory::CreateVodSource(const std::string &streamID,
                                                                 const std::string &filename) {
-	std::string fn = "files/" + filename;
+	// filename may carry ?start=<sec> to begin playback at an offset
+	std::string name = filename.substr(0, filename.find('?'));
+	std::string start;
+	GetParam("start", start, filename);
+	int64_t startMs = start.size() ? (int64_t)(atof(start.c_str()) * 1000) : 0;
+
+	std::string fn = "files/" + name;
 
 	// Check if file exists
 	std::ifstream file(fn);
@@ -60,7 +85,7 @@ std::shared_ptr<MsMediaSource> MsSourceFactory::CreateVodSource(const std::strin
 		return nullptr;
 	}
 
-	return std::make_shared<MsFileSource>(streamID, fn);
+	return std::make_shared<MsFileSource>(streamID, fn, startMs);
 }
 
 std::shared_ptr<MsMediaSource> MsSourceFactory::CreateGbvodSource(const std::string &streamID,
@@ -80,3 +105,59 @@ std::shared_ptr<MsMediaSource> MsSourceFactory::CreateGbvodSource(const std::str
 	std::lock_guard<std::mutex> lk(m_mutex);
 	return std::make_shared<MsGbSource>(streamID, ctx, m_seqID++);
 }
+
+bool MsSourceFactory::ParseTimeshift(const std::string &uri, std::string &streamID,
+                                     std::string &streamInfo) {
+	std::string delay;
+	GetParam("delay", delay, uri);
+	size_t p = uri.find('?');
+	if (delay.empty() || p == std::string::npos) {
+		return false;
+	}
+
+	streamInfo = streamID + uri.substr(p);
+	streamID = streamID + "_ts" + GenRandStr(8);
+	return true;
+}
+
+std::shared_ptr<MsMediaSource>
+MsSourceFactory::CreateTimeshiftSource(const std::string &streamID, const std::string &streamInfo) {
+	// <liveID>?delay=<sec>[&rate=<catch up rate>], the live source must be running
+	std::string liveID = streamInfo.substr(0, streamInfo.find('?'));
+	std::string delay, rate;
+	GetParam("delay", delay, streamInfo);
+	GetParam("rate", rate, streamInfo);
+
+	auto live = MsResManager::GetInstance().GetMediaSource(liveID);
+	std::shared_ptr<MsTimeshift> ring = live ? live->GetTimeshift() : nullptr;
+	if (!ring) {
+		MS_LOG_WARN("no timeshift buffer for stream:%s", liveID.c_str());
+		return nullptr;
+	}
+
+	int64_t delayMs = (int64_t)(atof(delay.c_str()) * 1000);
+	double r = rate.size() ? atof(rate.c_str()) : 1.0;
+	return std::make_shared<MsTimeshiftSource>(streamID, liveID, ring, delayMs, r);
+}
+
+std::shared_ptr<MsMediaSource> MsSourceFactory::CreateRecvodSource(const std::string &streamID,
+                                                                   const std::string &streamInfo) {
+	//%s-%ld-%ld", devID.c_str(), nSt, nEt, the stream id may contain '-'
+	size_t p2 = streamInfo.rfind('-');
+	size_t p1 = p2 == std::string::npos || p2 == 0 ? std::string::npos
+	                                                : streamInfo.rfind('-', p2 - 1);
+	if (p1 == std::string::npos || p1 == 0) {
+		MS_LOG_WARN("invalid recvod streamInfo:%s", streamInfo.c_str());
+		return nullptr;
+	}
+
+	std::string recID = streamInfo.substr(0, p1);
+	int64_t startMs = atoll(streamInfo.substr(p1 + 1, p2 - p1 - 1).c_str()) * 1000;
+	int64_t endMs = atoll(streamInfo.substr(p2 + 1).c_str()) * 1000;
+	if (endMs <= startMs) {
+		MS_LOG_WARN("invalid recvod range:%s", streamInfo.c_str());
+		return nullptr;
+	}
+
+	return std::make_shared<MsRecordSource>(streamID, recID, startMs, endMs);
+}
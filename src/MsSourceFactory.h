@@ -11,6 +11,17 @@ public:
 
 	static std::shared_ptr<MsMediaSource> CreateGbvodSource(const std::string &streamID,
 	                                                        const std::string &streamInfo);
+
+	// a live uri with ?delay=<sec> plays from the timeshift buffer through a source of
+	// its own, streamID and streamInfo are set for a "timeshift" source then
+	static bool ParseTimeshift(const std::string &uri, std::string &streamID,
+	                           std::string &streamInfo);
+
+	static std::shared_ptr<MsMediaSource> CreateTimeshiftSource(const std::string &streamID,
+	                                                            const std::string &streamInfo);
+
+	static std::shared_ptr<MsMediaSource> CreateRecvodSource(const std::string &streamID,
+	                                                         const std::string &streamInfo);
 };
 
 #endif // MS_SOURCE_FACTORY_H
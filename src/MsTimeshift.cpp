@@ -0,0 +1,304 @@
+#include "MsTimeshift.h"
+#include "MsConfig.h"
+#include "MsLog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TS_DEF_MAX_MB 64
+// freed spill space is given back in steps of this
+#define TS_PUNCH_BYTES (1024 * 1024)
+// a dts this far back means the source restarted its clock
+#define TS_RESTART_US 1000000
+
+MsTimeshift::MsTimeshift(const string &streamID, AVStream *video, int videoIdx, AVStream *audio,
+                         int audioIdx)
+    : m_streamID(streamID), m_srcVideoIdx(videoIdx), m_srcAudioIdx(audioIdx) {
+	MsConfig *config = MsConfig::Instance();
+	int maxMB = config->GetConfigInt("timeshiftMaxMB");
+	m_windowUs = (int64_t)config->GetConfigInt("timeshiftSec") * 1000000;
+	m_maxBytes = (int64_t)(maxMB > 0 ? maxMB : TS_DEF_MAX_MB) * 1024 * 1024;
+
+	// own copies of the streams, the source may go away while viewers still play
+	m_ctx = avformat_alloc_context();
+	m_video = avformat_new_stream(m_ctx, NULL);
+	avcodec_parameters_copy(m_video->codecpar, video->codecpar);
+	m_video->time_base = video->time_base;
+
+	if (audio) {
+		m_audio = avformat_new_stream(m_ctx, NULL);
+		avcodec_parameters_copy(m_audio->codecpar, audio->codecpar);
+		m_audio->time_base = audio->time_base;
+	}
+
+	string spill = config->GetConfigStr("timeshiftSpillPath");
+	if (spill.size()) {
+		spill += "/ms_timeshift_XXXXXX";
+		m_spillFd = mkstemp(&spill[0]);
+		if (m_spillFd < 0) {
+			MS_LOG_WARN("timeshift %s spill file err:%d", streamID.c_str(), errno);
+		} else {
+			// only the descriptor keeps it, the space is freed on close even after a crash
+			unlink(spill.c_str());
+		}
+	}
+}
+
+MsTimeshift::~MsTimeshift() {
+	for (auto &e : m_ring) {
+		if (e.m_pkt) {
+			av_packet_free(&e.m_pkt);
+		}
+	}
+
+	if (m_spillFd >= 0) {
+		close(m_spillFd);
+	}
+
+	avformat_free_context(m_ctx);
+}
+
+void MsTimeshift::Push(AVPacket *pkt) {
+	bool isVideo = pkt->stream_index == m_srcVideoIdx;
+	if (!isVideo && (!m_audio || pkt->stream_index != m_srcAudioIdx)) {
+		return;
+	}
+
+	int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+	if (dts == AV_NOPTS_VALUE) {
+		return;
+	}
+
+	AVStream *st = isVideo ? m_video : m_audio;
+	int64_t us = av_rescale_q(dts, st->time_base, AV_TIME_BASE_Q);
+	bool key = isVideo && (pkt->flags & AV_PKT_FLAG_KEY);
+
+	vector<SSpill> spill;
+	unique_lock<mutex> lk(m_mutex);
+	if (m_closed) {
+		return;
+	}
+
+	if (!m_ring.empty() && us < m_lastUs - TS_RESTART_US) {
+		MS_LOG_INFO("timeshift %s clock restarted, reset", m_streamID.c_str());
+		while (!m_ring.empty()) {
+			this->PopFront();
+		}
+		m_lastUs = INT64_MIN;
+	}
+
+	if (m_ring.empty() && !key) {
+		return;
+	}
+
+	AVPacket *p = av_packet_clone(pkt);
+	if (!p) {
+		return;
+	}
+	p->stream_index = isVideo ? 0 : 1;
+
+	STsPacket e = {};
+	e.m_pkt = p;
+	e.m_us = us;
+	e.m_key = key;
+	e.m_size = p->size;
+	m_ring.push_back(e);
+	m_ramBytes += p->size;
+	if (us > m_lastUs) {
+		m_lastUs = us;
+	}
+
+	while (!m_ring.empty() && m_lastUs - m_ring.front().m_us > m_windowUs) {
+		this->PopFront();
+	}
+
+	// over the memory bound the oldest packets in memory go to the spill file. their place
+	// in it is taken here, the writes are done once the lock is released
+	while (m_ramBytes > m_maxBytes && !m_ring.empty()) {
+		bool inRing = m_ramSeq < m_firstSeq + (int64_t)m_ring.size();
+		AVPacket *sp = nullptr;
+		if (m_spillFd >= 0 && !m_spillFailed && inRing) {
+			sp = av_packet_clone(m_ring[m_ramSeq - m_firstSeq].m_pkt);
+		}
+		if (!sp) {
+			this->PopFront();
+			continue;
+		}
+
+		STsPacket &e = m_ring[m_ramSeq - m_firstSeq];
+		e.m_spilling = true;
+		e.m_off = m_spillEnd;
+		e.m_pts = sp->pts;
+		e.m_dts = sp->dts;
+		e.m_duration = sp->duration;
+		e.m_flags = sp->flags;
+		e.m_index = sp->stream_index;
+		spill.push_back({m_ramSeq, m_spillEnd, sp});
+		m_spillEnd += e.m_size;
+		m_ramBytes -= e.m_size;
+		++m_ramSeq;
+	}
+
+	// a ring starting inside a gop can not be decoded
+	while (!m_ring.empty() && !m_ring.front().m_key) {
+		this->PopFront();
+	}
+
+	if (spill.size()) {
+		lk.unlock();
+		this->Spill(spill);
+	}
+}
+
+void MsTimeshift::Close() {
+	lock_guard<mutex> lk(m_mutex);
+	m_closed = true;
+}
+
+void MsTimeshift::PopFront() {
+	STsPacket &e = m_ring.front();
+
+	if (e.m_spilling) {
+		// its bytes are counted off already, the file space goes with the next spilled one
+		av_packet_free(&e.m_pkt);
+	} else if (e.m_pkt) {
+		m_ramBytes -= e.m_size;
+		av_packet_free(&e.m_pkt);
+	} else {
+		m_spillHead = e.m_off + e.m_size;
+		if (m_spillHead - m_punched >= TS_PUNCH_BYTES) {
+			fallocate(m_spillFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, m_punched,
+			          m_spillHead - m_punched);
+			m_punched = m_spillHead;
+		}
+	}
+
+	m_ring.pop_front();
+	++m_firstSeq;
+	if (m_ramSeq < m_firstSeq) {
+		m_ramSeq = m_firstSeq;
+	}
+}
+
+// runs on the pushing thread without the lock, readers keep the packets in memory meanwhile
+void MsTimeshift::Spill(vector<SSpill> &spill) {
+	bool failed = false;
+	for (auto &sp : spill) {
+		if (!failed && pwrite(m_spillFd, sp.m_pkt->data, sp.m_pkt->size, sp.m_off) !=
+		                   sp.m_pkt->size) {
+			MS_LOG_WARN("timeshift %s spill err:%d, drop instead", m_streamID.c_str(), errno);
+			failed = true;
+		}
+	}
+
+	lock_guard<mutex> lk(m_mutex);
+	for (auto &sp : spill) {
+		av_packet_free(&sp.m_pkt);
+		if (sp.m_seq < m_firstSeq) {
+			continue;
+		}
+
+		STsPacket &e = m_ring[sp.m_seq - m_firstSeq];
+		e.m_spilling = false;
+		if (failed) {
+			// stays in memory, dropped by PopFront from now on
+			m_ramBytes += e.m_size;
+		} else {
+			av_packet_free(&e.m_pkt);
+		}
+	}
+
+	if (failed) {
+		m_spillFailed = true;
+	}
+}
+
+int64_t MsTimeshift::LocateLive(int64_t behindUs) {
+	lock_guard<mutex> lk(m_mutex);
+	int64_t target = m_lastUs - behindUs;
+
+	for (size_t i = m_ring.size(); i > 0; --i) {
+		if (m_ring[i - 1].m_key && m_ring[i - 1].m_us <= target) {
+			return m_firstSeq + i - 1;
+		}
+	}
+
+	return m_firstSeq;
+}
+
+int64_t MsTimeshift::LocateStart(int64_t ms) {
+	lock_guard<mutex> lk(m_mutex);
+	if (m_ring.empty()) {
+		return m_firstSeq;
+	}
+
+	int64_t target = m_ring.front().m_us + ms * 1000;
+	int64_t seq = m_firstSeq;
+
+	for (size_t i = 0; i < m_ring.size() && m_ring[i].m_us <= target; ++i) {
+		if (m_ring[i].m_key) {
+			seq = m_firstSeq + i;
+		}
+	}
+
+	return seq;
+}
+
+int MsTimeshift::Read(int64_t &seq, AVPacket *pkt, bool &jumped) {
+	unique_lock<mutex> lk(m_mutex);
+
+	jumped = false;
+	if (seq < m_firstSeq) {
+		seq = m_firstSeq;
+		jumped = true;
+	}
+
+	if (seq >= m_firstSeq + (int64_t)m_ring.size()) {
+		return m_closed ? -1 : 1;
+	}
+
+	STsPacket e = m_ring[seq - m_firstSeq];
+	int64_t rseq = seq++;
+
+	if (e.m_pkt) {
+		return av_packet_ref(pkt, e.m_pkt) < 0 ? -1 : 0;
+	}
+
+	// the spill file is read without the lock, a slow disk must not hold up Push
+	lk.unlock();
+	if (av_new_packet(pkt, e.m_size) < 0) {
+		return -1;
+	}
+
+	bool ok = pread(m_spillFd, pkt->data, e.m_size, e.m_off) == e.m_size;
+	if (!ok) {
+		MS_LOG_WARN("timeshift %s read spill err:%d", m_streamID.c_str(), errno);
+	}
+
+	// popped meanwhile, its space may have been punched while being read
+	lk.lock();
+	if (!ok || rseq < m_firstSeq) {
+		av_packet_unref(pkt);
+		jumped = true;
+		return 1;
+	}
+
+	pkt->pts = e.m_pts;
+	pkt->dts = e.m_dts;
+	pkt->duration = e.m_duration;
+	pkt->flags = e.m_flags;
+	pkt->stream_index = e.m_index;
+	return 0;
+}
+
+int64_t MsTimeshift::LagUs(int64_t seq) {
+	lock_guard<mutex> lk(m_mutex);
+	if (seq < m_firstSeq) {
+		seq = m_firstSeq;
+	}
+	if (seq >= m_firstSeq + (int64_t)m_ring.size()) {
+		return 0;
+	}
+	return m_lastUs - m_ring[seq - m_firstSeq].m_us;
+}
@@ -0,0 +1,88 @@
+#ifndef MS_TIMESHIFT_H
+#define MS_TIMESHIFT_H
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+// the last timeshiftSec of a live source, shared by all its delayed viewers. packets
+// are refs of the source buffers, once timeshiftMaxMB is used the oldest ones are
+// moved to a file under timeshiftSpillPath, or dropped without one. the ring always
+// starts on a video key frame. video is stream 0, audio stream 1
+class MsTimeshift {
+public:
+	MsTimeshift(const string &streamID, AVStream *video, int videoIdx, AVStream *audio,
+	            int audioIdx);
+	~MsTimeshift();
+
+	void Push(AVPacket *pkt);
+	// no more packets, readers drain what is left
+	void Close();
+
+	// seq of the key frame at or before behindUs from the live edge
+	int64_t LocateLive(int64_t behindUs);
+	// seq of the key frame at or before ms from the oldest packet
+	int64_t LocateStart(int64_t ms);
+	// 0 with the packet at seq and seq moved on, 1 if there is none yet, -1 once closed
+	// and drained. a seq that fell out of the window jumps to the oldest key frame
+	int Read(int64_t &seq, AVPacket *pkt, bool &jumped);
+	int64_t LagUs(int64_t seq);
+
+	AVStream *m_video = nullptr;
+	AVStream *m_audio = nullptr;
+
+private:
+	struct STsPacket {
+		AVPacket *m_pkt;
+		int64_t m_us;
+		bool m_key;
+		// being written to the spill file, still read from m_pkt until done
+		bool m_spilling;
+		// where a spilled packet is kept
+		int64_t m_off;
+		int m_size;
+		int64_t m_pts;
+		int64_t m_dts;
+		int64_t m_duration;
+		int m_flags;
+		int m_index;
+	};
+
+	struct SSpill {
+		int64_t m_seq;
+		int64_t m_off;
+		AVPacket *m_pkt;
+	};
+
+	void PopFront();
+	void Spill(vector<SSpill> &spill);
+
+	string m_streamID;
+	int m_srcVideoIdx;
+	int m_srcAudioIdx;
+	AVFormatContext *m_ctx = nullptr;
+	int64_t m_windowUs;
+	int64_t m_maxBytes;
+
+	mutex m_mutex;
+	deque<STsPacket> m_ring;
+	int64_t m_firstSeq = 0;
+	int64_t m_ramSeq = 0;
+	int64_t m_ramBytes = 0;
+	int64_t m_lastUs = INT64_MIN;
+	bool m_closed = false;
+
+	int m_spillFd = -1;
+	bool m_spillFailed = false;
+	int64_t m_spillEnd = 0;
+	int64_t m_spillHead = 0;
+	int64_t m_punched = 0;
+};
+
+#endif // MS_TIMESHIFT_H
@@ -0,0 +1,76 @@
+#include "MsTimeshiftSource.h"
+#include "MsLog.h"
+#include "MsResManager.h"
+#include <atomic>
+
+// back within this of the live edge catch up ends
+#define TS_EDGE_US 1000000
+
+// keeps the live source open while delayed viewers read its ring
+class MsTimeshiftKeeper : public MsMediaSink {
+public:
+	MsTimeshiftKeeper(const std::string &streamID, int sinkID)
+	    : MsMediaSink("timeshift", streamID, sinkID) {}
+
+	void OnSourceClose() override {}
+	void OnStreamPacket(AVPacket *pkt) override {}
+};
+
+int MsTimeshiftSource::Open() {
+	static std::atomic<int> keeperID{0};
+
+	m_keeper = std::make_shared<MsTimeshiftKeeper>(m_filename, ++keeperID);
+	if (!MsResManager::GetInstance().GetOrCreateMediaSource("live", m_filename, "", m_keeper)) {
+		m_keeper = nullptr;
+	}
+
+	m_video = m_ring->m_video;
+	m_videoIdx = 0;
+	m_audio = m_ring->m_audio;
+	m_audioIdx = m_audio ? 1 : -1;
+
+	m_seq = m_ring->LocateLive(m_delayMs * 1000);
+	if (m_catchup > 1.0) {
+		this->SetRate(m_catchup > 2.0 ? 2.0 : m_catchup);
+	}
+
+	MS_LOG_INFO("timeshift %s of %s, %lld ms behind", m_streamID.c_str(), m_filename.c_str(),
+	            (long long)(m_ring->LagUs(m_seq) / 1000));
+	return 0;
+}
+
+int MsTimeshiftSource::ReadPacket(AVPacket *pkt, bool block) {
+	bool jumped;
+	int ret = m_ring->Read(m_seq, pkt, jumped);
+
+	// fell out of the window, go on from its oldest key frame
+	if (jumped) {
+		m_seekWaitKey = true;
+		m_newSeg = true;
+	}
+
+	if (ret > 0) {
+		return AVERROR(EAGAIN);
+	} else if (ret < 0) {
+		return AVERROR_EOF;
+	}
+
+	if (m_catchup > 1.0 && m_ring->LagUs(m_seq) < TS_EDGE_US) {
+		MS_LOG_INFO("timeshift %s caught up with live", m_streamID.c_str());
+		m_catchup = 1.0;
+		this->SetRate(1.0);
+	}
+
+	return 0;
+}
+
+void MsTimeshiftSource::SeekInput(int64_t ms) { m_seq = m_ring->LocateStart(ms); }
+
+void MsTimeshiftSource::SourceActiveClose() {
+	if (m_keeper) {
+		m_keeper->DetachSource();
+		m_keeper = nullptr;
+	}
+
+	MsFileSource::SourceActiveClose();
+}
@@ -0,0 +1,30 @@
+#ifndef MS_TIMESHIFT_SOURCE_H
+#define MS_TIMESHIFT_SOURCE_H
+#include "MsFileSource.h"
+#include "MsTimeshift.h"
+
+// one delayed viewer of a live stream, reading the shared MsTimeshift of the source
+// with its own cursor. it starts delayMs behind the live edge and may catch up at
+// rate, back at the edge it plays at 1x. seek positions count from the oldest packet
+class MsTimeshiftSource : public MsFileSource {
+public:
+	MsTimeshiftSource(const std::string &streamID, const std::string &liveID,
+	                  shared_ptr<MsTimeshift> ring, int64_t delayMs, double rate)
+	    : MsFileSource(streamID, liveID), m_ring(ring), m_delayMs(delayMs), m_catchup(rate) {}
+
+	void SourceActiveClose() override;
+
+protected:
+	int Open() override;
+	int ReadPacket(AVPacket *pkt, bool block) override;
+	void SeekInput(int64_t ms) override;
+
+private:
+	shared_ptr<MsTimeshift> m_ring;
+	shared_ptr<MsMediaSink> m_keeper;
+	int64_t m_delayMs;
+	double m_catchup;
+	int64_t m_seq = 0;
+};
+
+#endif // MS_TIMESHIFT_SOURCE_H
@@ -0,0 +1,308 @@
+#include "MsVodFile.h"
+#include "MsConfig.h"
+#include "MsFileIo.h"
+#include "MsFileProbe.h"
+#include "MsCommon.h"
+#include "MsLog.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VOD_DEF_MEM_MAX_BYTES (256 * 1024 * 1024)
+// packets read back and compared before trusting pkt->pos
+#define VOD_CHECK_PKTS 16
+
+mutex MsVodFile::m_mapMutex;
+map<string, weak_ptr<MsVodFile>> MsVodFile::m_files;
+
+MsVodFile::MsVodFile(const string &path)
+    : m_path(path), m_fd(-1), m_direct(false), m_openState(0), m_duration(0), m_fmtCtx(nullptr),
+      m_complete(false), m_exit(false) {}
+
+MsVodFile::~MsVodFile() {
+	{
+		lock_guard<mutex> lk(m_mutex);
+		m_exit = true;
+	}
+
+	if (m_worker && m_worker->joinable()) {
+		m_worker->join();
+	}
+
+	for (auto &vp : m_pkts) {
+		if (vp.m_pkt) {
+			av_packet_free(&vp.m_pkt);
+		}
+	}
+
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+
+	if (m_fmtCtx) {
+		MsFileProbe::Close(&m_fmtCtx);
+	}
+
+	MS_LOG_INFO("vod file %s released", m_path.c_str());
+}
+
+shared_ptr<MsVodFile> MsVodFile::Get(const string &path) {
+	shared_ptr<MsVodFile> file;
+
+	{
+		lock_guard<mutex> lk(m_mapMutex);
+		auto it = m_files.find(path);
+		if (it != m_files.end()) {
+			file = it->second.lock();
+		}
+
+		if (!file) {
+			file = make_shared<MsVodFile>(path);
+			m_files[path] = file;
+		}
+	}
+
+	{
+		lock_guard<mutex> lk(file->m_openMutex);
+		if (file->m_openState == 0) {
+			file->m_openState = file->Open() ? -1 : 1;
+		}
+
+		if (file->m_openState > 0) {
+			return file;
+		}
+	}
+
+	lock_guard<mutex> lk(m_mapMutex);
+	auto it = m_files.find(path);
+	if (it != m_files.end() && it->second.lock() == file) {
+		m_files.erase(it);
+	}
+
+	return nullptr;
+}
+
+int MsVodFile::Open() {
+	int ret = MsFileProbe::Open(m_path, &m_fmtCtx, nullptr);
+	if (ret < 0) {
+		MS_LOG_ERROR("vod open %s err:%d", m_path.c_str(), ret);
+		return -1;
+	}
+
+	ret = av_find_best_stream(m_fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (ret < 0) {
+		MS_LOG_ERROR("vod no video stream in %s", m_path.c_str());
+		return -1;
+	}
+
+	m_videoIdx = ret;
+	m_video = m_fmtCtx->streams[m_videoIdx];
+	if (m_video->codecpar->codec_id != AV_CODEC_ID_H264 &&
+	    m_video->codecpar->codec_id != AV_CODEC_ID_H265) {
+		MS_LOG_ERROR("vod not support codec:%d url:%s", m_video->codecpar->codec_id,
+		             m_path.c_str());
+		return -1;
+	}
+
+	ret = av_find_best_stream(m_fmtCtx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+	if (ret >= 0) {
+		if (m_fmtCtx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_AAC ||
+		    m_fmtCtx->streams[ret]->codecpar->codec_id == AV_CODEC_ID_OPUS) {
+			m_audioIdx = ret;
+			m_audio = m_fmtCtx->streams[m_audioIdx];
+		}
+	}
+
+	m_duration = m_fmtCtx->duration > 0 ? m_fmtCtx->duration / 1000 : 0;
+	m_direct = !strncmp(m_fmtCtx->iformat->name, "mov", 3);
+	if (m_direct) {
+		m_fd = open(m_path.c_str(), O_RDONLY);
+		m_direct = m_fd >= 0;
+	}
+
+	// check the first packets really sit at pkt->pos before trusting it, their payload is
+	// kept so nothing has to be demuxed twice when the check fails
+	AVPacket *pkt = av_packet_alloc();
+	int n = 0;
+	while (n < VOD_CHECK_PKTS && av_read_frame(m_fmtCtx, pkt) >= 0) {
+		if (m_direct && (pkt->stream_index == m_videoIdx || pkt->stream_index == m_audioIdx)) {
+			vector<uint8_t> data(pkt->size);
+			if (pkt->pos < 0 ||
+			    MsFileIo::Pread(m_fd, data.data(), pkt->size, pkt->pos) != pkt->size ||
+			    memcmp(data.data(), pkt->data, pkt->size)) {
+				MS_LOG_INFO("vod %s payload not at pkt pos, keep in memory", m_path.c_str());
+				m_direct = false;
+			}
+			++n;
+		}
+
+		this->AddPacket(pkt, true);
+	}
+	av_packet_free(&pkt);
+
+	if (!m_direct) {
+		int64_t maxBytes = MsConfig::Instance()->GetConfigInt("vodMemMaxBytes");
+		if (maxBytes <= 0) {
+			maxBytes = VOD_DEF_MEM_MAX_BYTES;
+		}
+
+		struct stat st;
+		if (stat(m_path.c_str(), &st) || st.st_size > maxBytes) {
+			MS_LOG_INFO("vod %s too big to share in memory", m_path.c_str());
+			return -1;
+		}
+	}
+
+	m_worker = make_unique<thread>(&MsVodFile::OnIndex, this);
+	return 0;
+}
+
+// append pkt to the index, the payload is moved out of pkt when keep is set
+int MsVodFile::AddPacket(AVPacket *pkt, bool keep) {
+	if (pkt->stream_index != m_videoIdx && pkt->stream_index != m_audioIdx) {
+		av_packet_unref(pkt);
+		return -1;
+	}
+
+	AVStream *st = m_fmtCtx->streams[pkt->stream_index];
+	int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+	if (dts == AV_NOPTS_VALUE) {
+		MS_LOG_WARN("vod %s pts dts both AV_NOPTS_VALUE", m_path.c_str());
+		av_packet_unref(pkt);
+		return -1;
+	}
+
+	MsVodPkt vp;
+	int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+
+	vp.m_pos = pkt->pos;
+	vp.m_size = pkt->size;
+	vp.m_stream = pkt->stream_index;
+	vp.m_flags = pkt->flags;
+	vp.m_pts = pkt->pts;
+	vp.m_dts = pkt->dts;
+	vp.m_ms = av_rescale_q(dts - start, st->time_base, {1, 1000});
+	vp.m_pkt = nullptr;
+
+	if (keep) {
+		vp.m_pkt = av_packet_alloc();
+		av_packet_move_ref(vp.m_pkt, pkt);
+	} else {
+		av_packet_unref(pkt);
+	}
+
+	{
+		lock_guard<mutex> lk(m_mutex);
+		if (vp.m_stream == m_videoIdx && (vp.m_flags & AV_PKT_FLAG_KEY)) {
+			m_keys.push_back(m_pkts.size());
+		}
+		m_pkts.push_back(vp);
+	}
+
+	m_cond.notify_all();
+	return 0;
+}
+
+void MsVodFile::OnIndex() {
+	AVPacket *pkt = av_packet_alloc();
+	int64_t t1 = GetCurMs();
+
+	while (true) {
+		{
+			lock_guard<mutex> lk(m_mutex);
+			if (m_exit) {
+				break;
+			}
+		}
+
+		if (av_read_frame(m_fmtCtx, pkt) < 0) {
+			break;
+		}
+
+		this->AddPacket(pkt, !m_direct);
+	}
+
+	av_packet_free(&pkt);
+
+	{
+		lock_guard<mutex> lk(m_mutex);
+		m_complete = true;
+		MS_LOG_INFO("vod %s indexed %d pkts, direct:%d take:%lldms", m_path.c_str(),
+		            (int)m_pkts.size(), m_direct, (long long)(GetCurMs() - t1));
+	}
+
+	m_cond.notify_all();
+}
+
+int MsVodFile::Wait(size_t idx) {
+	unique_lock<mutex> lk(m_mutex);
+	m_cond.wait(lk, [this, idx]() { return idx < m_pkts.size() || m_complete || m_exit; });
+	return idx < m_pkts.size() ? 0 : -1;
+}
+
+int MsVodFile::Peek(size_t idx) {
+	lock_guard<mutex> lk(m_mutex);
+	if (idx < m_pkts.size()) {
+		return 0;
+	}
+	return m_complete || m_exit ? -1 : 1;
+}
+
+bool MsVodFile::Indexed(int64_t ms) {
+	lock_guard<mutex> lk(m_mutex);
+	return m_complete || m_exit || (m_pkts.size() && m_pkts.back().m_ms >= ms);
+}
+
+int MsVodFile::ReadPacket(size_t idx, AVPacket *pkt) {
+	MsVodPkt vp;
+
+	{
+		lock_guard<mutex> lk(m_mutex);
+		if (idx >= m_pkts.size()) {
+			return AVERROR_EOF;
+		}
+
+		vp = m_pkts[idx];
+		if (vp.m_pkt) {
+			return av_packet_ref(pkt, vp.m_pkt);
+		}
+	}
+
+	int ret = av_new_packet(pkt, vp.m_size);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (MsFileIo::Pread(m_fd, pkt->data, vp.m_size, vp.m_pos) != vp.m_size) {
+		MS_LOG_ERROR("vod %s read pkt at %lld err:%d", m_path.c_str(), (long long)vp.m_pos,
+		             errno);
+		av_packet_unref(pkt);
+		return AVERROR(EIO);
+	}
+
+	pkt->pts = vp.m_pts;
+	pkt->dts = vp.m_dts;
+	pkt->flags = vp.m_flags;
+	pkt->stream_index = vp.m_stream;
+	pkt->pos = vp.m_pos;
+	return 0;
+}
+
+size_t MsVodFile::Seek(int64_t ms) {
+	unique_lock<mutex> lk(m_mutex);
+	m_cond.wait(lk, [this, ms]() {
+		return m_complete || m_exit || (m_pkts.size() && m_pkts.back().m_ms >= ms);
+	});
+
+	size_t idx = 0;
+	auto it = upper_bound(m_keys.begin(), m_keys.end(), ms,
+	                      [this](int64_t v, size_t k) { return v < m_pkts[k].m_ms; });
+	if (it != m_keys.begin()) {
+		idx = *(--it);
+	}
+
+	return idx;
+}
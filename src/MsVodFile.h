@@ -0,0 +1,82 @@
+#ifndef MS_VOD_FILE_H
+#define MS_VOD_FILE_H
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+struct MsVodPkt {
+	int64_t m_pos;
+	int m_size;
+	int m_stream;
+	int m_flags;
+	int64_t m_pts;
+	int64_t m_dts;
+	int64_t m_ms;       // dts in ms from the file start
+	AVPacket *m_pkt;    // payload held in memory when it can not be read back at m_pos
+};
+
+// packet index of one vod file shared by all viewers of it. the file is demuxed
+// once by an index thread, viewers walk the index with their own cursor. mp4
+// samples are contiguous at pkt->pos so their payload is pread back on demand,
+// other formats keep the demuxed packets in memory, up to vodMemMaxBytes
+class MsVodFile {
+public:
+	MsVodFile(const string &path);
+	~MsVodFile();
+
+	// shared instance for path, nullptr if the file can not be shared
+	static shared_ptr<MsVodFile> Get(const string &path);
+
+	// wait until idx is indexed, -1 once idx is past the end of the file
+	int Wait(size_t idx);
+	// Wait without blocking, 1 while idx is not indexed yet
+	int Peek(size_t idx);
+	// true once Seek(ms) would not block
+	bool Indexed(int64_t ms);
+	// ref or read packet idx into pkt, timestamps left in the stream time base
+	int ReadPacket(size_t idx, AVPacket *pkt);
+	// index of the video key frame at or before ms
+	size_t Seek(int64_t ms);
+	int64_t GetDuration() const { return m_duration; }
+
+	AVStream *m_video = nullptr;
+	int m_videoIdx = -1;
+	AVStream *m_audio = nullptr;
+	int m_audioIdx = -1;
+
+private:
+	int Open();
+	int AddPacket(AVPacket *pkt, bool keep);
+	void OnIndex();
+
+	string m_path;
+	int m_fd;
+	bool m_direct;
+	int m_openState;
+	mutex m_openMutex;
+	int64_t m_duration;
+	AVFormatContext *m_fmtCtx;
+
+	mutex m_mutex;
+	condition_variable m_cond;
+	bool m_complete;
+	bool m_exit;
+	vector<MsVodPkt> m_pkts;
+	vector<size_t> m_keys;
+	unique_ptr<thread> m_worker;
+
+	static mutex m_mapMutex;
+	static map<string, weak_ptr<MsVodFile>> m_files;
+};
+
+#endif // MS_VOD_FILE_H
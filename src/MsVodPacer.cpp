@@ -0,0 +1,22 @@
+#include "MsVodPacer.h"
+#include "MsFileSource.h"
+#include "MsMsgDef.h"
+
+void MsVodPacer::HandleMsg(MsMsg &msg) {
+	switch (msg.m_msgID) {
+	case MS_VOD_PACE: {
+		auto source = any_cast<shared_ptr<MsFileSource>>(msg.m_any);
+		int64_t delay = source->Pump(false);
+
+		if (delay < 0) {
+			source->Finish();
+		} else {
+			this->EnqueDelayMsg(msg, (int)delay);
+		}
+	} break;
+
+	default:
+		MsReactor::HandleMsg(msg);
+		break;
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef MS_VOD_PACER_H
+#define MS_VOD_PACER_H
+#include "MsReactor.h"
+
+// shared reactor driving vod sources from delayed msgs instead of a thread per viewer,
+// vodPacerThreads of them are started, 0 keeps the thread per viewer
+class MsVodPacer : public MsReactor {
+public:
+	MsVodPacer(int type, int id) : MsReactor(type, id) {}
+
+	void HandleMsg(MsMsg &msg) override;
+};
+
+#endif // MS_VOD_PACER_H
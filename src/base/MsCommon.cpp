@@ -1,4 +1,5 @@
 #include "MsCommon.h"
+#include "MsSearch.h"
 #include <iconv.h>
 #include <memory>
 #include <random>
@@ -8,7 +9,23 @@
 #include <time.h>
 #include <unistd.h>
 
-bool IsHeaderComplete(char *p) { return NULL != strstr(p, "\r\n\r\n"); }
+// search [p, p+len) for the header terminator, resuming where the last call stopped.
+// return header length including the terminator, or -1 with scanOff advanced
+int FindHeaderEnd(const char *p, int len, int &scanOff) {
+	int off = scanOff > 3 ? scanOff - 3 : 0;
+	if (len - off < 4) {
+		return -1;
+	}
+
+	const char *e = MsMemFind(p + off, len - off, "\r\n\r\n", 4);
+	if (!e) {
+		scanOff = len;
+		return -1;
+	}
+
+	scanOff = 0;
+	return e - p + 4;
+}
 
 void SkipToSpace(char *&p) {
 	while (*p != ' ' && *p) {
@@ -128,7 +145,10 @@ MsComHeader::MsComHeader(const char *key) : m_key(key), m_exist(false) {}
 
 void MsComHeader::Dump(string &rsp) {
 	if (m_exist) {
-		AddHeaderLine(rsp, m_key, m_value);
+		rsp += m_key;
+		rsp += ": ";
+		rsp += m_value;
+		rsp += "\r\n";
 	}
 }
 
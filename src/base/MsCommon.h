@@ -9,12 +9,25 @@ using namespace std;
 #define DEF_BUF_SIZE 64 * 1024
 
 #define AV_RB16(x) ((((const uint8_t *)(x))[0] << 8) | ((const uint8_t *)(x))[1])
+#define AV_RB24(x)                                                                                 \
+	((((const uint8_t *)(x))[0] << 16) | (((const uint8_t *)(x))[1] << 8) |                        \
+	 ((const uint8_t *)(x))[2])
 #define AV_RB32(x)                                                                                 \
 	((((const uint8_t *)(x))[0] << 24) | (((const uint8_t *)(x))[1] << 16) |                       \
 	 (((const uint8_t *)(x))[2] << 8) | ((const uint8_t *)(x))[3])
+#define AV_WB16(p, v)                                                                              \
+	do {                                                                                           \
+		((uint8_t *)(p))[0] = (uint8_t)((v) >> 8);                                                 \
+		((uint8_t *)(p))[1] = (uint8_t)(v);                                                        \
+	} while (0)
+#define AV_WB32(p, v)                                                                              \
+	do {                                                                                           \
+		AV_WB16(p, (v) >> 16);                                                                     \
+		AV_WB16((uint8_t *)(p) + 2, v);                                                            \
+	} while (0)
 #define RTP_FLAG_MARKER 0x2 ///< RTP marker bit was set for this packet
 
-bool IsHeaderComplete(char *p);
+int FindHeaderEnd(const char *p, int len, int &scanOff);
 void SkipToSpace(char *&p);
 void SkipSpace(char *&p);
 void ParseReqLine(char *&buf, string &method, string &uri, string &version);
@@ -43,7 +56,12 @@ public:
 		m_exist = true;
 	}
 
-	string m_key;
+	inline void SetValue(const char *value, size_t len) {
+		m_value.assign(value, len);
+		m_exist = true;
+	}
+
+	const char *m_key;
 	string m_value;
 	bool m_exist;
 };
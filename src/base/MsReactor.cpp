@@ -1,4 +1,5 @@
 #include "MsReactor.h"
+#include "MsCommon.h"
 #include "MsLog.h"
 #include "MsTimer.h"
 #include <thread>
@@ -90,7 +91,7 @@ int MsReactor::Wait() {
 	int ret;
 
 	while (!m_exit) {
-		ret = epoll_wait(m_efd, m_eventHandles, MS_MAX_EVENTS, -1);
+		ret = epoll_wait(m_efd, m_eventHandles, MS_MAX_EVENTS, this->NextDelay());
 
 		if (ret > 0) {
 			for (int i = 0; i < ret; ++i) {
@@ -115,6 +116,8 @@ int MsReactor::Wait() {
 		} else if (m_msgQue.size()) {
 			this->ProcessMsgQue();
 		}
+
+		this->ProcessDelayQue();
 	}
 
 	this->ProcessMsgQue();
@@ -162,6 +165,51 @@ void MsReactor::ProcessMsgQue() {
 	}
 }
 
+void MsReactor::EnqueDelayMsg(MsMsg &msg, int delay) {
+	unique_lock<mutex> lk(m_mutex);
+
+	int64_t due = GetCurMs() + (delay > 0 ? delay : 0);
+	bool wake = m_delayQue.empty() || due < m_delayQue.top().m_due;
+	m_delayQue.push({due, ++m_delaySeq, msg});
+
+	lk.unlock();
+
+	// epoll_wait has to pick up the earlier deadline
+	if (wake) {
+		uint64_t c = 1;
+		write(m_eventfd, &c, sizeof(c));
+	}
+}
+
+// epoll_wait timeout until the first delayed msg is due
+int MsReactor::NextDelay() {
+	lock_guard<mutex> lk(m_mutex);
+
+	if (m_delayQue.empty()) {
+		return -1;
+	}
+
+	int64_t d = m_delayQue.top().m_due - GetCurMs();
+	return d > 0 ? (int)d : 0;
+}
+
+void MsReactor::ProcessDelayQue() {
+	unique_lock<mutex> lk(m_mutex);
+	vector<MsMsg> msgs;
+	int64_t now = GetCurMs();
+
+	while (m_delayQue.size() && m_delayQue.top().m_due <= now) {
+		msgs.emplace_back(m_delayQue.top().m_msg);
+		m_delayQue.pop();
+	}
+
+	lk.unlock();
+
+	for (auto &msg : msgs) {
+		this->HandleMsg(msg);
+	}
+}
+
 int MsReactor::PostMsg(MsMsg &msg) {
 	msg.m_srcType = m_type;
 	msg.m_srcID = m_id;
@@ -243,6 +291,21 @@ shared_ptr<MsReactor> MsReactorMgr::GetReactor(int type, int id) {
 	}
 }
 
+shared_ptr<MsReactor> MsReactorMgr::PickReactor(int type) {
+	lock_guard<mutex> lk(MsReactorMgr::m_mutex);
+
+	auto it = m_reactors.find(type);
+
+	if (it == m_reactors.end() || it->second.empty()) {
+		return NULL;
+	}
+
+	auto itr = it->second.begin();
+	advance(itr, m_next[type]++ % it->second.size());
+
+	return itr->second;
+}
+
 MsReactorMgr *MsReactorMgr::Instance() {
 	if (MsReactorMgr::m_manager.get()) {
 		return MsReactorMgr::m_manager.get();
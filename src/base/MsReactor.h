@@ -2,9 +2,11 @@
 #define MS_REACTOR_H
 #include "MsEvent.h"
 #include "MsMsg.h"
+#include <functional>
 #include <map>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 class MsReactor : public enable_shared_from_this<MsReactor> {
 public:
@@ -33,6 +35,10 @@ public:
 	void EnqueMsg(MsMsg &msg);
 	void ProcessMsgQue();
 
+	// handle msg on this reactor after delay ms, at ms precision unlike AddTimer
+	void EnqueDelayMsg(MsMsg &msg, int delay);
+	void ProcessDelayQue();
+
 	int PostMsg(MsMsg &msg);
 	void PostExit();
 	inline bool IsExit() { return m_exit; }
@@ -63,6 +69,21 @@ private:
 
 	queue<MsMsg> m_msgQue;
 
+	struct SDelayMsg {
+		int64_t m_due;
+		int64_t m_seq;
+		MsMsg m_msg;
+
+		bool operator>(const SDelayMsg &other) const {
+			return m_due != other.m_due ? m_due > other.m_due : m_seq > other.m_seq;
+		}
+	};
+
+	priority_queue<SDelayMsg, vector<SDelayMsg>, greater<SDelayMsg>> m_delayQue;
+	int64_t m_delaySeq = 0;
+
+	int NextDelay();
+
 private:
 	mutex m_mutex;
 };
@@ -76,11 +97,14 @@ public:
 
 	int PostMsg(MsMsg &msg);
 	shared_ptr<MsReactor> GetReactor(int type, int id);
+	// next reactor of the type round robin, nullptr when none runs
+	shared_ptr<MsReactor> PickReactor(int type);
 
 	static MsReactorMgr *Instance();
 
 private:
 	map<int, map<int, shared_ptr<MsReactor>>> m_reactors;
+	map<int, unsigned> m_next;
 
 	static unique_ptr<MsReactorMgr> m_manager;
 	static mutex m_mutex;
@@ -0,0 +1,117 @@
+#include "MsSearch.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MS_SEARCH_X86 1
+#endif
+
+// needles up to this size go through the simd filter, the rest use memmem
+#define SHORT_NEEDLE 16
+
+static const char *ScalarFind(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+	const char *p = hay;
+	const char *end = hay + hlen - nlen + 1;
+
+	while (p < end) {
+		p = (const char *)memchr(p, needle[0], end - p);
+		if (!p) {
+			return nullptr;
+		}
+		if (!memcmp(p + 1, needle + 1, nlen - 1)) {
+			return p;
+		}
+		++p;
+	}
+
+	return nullptr;
+}
+
+#if MS_SEARCH_X86
+// compare the first and last needle byte over 16/32 positions at once,
+// memcmp only where both match
+static const char *Sse2Find(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+	size_t i = 0;
+
+	for (; i + nlen + 15 <= hlen; i += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(hay + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(hay + i + nlen - 1));
+		unsigned mask = _mm_movemask_epi8(
+		    _mm_and_si128(_mm_cmpeq_epi8(first, b0), _mm_cmpeq_epi8(last, b1)));
+
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			if (!memcmp(hay + i + bit + 1, needle + 1, nlen - 2)) {
+				return hay + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	if (i + nlen > hlen) {
+		return nullptr;
+	}
+
+	return ScalarFind(hay + i, hlen - i, needle, nlen);
+}
+
+__attribute__((target("avx2"))) static const char *Avx2Find(const char *hay, size_t hlen,
+                                                             const char *needle, size_t nlen) {
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+	size_t i = 0;
+
+	for (; i + nlen + 31 <= hlen; i += 32) {
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(hay + i));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(hay + i + nlen - 1));
+		unsigned mask = _mm256_movemask_epi8(
+		    _mm256_and_si256(_mm256_cmpeq_epi8(first, b0), _mm256_cmpeq_epi8(last, b1)));
+
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			if (!memcmp(hay + i + bit + 1, needle + 1, nlen - 2)) {
+				return hay + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	if (i + nlen > hlen) {
+		return nullptr;
+	}
+
+	return Sse2Find(hay + i, hlen - i, needle, nlen);
+}
+
+typedef const char *(*FindFunc)(const char *, size_t, const char *, size_t);
+
+static FindFunc GetShortFind() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? Avx2Find : Sse2Find;
+}
+#endif
+
+const char *MsMemFind(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+	if (nlen == 0) {
+		return hay;
+	}
+	if (hlen < nlen) {
+		return nullptr;
+	}
+	if (nlen == 1) {
+		return (const char *)memchr(hay, needle[0], hlen);
+	}
+
+	if (nlen <= SHORT_NEEDLE) {
+#if MS_SEARCH_X86
+		static const FindFunc shortFind = GetShortFind();
+		return shortFind(hay, hlen, needle, nlen);
+#else
+		return ScalarFind(hay, hlen, needle, nlen);
+#endif
+	}
+
+	return (const char *)memmem(hay, hlen, needle, nlen);
+}
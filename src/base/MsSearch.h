@@ -0,0 +1,27 @@
+#ifndef MS_SEARCH_H
+#define MS_SEARCH_H
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+// memmem with fast paths: memchr for one byte, sse2/avx2 first+last byte
+// filter for short needles, glibc memmem otherwise. nullptr if not found
+const char *MsMemFind(const char *hay, size_t hlen, const char *needle, size_t nlen);
+
+// needle searched over many buffers, e.g. a multipart boundary. long needles
+// go to glibc memmem, it beat a Boyer-Moore-Horspool table in ms_search_bench
+class MsMemSearcher {
+public:
+	MsMemSearcher(const string &needle) : m_needle(needle) {}
+
+	const char *Find(const char *hay, size_t hlen) const {
+		return MsMemFind(hay, hlen, m_needle.data(), m_needle.size());
+	}
+	size_t Size() const { return m_needle.size(); }
+
+private:
+	string m_needle;
+};
+
+#endif // MS_SEARCH_H
@@ -2,6 +2,7 @@
 #include "MsLog.h"
 #include "MsMd5.h"
 #include "MsSocket.h"
+#include <ctype.h>
 #include <string.h>
 #include <time.h>
 
@@ -122,65 +123,167 @@ void MsSipMsg::Dump(string &rsp) {
 	}
 }
 
-void MsSipMsg::Parse(char *&p2) {
-	ParseReqLine(p2, m_method, m_uri, m_version);
-
-	if (m_method == "SIP/2.0") {
-		m_status = m_uri;
-		m_reason = m_version;
-		m_version = m_method;
-	}
-
-	string line;
-	string key, value;
-
-	while (GetHeaderLine(p2, line)) {
-		size_t p1 = line.find_first_of(':');
-		size_t p2 = line.find_first_not_of(' ', p1 + 1);
-
-		key = line.substr(0, p1);
-		if (p2 != string::npos)
-			value = line.substr(p2);
-		else
-			value = "";
-
-		if (!strcasecmp(key.c_str(), "Via")) {
-			MsSipVia via("Via");
-			via.SetValue(value);
-
-			m_vias.push_back(via);
-		} else if (!strcasecmp(key.c_str(), "Record-Route")) {
-			MsComHeader rr("Record-Route");
-			rr.SetValue(value);
-
-			m_rrs.push_back(rr);
-		} else if (!strcasecmp(key.c_str(), "From")) {
-			m_from.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "To")) {
-			m_to.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Call-ID")) {
-			m_callID.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "CSeq")) {
-			m_cseq.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Contact")) {
-			m_contact.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Max-Forwards")) {
-			m_maxForwards.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Expires")) {
-			m_expires.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Content-Length")) {
-			m_contentLength.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Content-Type")) {
-			m_contentType.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Authorization")) {
-			m_authorization.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "Subject")) {
-			m_subject.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "WWW-Authenticate")) {
-			m_wwwAuthenticate.SetValue(value);
-		} else if (!strcasecmp(key.c_str(), "X-Source")) {
-			m_xSource.SetValue(value);
+#define SIP_KEY_IS(k, len, name) ((len) == sizeof(name) - 1 && !strncasecmp(k, name, len))
+
+static inline const char *SipLineEnd(const char *p, const char *eol) {
+	return (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+}
+
+// p points to a complete header block of len bytes, body is not touched
+int MsSipMsg::Parse(const char *p, int len) {
+	const char *end = p + len;
+	const char *eol = (const char *)memchr(p, '\n', len);
+	if (!eol) {
+		return -1;
+	}
+
+	const char *le = SipLineEnd(p, eol);
+	const char *s1 = (const char *)memchr(p, ' ', le - p);
+	if (!s1) {
+		return -1;
+	}
+
+	const char *t2 = s1;
+	while (t2 < le && *t2 == ' ') {
+		++t2;
+	}
+
+	const char *s2 = (const char *)memchr(t2, ' ', le - t2);
+	if (!s2) {
+		s2 = le;
+	}
+
+	const char *t3 = s2;
+	while (t3 < le && *t3 == ' ') {
+		++t3;
+	}
+
+	if (s1 - p == 7 && !memcmp(p, "SIP/2.0", 7)) {
+		m_version.assign(p, s1 - p);
+		m_status.assign(t2, s2 - t2);
+		m_reason.assign(t3, le - t3);
+	} else {
+		m_method.assign(p, s1 - p);
+		m_uri.assign(t2, s2 - t2);
+		m_version.assign(t3, le - t3);
+	}
+
+	p = eol + 1;
+
+	while (p < end) {
+		eol = (const char *)memchr(p, '\n', end - p);
+		if (!eol) {
+			eol = end;
+		}
+
+		le = SipLineEnd(p, eol);
+		if (le == p) {
+			break;
+		}
+
+		const char *colon = (const char *)memchr(p, ':', le - p);
+		if (colon) {
+			const char *ke = colon;
+			while (ke > p && (ke[-1] == ' ' || ke[-1] == '\t')) {
+				--ke;
+			}
+
+			const char *v = colon + 1;
+			while (v < le && (*v == ' ' || *v == '\t')) {
+				++v;
+			}
+
+			SetHeader(p, ke - p, v, le - v);
+		}
+
+		p = eol + 1;
+	}
+
+	return 0;
+}
+
+void MsSipMsg::SetHeader(const char *key, int keyLen, const char *val, int valLen) {
+	// only headers used by the server are kept, the others are skipped
+	switch (keyLen ? tolower(key[0]) : 0) {
+	case 'v':
+		if (keyLen == 1 || SIP_KEY_IS(key, keyLen, "Via")) {
+			m_vias.emplace_back("Via");
+			m_vias.back().SetValue(val, valLen);
+		}
+		break;
+	case 'r':
+		if (SIP_KEY_IS(key, keyLen, "Record-Route")) {
+			m_rrs.emplace_back("Record-Route");
+			m_rrs.back().SetValue(val, valLen);
+		}
+		break;
+	case 'f':
+		if (keyLen == 1 || SIP_KEY_IS(key, keyLen, "From")) {
+			m_from.SetValue(val, valLen);
+		}
+		break;
+	case 't':
+		if (keyLen == 1 || SIP_KEY_IS(key, keyLen, "To")) {
+			m_to.SetValue(val, valLen);
+		}
+		break;
+	case 'i':
+		if (keyLen == 1) {
+			m_callID.SetValue(val, valLen);
+		}
+		break;
+	case 'c':
+		if (SIP_KEY_IS(key, keyLen, "Call-ID")) {
+			m_callID.SetValue(val, valLen);
+		} else if (SIP_KEY_IS(key, keyLen, "CSeq")) {
+			m_cseq.SetValue(val, valLen);
+		} else if (SIP_KEY_IS(key, keyLen, "Contact")) {
+			m_contact.SetValue(val, valLen);
+		} else if (SIP_KEY_IS(key, keyLen, "Content-Length")) {
+			m_contentLength.SetValue(val, valLen);
+		} else if (keyLen == 1 || SIP_KEY_IS(key, keyLen, "Content-Type")) {
+			m_contentType.SetValue(val, valLen);
+		}
+		break;
+	case 'm':
+		if (keyLen == 1) {
+			m_contact.SetValue(val, valLen);
+		} else if (SIP_KEY_IS(key, keyLen, "Max-Forwards")) {
+			m_maxForwards.SetValue(val, valLen);
+		}
+		break;
+	case 'l':
+		if (keyLen == 1) {
+			m_contentLength.SetValue(val, valLen);
+		}
+		break;
+	case 'e':
+		if (SIP_KEY_IS(key, keyLen, "Expires")) {
+			m_expires.SetValue(val, valLen);
+		}
+		break;
+	case 'a':
+		if (SIP_KEY_IS(key, keyLen, "Authorization")) {
+			m_authorization.SetValue(val, valLen);
+		}
+		break;
+	case 's':
+		if (keyLen == 1 || SIP_KEY_IS(key, keyLen, "Subject")) {
+			m_subject.SetValue(val, valLen);
+		}
+		break;
+	case 'w':
+		if (SIP_KEY_IS(key, keyLen, "WWW-Authenticate")) {
+			m_wwwAuthenticate.SetValue(val, valLen);
+		}
+		break;
+	case 'x':
+		if (SIP_KEY_IS(key, keyLen, "X-Source")) {
+			m_xSource.SetValue(val, valLen);
 		}
+		break;
+	default:
+		break;
 	}
 }
 
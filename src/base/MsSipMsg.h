@@ -53,7 +53,7 @@ public:
 	MsSipMsg();
 
 	void Dump(string &rsp);
-	void Parse(char *&p2);
+	int Parse(const char *p, int len);
 	void CloneBasic(MsSipMsg &from);
 
 	std::vector<MsSipVia> m_vias;
@@ -72,6 +72,9 @@ public:
 	MsComHeader m_date;
 	MsComHeader m_event;
 	MsComHeader m_xSource;
+
+private:
+	void SetHeader(const char *key, int keyLen, const char *val, int valLen);
 };
 
 string GenNonce();